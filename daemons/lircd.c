@@ -57,8 +57,16 @@
 #include <fcntl.h>
 #include <sys/file.h>
 #include <pwd.h>
+#include <poll.h>
+#include <pthread.h>
 
 #if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
 #include "lirc/input_map.h"
@@ -73,6 +81,7 @@
 #endif
 
 #include "lirc_private.h"
+#include "lirc/lirc_events.h"
 
 /****************************************************************************
  ** lircd.h *****************************************************************
@@ -89,12 +98,194 @@
 #endif
 #define WHITE_SPACE " \t"
 
+/* What a file descriptor registered in the event loop refers to. */
+enum watch_type {
+	WATCH_LISTEN,
+	WATCH_CLIENT,
+	WATCH_PEER,
+	WATCH_DRIVER,
+	WATCH_TIMER,
+	WATCH_DECODER,
+	WATCH_TRANSMIT,
+	WATCH_INPUT,
+	WATCH_CONFIG
+};
+
+/* A file descriptor registered in the event loop, fd == -1 if not. */
+struct watch {
+	int fd;
+	enum watch_type type;
+	void *data;
+	int events;		/* LOOP_IN | LOOP_OUT */
+	int always_ready;	/* fd can't be polled, e.g. /dev/zero */
+	struct watch *next;	/* all registered watches */
+};
+
 struct peer_connection {
 	char *host;
 	unsigned short port;
 	struct timeval reconnect;
 	int connection_failure;
 	int socket;
+	struct watch watch;
+};
+
+/* A chunk of queued client output, see client_write(). */
+struct out_unit {
+	int len;
+	int is_event;		/* broadcast event, can be dropped as a whole */
+};
+
+/* The remote and code lircd decoded an event from, see get_event_code(). */
+struct event_code {
+	const struct ir_remote *remote;	/* NULL if unknown */
+	const struct ir_ncode *ncode;
+	ir_code code;
+};
+
+/* Ids of an event's remote and button, see event_ids(). */
+struct event_ids {
+	int valid;		/* the names were found in the current config */
+	uint32_t remote;	/* index in remotes */
+	uint32_t button;	/* index in the remote's codes */
+};
+
+#define SUBSCRIBE_ANY ((uint32_t)-1)	/* "*" or no button given */
+#define SUBSCRIBE_NONE ((uint32_t)-2)	/* not in the current config */
+
+/* An event pattern of a client, see SUBSCRIBE. */
+struct subscription {
+	char *remote_name;
+	char *button_name;
+	uint32_t remote;	/* as struct event_ids, or SUBSCRIBE_* */
+	uint32_t button;
+	struct subscription *next;
+};
+
+struct client {
+	int fd;
+	int type;		/* CT_LOCAL or CT_REMOTE */
+	unsigned long id;	/* unique, fds are reused */
+	int source_tags;	/* append the source to events, SET_SOURCE_TAGS */
+	int binary_events;	/* send struct lirc_event_record, SET_BINARY_EVENTS */
+	int ring_reader;	/* reads events from the ring, GET_EVENT_RING */
+	struct subscription *subscriptions;	/* SUBSCRIBE, NULL for all events */
+	struct watch watch;
+
+	/* output not yet accepted by the socket, a ring of bytes... */
+	char *obuf;
+	int ohead;
+	int olen;
+	/* ...split into units, also a ring */
+	struct out_unit *units;
+	int unit_head;
+	int unitn;
+	int head_sent;		/* bytes of the head unit already written */
+
+	unsigned long dropped;	/* events dropped on overflow */
+	struct client *next_dead;
+};
+
+/* An event passed from the decode thread to the main thread. */
+struct decoded_event {
+	char message[PACKET_SIZE + 1];
+	char remote_name[PACKET_SIZE + 1];
+	char button_name[PACKET_SIZE + 1];
+	int reps;
+	int release;
+	struct event_code ec;	/* remote cleared by config_publish() */
+};
+
+/* What decoding changes in a remote, kept for each --input. */
+struct remote_state {
+	ir_code toggle_bit_mask_state;
+	int toggle_mask_state;
+	struct ir_ncode *last_code;
+	struct ir_ncode *toggle_code;
+	int reps;
+	struct timeval last_send;
+	lirc_t min_remaining_gap;
+	lirc_t max_remaining_gap;
+	int release_detected;
+	int dyncode;
+	ir_code dyncodes[2];
+};
+
+/* A driver instance given by --input, see input_swap(). */
+struct input {
+	char *tag;			/* event source, see SET_SOURCE_TAGS */
+	struct driver drv;		/* drv while the input isn't being read */
+	struct rbuf *rec_buffer;	/* likewise the receive buffer, */
+	struct ir_remote *last_remote;	/* last decoded remotes, */
+	struct ir_remote *last_decoded;
+	struct release_state *release;	/* release events... */
+	struct remote_state *states;	/* ...and remotes' state, see input_swap() */
+	int n_states;			/* remotes the states are for */
+	struct watch watch;
+	struct timeval reconnect;	/* next try to open it, if closed */
+};
+
+/* A repeating transmission started by SEND_START. */
+struct repeat_job {
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+	__u32 transmitters;		/* transmitter mask, 0 if never set */
+	struct timeval deadline;	/* when the next frame is due */
+	int busy;			/* a frame is queued for the transmit thread */
+	int stopped;			/* SEND_STOP while busy, free when done */
+	struct repeat_job *next;
+};
+
+enum tx_type {
+	TX_ONCE,			/* SEND_ONCE including its repeats */
+	TX_START,			/* first frame of SEND_START */
+	TX_REPEAT,			/* next frame of a repeat job */
+	TX_SEQUENCE			/* SEND_SEQUENCE */
+};
+
+/* A code of a SEND_SEQUENCE. */
+struct tx_item {
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+	int reps;
+};
+
+/* A transmission queued for the transmit threads, see tx_thread_main(). */
+struct tx_job {
+	enum tx_type type;
+	struct ir_remote *remote;	/* for TX_SEQUENCE the current item */
+	struct ir_ncode *code;
+	int reps;			/* TX_ONCE */
+	struct tx_item *items;		/* TX_SEQUENCE */
+	int n_items;
+	__u32 transmitters;
+	struct send_buffer *buffer;	/* for send_channel_func, see tx_send() */
+	struct repeat_job *repeat;	/* TX_START, TX_REPEAT */
+	unsigned long client;		/* client id to reply to, 0 if none */
+	char *message;			/* the command to reply to */
+	struct timeval queued;
+	/* results, set by the transmit thread */
+	const char *error;		/* reply on failure, NULL on success */
+	int repeating;			/* more frames due at deadline */
+	int stopped;			/* SEND_STOP received, TX_ONCE */
+	struct timeval deadline;
+	struct timeval done;
+	struct tx_job *next;		/* in tx_queue, tx_running or tx_done */
+};
+
+/*
+ * A config replaced on SIGHUP. It's freed once the transmissions queued
+ * before the swap are done and no repeat job is left in it.
+ */
+struct retired_config {
+	struct ir_remote *remotes;
+	int pending;			/* jobs queued before the swap */
+	struct retired_config *next;
+};
+
+enum overflow_policy {
+	OVERFLOW_DROP_OLDEST,
+	OVERFLOW_DISCONNECT
 };
 
 
@@ -124,7 +315,14 @@ static  const char* const help =
 #       endif
 "\t -e --effective-uid=uid\t\tRun as uid after init as root\n"
 "\t -R --repeat-max=limit\t\tallow at most this many repeats\n"
-"\t -S --dedup-delay=time_ms\tdelay to impose between the same key pressed\n";
+"\t -S --dedup-delay=time_ms\tdelay to impose between the same key pressed\n"
+"\t -B --client-buffer=bytes\tOutput buffer size per client\n"
+"\t -Q --overflow=policy\t\t'drop-oldest' or 'disconnect' slow clients\n"
+"\t -T --decode-thread\t\tRead and decode input in a separate thread\n"
+"\t -M --compiled-decoder\t\tCheck frames for all remotes in one pass\n"
+"\t -F --adaptive-order\t\tTry remotes which decoded last first\n"
+"\t -C --config-cache=file\t\tCache the parsed config file here\n"
+"\t -I --input=driver[@device][,...]\tAlso read from these drivers\n";
 
 
 
@@ -154,6 +352,13 @@ static const struct option lircd_options[] = {
 #        endif
 	{"repeat-max", required_argument, NULL, 'R'},
 	{"dedup-delay", required_argument, NULL, 'S'},
+	{"client-buffer", required_argument, NULL, 'B'},
+	{"overflow", required_argument, NULL, 'Q'},
+	{"decode-thread", no_argument, NULL, 'T'},
+	{"compiled-decoder", no_argument, NULL, 'M'},
+	{"adaptive-order", no_argument, NULL, 'F'},
+	{"config-cache", required_argument, NULL, 'C'},
+	{"input", required_argument, NULL, 'I'},
 	{0, 0, 0, 0}
 };
 
@@ -162,8 +367,11 @@ void sigterm(int sig);
 void dosigterm(int sig);
 void sighup(int sig);
 void dosighup(int sig);
+static void dosighup_done(void);
 int setup_uinput(const char *name);
 void config(void);
+static int config_load_start(void);
+static void config_reclaim(void);
 void nolinger(int sock);
 void remove_client(int fd);
 void add_client(int);
@@ -174,8 +382,6 @@ void start_server(mode_t permission, int nodaemon, loglevel_t loglevel);
 
 
 void daemonize(void);
-void sigalrm(int sig);
-void dosigalrm(int sig);
 int parse_rc(int fd, char *message, char *arguments, struct ir_remote **remote, struct ir_ncode **code, int *reps,
 	     int n, int *err);
 int send_success(int fd, char *message);
@@ -188,15 +394,41 @@ int set_transmitters(int fd, char *message, char *arguments);
 int set_inputlog(int fd, char *message, char *arguments);
 int simulate(int fd, char *message, char *arguments);
 int send_once(int fd, char *message, char *arguments);
+int send_sequence(int fd, char *message, char *arguments);
 int drv_option(int fd, char *message, char *arguments);
 int send_start(int fd, char *message, char *arguments);
 int send_stop(int fd, char *message, char *arguments);
 int send_core(int fd, char *message, char *arguments, int once);
 int version(int fd, char *message, char *arguments);
+int stats(int fd, char *message, char *arguments);
 int get_pid(int fd, char *message, char *arguments);
 int get_command(int fd);
-void input_message(const char *message, const char *remote_name, const char *button_name, int reps, int release);
+void input_message(const char *message, const char *remote_name, const char *button_name, int reps, int release,
+		   const char *source, const struct event_code *ec);
+static void deliver_message(const char *message, const char *remote_name, const char *button_name, int reps,
+			    int release, const char *source, const struct event_code *ec);
 void broadcast_message(const char *message);
+static void broadcast_event(const char *message, const char *remote_name, const char *button_name, int reps,
+			    int release, const char *source, const struct event_code *ec);
+static void get_event_code(struct event_code *ec, int release);
+static int tag_event(const char *message, const char *source, char *buffer, int size);
+static int client_write_event(struct client *cli, const char *message, int len, const char *tagged, int tagged_len);
+int set_source_tags(int fd, char *message, char *arguments);
+int set_binary_events(int fd, char *message, char *arguments);
+int get_event_ring(int fd, char *message, char *arguments);
+int subscribe(int fd, char *message, char *arguments);
+int unsubscribe(int fd, char *message, char *arguments);
+static void subscriptions_resolve(void);
+static void event_ring_put(const char *message, int len);
+static void broadcast_names(void);
+static void remote_index_build(void);
+static void decode_ring_forget(void);
+int parse_inputs(const char *opt);
+static void inputs_setup(void);
+static void inputs_deinit(void);
+static int input_map_remotes(struct input *in, const struct ir_remote *old);
+static void input_swap(struct input *in);
+static int is_duplicate(const char *button_name);
 static int mywaitfordata(long maxusec);
 void loop(void);
 
@@ -220,20 +452,76 @@ struct protocol_directive {
 #endif
 
 
-static struct ir_remote *remotes;
-static struct ir_remote *free_remotes = NULL;
-
-extern struct ir_remote *decoding;
+static struct ir_remote *remotes;		/* swapped by config_publish() */
+static struct retired_config *retired_configs = NULL;
 
-static int repeat_fd = -1;
-static char *repeat_message = NULL;
+static struct repeat_job *repeat_jobs = NULL;
 static __u32 repeat_max = REPEAT_MAX_DEFAULT;
 
+/* Transmitters selected by SET_TRANSMITTERS, and currently set in hardware. */
+static __u32 transmitters = 0;
+static __u32 hw_transmitters = 0;
+
 static int dedup_delay = 0;
 
-extern struct driver hw;
+/* Client output buffering, see client_write(). */
+#define DEFAULT_CLIENT_BUFFER 65536
+#define MIN_CLIENT_BUFFER (4 * PACKET_SIZE)
+
+static int client_buffer_size = DEFAULT_CLIENT_BUFFER;
+static enum overflow_policy overflow_policy = OVERFLOW_DROP_OLDEST;
+static unsigned long events_dropped = 0;
+static unsigned long events_filtered = 0;
+static unsigned long clients_overflowed = 0;
+
+/* Decode thread, see start_decode_thread(). */
+#define DECODE_RING_SIZE 64
+
+static int use_decode_thread = 0;
+static int decode_thread_running = 0;
+static pthread_t decode_thread;
+static struct decoded_event decode_ring[DECODE_RING_SIZE];
+static unsigned int decode_ring_head = 0;
+static unsigned int decode_ring_tail = 0;
+static unsigned long decode_ring_overflows = 0;
+static int decode_pipe[2] = { -1, -1 };
+
+/* Transmit threads, see start_tx_thread(). */
+#define TX_THREADS 4
+
+static int threads_running = 0;
+static pthread_mutex_t hw_mutex;
+static pthread_rwlock_t drv_rwlock;	/* see send_lock() */
+static pthread_t tx_threads[TX_THREADS];
+static pthread_mutex_t tx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tx_cond = PTHREAD_COND_INITIALIZER;
+static struct tx_job *tx_queue = NULL;
+static struct tx_job **tx_queue_tail = &tx_queue;
+static struct tx_job *tx_done = NULL;
+static struct tx_job **tx_done_tail = &tx_done;
+static struct tx_job *tx_running = NULL;	/* being sent, under tx_mutex */
+static int tx_running_n = 0;
+static int tx_running_max = 0;
+static int tx_pipe[2] = { -1, -1 };
+static pthread_t config_thread;
+static int config_pipe[2] = { -1, -1 };
+static int config_loading = 0;		/* config thread is reading */
+static int config_reload = 0;		/* SIGHUP while reading */
+static struct ir_remote *config_loaded;	/* result of the config thread */
+static int tx_depth = 0;			/* queued or being sent */
+static int tx_depth_max = 0;
+/* How the driver sends, drv may hold an --input driver meanwhile. */
+static int tx_channels = 0;		/* has send_channel_func */
+static int tx_buffered = 0;		/* has send_buffer_func */
+static unsigned long tx_jobs_done = 0;
+static unsigned long long tx_latency_total = 0;
+static unsigned long tx_latency_max = 0;
+
+/* Only written to switch between --input drivers, see input_swap(). */
+extern struct driver drv;
 
 static const char *configfile = NULL;
+static const char *config_cache = NULL;
 extern char *logfile ;
 extern const char *syslogident;
 static FILE *pidf;
@@ -243,6 +531,7 @@ static const char *lircdfile = LIRCD;
 static const struct protocol_directive const directives[] = {
 	{"LIST", list},
 	{"SEND_ONCE", send_once},
+	{"SEND_SEQUENCE", send_sequence},
 	{"SEND_START", send_start},
 	{"SEND_STOP", send_stop},
 	{"SET_INPUTLOG", set_inputlog},
@@ -250,6 +539,12 @@ static const struct protocol_directive const directives[] = {
 	{"VERSION", version},
 	{"SET_TRANSMITTERS", set_transmitters},
 	{"SIMULATE", simulate},
+	{"STATS", stats},
+	{"SET_SOURCE_TAGS", set_source_tags},
+	{"SET_BINARY_EVENTS", set_binary_events},
+	{"GET_EVENT_RING", get_event_ring},
+	{"SUBSCRIBE", subscribe},
+	{"UNSUBSCRIBE", unsubscribe},
 	{NULL, NULL}
 	/*
 	   {"DEBUG",debug},
@@ -280,15 +575,22 @@ static const char hostname[HOSTNAME_LEN + 1];
 
 extern FILE *lf;
 
-/* substract one for lirc, sockfd, sockinet, logfile, pidfile, uinput */
-#define MAX_PEERS	((FD_SETSIZE-6)/2)
-#define MAX_CLIENTS     ((FD_SETSIZE-6)/2)
+/* Max number of events handled per event loop wakeup. */
+#define LOOP_MAX_EVENTS 64
+
+/* Event loop interest flags, see loop_add(). */
+#define LOOP_IN   1
+#define LOOP_OUT  2
+
+struct loop_event {
+	struct watch *watch;
+	int events;
+};
 
 static int sockfd, sockinet;
 static int do_shutdown;
 
 static int uinputfd = -1;
-static int clis[MAX_CLIENTS];
 
 static int nodaemon = 0;
 static loglevel_t loglevel_opt = 0;
@@ -296,22 +598,66 @@ static loglevel_t loglevel_opt = 0;
 #define CT_LOCAL  1
 #define CT_REMOTE 2
 
-static int cli_type[MAX_CLIENTS];
+static struct client **clis = NULL;
 static int clin = 0; /* Number of clients */
+static int clis_size = 0;
+static unsigned long client_ids = 0;
+static struct client *dead_clients = NULL;
 
 static int listen_tcpip = 0;
 static unsigned short int port = LIRC_INET_PORT;
 static struct in_addr address;
 
-static struct peer_connection *peers[MAX_PEERS];
+static struct peer_connection **peers = NULL;
 static int peern = 0;
 
+static struct input **inputs = NULL;
+static int inputn = 0;
+static char *driver_tag = NULL;		/* event source of --driver */
+static const char *release_suffix = NULL;
+static uint32_t names_generation = 0;		/* of the binary name table */
+
+/* The current remotes by address, see event_ids(). */
+struct remote_index {
+	const struct ir_remote *remote;
+	uint32_t index;			/* in remotes */
+};
+static struct remote_index *remote_index = NULL;
+static int remote_index_n = 0;
+
+#define EVENT_RING_SLOTS 256			/* power of two */
+#define EVENT_RING_SLOT_SIZE 512
+static struct lirc_ring_header *event_ring = NULL;
+static int event_ring_fd = -1;			/* read-only, passed to clients */
+static int ring_readers = 0;
+
+static struct watch sockfd_watch = { -1, WATCH_LISTEN, NULL, 0 };
+static struct watch sockinet_watch = { -1, WATCH_LISTEN, NULL, 0 };
+static struct watch driver_watch = { -1, WATCH_DRIVER, NULL, 0 };
+static struct watch decode_watch = { -1, WATCH_DECODER, NULL, 0 };
+static struct watch tx_watch = { -1, WATCH_TRANSMIT, NULL, 0 };
+static struct watch config_watch = { -1, WATCH_CONFIG, NULL, 0 };
+
+static struct watch *watches = NULL;
+
+#if defined(__linux__)
+static int epoll_fd = -1;
+static struct watch timer_watch = { -1, WATCH_TIMER, NULL, 0 };
+static struct timeval timer_armed;
+static int always_ready_n = 0;
+#else
+static struct watch **poll_watches = NULL;
+static struct pollfd *poll_fds = NULL;
+static int poll_n = 0;
+static int poll_size = 0;
+#endif
+
 static int daemonized = 0;
 static int allow_simulate = 0;
 static int userelease = 0;
 static int useuinput = 0;
 
-static sig_atomic_t term = 0, hup = 0, alrm = 0;
+static sig_atomic_t term = 0, hup = 0;
 static int termsig;
 
 static __u32 setup_min_freq = 0, setup_max_freq = 0;
@@ -322,7 +668,8 @@ static lirc_t setup_max_pulse = 0, setup_max_space = 0;
 /* Use already opened hardware? */
 int use_hw()
 {
-	return (clin > 0 || (useuinput && uinputfd != -1) || repeat_remote != NULL);
+	return (clin > 0 || (useuinput && uinputfd != -1) || repeat_jobs != NULL || tx_depth > 0
+		|| decode_thread_running);
 }
 
 /* set_transmitters only supports 32 bit int */
@@ -333,199 +680,890 @@ int max(int a, int b)
 	return (a > b ? a : b);
 }
 
-/* cut'n'paste from fileutils-3.16: */
+/*
+ * The event loop. All descriptors lircd waits for are registered once
+ * as a struct watch and stay registered until removed, so a wakeup
+ * costs O(ready descriptors) rather than O(clients). On Linux this is
+ * an epoll instance plus a timerfd carrying the nearest deadline (peer
+ * reconnect, release event, driver retry); elsewhere a poll() set
+ * which is only touched when registrations change.
+ */
 
-#define isodigit(c) ((c) >= '0' && (c) <= '7')
+static int loop_add(struct watch *w, int fd, enum watch_type type, void *data, int events)
+{
+#if defined(__linux__)
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (events & LOOP_IN ? EPOLLIN : 0) | (events & LOOP_OUT ? EPOLLOUT : 0);
+	ev.data.ptr = w;
+	w->always_ready = 0;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		if (errno != EPERM) {
+			logperror(LIRC_ERROR, "epoll_ctl(ADD, %d)", fd);
+			return 0;
+		}
+		/* like select(), treat files without poll support as always ready */
+		w->always_ready = 1;
+		always_ready_n++;
+	}
+#else
+	if (poll_n == poll_size) {
+		int size = poll_size ? 2 * poll_size : 16;
+		struct watch **watches;
+		struct pollfd *fds;
 
-/* Return a positive integer containing the value of the ASCII
-   octal number S.  If S is not an octal number, return -1.  */
+		watches = realloc(poll_watches, size * sizeof(struct watch *));
+		if (watches == NULL)
+			return 0;
+		poll_watches = watches;
+		fds = realloc(poll_fds, size * sizeof(struct pollfd));
+		if (fds == NULL)
+			return 0;
+		poll_fds = fds;
+		poll_size = size;
+	}
+	poll_watches[poll_n] = w;
+	poll_fds[poll_n].fd = fd;
+	poll_fds[poll_n].events = (events & LOOP_IN ? POLLIN : 0) | (events & LOOP_OUT ? POLLOUT : 0);
+	poll_n++;
+#endif
+	w->fd = fd;
+	w->type = type;
+	w->data = data;
+	w->events = events;
+	w->next = watches;
+	watches = w;
+	return 1;
+}
 
-static int oatoi(s)
-char *s;
+static int loop_mod(struct watch *w, int events)
 {
-	register int i;
+	if (w->fd == -1 || w->events == events)
+		return 1;
+#if defined(__linux__)
+	struct epoll_event ev;
 
-	if (*s == 0)
-		return -1;
-	for (i = 0; isodigit(*s); ++s)
-		i = i * 8 + *s - '0';
-	if (*s)
-		return -1;
-	return i;
-}
+	if (w->always_ready) {
+		w->events = events;
+		return 1;
+	}
 
-/* A safer write(), since sockets might not write all but only some of the
-   bytes requested */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (events & LOOP_IN ? EPOLLIN : 0) | (events & LOOP_OUT ? EPOLLOUT : 0);
+	ev.data.ptr = w;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, w->fd, &ev) == -1) {
+		logperror(LIRC_ERROR, "epoll_ctl(MOD, %d)", w->fd);
+		return 0;
+	}
+#else
+	int i;
 
-int write_socket(int fd, const char *buf, int len)
+	for (i = 0; i < poll_n; i++) {
+		if (poll_watches[i] == w) {
+			poll_fds[i].events = (events & LOOP_IN ? POLLIN : 0) | (events & LOOP_OUT ? POLLOUT : 0);
+			break;
+		}
+	}
+#endif
+	w->events = events;
+	return 1;
+}
+
+/* Drop w without touching the kernel, for descriptors already closed. */
+static void loop_forget(struct watch *w)
 {
-	int done, todo = len;
+	struct watch **p;
+#if !defined(__linux__)
+	int i;
 
-	while (todo) {
-#ifdef SIM_REC
-		do {
-			done = write(fd, buf, todo);
+	for (i = 0; i < poll_n; i++) {
+		if (poll_watches[i] == w) {
+			poll_n--;
+			poll_watches[i] = poll_watches[poll_n];
+			poll_fds[i] = poll_fds[poll_n];
+			break;
 		}
-		while (done < 0 && errno == EAGAIN);
+	}
 #else
-		done = write(fd, buf, todo);
+	if (w->always_ready)
+		always_ready_n--;
+	w->always_ready = 0;
 #endif
-		if (done <= 0)
-			return (done);
-		buf += done;
-		todo -= done;
+	for (p = &watches; *p != NULL; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
 	}
-	return (len);
+	w->fd = -1;
 }
 
-int write_socket_len(int fd, const char *buf)
+/* Check if fd is registered by any watch but w. */
+static int loop_fd_watched(int fd, struct watch *w)
 {
-	int len;
+	struct watch *scan;
 
-	len = strlen(buf);
-	if (write_socket(fd, buf, len) < len)
-		return (0);
-	return (1);
+	for (scan = watches; scan != NULL; scan = scan->next) {
+		if (scan != w && scan->fd == fd)
+			return 1;
+	}
+	return 0;
 }
 
-int read_timeout(int fd, char *buf, int len, int timeout)
+/*
+ * Check that w is still registered. The kernel drops a registration
+ * when its file is closed, also if the number is reused by a reopen.
+ */
+static int loop_registered(struct watch *w)
 {
-	fd_set fds;
-	struct timeval tv;
-	int ret, n;
-
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0;
-
-	/* CAVEAT: (from libc documentation)
-	   Any signal will cause `select' to return immediately.  So if your
-	   program uses signals, you can't rely on `select' to keep waiting
-	   for the full time specified.  If you want to be sure of waiting
-	   for a particular amount of time, you must check for `EINTR' and
-	   repeat the `select' with a newly calculated timeout based on the
-	   current time.  See the example below.
-
-	   Obviously the timeout is not recalculated in the example because
-	   this is done automatically on Linux systems...
-	 */
+#if defined(__linux__)
+	struct epoll_event ev;
 
-	do {
-		ret = select(fd + 1, &fds, NULL, NULL, &tv);
-	}
-	while (ret == -1 && errno == EINTR);
-	if (ret == -1) {
-		logprintf(LIRC_ERROR, "select() failed");
-		logperror(LIRC_ERROR, NULL);
-		return (-1);
-	} else if (ret == 0)
-		return (0);	/* timeout */
-	n = read(fd, buf, len);
-	if (n == -1) {
-		logprintf(LIRC_ERROR, "read() failed");
-		logperror(LIRC_ERROR, NULL);
-		return (-1);
-	}
-	return (n);
+	if (w->fd == -1 || w->always_ready)
+		return 1;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (w->events & LOOP_IN ? EPOLLIN : 0) | (w->events & LOOP_OUT ? EPOLLOUT : 0);
+	ev.data.ptr = w;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, w->fd, &ev) == 0 || errno != ENOENT;
+#else
+	return 1;
+#endif
 }
 
-void sigterm(int sig)
+/* Unregister w, must be called while w->fd is still open. */
+static void loop_del(struct watch *w)
 {
-	/* all signals are blocked now */
-	if (term)
+	if (w->fd == -1)
 		return;
-	term = 1;
-	termsig = sig;
+#if defined(__linux__)
+	if (!w->always_ready && epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL) == -1
+	    && errno != EBADF && errno != ENOENT)
+		logperror(LIRC_WARNING, "epoll_ctl(DEL, %d)", w->fd);
+#endif
+	loop_forget(w);
 }
 
-void dosigterm(int sig)
+static int loop_init(void)
 {
-	int i;
-
-	signal(SIGALRM, SIG_IGN);
-	logprintf(LIRC_NOTICE, "caught signal");
+#if defined(__linux__)
+	int fd;
 
-	if (free_remotes != NULL) {
-		free_config(free_remotes);
-	}
-	free_config(remotes);
-	repeat_remote = NULL;
-	for (i = 0; i < clin; i++) {
-		shutdown(clis[i], 2);
-		close(clis[i]);
-	};
-	if (do_shutdown) {
-		shutdown(sockfd, 2);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		logperror(LIRC_ERROR, "epoll_create1()");
+		return 0;
 	}
-	close(sockfd);
-
-#if defined(__linux__)
-	if (uinputfd != -1) {
-		ioctl(uinputfd, UI_DEV_DESTROY);
-		close(uinputfd);
-		uinputfd = -1;
+	fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		logperror(LIRC_ERROR, "timerfd_create()");
+		return 0;
 	}
+	timerclear(&timer_armed);
+	return loop_add(&timer_watch, fd, WATCH_TIMER, NULL, LOOP_IN);
+#else
+	return 1;
 #endif
-	if (listen_tcpip) {
-		shutdown(sockinet, 2);
-		close(sockinet);
-	}
-	fclose(pidf);
-	(void)unlink(pidfile);
-	if (curr_driver->close_func)
-		curr_driver->close_func();
-	if (use_hw() && curr_driver->deinit_func)
-		curr_driver->deinit_func();
-	if (curr_driver->close_func)
-		curr_driver->close_func();
-	lirc_log_close();
-	signal(sig, SIG_DFL);
-	if (sig == SIGUSR1)
-		exit(0);
-	raise(sig);
-}
-
-void sighup(int sig)
-{
-	hup = 1;
 }
 
-void dosighup(int sig)
+/*
+ * Wait for registered descriptors until the absolute deadline (which
+ * may be NULL). Returns number of events stored in events, 0 on timeout
+ * and -1 on errors incl. EINTR.
+ */
+static int loop_wait(struct loop_event *events, int max_events, const struct timeval *deadline)
 {
-	struct stat s;
-	int i;
+#if defined(__linux__)
+	struct epoll_event evs[LOOP_MAX_EVENTS];
+	int i, n, ret;
+
+	if (deadline == NULL ? timerisset(&timer_armed) : timercmp(deadline, &timer_armed, !=)) {
+		struct itimerspec its;
+
+		memset(&its, 0, sizeof(its));
+		if (deadline != NULL) {
+			its.it_value.tv_sec = deadline->tv_sec;
+			its.it_value.tv_nsec = deadline->tv_usec * 1000;
+			/* an all-zero it_value would disarm the timer */
+			if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+				its.it_value.tv_nsec = 1;
+			timer_armed = *deadline;
+		} else {
+			timerclear(&timer_armed);
+		}
+		if (timerfd_settime(timer_watch.fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+			logperror(LIRC_WARNING, "timerfd_settime()");
+	}
+	if (max_events > LOOP_MAX_EVENTS)
+		max_events = LOOP_MAX_EVENTS;
+	ret = epoll_wait(epoll_fd, evs, max_events - always_ready_n, always_ready_n > 0 ? 0 : -1);
+	if (ret == -1)
+		return -1;
+	for (i = 0, n = 0; i < ret; i++) {
+		struct watch *w = evs[i].data.ptr;
 
-	/* reopen logfile first */
+		if (w->type == WATCH_TIMER) {
+			__u64 expirations;
 
-	if (! lirc_log_use_syslog()){
-		logprintf(LIRC_INFO, "closing logfile");
-		if (-1 == fstat(fileno(lf), &s)) {
-			dosigterm(SIGTERM);	/* shouldn't ever happen */
-		}
-		lirc_log_close();
-		lirc_log_open("lircd", nodaemon, loglevel_opt);
-		lf = fopen(logfile, "a");
-		if (lf == NULL) {
-			/* can't print any error messagees */
-			dosigterm(SIGTERM);
+			if (read(w->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+				logperror(LIRC_WARNING, "timerfd read()");
+			timerclear(&timer_armed);
+			continue;
 		}
-		logprintf(LIRC_INFO, "reopened logfile");
-		if (-1 == fchmod(fileno(lf), s.st_mode)) {
-			logprintf(LIRC_WARNING, "could not set file permissions");
-			logperror(LIRC_WARNING, NULL);
+		events[n].watch = w;
+		events[n].events = 0;
+		if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			events[n].events |= LOOP_IN;
+		if (evs[i].events & EPOLLOUT)
+			events[n].events |= LOOP_OUT;
+		n++;
+	}
+	if (always_ready_n > 0) {
+		struct watch *w;
+
+		for (w = watches; w != NULL && n < max_events; w = w->next) {
+			if (!w->always_ready)
+				continue;
+			events[n].watch = w;
+			events[n].events = w->events;
+			n++;
 		}
 	}
+	return n;
+#else
+	int i, n, ret, timeout = -1;
 
-	config();
+	if (deadline != NULL) {
+		struct timeval now, left;
 
-	for (i = 0; i < clin; i++) {
-		if (!
-		    (write_socket_len(clis[i], protocol_string[P_BEGIN])
-		     && write_socket_len(clis[i], protocol_string[P_SIGHUP])
-		     && write_socket_len(clis[i], protocol_string[P_END]))) {
-			remove_client(clis[i]);
-			i--;
+		gettimeofday(&now, NULL);
+		if (timercmp(deadline, &now, >)) {
+			timersub(deadline, &now, &left);
+			timeout = left.tv_sec * 1000 + (left.tv_usec + 999) / 1000;
+		} else {
+			timeout = 0;
+		}
+	}
+	ret = poll(poll_fds, poll_n, timeout);
+	if (ret <= 0)
+		return ret;
+	for (i = 0, n = 0; i < poll_n && n < max_events; i++) {
+		if (poll_fds[i].revents == 0)
+			continue;
+		events[n].watch = poll_watches[i];
+		events[n].events = 0;
+		if (poll_fds[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+			events[n].events |= LOOP_IN;
+		if (poll_fds[i].revents & POLLOUT)
+			events[n].events |= LOOP_OUT;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Keep the driver's fd registered iff lircd should read from it. */
+static void update_driver_watch(void)
+{
+	int fd = -1;
+
+	if (driver_watch.fd != -1 && driver_watch.fd != curr_driver->fd
+	    && loop_fd_watched(driver_watch.fd, &driver_watch)) {
+		/* closed by the driver and the number reused, the kernel already forgot it */
+		loop_forget(&driver_watch);
+	}
+	if (use_hw() && !decode_thread_running && curr_driver->rec_mode != 0
+	    && curr_driver->fd != 0 && curr_driver->fd != -1)
+		fd = curr_driver->fd;
+	if (fd != -1 && fd == driver_watch.fd && !loop_registered(&driver_watch))
+		/* closed and reopened by the driver onto the same number */
+		loop_forget(&driver_watch);
+	if (fd == driver_watch.fd)
+		return;
+	loop_del(&driver_watch);
+	if (fd != -1)
+		loop_add(&driver_watch, fd, WATCH_DRIVER, NULL, LOOP_IN);
+}
+
+/* Initialize the driver, keeping the event loop in sync. */
+static int hw_init(void)
+{
+	loop_del(&driver_watch);
+	if (curr_driver->init_func == NULL)
+		return 1;
+	return curr_driver->init_func();
+}
+
+/* Deinitialize the driver, keeping the event loop in sync. */
+static void hw_deinit(void)
+{
+	loop_del(&driver_watch);
+	if (curr_driver->deinit_func)
+		curr_driver->deinit_func();
+}
+
+/* Serialize access to the driver and remotes with the helper threads. */
+static void hw_lock(void)
+{
+	if (threads_running)
+		pthread_mutex_lock(&hw_mutex);
+}
+
+static void hw_unlock(void)
+{
+	if (threads_running)
+		pthread_mutex_unlock(&hw_mutex);
+}
+
+/*
+ * The driver's send functions run under send_lock() instead of
+ * hw_lock(), so a transmission doesn't hold up decoding and clients.
+ * Sending with send_channel_func may go on in several threads, with
+ * send_func one job is sent at a time, see tx_next(). drv_lock()
+ * waits for all sends, for changing what they use: the driver's
+ * transmitters and options, and its fd. Both are taken before
+ * hw_lock(), never while holding it. With --input, drv holds the input
+ * drivers in turn under hw_lock(), see input_read(), and send_lock()
+ * takes hw_lock() as well.
+ */
+static void send_lock(void)
+{
+	if (threads_running)
+		pthread_rwlock_rdlock(&drv_rwlock);
+	if (inputn > 0)
+		hw_lock();
+}
+
+static void send_unlock(void)
+{
+	if (inputn > 0)
+		hw_unlock();
+	if (threads_running)
+		pthread_rwlock_unlock(&drv_rwlock);
+}
+
+static void drv_lock(void)
+{
+	if (threads_running)
+		pthread_rwlock_wrlock(&drv_rwlock);
+}
+
+static void drv_unlock(void)
+{
+	if (threads_running)
+		pthread_rwlock_unlock(&drv_rwlock);
+}
+
+/* Make hw_lock() and drv_lock() effective, must be done before starting a thread. */
+static void hw_lock_init(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_rwlockattr_t rwattr;
+
+	if (threads_running)
+		return;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&hw_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_rwlockattr_init(&rwattr);
+#ifdef __GLIBC__
+	/* repeats in parallel must not keep drv_lock() waiting forever */
+	pthread_rwlockattr_setkind_np(&rwattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	pthread_rwlock_init(&drv_rwlock, &rwattr);
+	pthread_rwlockattr_destroy(&rwattr);
+	threads_running = 1;
+}
+
+/* Create a helper thread, signals are handled by the main thread. */
+static int spawn_thread(pthread_t *thread, void *(*start)(void *), const char *what)
+{
+	sigset_t all, old;
+	int ret;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	ret = pthread_create(thread, NULL, start, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		logprintf(LIRC_ERROR, "cannot create %s thread: %s", what, strerror(ret));
+		return 0;
+	}
+	logprintf(LIRC_INFO, "started %s thread", what);
+	return 1;
+}
+
+/* Non-blocking pipe a helper thread wakes up the event loop with. */
+static int wakeup_pipe(int fds[2], struct watch *w, enum watch_type type)
+{
+	int flags, i;
+
+	if (pipe(fds) == -1) {
+		logperror(LIRC_ERROR, "pipe()");
+		return 0;
+	}
+	for (i = 0; i < 2; i++) {
+		flags = fcntl(fds[i], F_GETFL, 0);
+		fcntl(fds[i], F_SETFL, flags | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	return (loop_add(w, fds[0], type, NULL, LOOP_IN));
+}
+
+static struct client *get_client(int fd)
+{
+	int i;
+
+	for (i = 0; i < clin; i++) {
+		if (clis[i]->fd == fd)
+			return clis[i];
+	}
+	return NULL;
+}
+
+static struct client *get_client_by_id(unsigned long id)
+{
+	int i;
+
+	for (i = 0; i < clin; i++) {
+		if (clis[i]->id == id)
+			return clis[i];
+	}
+	return NULL;
+}
+
+/* Register the events a client currently needs. */
+static void client_update_watch(struct client *cli)
+{
+	int events = LOOP_IN | (cli->olen > 0 ? LOOP_OUT : 0);
+
+	if (cli->watch.fd == -1)
+		loop_add(&cli->watch, cli->fd, WATCH_CLIENT, cli, events);
+	else
+		loop_mod(&cli->watch, events);
+}
+
+static void free_subscription(struct subscription *sub)
+{
+	free(sub->remote_name);
+	free(sub->button_name);
+	free(sub);
+}
+
+/*
+ * Whether an event matches one of the client's SUBSCRIBE patterns.
+ * Patterns are matched by id; names are compared only for events not in
+ * the current config and for a button under a "*" remote, whose id
+ * differs between remotes.
+ */
+static int subscribed(const struct client *cli, const struct event_ids *ids, const char *remote_name,
+		      const char *button_name)
+{
+	const struct subscription *sub;
+
+	if (cli->subscriptions == NULL)
+		return (1);
+	for (sub = cli->subscriptions; sub != NULL; sub = sub->next) {
+		if (sub->remote != SUBSCRIBE_ANY) {
+			if (ids->valid) {
+				if (sub->remote != ids->remote)
+					continue;
+			} else if (remote_name == NULL || strcasecmp(sub->remote_name, remote_name) != 0) {
+				continue;
+			}
+		}
+		if (sub->button == SUBSCRIBE_ANY)
+			return (1);
+		if (ids->valid && sub->remote != SUBSCRIBE_ANY) {
+			if (sub->button == ids->button)
+				return (1);
+		} else if (button_name != NULL && strcasecmp(sub->button_name, button_name) == 0) {
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/* Free clients removed while dispatching events. */
+static void free_dead_clients(void)
+{
+	struct client *cli;
+	struct subscription *sub;
+
+	while (dead_clients != NULL) {
+		cli = dead_clients;
+		dead_clients = cli->next_dead;
+		while ((sub = cli->subscriptions) != NULL) {
+			cli->subscriptions = sub->next;
+			free_subscription(sub);
+		}
+		free(cli->obuf);
+		free(cli->units);
+		free(cli);
+	}
+}
+
+/* cut'n'paste from fileutils-3.16: */
+
+#define isodigit(c) ((c) >= '0' && (c) <= '7')
+
+/* Return a positive integer containing the value of the ASCII
+   octal number S.  If S is not an octal number, return -1.  */
+
+static int oatoi(s)
+char *s;
+{
+	register int i;
+
+	if (*s == 0)
+		return -1;
+	for (i = 0; isodigit(*s); ++s)
+		i = i * 8 + *s - '0';
+	if (*s)
+		return -1;
+	return i;
+}
+
+/*
+ * Client sockets are non-blocking. Whatever the socket doesn't accept
+ * right away is queued in a bounded per-client ring and flushed by the
+ * event loop once the socket becomes writable, so a stalled client
+ * can't block decoding for everybody else.
+ */
+
+static int client_units_size(void)
+{
+	/* an event is at least "<16 digits> <2 digits> x y\n" */
+	return client_buffer_size / 16 + 1;
+}
+
+/* Write queued output, returns 0 on errors. */
+static int client_flush(struct client *cli)
+{
+	int done, todo;
+
+	while (cli->olen > 0) {
+		todo = cli->olen;
+		if (cli->ohead + todo > client_buffer_size)
+			todo = client_buffer_size - cli->ohead;
+		done = write(cli->fd, cli->obuf + cli->ohead, todo);
+		if (done == -1 && errno == EINTR)
+			continue;
+		if (done == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (done <= 0)
+			return (0);
+		cli->ohead = (cli->ohead + done) % client_buffer_size;
+		cli->olen -= done;
+		cli->head_sent += done;
+		while (cli->unitn > 0 && cli->head_sent >= cli->units[cli->unit_head].len) {
+			cli->head_sent -= cli->units[cli->unit_head].len;
+			cli->unit_head = (cli->unit_head + 1) % client_units_size();
+			cli->unitn--;
+		}
+	}
+	client_update_watch(cli);
+	return (1);
+}
+
+/* Drop the oldest queued event, if that is possible. */
+static int client_drop_oldest(struct client *cli)
+{
+	struct out_unit *unit;
+
+	if (cli->unitn == 0 || cli->head_sent > 0)
+		return (0);
+	unit = &cli->units[cli->unit_head];
+	if (!unit->is_event)
+		return (0);
+	cli->ohead = (cli->ohead + unit->len) % client_buffer_size;
+	cli->olen -= unit->len;
+	cli->unit_head = (cli->unit_head + 1) % client_units_size();
+	cli->unitn--;
+	cli->dropped++;
+	events_dropped++;
+	return (1);
+}
+
+/*
+ * Send buf to a client, queueing what can't be written now. Broadcast
+ * events (is_event) are subject to the overflow policy, replies never
+ * are. Returns 0 if the client should be removed.
+ */
+static int client_write(struct client *cli, const char *buf, int len, int is_event)
+{
+	int done, tail, n, partial = 0;
+	struct out_unit *unit;
+
+	if (cli->olen == 0) {
+		while (len > 0) {
+			done = write(cli->fd, buf, len);
+			if (done == -1 && errno == EINTR)
+				continue;
+			if (done == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (done <= 0)
+				return (0);
+			buf += done;
+			len -= done;
+			partial = 1;
+		}
+		if (len == 0)
+			return (1);
+	}
+	if (cli->obuf == NULL) {
+		cli->obuf = malloc(client_buffer_size);
+		cli->units = malloc(client_units_size() * sizeof(struct out_unit));
+		if (cli->obuf == NULL || cli->units == NULL) {
+			logprintf(LIRC_ERROR, "out of memory");
+			return (0);
+		}
+	}
+	/* a partially written event must be completed, else we'd garble the stream */
+	if (partial)
+		is_event = 0;
+	while (client_buffer_size - cli->olen < len || cli->unitn == client_units_size()) {
+		if (is_event && overflow_policy == OVERFLOW_DROP_OLDEST) {
+			if (client_drop_oldest(cli))
+				continue;
+			cli->dropped++;
+			events_dropped++;
+			LOGPRINTF(1, "client %d: output buffer full, event dropped", cli->fd);
+			return (1);
+		}
+		if (is_event)
+			events_dropped++;
+		clients_overflowed++;
+		logprintf(LIRC_WARNING, "client %d: output buffer full, disconnecting", cli->fd);
+		return (0);
+	}
+	tail = (cli->ohead + cli->olen) % client_buffer_size;
+	n = len < client_buffer_size - tail ? len : client_buffer_size - tail;
+	memcpy(cli->obuf + tail, buf, n);
+	memcpy(cli->obuf, buf + n, len - n);
+	cli->olen += len;
+
+	unit = cli->unitn > 0 ? &cli->units[(cli->unit_head + cli->unitn - 1) % client_units_size()] : NULL;
+	if (unit != NULL && !unit->is_event && !is_event) {
+		unit->len += len;
+	} else {
+		unit = &cli->units[(cli->unit_head + cli->unitn) % client_units_size()];
+		unit->len = len;
+		unit->is_event = is_event;
+		cli->unitn++;
+	}
+	client_update_watch(cli);
+	return (1);
+}
+
+/* A safer write(), since sockets might not write all but only some of the
+   bytes requested */
+
+int write_socket(int fd, const char *buf, int len)
+{
+	int done, todo = len;
+	struct client *cli;
+
+	cli = get_client(fd);
+	if (cli != NULL)
+		return (client_write(cli, buf, len, 0) ? len : -1);
+
+	while (todo) {
+#ifdef SIM_REC
+		do {
+			done = write(fd, buf, todo);
+		}
+		while (done < 0 && errno == EAGAIN);
+#else
+		done = write(fd, buf, todo);
+#endif
+		if (done <= 0)
+			return (done);
+		buf += done;
+		todo -= done;
+	}
+	return (len);
+}
+
+int write_socket_len(int fd, const char *buf)
+{
+	int len;
+
+	len = strlen(buf);
+	if (write_socket(fd, buf, len) < len)
+		return (0);
+	return (1);
+}
+
+int read_timeout(int fd, char *buf, int len, int timeout)
+{
+	struct pollfd pfd;
+	int ret, n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	/* CAVEAT: (from libc documentation)
+	   Any signal will cause `select' to return immediately.  So if your
+	   program uses signals, you can't rely on `select' to keep waiting
+	   for the full time specified.  If you want to be sure of waiting
+	   for a particular amount of time, you must check for `EINTR' and
+	   repeat the `select' with a newly calculated timeout based on the
+	   current time.  See the example below.
+
+	   Obviously the timeout is not recalculated in the example because
+	   this is done automatically on Linux systems...
+
+	   The same holds for poll(), used here since it has no FD_SETSIZE
+	   limit.
+	 */
+
+	do {
+		ret = poll(&pfd, 1, timeout * 1000);
+	}
+	while (ret == -1 && errno == EINTR);
+	if (ret == -1) {
+		logprintf(LIRC_ERROR, "poll() failed");
+		logperror(LIRC_ERROR, NULL);
+		return (-1);
+	} else if (ret == 0)
+		return (0);	/* timeout */
+	n = read(fd, buf, len);
+	if (n == -1) {
+		logprintf(LIRC_ERROR, "read() failed");
+		logperror(LIRC_ERROR, NULL);
+		return (-1);
+	}
+	return (n);
+}
+
+void sigterm(int sig)
+{
+	/* all signals are blocked now */
+	if (term)
+		return;
+	term = 1;
+	termsig = sig;
+}
+
+void dosigterm(int sig)
+{
+	int i;
+
+	struct retired_config *cfg;
+
+	logprintf(LIRC_NOTICE, "caught signal");
+
+	/*
+	 * Stop the transmit and decode threads where they are, they wait
+	 * for the locks from now on and don't touch the remotes again.
+	 */
+	drv_lock();
+	hw_lock();
+	while (retired_configs != NULL) {
+		cfg = retired_configs;
+		retired_configs = cfg->next;
+		free_config(cfg->remotes);
+		free(cfg);
+	}
+	free_config(remotes);
+	repeat_remote = NULL;
+	for (i = 0; i < clin; i++) {
+		shutdown(clis[i]->fd, 2);
+		close(clis[i]->fd);
+	};
+	if (do_shutdown) {
+		shutdown(sockfd, 2);
+	}
+	close(sockfd);
+
+#if defined(__linux__)
+	if (uinputfd != -1) {
+		ioctl(uinputfd, UI_DEV_DESTROY);
+		close(uinputfd);
+		uinputfd = -1;
+	}
+#endif
+	if (listen_tcpip) {
+		shutdown(sockinet, 2);
+		close(sockinet);
+	}
+	fclose(pidf);
+	(void)unlink(pidfile);
+	if (use_hw())
+		hw_deinit();
+	inputs_deinit();
+	if (curr_driver->close_func)
+		curr_driver->close_func();
+	lirc_log_close();
+	signal(sig, SIG_DFL);
+	if (sig == SIGUSR1)
+		exit(0);
+	raise(sig);
+}
+
+void sighup(int sig)
+{
+	hup = 1;
+}
+
+void dosighup(int sig)
+{
+	struct stat s;
+
+	if (config_loading) {
+		/* the file may have changed again, read it once more when done */
+		config_reload = 1;
+		return;
+	}
+
+	/* reopen logfile first */
+
+	if (! lirc_log_use_syslog()){
+		logprintf(LIRC_INFO, "closing logfile");
+		if (-1 == fstat(fileno(lf), &s)) {
+			dosigterm(SIGTERM);	/* shouldn't ever happen */
+		}
+		/* the transmit and decode threads log under the locks */
+		drv_lock();
+		hw_lock();
+		lirc_log_close();
+		lirc_log_open("lircd", nodaemon, loglevel_opt);
+		lf = fopen(logfile, "a");
+		hw_unlock();
+		drv_unlock();
+		if (lf == NULL) {
+			/* can't print any error messagees */
+			dosigterm(SIGTERM);
+		}
+		logprintf(LIRC_INFO, "reopened logfile");
+		if (-1 == fchmod(fileno(lf), s.st_mode)) {
+			logprintf(LIRC_WARNING, "could not set file permissions");
+			logperror(LIRC_WARNING, NULL);
+		}
+	}
+
+	/* read in the background, dosighup_done() is called when ready */
+	if (!config_load_start()) {
+		config();
+		dosighup_done();
+	}
+}
+
+/* Tell clients about the new config once it's in use. */
+static void dosighup_done(void)
+{
+	int i;
+
+	for (i = 0; i < clin; i++) {
+		if (!
+		    (write_socket_len(clis[i]->fd, protocol_string[P_BEGIN])
+		     && write_socket_len(clis[i]->fd, protocol_string[P_SIGHUP])
+		     && write_socket_len(clis[i]->fd, protocol_string[P_END]))) {
+			remove_client(clis[i]->fd);
+			i--;
 		}
 	}
 	/* restart all connection timers */
@@ -712,7 +1750,13 @@ static int setup_hardware()
 	return ret;
 }
 
-void config(void)
+/*
+ * Read the config file, returns the remotes or (void *)-1 on errors.
+ * Called by the config thread, so it mustn't touch any lircd state but
+ * configfile, which is the same on every call after the first one. The
+ * remotes come from config_cache if none of the files have changed.
+ */
+static struct ir_remote *read_config_file(void)
 {
 	FILE *fd;
 	struct ir_remote *config_remotes;
@@ -720,11 +1764,6 @@ void config(void)
 	if (filename == NULL)
 		filename = LIRCDCFGFILE;
 
-	if (free_remotes != NULL) {
-		logprintf(LIRC_ERROR, "cannot read config file");
-		logprintf(LIRC_ERROR, "old config is still in use");
-		return;
-	}
 	fd = fopen(filename, "r");
 	if (fd == NULL && errno == ENOENT && configfile == NULL) {
 		/* try old lircd.conf location */
@@ -739,10 +1778,10 @@ void config(void)
 	if (fd == NULL) {
 		logprintf(LIRC_ERROR, "could not open config file '%s'", filename);
 		logperror(LIRC_ERROR, NULL);
-		return;
+		return (void *)-1;
 	}
 	configfile = filename;
-	config_remotes = read_config(fd, configfile);
+	config_remotes = read_config_cached(fd, configfile, config_cache);
 	fclose(fd);
 	if (config_remotes == (void *)-1) {
 		logprintf(LIRC_ERROR, "reading of config file failed");
@@ -753,17 +1792,251 @@ void config(void)
                                   "config file %s contains no valid remote control definition",
                                   filename);
 		}
-		/* I cannot free the data structure
-		   as they could still be in use */
-		free_remotes = remotes;
-		remotes = config_remotes;
+	}
+	return config_remotes;
+}
+
+/* Carry the send and receive state of a remote over to its new definition. */
+static void copy_remote_state(const struct ir_remote *from, struct ir_remote *to)
+{
+	to->toggle_bit_mask_state = from->toggle_bit_mask_state;
+	to->toggle_mask_state = from->toggle_mask_state;
+	to->repeat_countdown = from->repeat_countdown;
+	to->last_code = from->last_code != NULL ? get_code_by_name(to, from->last_code->name) : NULL;
+	to->toggle_code = from->toggle_code != NULL ? get_code_by_name(to, from->toggle_code->name) : NULL;
+	to->reps = from->reps;
+	to->last_send = from->last_send;
+	to->min_remaining_gap = from->min_remaining_gap;
+	to->max_remaining_gap = from->max_remaining_gap;
+	to->release_detected = from->release_detected;
+}
+
+/* The new definition of a remote decoded last, NULL if it's gone. */
+static struct ir_remote *map_last_remote(struct ir_remote *remote, const struct ir_remote *old)
+{
+	if (remote == NULL || !is_in_remotes(old, remote))
+		return (remote);
+	remote = get_ir_remote(remotes, remote->name);
+	return (remote != NULL && remote->last_code != NULL ? remote : NULL);
+}
+
+/* Move a repeat job over to the current config, 0 if its code is gone. */
+static int repeat_job_remap(struct repeat_job *job)
+{
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+
+	remote = get_ir_remote(remotes, job->remote->name);
+	code = remote != NULL ? get_code_by_name(remote, job->code->name) : NULL;
+	if (code == NULL)
+		return (0);
+	copy_remote_state(job->remote, remote);
+	remote->last_code = code;
+	job->remote = remote;
+	job->code = code;
+	return (1);
+}
+
+/*
+ * Make a new config current. The swap is a single pointer store under
+ * hw_lock(), so decoding and transmitting see either the old or the new
+ * remotes; everything pointing into the old config is moved over before
+ * the lock is dropped. The old config is kept until config_reclaim()
+ * finds it unused.
+ */
+static void config_publish(struct ir_remote *config_remotes)
+{
+	struct ir_remote *old, *scan, *found;
+	struct retired_config *cfg;
+	struct repeat_job *job;
+	const char *release_event;
+	const char *release_remote_name;
+	const char *release_button_name;
+	struct event_code ec;
+	int i;
+
+	cfg = NULL;
+	if (remotes != NULL) {
+		cfg = malloc(sizeof(struct retired_config));
+		if (cfg == NULL) {
+			logprintf(LIRC_ERROR, "out of memory, keeping old config");
+			free_config(config_remotes);
+			return;
+		}
+	}
+	/* inputs_setup() swaps the --input drivers into drv */
+	if (inputn > 0)
+		drv_lock();
+	hw_lock();
+	old = remotes;
+	__atomic_store_n(&remotes, config_remotes, __ATOMIC_RELEASE);
+	/* before any event referring to the new remotes */
+	broadcast_names();
+	subscriptions_resolve();
+	remote_index_build();
+	decode_ring_forget();
+
+	/* before the new remotes get the global state of the old ones */
+	for (i = 0; i < inputn; i++) {
+		if (!input_map_remotes(inputs[i], old)) {
+			logprintf(LIRC_ERROR, "out of memory, input %s shares the state of the remotes",
+				  inputs[i]->tag);
+			free(inputs[i]->states);
+			inputs[i]->states = NULL;
+			inputs[i]->n_states = 0;
+		}
+	}
+	for (scan = old; scan != NULL; scan = scan->next) {
+		found = get_ir_remote(remotes, scan->name);
+		if (found != NULL)
+			copy_remote_state(scan, found);
+	}
+	release_event = release_map_remotes(old, remotes, &release_remote_name, &release_button_name);
+	if (release_event != NULL) {
+		get_event_code(&ec, 1);
+		input_message(release_event, release_remote_name, release_button_name, 0, 1, driver_tag, &ec);
+	}
+	last_remote = map_last_remote(last_remote, old);
+	last_decoded = map_last_remote(last_decoded, old);
+	for (i = 0; i < inputn; i++) {
+		input_swap(inputs[i]);
+		last_remote = map_last_remote(last_remote, old);
+		last_decoded = map_last_remote(last_decoded, old);
+		release_event = release_map_remotes(old, remotes, &release_remote_name, &release_button_name);
+		if (release_event != NULL)
+			get_event_code(&ec, 1);
+		input_swap(inputs[i]);
+		if (release_event != NULL)
+			deliver_message(release_event, release_remote_name, release_button_name, 0, 1, inputs[i]->tag,
+					&ec);
+	}
+	/* busy ones are moved by config_reclaim() when their frame is sent */
+	for (job = repeat_jobs; job != NULL; job = job->next) {
+		if (!job->busy && is_in_remotes(old, job->remote))
+			repeat_job_remap(job);
+	}
+
+	get_frequency_range(remotes, &setup_min_freq, &setup_max_freq);
+	get_filter_parameters(remotes, &setup_max_gap, &setup_min_pulse, &setup_min_space, &setup_max_pulse,
+			      &setup_max_space);
+
+	setup_hardware();
+	inputs_setup();
+	hw_unlock();
+	if (inputn > 0)
+		drv_unlock();
+
+	if (cfg == NULL)
+		return;
+	cfg->remotes = old;
+	cfg->pending = tx_depth;
+	cfg->next = retired_configs;
+	retired_configs = cfg;
+	config_reclaim();
+}
+
+/* Free the retired configs nothing refers to any more. */
+static void config_reclaim(void)
+{
+	struct retired_config **p, *cfg;
+	struct repeat_job *job;
+	int used;
+
+	/* only changed on the main thread, checked without the lock */
+	if (retired_configs == NULL)
+		return;
+	hw_lock();
+	for (p = &retired_configs; *p != NULL;) {
+		cfg = *p;
+		used = cfg->pending > 0;
+		for (job = repeat_jobs; job != NULL; job = job->next) {
+			if (!is_in_remotes(cfg->remotes, job->remote))
+				continue;
+			/* a repeat of a code which is gone keeps its config */
+			if (job->busy || !repeat_job_remap(job))
+				used = 1;
+		}
+		if (used) {
+			p = &cfg->next;
+			continue;
+		}
+		*p = cfg->next;
+		free_config(cfg->remotes);
+		free(cfg);
+		LOGPRINTF(1, "old config freed");
+	}
+	hw_unlock();
+}
+
+/* A queued transmission is done, release the configs waiting for it. */
+static void config_job_done(void)
+{
+	struct retired_config *cfg;
+
+	for (cfg = retired_configs; cfg != NULL; cfg = cfg->next) {
+		if (cfg->pending > 0)
+			cfg->pending--;
+	}
+}
+
+void config(void)
+{
+	struct ir_remote *config_remotes;
+
+	config_remotes = read_config_file();
+	if (config_remotes != (void *)-1)
+		config_publish(config_remotes);
+}
+
+/*
+ * Reloading on SIGHUP: the config file is parsed by a short-lived
+ * thread so lircd keeps decoding and transmitting with the old config
+ * meanwhile. The result is handed back through config_loaded and a
+ * wakeup pipe, and made current on the main thread.
+ */
+
+static void *config_thread_main(void *arg)
+{
+	char c = 0;
+
+	__atomic_store_n(&config_loaded, read_config_file(), __ATOMIC_RELEASE);
+	if (write(config_pipe[1], &c, 1) == -1 && errno != EAGAIN)
+		logperror(LIRC_WARNING, "config thread wakeup");
+	return NULL;
+}
+
+/* Start reading the config file in the background, 0 if that fails. */
+static int config_load_start(void)
+{
+	if (config_pipe[0] == -1 && !wakeup_pipe(config_pipe, &config_watch, WATCH_CONFIG))
+		return 0;
+	if (!spawn_thread(&config_thread, config_thread_main, "config"))
+		return 0;
+	config_loading = 1;
+	return 1;
+}
 
-		get_frequency_range(remotes, &setup_min_freq, &setup_max_freq);
-		get_filter_parameters(remotes, &setup_max_gap, &setup_min_pulse, &setup_min_space, &setup_max_pulse,
-				      &setup_max_space);
+/* The config thread is done, main thread only. */
+static void config_load_done(void)
+{
+	struct ir_remote *config_remotes;
+	char buf[64];
 
-		setup_hardware();
+	while (read(config_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	if (!config_loading)
+		return;
+	pthread_join(config_thread, NULL);
+	config_loading = 0;
+	config_remotes = __atomic_load_n(&config_loaded, __ATOMIC_ACQUIRE);
+	if (config_remotes != (void *)-1)
+		config_publish(config_remotes);
+	if (config_reload) {
+		config_reload = 0;
+		dosighup(SIGHUP);
+		return;
 	}
+	dosighup_done();
 }
 
 void nolinger(int sock)
@@ -776,27 +2049,32 @@ void nolinger(int sock)
 void remove_client(int fd)
 {
 	int i;
+	struct client *cli;
 
 	for (i = 0; i < clin; i++) {
-		if (clis[i] == fd) {
-			shutdown(clis[i], 2);
-			close(clis[i]);
+		if (clis[i]->fd == fd) {
+			cli = clis[i];
+			loop_del(&cli->watch);
+			shutdown(fd, 2);
+			close(fd);
 			logprintf(LIRC_INFO, "removed client");
+			if (cli->ring_reader)
+				ring_readers--;
 
 			clin--;
-			if (!use_hw() && curr_driver->deinit_func) {
-				curr_driver->deinit_func();
-			}
-			for (; i < clin; i++) {
-				clis[i] = clis[i + 1];
-			}
+			if (!use_hw())
+				hw_deinit();
+			memmove(&clis[i], &clis[i + 1], (clin - i) * sizeof(struct client *));
+			/* may still be referenced by the current event batch */
+			cli->fd = -1;
+			cli->next_dead = dead_clients;
+			dead_clients = cli;
 			return;
 		}
 	}
 	LOGPRINTF(1, "internal error in remove_client: no such fd");
 }
 
-
 void drop_privileges()
 {
 	const char* user;
@@ -831,6 +2109,7 @@ void add_client(int sock)
 	socklen_t clilen;
 	struct sockaddr client_addr;
 	int flags;
+	struct client *cli;
 
 	clilen = sizeof(client_addr);
 	fd = accept(sock, (struct sockaddr *)&client_addr, &clilen);
@@ -840,8 +2119,30 @@ void add_client(int sock)
 		dosigterm(SIGTERM);
 	};
 
-	if (fd >= FD_SETSIZE || clin >= MAX_CLIENTS) {
+	if (clin == clis_size) {
+		int size = clis_size ? 2 * clis_size : 16;
+		struct client **p;
+
+		p = realloc(clis, size * sizeof(struct client *));
+		if (p != NULL) {
+			clis = p;
+			clis_size = size;
+		}
+	}
+	cli = clin < clis_size ? malloc(sizeof(struct client)) : NULL;
+	if (cli == NULL) {
+		logprintf(LIRC_ERROR, "connection rejected");
+		shutdown(fd, 2);
+		close(fd);
+		return;
+	}
+	memset(cli, 0, sizeof(struct client));
+	cli->fd = fd;
+	cli->id = ++client_ids;
+	cli->watch.fd = -1;
+	if (!loop_add(&cli->watch, fd, WATCH_CLIENT, cli, LOOP_IN)) {
 		logprintf(LIRC_ERROR, "connection rejected");
+		free(cli);
 		shutdown(fd, 2);
 		close(fd);
 		return;
@@ -852,28 +2153,26 @@ void add_client(int sock)
 		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 	}
 	if (client_addr.sa_family == AF_UNIX) {
-		cli_type[clin] = CT_LOCAL;
+		cli->type = CT_LOCAL;
 		logprintf(LIRC_NOTICE, "accepted new client on %s", lircdfile);
 	} else if (client_addr.sa_family == AF_INET) {
-		cli_type[clin] = CT_REMOTE;
+		cli->type = CT_REMOTE;
 		logprintf(LIRC_NOTICE, "accepted new client from %s",
 			  inet_ntoa(((struct sockaddr_in *)&client_addr)->sin_addr));
 	} else {
-		cli_type[clin] = 0;	/* what? */
-	}
-	clis[clin] = fd;
-	if (!use_hw()) {
-		if (curr_driver->init_func) {
-			if (!curr_driver->init_func()) {
-				logprintf(LIRC_WARNING, "Failed to initialize hardware");
-				/* Don't exit here, otherwise lirc
-				 * bails out, and lircd exits, making
-				 * it impossible to connect to when we
-				 * have a device actually plugged
-				 * in. */
-			} else {
-				setup_hardware();
-			}
+		cli->type = 0;	/* what? */
+	}
+	clis[clin] = cli;
+	if (!use_hw() && curr_driver->init_func) {
+		if (!hw_init()) {
+			logprintf(LIRC_WARNING, "Failed to initialize hardware");
+			/* Don't exit here, otherwise lirc
+			 * bails out, and lircd exits, making
+			 * it impossible to connect to when we
+			 * have a device actually plugged
+			 * in. */
+		} else {
+			setup_hardware();
 		}
 	}
 	clin++;
@@ -884,8 +2183,11 @@ int add_peer_connection(const char *server)
 {
 	char *sep;
 	struct servent *service;
+	struct peer_connection **p;
 
-	if (peern < MAX_PEERS) {
+	p = realloc(peers, (peern + 1) * sizeof(struct peer_connection *));
+	if (p != NULL) {
+		peers = p;
 		peers[peern] = malloc(sizeof(struct peer_connection));
 		if (peers[peern] != NULL) {
 			gettimeofday(&peers[peern]->reconnect, NULL);
@@ -922,10 +2224,11 @@ int add_peer_connection(const char *server)
 			return (0);
 		}
 		peers[peern]->socket = -1;
+		peers[peern]->watch.fd = -1;
 		peern++;
 		return (1);
 	} else {
-		fprintf(stderr, "%s: too many client connections\n", progname);
+		fprintf(stderr, "%s: out of memory\n", progname);
 	}
 	return (0);
 }
@@ -973,14 +2276,17 @@ void connect_to_peers()
 			}
 			logprintf(LIRC_NOTICE, "connected to %s", peers[i]->host);
 			peers[i]->connection_failure = 0;
+			loop_add(&peers[i]->watch, peers[i]->socket, WATCH_PEER, peers[i], LOOP_IN);
 		}
 	}
 }
 
 int get_peer_message(struct peer_connection *peer)
 {
-	int length;
+	static const struct event_ids no_ids = { 0, 0, 0 };
+	int length, tagged_len;
 	char buffer[PACKET_SIZE + 1];
+	char tagged[2 * PACKET_SIZE + 1];
 	char *end;
 	int i;
 
@@ -997,13 +2303,21 @@ int get_peer_message(struct peer_connection *peer)
 		end[0] = 0;
 		length = strlen(buffer);
 		LOGPRINTF(1, "received peer message: \"%s\"", buffer);
+		if (ring_readers > 0)
+			event_ring_put(buffer, length);
+		tagged_len = tag_event(buffer, peer->host, tagged, sizeof(tagged));
 		for (i = 0; i < clin; i++) {
 			/* don't relay messages to remote clients */
-			if (cli_type[i] == CT_REMOTE)
+			if (clis[i]->type == CT_REMOTE || clis[i]->ring_reader)
 				continue;
+			/* the names aren't parsed, only "SUBSCRIBE *" matches */
+			if (!subscribed(clis[i], &no_ids, NULL, NULL)) {
+				events_filtered++;
+				continue;
+			}
 			LOGPRINTF(1, "writing to client %d", i);
-			if (write_socket(clis[i], buffer, length) < length) {
-				remove_client(clis[i]);
+			if (!client_write_event(clis[i], buffer, length, tagged, tagged_len)) {
+				remove_client(clis[i]->fd);
 				i--;
 			}
 		}
@@ -1056,6 +2370,11 @@ void start_server(mode_t permission, int nodaemon, loglevel_t loglevel)
 	}
         ir_remote_init(options_getboolean("lircd:dynamic-codes"));
 
+	if (!loop_init()) {
+		fprintf(stderr, "%s: could not set up event loop\n", progname);
+		goto start_server_failed0;
+	}
+
 	/* create socket */
 	sockfd = -1;
 	do_shutdown = 0;
@@ -1113,125 +2432,724 @@ void start_server(mode_t permission, int nodaemon, loglevel_t loglevel)
 			perror(progname);
 			goto start_server_failed1;
 		}
-
-		listen(sockfd, 3);
+
+		listen(sockfd, 3);
+	}
+	nolinger(sockfd);
+
+	if (useuinput) {
+		uinputfd = setup_uinputfd(progname);
+	}
+	drop_privileges();
+	if (listen_tcpip) {
+		int enable = 1;
+
+		/* create socket */
+		sockinet = socket(PF_INET, SOCK_STREAM, IPPROTO_IP);
+		if (sockinet == -1) {
+			fprintf(stderr, "%s: could not create TCP/IP socket\n", progname);
+			perror(progname);
+			goto start_server_failed1;
+		}
+		(void)setsockopt(sockinet, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+		serv_addr_in.sin_family = AF_INET;
+		serv_addr_in.sin_addr = address;
+		serv_addr_in.sin_port = htons(port);
+
+		if (bind(sockinet, (struct sockaddr *)&serv_addr_in, sizeof(serv_addr_in)) == -1) {
+			fprintf(stderr, "%s: could not assign address to socket\n", progname);
+			perror(progname);
+			goto start_server_failed2;
+		}
+
+		listen(sockinet, 3);
+		nolinger(sockinet);
+		loop_add(&sockinet_watch, sockinet, WATCH_LISTEN, NULL, LOOP_IN);
+	}
+	loop_add(&sockfd_watch, sockfd, WATCH_LISTEN, NULL, LOOP_IN);
+	LOGPRINTF(1, "started server socket");
+	return;
+
+start_server_failed2:
+	if (listen_tcpip) {
+		close(sockinet);
+	}
+start_server_failed1:
+	close(sockfd);
+start_server_failed0:
+	fclose(pidf);
+	(void)unlink(pidfile);
+	exit(EXIT_FAILURE);
+}
+
+
+void daemonize(void)
+{
+	if (daemon(0, 0) == -1) {
+		logprintf(LIRC_ERROR, "daemon() failed");
+		logperror(LIRC_ERROR, NULL);
+		dosigterm(SIGTERM);
+	}
+	umask(0);
+	rewind(pidf);
+	fprintf(pidf, "%d\n", getpid());
+	fflush(pidf);
+	if (ftruncate(fileno(pidf), ftell(pidf)) != 0) {
+		logperror(LIRC_WARNING, "lircd: ftruncate()");
+	}
+	daemonized = 1;
+}
+
+
+/* Apply the transmitter mask for the next transmission, if needed. */
+static int apply_transmitters(__u32 mask)
+{
+	int ret = 1;
+
+	if (mask == 0)
+		return (1);
+	send_lock();
+	if (mask != hw_transmitters) {
+		if (curr_driver->drvctl_func == NULL
+		    || curr_driver->drvctl_func(LIRC_SET_TRANSMITTER_MASK, &mask) != 0)
+			ret = 0;
+		else
+			hw_transmitters = mask;
+	}
+	send_unlock();
+	return (ret);
+}
+
+static struct repeat_job *get_repeat_job(const struct ir_remote *remote)
+{
+	struct repeat_job *job;
+
+	for (job = repeat_jobs; job != NULL; job = job->next) {
+		if (job->remote == remote && !job->stopped)
+			return (job);
+	}
+	return (NULL);
+}
+
+/* When the next frame of a repeated code is due. */
+static void get_frame_time(const struct ir_remote *remote, struct timeval *tv)
+{
+	struct timeval gap;
+
+	gap.tv_sec = remote->min_remaining_gap / 1000000;
+	gap.tv_usec = remote->min_remaining_gap % 1000000;
+	timeradd(&remote->last_send, &gap, tv);
+}
+
+static void repeat_job_free(struct repeat_job *job)
+{
+	struct repeat_job **p;
+
+	for (p = &repeat_jobs; *p != NULL; p = &(*p)->next) {
+		if (*p == job) {
+			*p = job->next;
+			break;
+		}
+	}
+	free(job);
+	if (!use_hw())
+		hw_deinit();
+}
+
+/* Earliest frame due of all repeat jobs, cleared if there are none. */
+static void get_repeat_time(struct timeval *tv)
+{
+	struct repeat_job *job;
+
+	timerclear(tv);
+	for (job = repeat_jobs; job != NULL; job = job->next) {
+		if (job->busy)
+			continue;
+		if (!timerisset(tv) || timercmp(tv, &job->deadline, >))
+			*tv = job->deadline;
+	}
+}
+
+/*
+ * SEND_STOP for a remote. Returns 0 if it has to go on until min_repeat
+ * frames are sent.
+ */
+static int stop_repeating(struct ir_remote *remote)
+{
+	int done;
+
+	done = repeat_max - remote->repeat_countdown;
+	if (done < remote->min_repeat) {
+		/* we still have some repeats to do */
+		remote->repeat_countdown = remote->min_repeat - done;
+		return (0);
+	}
+	remote->toggle_mask_state = 0;
+	return (1);
+}
+
+/*
+ * The transmit threads: all transmissions are queued as a struct tx_job,
+ * the threads send them in order and hand them back to the main thread
+ * through tx_done, which replies to the client. The main thread is thus
+ * never blocked by the driver, and a client may send more commands
+ * while its earlier ones are still waiting. If the driver can send to
+ * its transmitters independently, jobs for disjoint transmitters and
+ * remotes are sent in parallel, see tx_next().
+ */
+
+static struct tx_job *tx_job_new(enum tx_type type, struct ir_remote *remote, struct ir_ncode *code)
+{
+	struct tx_job *job;
+
+	job = malloc(sizeof(struct tx_job));
+	if (job == NULL)
+		return (NULL);
+	memset(job, 0, sizeof(struct tx_job));
+	job->type = type;
+	job->remote = remote;
+	job->code = code;
+	job->transmitters = transmitters;
+	return (job);
+}
+
+static void tx_job_free(struct tx_job *job)
+{
+	send_buffer_delete(job->buffer);
+	free(job->items);
+	free(job->message);
+	free(job);
+}
+
+/* Queue a job for the transmit thread, main thread only. */
+static void tx_submit(struct tx_job *job)
+{
+	gettimeofday(&job->queued, NULL);
+	job->next = NULL;
+	pthread_mutex_lock(&tx_mutex);
+	*tx_queue_tail = job;
+	tx_queue_tail = &job->next;
+	pthread_cond_signal(&tx_cond);
+	pthread_mutex_unlock(&tx_mutex);
+	tx_depth++;
+	if (tx_depth > tx_depth_max)
+		tx_depth_max = tx_depth;
+}
+
+/* The driver sends to transmitters independently: only file, see send_channel_func. */
+static int tx_parallel(void)
+{
+	return (tx_channels);
+}
+
+static int tx_uses_remote(const struct tx_job *job, const struct ir_remote *remote)
+{
+	int i;
+
+	if (job->type != TX_SEQUENCE)
+		return (job->remote == remote);
+	for (i = 0; i < job->n_items; i++)
+		if (job->items[i].remote == remote)
+			return (1);
+	return (0);
+}
+
+/*
+ * Jobs which can't be sent at the same time with send_channel_func: those
+ * sharing a transmitter, or a remote as its transmit state is in struct
+ * ir_remote.
+ */
+static int tx_conflict(const struct tx_job *a, const struct tx_job *b)
+{
+	int i;
+
+	if (a->transmitters == 0 || b->transmitters == 0 || (a->transmitters & b->transmitters) != 0)
+		return (1);
+	if (a->type != TX_SEQUENCE)
+		return (tx_uses_remote(b, a->remote));
+	for (i = 0; i < a->n_items; i++)
+		if (tx_uses_remote(b, a->items[i].remote))
+			return (1);
+	return (0);
+}
+
+/*
+ * Take the first queued job which conflicts with no job being sent, nor
+ * with a job queued before it, so conflicting jobs keep their order.
+ * NULL if all queued jobs have to wait. Called with tx_mutex held.
+ * Without send_channel_func there's just one thread, sending in order.
+ */
+static struct tx_job *tx_next(void)
+{
+	struct tx_job **p, *job, *other;
+
+	if (!tx_parallel()) {
+		job = tx_queue;
+		if (job != NULL) {
+			tx_queue = job->next;
+			if (tx_queue == NULL)
+				tx_queue_tail = &tx_queue;
+		}
+		return (job);
+	}
+	for (p = &tx_queue; *p != NULL; p = &(*p)->next) {
+		job = *p;
+		for (other = tx_running; other != NULL; other = other->next)
+			if (tx_conflict(job, other))
+				break;
+		if (other != NULL)
+			continue;
+		for (other = tx_queue; other != job; other = other->next)
+			if (tx_conflict(job, other))
+				break;
+		if (other != job)
+			continue;
+		*p = job->next;
+		if (*p == NULL)
+			tx_queue_tail = p;
+		return (job);
+	}
+	return (NULL);
+}
+
+static void sleep_until(const struct timeval *tv)
+{
+	struct timeval now;
+	struct timespec ts;
+
+	gettimeofday(&now, NULL);
+	if (!timercmp(&now, tv, <))
+		return;
+	timersub(tv, &now, &now);
+	ts.tv_sec = now.tv_sec;
+	ts.tv_nsec = now.tv_usec * 1000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/* When the pause send_ir_ncode() makes before another code is over. */
+static void get_pause_time(const struct ir_remote *remote, struct timeval *tv)
+{
+	struct timeval gap;
+
+	gap.tv_sec = 2 * remote->min_remaining_gap / 1000000;
+	gap.tv_usec = 2 * remote->min_remaining_gap % 1000000;
+	timeradd(&remote->last_send, &gap, tv);
+}
+
+/*
+ * Send a frame of the job's code as send_ir_ncode() does, repeat tells
+ * if it repeats the last frame. The frame is prepared under hw_lock(),
+ * as the decoder changes the remote's state too, and handed to the
+ * driver under send_lock(). With send_channel_func it's prepared in a
+ * buffer of the job's own, passed explicitly rather than selected, as
+ * other transmit threads fill theirs meanwhile. Drivers without
+ * send_buffer_func prepare it in send_func, without hw_lock().
+ */
+static int tx_send(struct tx_job *job, int repeat)
+{
+	struct ir_remote *remote = job->remote;
+	struct ir_ncode *code = job->code;
+	struct timeval deadline;
+	const lirc_t *signals = NULL;
+	int length, wait, ret;
+
+	if (tx_parallel() && job->buffer == NULL) {
+		job->buffer = send_buffer_new();
+		if (job->buffer == NULL)
+			return (0);
+	}
+	hw_lock();
+	wait = !repeat && remote->last_code != NULL;
+	get_pause_time(remote, &deadline);
+	hw_unlock();
+	if (wait)
+		sleep_until(&deadline);
+
+	send_lock();
+	hw_lock();
+	/*
+	 * Tells send_buffer_put() to send a repeat frame. Set by one
+	 * thread at a time unless the driver has send_channel_func,
+	 * which has it set under hw_lock() only.
+	 */
+	if (repeat) {
+		repeat_remote = remote;
+		repeat_code = code;
+	}
+	if (tx_parallel() || tx_buffered) {
+		if (tx_parallel()) {
+			signals = send_buffer_put_into(job->buffer, remote, code, &length);
+			ret = signals != NULL;
+		} else {
+			ret = send_buffer_put(remote, code);
+		}
+		repeat_remote = NULL;
+		repeat_code = NULL;
+		hw_unlock();
+		if (ret && tx_parallel())
+			ret = curr_driver->send_channel_func(remote, job->transmitters, signals, length);
+		else if (ret)
+			ret = curr_driver->send_buffer_func(remote);
+	} else {
+		hw_unlock();
+		ret = curr_driver->send_func(remote, code);
+		hw_lock();
+		repeat_remote = NULL;
+		repeat_code = NULL;
+		hw_unlock();
+	}
+	send_unlock();
+	if (!ret)
+		return (0);
+	hw_lock();
+	gettimeofday(&remote->last_send, NULL);
+	remote->last_code = code;
+	hw_unlock();
+	return (1);
+}
+
+/* Send the first frame of SEND_ONCE or SEND_START, returns the error if any. */
+static const char *tx_first_frame(struct tx_job *job)
+{
+	struct ir_remote *remote = job->remote;
+	struct ir_ncode *code = job->code;
+
+	hw_lock();
+	if (has_toggle_mask(remote)) {
+		remote->toggle_mask_state = 0;
+	}
+	if (has_toggle_bit_mask(remote)) {
+		remote->toggle_bit_mask_state = (remote->toggle_bit_mask_state ^ remote->toggle_bit_mask);
+	}
+	code->transmit_state = NULL;
+	hw_unlock();
+	if (!tx_parallel() && !apply_transmitters(job->transmitters)) {
+		return ("error - could not set transmitters\n");
+	}
+	if (!tx_send(job, 0)) {
+		return ("transmission failed\n");
+	}
+	hw_lock();
+	if (job->type != TX_START) {
+		remote->repeat_countdown = max(remote->repeat_countdown, job->reps);
+	} else {
+		/* you've been warned, now we have a limit */
+		remote->repeat_countdown = repeat_max;
+	}
+	hw_unlock();
+	return (NULL);
+}
+
+/*
+ * Send one more frame of a repeated code. Returns 1 if more frames are
+ * due, 0 when done and -1 if the repeat was interrupted.
+ */
+static int tx_repeat_frame(struct tx_job *job)
+{
+	struct ir_remote *remote = job->remote;
+	struct ir_ncode *code = job->code;
+	int ret;
+
+	hw_lock();
+	if (job->stopped || remote->last_code != code) {
+		/* we received a different code from the original
+		   remote control we could repeat the wrong code so
+		   better stop repeating */
+		hw_unlock();
+		return (-1);
+	}
+	if (code->next == NULL || (code->transmit_state != NULL && code->transmit_state->next == NULL)) {
+		remote->repeat_countdown--;
+	}
+	hw_unlock();
+	if (!tx_parallel())
+		apply_transmitters(job->transmitters);
+	ret = tx_send(job, 1);
+	hw_lock();
+	ret = ret && remote->repeat_countdown > 0 ? 1 : 0;
+	hw_unlock();
+	return (ret);
+}
+
+/* Send the first frame of a code, and unless it's SEND_START its repeats. */
+static void tx_code(struct tx_job *job)
+{
+	const char *error;
+	int ret;
+
+	error = tx_first_frame(job);
+	/* job->repeating is read by SEND_STOP under hw_lock() */
+	hw_lock();
+	job->error = error;
+	job->repeating = error == NULL
+		&& (job->remote->repeat_countdown > 0 || job->code->next != NULL);
+	/* SEND_START is repeated by a repeat job, the others right here */
+	while (job->type != TX_START && job->repeating) {
+		get_frame_time(job->remote, &job->deadline);
+		hw_unlock();
+		sleep_until(&job->deadline);
+		ret = tx_repeat_frame(job);
+		hw_lock();
+		if (ret < 0)
+			job->error = "repeating interrupted\n";
+		job->repeating = ret > 0;
+	}
+	hw_unlock();
+}
+
+static int same_carrier(const struct ir_remote *a, const struct ir_remote *b)
+{
+	return (a->freq == b->freq && a->duty_cycle == b->duty_cycle);
+}
+
+/*
+ * Send a SEND_SEQUENCE. Codes sharing a carrier are put in one buffer
+ * and sent in one go if the driver can, else the codes are sent one
+ * by one as for SEND_ONCE.
+ */
+static void tx_sequence(struct tx_job *job)
+{
+	struct tx_item *item;
+	struct timeval now;
+	const lirc_t *signals = NULL;
+	int i, j, k, length, ret;
+
+	if (!tx_parallel() && !tx_buffered) {
+		for (i = 0; i < job->n_items && job->error == NULL; i++) {
+			/* read by SEND_STOP too */
+			hw_lock();
+			job->remote = job->items[i].remote;
+			job->code = job->items[i].code;
+			job->reps = job->items[i].reps;
+			hw_unlock();
+			tx_code(job);
+		}
+		return;
+	}
+	if (tx_parallel()) {
+		if (job->buffer == NULL)
+			job->buffer = send_buffer_new();
+		if (job->buffer == NULL) {
+			job->error = "transmission failed\n";
+			return;
+		}
+	} else if (!apply_transmitters(job->transmitters)) {
+		job->error = "error - could not set transmitters\n";
+		return;
+	}
+	for (i = 0; i < job->n_items; i = j) {
+		if (i > 0) {
+			hw_lock();
+			get_pause_time(job->items[i - 1].remote, &job->deadline);
+			hw_unlock();
+			sleep_until(&job->deadline);
+		}
+		send_lock();
+		hw_lock();
+		if (tx_parallel())
+			send_buffer_start_into(job->buffer);
+		else
+			send_buffer_start();
+		ret = 1;
+		for (j = i; j < job->n_items && same_carrier(job->items[i].remote, job->items[j].remote); j++) {
+			item = &job->items[j];
+			job->remote = item->remote;
+			job->code = item->code;
+			if (has_toggle_mask(item->remote))
+				item->remote->toggle_mask_state = 0;
+			if (has_toggle_bit_mask(item->remote))
+				item->remote->toggle_bit_mask_state ^= item->remote->toggle_bit_mask;
+			item->code->transmit_state = NULL;
+			if (tx_parallel()) {
+				signals = send_buffer_add_into(job->buffer, item->remote, item->code, item->reps, &length);
+				ret = signals != NULL;
+			} else {
+				ret = send_buffer_add(item->remote, item->code, item->reps);
+			}
+			if (!ret)
+				break;
+		}
+		hw_unlock();
+		if (ret && tx_parallel())
+			ret = curr_driver->send_channel_func(job->items[j - 1].remote, job->transmitters,
+							     signals, length);
+		else if (ret)
+			ret = curr_driver->send_buffer_func(job->items[j - 1].remote);
+		send_unlock();
+		if (!ret) {
+			job->error = "transmission failed\n";
+			return;
+		}
+		gettimeofday(&now, NULL);
+		hw_lock();
+		for (k = i; k < j; k++) {
+			job->items[k].remote->last_send = now;
+			job->items[k].remote->last_code = job->items[k].code;
+		}
+		hw_unlock();
 	}
-	nolinger(sockfd);
+}
 
-	if (useuinput) {
-		uinputfd = setup_uinputfd(progname);
+/* Send a job, taking the locks it needs, see send_lock(). */
+static void tx_execute(struct tx_job *job)
+{
+	int ret;
+
+	if (job->type == TX_REPEAT) {
+		ret = tx_repeat_frame(job);
+		hw_lock();
+		job->repeating = ret > 0;
+		hw_unlock();
+	} else if (job->type == TX_SEQUENCE) {
+		tx_sequence(job);
+	} else {
+		tx_code(job);
 	}
-	drop_privileges();
-	if (listen_tcpip) {
-		int enable = 1;
+	hw_lock();
+	if (job->repeating)
+		get_frame_time(job->remote, &job->deadline);
+	hw_unlock();
+	gettimeofday(&job->done, NULL);
+}
 
-		/* create socket */
-		sockinet = socket(PF_INET, SOCK_STREAM, IPPROTO_IP);
-		if (sockinet == -1) {
-			fprintf(stderr, "%s: could not create TCP/IP socket\n", progname);
-			perror(progname);
-			goto start_server_failed1;
-		}
-		(void)setsockopt(sockinet, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
-		serv_addr_in.sin_family = AF_INET;
-		serv_addr_in.sin_addr = address;
-		serv_addr_in.sin_port = htons(port);
+static void *tx_thread_main(void *arg)
+{
+	struct tx_job *job, **p;
+	char c = 0;
 
-		if (bind(sockinet, (struct sockaddr *)&serv_addr_in, sizeof(serv_addr_in)) == -1) {
-			fprintf(stderr, "%s: could not assign address to socket\n", progname);
-			perror(progname);
-			goto start_server_failed2;
+	while (1) {
+		pthread_mutex_lock(&tx_mutex);
+		while ((job = tx_next()) == NULL)
+			pthread_cond_wait(&tx_cond, &tx_mutex);
+		job->next = tx_running;
+		tx_running = job;
+		tx_running_n++;
+		if (tx_running_n > tx_running_max)
+			tx_running_max = tx_running_n;
+		pthread_mutex_unlock(&tx_mutex);
+
+		tx_execute(job);
+
+		pthread_mutex_lock(&tx_mutex);
+		for (p = &tx_running; *p != job; p = &(*p)->next)
+			;
+		*p = job->next;
+		tx_running_n--;
+		job->next = NULL;
+		*tx_done_tail = job;
+		tx_done_tail = &job->next;
+		/* jobs which waited for this one may go now */
+		if (tx_parallel())
+			pthread_cond_broadcast(&tx_cond);
+		pthread_mutex_unlock(&tx_mutex);
+		if (write(tx_pipe[1], &c, 1) == -1 && errno != EAGAIN) {
+			hw_lock();
+			logperror(LIRC_WARNING, "transmit thread wakeup");
+			hw_unlock();
 		}
-
-		listen(sockinet, 3);
-		nolinger(sockinet);
-	}
-	LOGPRINTF(1, "started server socket");
-	return;
-
-start_server_failed2:
-	if (listen_tcpip) {
-		close(sockinet);
 	}
-start_server_failed1:
-	close(sockfd);
-start_server_failed0:
-	fclose(pidf);
-	(void)unlink(pidfile);
-	exit(EXIT_FAILURE);
+	return NULL;
 }
 
+/* Reply to the client and update the repeat job of a finished job. */
+static void tx_complete(struct tx_job *job)
+{
+	struct client *cli;
+	struct repeat_job *repeat = job->repeat;
+	unsigned long latency;
+	int ret = 1;
+
+	latency = time_elapsed(&job->queued, &job->done);
+	tx_jobs_done++;
+	tx_latency_total += latency;
+	if (latency > tx_latency_max)
+		tx_latency_max = latency;
+
+	cli = job->client != 0 ? get_client_by_id(job->client) : NULL;
+	if (cli != NULL) {
+		if (job->error != NULL)
+			ret = send_error(cli->fd, job->message, "%s", job->error);
+		else
+			ret = send_success(cli->fd, job->message);
+		if (!ret)
+			remove_client(cli->fd);
+	}
+	if (repeat != NULL) {
+		repeat->busy = 0;
+		if (job->repeating && !repeat->stopped)
+			repeat->deadline = job->deadline;
+		else
+			repeat_job_free(repeat);
+	}
+	tx_job_free(job);
+	config_job_done();
+	/* last, so the hardware is closed once only */
+	tx_depth--;
+	if (!use_hw())
+		hw_deinit();
+}
 
-void daemonize(void)
+/* Handle the jobs finished by the transmit thread, main thread only. */
+static void tx_drain(void)
 {
-	if (daemon(0, 0) == -1) {
-		logprintf(LIRC_ERROR, "daemon() failed");
-		logperror(LIRC_ERROR, NULL);
-		dosigterm(SIGTERM);
-	}
-	umask(0);
-	rewind(pidf);
-	fprintf(pidf, "%d\n", getpid());
-	fflush(pidf);
-	if (ftruncate(fileno(pidf), ftell(pidf)) != 0) {
-		logperror(LIRC_WARNING, "lircd: ftruncate()");
+	struct tx_job *job, *next;
+	char buf[64];
+
+	while (read(tx_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	pthread_mutex_lock(&tx_mutex);
+	job = tx_done;
+	tx_done = NULL;
+	tx_done_tail = &tx_done;
+	pthread_mutex_unlock(&tx_mutex);
+	for (; job != NULL; job = next) {
+		next = job->next;
+		tx_complete(job);
 	}
-	daemonized = 1;
 }
 
-
-void sigalrm(int sig)
+/* One transmit thread, or TX_THREADS if the driver sends in parallel. */
+static int start_tx_thread(void)
 {
-	alrm = 1;
+	int i, n;
+
+	tx_channels = curr_driver->api_version >= 3 && curr_driver->send_channel_func != NULL;
+	tx_buffered = curr_driver->api_version >= 3 && curr_driver->send_buffer_func != NULL;
+	n = tx_parallel() ? TX_THREADS : 1;
+
+	if (!wakeup_pipe(tx_pipe, &tx_watch, WATCH_TRANSMIT))
+		return 0;
+	hw_lock_init();
+	for (i = 0; i < n; i++)
+		if (!spawn_thread(&tx_threads[i], tx_thread_main, "transmit"))
+			return 0;
+	return 1;
 }
 
-void dosigalrm(int sig)
+/* Queue the frames due for all repeat jobs. */
+static void run_repeat_jobs(void)
 {
-	struct itimerval repeat_timer;
-
-	if (repeat_remote->last_code != repeat_code) {
-		/* we received a different code from the original
-		   remote control we could repeat the wrong code so
-		   better stop repeating */
-		if (repeat_fd != -1) {
-			send_error(repeat_fd, repeat_message, "repeating interrupted\n");
-		}
+	struct repeat_job *job, *next;
+	struct tx_job *tx;
+	struct timeval now;
 
-		repeat_remote = NULL;
-		repeat_code = NULL;
-		repeat_fd = -1;
-		if (repeat_message != NULL) {
-			free(repeat_message);
-			repeat_message = NULL;
-		}
-		if (!use_hw() && curr_driver->deinit_func) {
-			curr_driver->deinit_func();
+	gettimeofday(&now, NULL);
+	for (job = repeat_jobs; job != NULL; job = next) {
+		next = job->next;
+		/* some timercmp() definitions don't work with <= */
+		if (job->busy || timercmp(&now, &job->deadline, <))
+			continue;
+		tx = tx_job_new(TX_REPEAT, job->remote, job->code);
+		if (tx == NULL) {
+			logprintf(LIRC_ERROR, "out of memory");
+			repeat_job_free(job);
+			continue;
 		}
-		return;
-	}
-	if (repeat_code->next == NULL
-	    || (repeat_code->transmit_state != NULL && repeat_code->transmit_state->next == NULL)) {
-		repeat_remote->repeat_countdown--;
-	}
-	if (send_ir_ncode(repeat_remote, repeat_code, 1) && repeat_remote->repeat_countdown > 0) {
-		repeat_timer.it_value.tv_sec = 0;
-		repeat_timer.it_value.tv_usec = repeat_remote->min_remaining_gap;
-		repeat_timer.it_interval.tv_sec = 0;
-		repeat_timer.it_interval.tv_usec = 0;
-
-		setitimer(ITIMER_REAL, &repeat_timer, NULL);
-		return;
-	}
-	repeat_remote = NULL;
-	repeat_code = NULL;
-	if (repeat_fd != -1) {
-		send_success(repeat_fd, repeat_message);
-		free(repeat_message);
-		repeat_message = NULL;
-		repeat_fd = -1;
-	}
-	if (!use_hw() && curr_driver->deinit_func) {
-		curr_driver->deinit_func();
+		tx->transmitters = job->transmitters;
+		tx->repeat = job;
+		job->busy = 1;
+		tx_submit(tx);
 	}
 }
 
@@ -1489,7 +3407,13 @@ int set_transmitters(int fd, char *message, char *arguments)
 		channels |= next_tx_hex;
 	} while ((next_arg = strtok(NULL, WHITE_SPACE)) != NULL);
 
+	drv_lock();
+	hw_lock();
 	retval = curr_driver->drvctl_func(LIRC_SET_TRANSMITTER_MASK, &channels);
+	if (retval == 0)
+		transmitters = hw_transmitters = channels;
+	hw_unlock();
+	drv_unlock();
 	if (retval < 0) {
 		return (send_error(fd, message, "error - could not set transmitters\n"));
 	}
@@ -1506,6 +3430,10 @@ int simulate(int fd, char *message, char *arguments)
 {
 	int i;
 	char *sim, *s, *space;
+	char button_name[PACKET_SIZE + 1];
+	char remote_name[PACKET_SIZE + 1];
+	unsigned long reps;
+	struct event_code ec;
 logprintf(LIRC_DEBUG, "simulate: enter");
 
 	if (!allow_simulate) {
@@ -1548,7 +3476,14 @@ logprintf(LIRC_DEBUG, "simulate: enter");
 	}
 	strcpy(sim, arguments);
 	strcat(sim, "\n");
-	broadcast_message(sim);
+	/* already validated, names let subscriptions and binary clients see it */
+	sscanf(arguments, "%*s %lx %s %s", &reps, button_name, remote_name);
+	ec.code = strtoull(arguments, NULL, 16);
+	ec.remote = get_ir_remote(remotes, remote_name);
+	ec.ncode = ec.remote != NULL ? get_code_by_name(ec.remote, button_name) : NULL;
+	if (ec.ncode == NULL)
+		ec.remote = NULL;
+	broadcast_event(sim, remote_name, button_name, reps, 0, "simulate", &ec);
 	free(sim);
 
 	return (send_success(fd, message));
@@ -1567,11 +3502,72 @@ int send_start(int fd, char *message, char *arguments)
 	return (send_core(fd, message, arguments, 0));
 }
 
+/* SEND_SEQUENCE remote code reps [remote code reps...] */
+int send_sequence(int fd, char *message, char *arguments)
+{
+	struct tx_item items[PACKET_SIZE / 6];
+	struct tx_job *tx;
+	struct client *cli;
+	char *name, *command, *repeats, *end_ptr;
+	int n = 0;
+
+	if (curr_driver->send_mode == 0)
+		return (send_error(fd, message, "hardware does not support sending\n"));
+
+	name = arguments != NULL ? strtok(arguments, WHITE_SPACE) : NULL;
+	if (name == NULL)
+		return (send_error(fd, message, "remote missing\n"));
+	for (; name != NULL; name = strtok(NULL, WHITE_SPACE)) {
+		if (n == sizeof(items) / sizeof(items[0]))
+			return (send_error(fd, message, "too many codes\n"));
+		command = strtok(NULL, WHITE_SPACE);
+		repeats = strtok(NULL, WHITE_SPACE);
+		if (repeats == NULL)
+			return (send_error(fd, message, "bad send packet (remote code reps)\n"));
+		items[n].remote = get_ir_remote(remotes, name);
+		if (items[n].remote == NULL)
+			return (send_error(fd, message, "unknown remote: \"%s\"\n", name));
+		items[n].code = get_code_by_name(items[n].remote, command);
+		if (items[n].code == NULL)
+			return (send_error(fd, message, "unknown command: \"%s\"\n", command));
+		items[n].reps = strtol(repeats, &end_ptr, 10);
+		if (*end_ptr || items[n].reps < 0)
+			return (send_error(fd, message, "bad send packet (reps/eol)\n"));
+		if (items[n].reps > repeat_max) {
+			return (send_error
+				(fd, message, "too many repeats: \"%d\" > \"%u\"\n", items[n].reps, repeat_max));
+		}
+		/* the remote's transmit state belongs to a running repeat */
+		if (get_repeat_job(items[n].remote) != NULL)
+			return (send_error(fd, message, "busy: repeating\n"));
+		n++;
+	}
+	tx = tx_job_new(TX_SEQUENCE, items[0].remote, items[0].code);
+	if (tx != NULL) {
+		tx->message = strdup(message);
+		tx->items = malloc(n * sizeof(struct tx_item));
+	}
+	if (tx == NULL || tx->message == NULL || tx->items == NULL) {
+		if (tx != NULL)
+			tx_job_free(tx);
+		return (send_error(fd, message, "out of memory\n"));
+	}
+	memcpy(tx->items, items, n * sizeof(struct tx_item));
+	tx->n_items = n;
+	/* answered by tx_complete() */
+	cli = get_client(fd);
+	tx->client = cli != NULL ? cli->id : 0;
+	tx_submit(tx);
+	return (1);
+}
+
 int send_core(int fd, char *message, char *arguments, int once)
 {
 	struct ir_remote *remote;
 	struct ir_ncode *code;
-	struct itimerval repeat_timer;
+	struct repeat_job *job = NULL;
+	struct tx_job *tx;
+	struct client *cli;
 	int reps;
 	int err;
 
@@ -1585,103 +3581,526 @@ int send_core(int fd, char *message, char *arguments, int once)
 	if (err)
 		return 1;
 
-	if (once) {
-		if (repeat_remote != NULL) {
+	/* the remote's transmit state belongs to a running repeat */
+	if (get_repeat_job(remote) != NULL) {
+		if (once) {
 			return (send_error(fd, message, "busy: repeating\n"));
+		} else {
+			return (send_error(fd, message, "already repeating\n"));
 		}
+	}
+	tx = tx_job_new(once ? TX_ONCE : TX_START, remote, code);
+	if (tx != NULL)
+		tx->message = strdup(message);
+	if (!once && tx != NULL) {
+		job = malloc(sizeof(struct repeat_job));
+		tx->repeat = job;
+	}
+	if (tx == NULL || tx->message == NULL || (!once && job == NULL)) {
+		if (tx != NULL)
+			tx_job_free(tx);
+		free(job);
+		return (send_error(fd, message, "out of memory\n"));
+	}
+	if (once) {
+		tx->reps = reps;
 	} else {
-		if (repeat_remote != NULL) {
-			return (send_error(fd, message, "already repeating\n"));
+		memset(job, 0, sizeof(struct repeat_job));
+		job->remote = remote;
+		job->code = code;
+		job->transmitters = transmitters;
+		job->busy = 1;
+		job->next = repeat_jobs;
+		repeat_jobs = job;
+	}
+	/* answered by tx_complete() */
+	cli = get_client(fd);
+	tx->client = cli != NULL ? cli->id : 0;
+	tx_submit(tx);
+	return (1);
+}
+
+int send_stop(int fd, char *message, char *arguments)
+{
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+	struct repeat_job *job, *next;
+	struct tx_job *tx;
+	int err, found = 0, sending = 0, sending_remote = 0;
+
+	if (parse_rc(fd, message, arguments, &remote, &code, NULL, 0, &err) == 0)
+		return 0;
+	if (err)
+		return 1;
+
+	hw_lock();
+	/* SEND_ONCEs still sending their repeats */
+	pthread_mutex_lock(&tx_mutex);
+	for (tx = tx_running; tx != NULL; tx = tx->next) {
+		if ((tx->type != TX_ONCE && tx->type != TX_SEQUENCE) || !tx->repeating || tx->stopped)
+			continue;
+		sending = 1;
+		if (tx->remote == remote)
+			sending_remote = 1;
+		if ((remote == NULL || strcasecmp(remote->name, tx->remote->name) == 0)
+		    && (code == NULL || strcasecmp(code->name, tx->code->name) == 0)) {
+			found = 1;
+			if (stop_repeating(tx->remote))
+				tx->stopped = 1;
 		}
 	}
-	if (has_toggle_mask(remote)) {
-		remote->toggle_mask_state = 0;
+	pthread_mutex_unlock(&tx_mutex);
+	if (repeat_jobs == NULL && !sending) {
+		hw_unlock();
+		return (send_error(fd, message, "not repeating\n"));
 	}
-	if (has_toggle_bit_mask(remote)) {
-		remote->toggle_bit_mask_state = (remote->toggle_bit_mask_state ^ remote->toggle_bit_mask);
+	for (job = repeat_jobs; job != NULL; job = next) {
+		next = job->next;
+		if (job->stopped)
+			continue;
+		if (remote && strcasecmp(remote->name, job->remote->name) != 0)
+			continue;
+		if (code && strcasecmp(code->name, job->code->name) != 0)
+			continue;
+		found = 1;
+		if (!stop_repeating(job->remote))
+			continue;
+		if (job->busy)
+			job->stopped = 1;
+		else
+			repeat_job_free(job);
+	}
+	hw_unlock();
+	if (!found) {
+		if (code != NULL && (remote == NULL || get_repeat_job(remote) != NULL || sending_remote)) {
+			return (send_error(fd, message, "specified code does not match\n"));
+		}
+		return (send_error(fd, message, "specified remote does not match\n"));
 	}
-	code->transmit_state = NULL;
-	if (!send_ir_ncode(remote, code, 1)) {
-		return (send_error(fd, message, "transmission failed\n"));
+	return (send_success(fd, message));
+}
+
+int set_source_tags(int fd, char *message, char *arguments)
+{
+	struct client *cli;
+	char buff[8];
+
+	cli = get_client(fd);
+	if (arguments == NULL || sscanf(arguments, "%7s", buff) != 1) {
+		return (send_error(fd, message, "no arguments given\n"));
 	}
-	gettimeofday(&remote->last_send, NULL);
-	remote->last_code = code;
-	if (once) {
-		remote->repeat_countdown = max(remote->repeat_countdown, reps);
+	if (cli == NULL) {
+		return (send_error(fd, message, "not a client\n"));
+	}
+	if (strcasecmp(buff, "on") == 0) {
+		cli->source_tags = 1;
+	} else if (strcasecmp(buff, "off") == 0) {
+		cli->source_tags = 0;
 	} else {
-		/* you've been warned, now we have a limit */
-		remote->repeat_countdown = repeat_max;
+		return (send_error(fd, message, "invalid argument\n"));
 	}
-	if (remote->repeat_countdown > 0 || code->next != NULL) {
-		repeat_remote = remote;
-		repeat_code = code;
-		repeat_timer.it_value.tv_sec = 0;
-		repeat_timer.it_value.tv_usec = remote->min_remaining_gap;
-		repeat_timer.it_interval.tv_sec = 0;
-		repeat_timer.it_interval.tv_usec = 0;
-		if (once) {
-			repeat_message = strdup(message);
-			if (repeat_message == NULL) {
-				repeat_remote = NULL;
-				repeat_code = NULL;
-				return (send_error(fd, message, "out of memory\n"));
+	return (send_success(fd, message));
+}
+
+/* Append an entry to a name table, returns the new length or -1. */
+static int names_add(char *buffer, int size, int len, uint8_t kind, const char *name)
+{
+	int n;
+
+	n = strlen(name) + 1;
+	if (buffer != NULL) {
+		if (len + 1 + n > size)
+			return (-1);
+		buffer[len] = kind;
+		memcpy(buffer + len + 1, name, n);
+	}
+	return (len + 1 + n);
+}
+
+/*
+ * Make the name table frame of the current config, see lirc_events.h.
+ * Sized in a first pass with buffer == NULL. Returns the length.
+ */
+static int names_table(char *buffer, int size)
+{
+	struct lirc_names_header header;
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+	int len = sizeof(header);
+	uint32_t count = 0;
+	int i;
+
+	for (remote = remotes; remote != NULL && len != -1; remote = remote->next) {
+		len = names_add(buffer, size, len, LIRC_NAME_REMOTE, remote->name);
+		count++;
+		for (code = remote->codes; code->name != NULL && len != -1; code++) {
+			len = names_add(buffer, size, len, LIRC_NAME_BUTTON, code->name);
+			count++;
+		}
+	}
+	if (len != -1) {
+		len = names_add(buffer, size, len, LIRC_NAME_SOURCE, driver_tag != NULL ? driver_tag : "-");
+		count++;
+	}
+	for (i = 0; i < inputn && len != -1; i++) {
+		len = names_add(buffer, size, len, LIRC_NAME_SOURCE, inputs[i]->tag);
+		count++;
+	}
+	if (userelease && release_suffix != NULL && len != -1) {
+		len = names_add(buffer, size, len, LIRC_NAME_SUFFIX, release_suffix);
+		count++;
+	}
+	if (buffer != NULL && len != -1) {
+		memset(&header, 0, sizeof(header));
+		header.header.mark = LIRC_FRAME_MARK;
+		header.header.type = LIRC_FRAME_NAMES;
+		header.header.length = len;
+		header.generation = names_generation;
+		header.count = count;
+		memcpy(buffer, &header, sizeof(header));
+	}
+	return (len);
+}
+
+/* Send the name table to a client, or to all binary ones if cli is NULL. */
+static int send_names(struct client *cli)
+{
+	char *buffer;
+	int len, i, ret = 1;
+
+	len = names_table(NULL, 0);
+	buffer = malloc(len);
+	if (buffer == NULL || names_table(buffer, len) != len) {
+		logprintf(LIRC_ERROR, "out of memory");
+		free(buffer);
+		return (0);
+	}
+	if (cli != NULL) {
+		ret = client_write(cli, buffer, len, 0);
+	} else {
+		for (i = 0; i < clin; i++) {
+			if (clis[i]->binary_events && !client_write(clis[i], buffer, len, 0)) {
+				remove_client(clis[i]->fd);
+				i--;
 			}
-			repeat_fd = fd;
-		} else if (!send_success(fd, message)) {
-			repeat_remote = NULL;
-			repeat_code = NULL;
+		}
+	}
+	free(buffer);
+	return (ret);
+}
+
+/* A new config is current, the old indexes are meaningless. */
+static void broadcast_names(void)
+{
+	int i;
+
+	names_generation++;
+	for (i = 0; i < clin; i++) {
+		if (clis[i]->binary_events) {
+			send_names(NULL);
+			return;
+		}
+	}
+}
+
+int set_binary_events(int fd, char *message, char *arguments)
+{
+	struct client *cli;
+	char buff[8];
+
+	cli = get_client(fd);
+	if (arguments == NULL || sscanf(arguments, "%7s", buff) != 1) {
+		return (send_error(fd, message, "no arguments given\n"));
+	}
+	if (cli == NULL) {
+		return (send_error(fd, message, "not a client\n"));
+	}
+	if (strcasecmp(buff, "on") == 0) {
+		/* records are in host byte order */
+		if (cli->type != CT_LOCAL)
+			return (send_error(fd, message, "binary events only on the local socket\n"));
+		if (!send_success(fd, message))
 			return (0);
+		if (!cli->binary_events) {
+			cli->binary_events = 1;
+			return (send_names(cli));
 		}
-		setitimer(ITIMER_REAL, &repeat_timer, NULL);
 		return (1);
+	} else if (strcasecmp(buff, "off") == 0) {
+		cli->binary_events = 0;
 	} else {
-		return (send_success(fd, message));
+		return (send_error(fd, message, "invalid argument\n"));
+	}
+	return (send_success(fd, message));
+}
+
+/* Map the names of a SUBSCRIBE pattern to ids in the current config. */
+static void subscription_resolve(struct subscription *sub)
+{
+	struct ir_remote *remote;
+	struct ir_ncode *code;
+	uint32_t index = 0;
+
+	sub->remote = SUBSCRIBE_ANY;
+	sub->button = SUBSCRIBE_ANY;
+	remote = NULL;
+	if (strcmp(sub->remote_name, "*") != 0) {
+		for (remote = remotes; remote != NULL; remote = remote->next, index++) {
+			if (strcasecmp(remote->name, sub->remote_name) == 0)
+				break;
+		}
+		sub->remote = remote != NULL ? index : SUBSCRIBE_NONE;
+	}
+	if (sub->button_name == NULL || strcmp(sub->button_name, "*") == 0)
+		return;
+	sub->button = SUBSCRIBE_NONE;
+	if (remote == NULL)
+		return;
+	for (code = remote->codes; code->name != NULL; code++) {
+		if (strcasecmp(code->name, sub->button_name) == 0) {
+			sub->button = code - remote->codes;
+			return;
+		}
+	}
+}
+
+/* Ids change with the config, called when it's replaced. */
+static void subscriptions_resolve(void)
+{
+	struct subscription *sub;
+	int i;
+
+	for (i = 0; i < clin; i++) {
+		for (sub = clis[i]->subscriptions; sub != NULL; sub = sub->next)
+			subscription_resolve(sub);
+	}
+}
+
+int subscribe(int fd, char *message, char *arguments)
+{
+	struct client *cli;
+	struct subscription *sub;
+	char remote_name[PACKET_SIZE + 1];
+	char button_name[PACKET_SIZE + 1];
+	char extra[2];
+	int n;
+
+	cli = get_client(fd);
+	if (arguments == NULL)
+		return (send_error(fd, message, "no arguments given\n"));
+	n = sscanf(arguments, "%s %s %1s", remote_name, button_name, extra);
+	if (n < 1)
+		return (send_error(fd, message, "no arguments given\n"));
+	if (n > 2)
+		return (send_error(fd, message, "bad send packet\n"));
+	if (cli == NULL)
+		return (send_error(fd, message, "not a client\n"));
+	sub = calloc(1, sizeof(*sub));
+	if (sub == NULL)
+		return (send_error(fd, message, "out of memory\n"));
+	sub->remote_name = strdup(remote_name);
+	sub->button_name = n == 2 ? strdup(button_name) : NULL;
+	if (sub->remote_name == NULL || (n == 2 && sub->button_name == NULL)) {
+		free_subscription(sub);
+		return (send_error(fd, message, "out of memory\n"));
+	}
+	subscription_resolve(sub);
+	if (sub->remote == SUBSCRIBE_NONE)
+		logprintf(LIRC_NOTICE, "subscription to unknown remote %s", remote_name);
+	sub->next = cli->subscriptions;
+	cli->subscriptions = sub;
+	return (send_success(fd, message));
+}
+
+/* Remove the patterns given, all of them without arguments. */
+int unsubscribe(int fd, char *message, char *arguments)
+{
+	struct client *cli;
+	struct subscription **p, *sub;
+	char remote_name[PACKET_SIZE + 1];
+	char button_name[PACKET_SIZE + 1];
+	int n = 0;
+
+	cli = get_client(fd);
+	if (cli == NULL)
+		return (send_error(fd, message, "not a client\n"));
+	if (arguments != NULL)
+		n = sscanf(arguments, "%s %s", remote_name, button_name);
+	p = &cli->subscriptions;
+	while ((sub = *p) != NULL) {
+		if (n < 1 || (strcasecmp(sub->remote_name, remote_name) == 0
+			      && (n < 2 ? sub->button_name == NULL
+				  : sub->button_name != NULL && strcasecmp(sub->button_name, button_name) == 0))) {
+			*p = sub->next;
+			free_subscription(sub);
+		} else {
+			p = &sub->next;
+		}
+	}
+	return (send_success(fd, message));
+}
+
+/*
+ * The shared event ring (GET_EVENT_RING): local clients map a memfd
+ * lircd writes each event to once, instead of getting a copy written to
+ * their socket. Layout and reader protocol are in lirc_events.h.
+ */
+
+#if defined(__linux__) && defined(SYS_memfd_create) && defined(F_ADD_SEALS)
+
+static int event_ring_init(void)
+{
+	size_t size;
+	char path[64];
+	void *map;
+	int fd;
+
+	size = sizeof(struct lirc_ring_header) + EVENT_RING_SLOTS * EVENT_RING_SLOT_SIZE;
+	fd = syscall(SYS_memfd_create, "lircd-events", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		logperror(LIRC_ERROR, "memfd_create()");
+		return (0);
 	}
+	/* clients can't resize it under our feet */
+	if (ftruncate(fd, size) == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+		logperror(LIRC_ERROR, "cannot set up event ring");
+		close(fd);
+		return (0);
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	/* clients get a read-only descriptor */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	event_ring_fd = open(path, O_RDONLY | O_CLOEXEC);
+	close(fd);
+	if (map == MAP_FAILED || event_ring_fd == -1) {
+		logperror(LIRC_ERROR, "cannot set up event ring");
+		if (map != MAP_FAILED)
+			munmap(map, size);
+		if (event_ring_fd != -1)
+			close(event_ring_fd);
+		event_ring_fd = -1;
+		return (0);
+	}
+	event_ring = map;
+	event_ring->magic = LIRC_RING_MAGIC;
+	event_ring->version = LIRC_RING_VERSION;
+	event_ring->slots = EVENT_RING_SLOTS;
+	event_ring->slot_size = EVENT_RING_SLOT_SIZE;
+	return (1);
 }
 
-int send_stop(int fd, char *message, char *arguments)
+static void event_ring_put_line(const char *message, int len)
 {
-	struct ir_remote *remote;
-	struct ir_ncode *code;
-	struct itimerval repeat_timer;
-	int err;
+	struct lirc_ring_slot *slot;
+	uint64_t head;
+
+	head = event_ring->head;
+	slot = (struct lirc_ring_slot *)((char *)(event_ring + 1)
+					 + (head & (EVENT_RING_SLOTS - 1)) * EVENT_RING_SLOT_SIZE);
+	if (len > EVENT_RING_SLOT_SIZE - (int)sizeof(*slot) - 1)
+		len = EVENT_RING_SLOT_SIZE - sizeof(*slot) - 1;
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->length = len;
+	memcpy(slot + 1, message, len);
+	((char *)(slot + 1))[len] = '\0';
+	__atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&event_ring->head, head + 1, __ATOMIC_RELEASE);
+}
 
-	if (parse_rc(fd, message, arguments, &remote, &code, NULL, 0, &err) == 0)
-		return 0;
-	if (err)
-		return 1;
+/* Write the lines of an event to the ring and wake up the readers. */
+static void event_ring_put(const char *message, int len)
+{
+	const char *end;
+	int n;
 
-	if (repeat_remote && repeat_code) {
-		int done;
-		if (remote && strcasecmp(remote->name, repeat_remote->name) != 0) {
-			return (send_error(fd, message, "specified remote does not match\n"));
-		}
-		if (code && strcasecmp(code->name, repeat_code->name) != 0) {
-			return (send_error(fd, message, "specified code does not match\n"));
-		}
+	while (len > 0) {
+		end = memchr(message, '\n', len);
+		n = end != NULL ? end - message + 1 : len;
+		event_ring_put_line(message, n);
+		message += n;
+		len -= n;
+	}
+	__atomic_store_n(&event_ring->futex, (uint32_t)event_ring->head, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &event_ring->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
 
-		done = repeat_max - repeat_remote->repeat_countdown;
-		if (done < repeat_remote->min_repeat) {
-			/* we still have some repeats to do */
-			repeat_remote->repeat_countdown = repeat_remote->min_repeat - done;
-			return (send_success(fd, message));
-		}
-		repeat_timer.it_value.tv_sec = 0;
-		repeat_timer.it_value.tv_usec = 0;
-		repeat_timer.it_interval.tv_sec = 0;
-		repeat_timer.it_interval.tv_usec = 0;
+/* Send the reply with the ring descriptor attached. */
+static int send_ring_reply(struct client *cli, char *message)
+{
+	char reply[PACKET_SIZE + 1];
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int len, done;
+
+	len = snprintf(reply, sizeof(reply), "%s%s%s%s", protocol_string[P_BEGIN], message,
+		       protocol_string[P_SUCCESS], protocol_string[P_END]);
+	if (len >= (int)sizeof(reply))
+		return (send_error(cli->fd, message, "command too long\n"));
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = reply;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &event_ring_fd, sizeof(int));
+	do {
+		done = sendmsg(cli->fd, &msg, 0);
+	} while (done == -1 && errno == EINTR);
+	if (done <= 0)
+		return (0);
+	return (done == len || client_write(cli, reply + done, len - done, 0));
+}
 
-		setitimer(ITIMER_REAL, &repeat_timer, NULL);
+#else
 
-		repeat_remote->toggle_mask_state = 0;
-		repeat_remote = NULL;
-		repeat_code = NULL;
-		/* clin!=0, so we don't have to deinit hardware */
-		alrm = 0;
-		return (send_success(fd, message));
-	} else {
-		return (send_error(fd, message, "not repeating\n"));
+static int event_ring_init(void)
+{
+	logprintf(LIRC_ERROR, "event ring not supported on this system");
+	return (0);
+}
+
+static void event_ring_put(const char *message, int len)
+{
+}
+
+static int send_ring_reply(struct client *cli, char *message)
+{
+	return (0);
+}
+
+#endif
+
+int get_event_ring(int fd, char *message, char *arguments)
+{
+	struct client *cli;
+
+	cli = get_client(fd);
+	if (cli == NULL || cli->type != CT_LOCAL) {
+		return (send_error(fd, message, "event ring only on the local socket\n"));
 	}
+	if (event_ring == NULL && !event_ring_init()) {
+		return (send_error(fd, message, "event ring not available\n"));
+	}
+	/* the descriptor must go with the first byte of the reply */
+	if (cli->olen > 0) {
+		return (send_error(fd, message, "output pending, try again\n"));
+	}
+	if (!send_ring_reply(cli, message))
+		return (0);
+	if (!cli->ring_reader) {
+		cli->ring_reader = 1;
+		ring_readers++;
+	}
+	return (1);
 }
 
 int version(int fd, char *message, char *arguments)
@@ -1700,6 +4119,67 @@ int version(int fd, char *message, char *arguments)
 	return (1);
 }
 
+static void stats_add(char *buffer, int size, int *len, int *n, const char *key, unsigned long value)
+{
+	if (*len < size)
+		*len += snprintf(buffer + *len, size - *len, "%s %lu\n", key, value);
+	(*n)++;
+}
+
+int stats(int fd, char *message, char *arguments)
+{
+	char lines[2048];
+	char buffer[PACKET_SIZE + 1];
+	unsigned long queued = 0, jobs = 0, decoded, attempts;
+	struct repeat_job *job;
+	int i, len = 0, n = 0;
+
+	if (arguments != NULL) {
+		return (send_error(fd, message, "bad send packet\n"));
+	}
+	for (i = 0; i < clin; i++)
+		queued += clis[i]->olen;
+	stats_add(lines, sizeof(lines), &len, &n, "clients", clin);
+	stats_add(lines, sizeof(lines), &len, &n, "ring_readers", ring_readers);
+	stats_add(lines, sizeof(lines), &len, &n, "inputs", inputn + 1);
+	stats_add(lines, sizeof(lines), &len, &n, "client_bytes_queued", queued);
+	stats_add(lines, sizeof(lines), &len, &n, "events_dropped", events_dropped);
+	stats_add(lines, sizeof(lines), &len, &n, "events_filtered", events_filtered);
+	stats_add(lines, sizeof(lines), &len, &n, "clients_overflowed", clients_overflowed);
+	for (job = repeat_jobs; job != NULL; job = job->next)
+		jobs++;
+	stats_add(lines, sizeof(lines), &len, &n, "repeat_jobs", jobs);
+	stats_add(lines, sizeof(lines), &len, &n, "decode_ring_overflows",
+		  __atomic_load_n(&decode_ring_overflows, __ATOMIC_RELAXED));
+	stats_add(lines, sizeof(lines), &len, &n, "remotes_decoded",
+		  __atomic_load_n(&decode_stats.decodes, __ATOMIC_RELAXED));
+	stats_add(lines, sizeof(lines), &len, &n, "remotes_pruned",
+		  __atomic_load_n(&decode_stats.pruned, __ATOMIC_RELAXED));
+	decoded = __atomic_load_n(&decode_stats.decoded, __ATOMIC_RELAXED);
+	attempts = __atomic_load_n(&decode_stats.attempts, __ATOMIC_RELAXED);
+	stats_add(lines, sizeof(lines), &len, &n, "frames_decoded", decoded);
+	stats_add(lines, sizeof(lines), &len, &n, "remote_attempts", attempts);
+	stats_add(lines, sizeof(lines), &len, &n, "remote_attempts_avg_x100",
+		  decoded > 0 ? attempts * 100 / decoded : 0);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_queue_depth", tx_depth);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_queue_depth_max", tx_depth_max);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_jobs", tx_jobs_done);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_latency_avg_us",
+		  tx_jobs_done > 0 ? tx_latency_total / tx_jobs_done : 0);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_latency_max_us", tx_latency_max);
+	stats_add(lines, sizeof(lines), &len, &n, "tx_parallel_max", tx_running_max);
+	if (len >= sizeof(lines)) {
+		return (send_error(fd, message, "stats too long\n"));
+	}
+	sprintf(buffer, "%d\n", n);
+	if (!(write_socket_len(fd, protocol_string[P_BEGIN]) &&
+	      write_socket_len(fd, message) && write_socket_len(fd, protocol_string[P_SUCCESS])
+	      && write_socket_len(fd, protocol_string[P_DATA]) && write_socket_len(fd, buffer)
+	      && write_socket_len(fd, lines) && write_socket_len(fd, protocol_string[P_END])))
+		return (0);
+	return (1);
+}
+
 
 int drv_option(int fd, char *message, char *arguments)
 {
@@ -1712,7 +4192,11 @@ int drv_option(int fd, char *message, char *arguments)
 				  "Illegal argument (protocol error): %s",
 				  arguments);
 	}
+	drv_lock();
+	hw_lock();
 	r = curr_driver->drvctl_func(DRVCTL_SET_OPTION, (void*) &option);
+	hw_unlock();
+	drv_unlock();
 	if (r != 0) {
 		logprintf(LIRC_WARNING, "Cannot set driver option");
 		return send_error(fd, message,
@@ -1735,7 +4219,9 @@ int set_inputlog(int fd, char *message, char *arguments)
 				  arguments);
 	}
 	if (strcasecmp(buff, "null") == 0) {
+		hw_lock();
 		rec_buffer_set_logfile(NULL);
+		hw_unlock();
 		return send_success(fd, message);
 	}
 	f = fopen(buff, "w");
@@ -1746,7 +4232,9 @@ int set_inputlog(int fd, char *message, char *arguments)
 				  "Cannot open input logfile: %s (errno: %d)",
 				  buff, errno);
 	}
+	hw_lock();
 	rec_buffer_set_logfile(f);
+	hw_unlock();
 	return send_success(fd, message);
 }
 
@@ -1787,6 +4275,10 @@ int get_command(int fd)
 				return (0);
 			goto skip;
 		}
+		/*
+		 * Not under hw_lock(): directives using the driver take it
+		 * themselves, so queries like LIST don't wait for decoding.
+		 */
 		for (i = 0; directives[i].name != NULL; i++) {
 			if (strcasecmp(directive, directives[i].name) == 0) {
 				if (!directives[i].function(fd, backup, strtok(NULL, "")))
@@ -1814,177 +4306,875 @@ skip:
 			} else {
 				length -= packet_length;
 			}
-			packet_length = 0;
+			packet_length = 0;
+		}
+	}
+
+	if (length == 0) {	/* EOF: connection closed by client */
+		return (0);
+	}
+	return (1);
+}
+
+void input_message(const char *message, const char *remote_name, const char *button_name, int reps, int release,
+		   const char *source, const struct event_code *ec)
+{
+	const char *release_message;
+	const char *release_remote_name;
+	const char *release_button_name;
+	struct event_code release_ec;
+
+	release_message = check_release_event(&release_remote_name, &release_button_name);
+	if (release_message) {
+		get_event_code(&release_ec, 1);
+		input_message(release_message, release_remote_name, release_button_name, 0, 1, source, &release_ec);
+	}
+	deliver_message(message, remote_name, button_name, reps, release, source, ec);
+}
+
+/* Send a decoded event to clients and uinput. */
+static void deliver_message(const char *message, const char *remote_name, const char *button_name, int reps,
+			    int release, const char *source, const struct event_code *ec)
+{
+	if (!release || userelease) {
+		broadcast_event(message, remote_name, button_name, reps, release, source, ec);
+	}
+#ifdef __linux__
+	if (uinputfd == -1 || reps >= 2) {
+		return;
+	}
+
+	linux_input_code input_code;
+
+	if (get_input_code(button_name, &input_code) != -1) {
+		struct input_event event;
+
+		memset(&event, 0, sizeof(event));
+		event.type = EV_KEY;
+		event.code = input_code;
+		event.value = release ? 0 : (reps > 0 ? 2 : 1);
+		if (write(uinputfd, &event, sizeof(event)) != sizeof(event)) {
+			logprintf(LIRC_ERROR, "writing to uinput failed");
+			logperror(LIRC_ERROR, NULL);
+		}
+
+		/* Need to write sync event */
+		memset(&event, 0, sizeof(event));
+		event.type = EV_SYN;
+		event.code = SYN_REPORT;
+		event.value = 0;
+		if (write(uinputfd, &event, sizeof(event)) != sizeof(event)) {
+			logprintf(LIRC_ERROR, "writing EV_SYN to uinput failed");
+			logperror(LIRC_ERROR, NULL);
+		}
+	}
+	else {
+		logprintf(LIRC_DEBUG,
+			  "Dropping non-standard symbol %s in uinput mode",
+			   button_name == NULL ? "Null" : button_name);
+	}
+#endif
+}
+
+
+/*
+ * Append the source to each line of an event. Returns the length, or -1
+ * if it doesn't fit.
+ */
+static int tag_event(const char *message, const char *source, char *buffer, int size)
+{
+	const char *line, *end;
+	int len = 0, n;
+
+	if (source == NULL)
+		source = "-";
+	for (line = message; *line != '\0'; line = end + 1) {
+		end = strchr(line, '\n');
+		if (end == NULL)
+			return (-1);
+		n = snprintf(buffer + len, size - len, "%.*s %s\n", (int)(end - line), line, source);
+		if (n >= size - len)
+			return (-1);
+		len += n;
+	}
+	return (len);
+}
+
+/* Tagged event text for a client, see SET_SOURCE_TAGS. */
+static int client_write_event(struct client *cli, const char *message, int len, const char *tagged, int tagged_len)
+{
+	if (cli->source_tags && tagged_len > 0)
+		return (client_write(cli, tagged, tagged_len, 1));
+	return (client_write(cli, message, len, 1));
+}
+
+/* Index of a source in the name table, 0 if none. */
+static uint32_t source_index(const char *source)
+{
+	int i;
+
+	if (source == NULL)
+		return (0);
+	if (source == driver_tag)
+		return (1);
+	for (i = 0; i < inputn; i++) {
+		if (source == inputs[i]->tag)
+			return (i + 2);
+	}
+	return (0);
+}
+
+static int remote_index_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)((const struct remote_index *)a)->remote;
+	uintptr_t y = (uintptr_t)((const struct remote_index *)b)->remote;
+
+	return (x < y ? -1 : x > y);
+}
+
+/* Index the current remotes by address, when they are swapped. */
+static void remote_index_build(void)
+{
+	struct remote_index *index;
+	struct ir_remote *remote;
+	int n = 0;
+
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		n++;
+	index = realloc(remote_index, (n > 0 ? n : 1) * sizeof(struct remote_index));
+	if (index == NULL) {
+		logprintf(LIRC_ERROR, "out of memory, events have no ids");
+		remote_index_n = 0;
+		return;
+	}
+	remote_index = index;
+	remote_index_n = n;
+	for (n = 0, remote = remotes; remote != NULL; remote = remote->next, n++) {
+		index[n].remote = remote;
+		index[n].index = n;
+	}
+	qsort(index, remote_index_n, sizeof(struct remote_index), remote_index_cmp);
+}
+
+/* The decoder's remote and code of the event just made, see get_release_code(). */
+static void get_event_code(struct event_code *ec, int release)
+{
+	struct ir_remote *remote;
+	struct ir_ncode *ncode;
+
+	get_release_code(release, &remote, &ncode, &ec->code);
+	ec->remote = remote;
+	ec->ncode = ncode;
+}
+
+/*
+ * The ids of an event's remote and button in the current config, from
+ * the remote and code it was decoded from. Events which don't map (e.g.
+ * dynamic codes) get valid = 0.
+ */
+static void event_ids(struct event_ids *ids, const struct event_code *ec)
+{
+	struct remote_index key, *found;
+
+	ids->valid = 0;
+	if (ec == NULL || ec->remote == NULL || ec->ncode == NULL)
+		return;
+	if (ec->ncode == &ec->remote->dyncodes[0] || ec->ncode == &ec->remote->dyncodes[1])
+		return;
+	key.remote = ec->remote;
+	found = bsearch(&key, remote_index, remote_index_n, sizeof(key), remote_index_cmp);
+	if (found == NULL)
+		return;
+	ids->valid = 1;
+	ids->remote = found->index;
+	ids->button = ec->ncode - ec->remote->codes;
+}
+
+/* Fill in the binary record of an event with valid ids, from what it was decoded from. */
+static void event_record(struct lirc_event_record *rec, const struct event_ids *ids, const struct event_code *ec,
+			 int reps, int release, const char *source)
+{
+	struct timespec now;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->header.mark = LIRC_FRAME_MARK;
+	rec->header.type = LIRC_FRAME_EVENT;
+	rec->header.length = sizeof(*rec);
+	rec->code = ec->code;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rec->timestamp = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	rec->reps = reps;
+	rec->remote = ids->remote;
+	rec->button = ids->button;
+	rec->source = source_index(source);
+	rec->flags = release ? LIRC_EVENT_RELEASE : 0;
+	rec->generation = names_generation;
+}
+
+/*
+ * Send an event to all clients. The binary record is only made if some
+ * client asked for it.
+ */
+static void broadcast_event(const char *message, const char *remote_name, const char *button_name, int reps,
+			    int release, const char *source, const struct event_code *ec)
+{
+	char tagged[2 * PACKET_SIZE + 1];
+	struct lirc_event_record rec;
+	struct event_ids ids;
+	int len, tagged_len, i, have_ids = 0, have_rec = 0;
+
+	len = strlen(message);
+	if (ring_readers > 0)
+		event_ring_put(message, len);
+	tagged_len = tag_event(message, source, tagged, sizeof(tagged));
+	for (i = 0; i < clin; i++) {
+		if (clis[i]->ring_reader)
+			continue;
+		if (!have_ids && (clis[i]->subscriptions != NULL || clis[i]->binary_events)) {
+			event_ids(&ids, ec);
+			have_ids = 1;
+		}
+		if (!subscribed(clis[i], &ids, remote_name, button_name)) {
+			events_filtered++;
+			continue;
+		}
+		LOGPRINTF(1, "writing to client %d: %s", i, message);
+		if (clis[i]->binary_events && ids.valid && !have_rec) {
+			event_record(&rec, &ids, ec, reps, release, source);
+			have_rec = 1;
+		}
+		if (clis[i]->binary_events && ids.valid) {
+			if (!client_write(clis[i], (const char *)&rec, sizeof(rec), 1)) {
+				remove_client(clis[i]->fd);
+				i--;
+			}
+			continue;
+		}
+		if (!client_write_event(clis[i], message, len, tagged, tagged_len)) {
+			remove_client(clis[i]->fd);
+			i--;
+		}
+	}
+}
+
+void broadcast_message(const char *message)
+{
+	int len, i;
+
+	len = strlen(message);
+
+	for (i = 0; i < clin; i++) {
+		LOGPRINTF(1, "writing to client %d: %s", i, message);
+		if (!client_write(clis[i], message, len, 1)) {
+			remove_client(clis[i]->fd);
+			i--;
+		}
+	}
+}
+
+
+/* Check (and remember) a button press against --dedup-delay. */
+static int is_duplicate(const char *button_name)
+{
+	static char prev_button_name[PACKET_SIZE + 1];
+	static struct timeval ptime;
+	struct timeval ctime, gap;
+
+	if (strcmp(button_name, prev_button_name) == 0) {
+		gettimeofday(&ctime, NULL);
+		timersub(&ctime, &ptime, &gap);
+		if (gap.tv_usec <= dedup_delay)
+			return 1;
+	}
+	gettimeofday(&ptime, NULL);
+	snprintf(prev_button_name, sizeof(prev_button_name), "%s", button_name);
+	return 0;
+}
+
+/*
+ * Optional decode thread (--decode-thread). The thread owns reading
+ * from the driver, decode_all() and release event generation; decoded
+ * events are handed to the main thread through a single-producer,
+ * single-consumer ring and a wakeup pipe. Everything else touching the
+ * driver or the remotes - transmitting, driver options, config swaps -
+ * runs on the main thread under hw_mutex, which the decode thread holds
+ * while decoding. Thus decoding is never seen half-way by a config swap
+ * and the old remotes aren't used by the thread once they're replaced.
+ */
+
+static void decode_ring_push(const char *message, const char *remote_name, const char *button_name, int reps,
+			     int release, const struct event_code *ec)
+{
+	struct decoded_event *ev;
+	unsigned int head, tail;
+	char c = 0;
+
+	head = __atomic_load_n(&decode_ring_head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&decode_ring_tail, __ATOMIC_ACQUIRE);
+	if (head - tail == DECODE_RING_SIZE) {
+		__atomic_add_fetch(&decode_ring_overflows, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ev = &decode_ring[head % DECODE_RING_SIZE];
+	snprintf(ev->message, sizeof(ev->message), "%s", message);
+	snprintf(ev->remote_name, sizeof(ev->remote_name), "%s", remote_name);
+	snprintf(ev->button_name, sizeof(ev->button_name), "%s", button_name);
+	ev->reps = reps;
+	ev->release = release;
+	ev->ec = *ec;
+	__atomic_store_n(&decode_ring_head, head + 1, __ATOMIC_RELEASE);
+	if (write(decode_pipe[1], &c, 1) == -1 && errno != EAGAIN)
+		logperror(LIRC_WARNING, "decode thread wakeup");
+}
+
+/* Deliver events queued by the decode thread, main thread only. */
+static void decode_ring_drain(void)
+{
+	struct decoded_event *ev;
+	unsigned int head, tail;
+	char buf[64];
+
+	while (read(decode_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	tail = __atomic_load_n(&decode_ring_tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&decode_ring_head, __ATOMIC_ACQUIRE);
+	for (; tail != head; tail++) {
+		ev = &decode_ring[tail % DECODE_RING_SIZE];
+		if (ev->release)
+			deliver_message(ev->message, ev->remote_name, ev->button_name, 0, 1, driver_tag, &ev->ec);
+		else if (!is_duplicate(ev->button_name))
+			deliver_message(ev->message, ev->remote_name, ev->button_name, ev->reps, 0, driver_tag,
+					&ev->ec);
+		__atomic_store_n(&decode_ring_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Drop the remotes of the events not yet delivered, which the old config
+ * may be freed with. On the main thread under hw_lock(), the decode
+ * thread doesn't add events meanwhile.
+ */
+static void decode_ring_forget(void)
+{
+	unsigned int head, tail;
+
+	tail = __atomic_load_n(&decode_ring_tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&decode_ring_head, __ATOMIC_ACQUIRE);
+	for (; tail != head; tail++)
+		decode_ring[tail % DECODE_RING_SIZE].ec.remote = NULL;
+}
+
+static void decode_release_event(int trigger)
+{
+	const char *message;
+	const char *remote_name;
+	const char *button_name;
+	struct event_code ec;
+
+	if (trigger)
+		message = trigger_release_event(&remote_name, &button_name);
+	else
+		message = check_release_event(&remote_name, &button_name);
+	if (message != NULL) {
+		get_event_code(&ec, 1);
+		decode_ring_push(message, remote_name, button_name, 0, 1, &ec);
+	}
+}
+
+static void *decode_thread_main(void *arg)
+{
+	struct pollfd pfd;
+	struct timeval now, release_time;
+	loglevel_t oldlevel;
+	char *message;
+	int ret, timeout;
+
+	while (1) {
+		/* drv is only stable under the lock, see input_swap() */
+		hw_lock();
+		pfd.fd = curr_driver->fd;
+		get_release_time(&release_time);
+		hw_unlock();
+		if (pfd.fd == 0 || pfd.fd == -1) {
+			/* try to reconnect */
+			poll(NULL, 0, 1000);
+			drv_lock();
+			hw_lock();
+			oldlevel = loglevel;
+			lirc_log_setlevel(LIRC_ERROR);
+			if (hw_init())
+				setup_hardware();
+			lirc_log_setlevel(oldlevel);
+			hw_unlock();
+			drv_unlock();
+			continue;
+		}
+		timeout = -1;
+		if (timerisset(&release_time)) {
+			gettimeofday(&now, NULL);
+			timeout = 0;
+			if (timercmp(&release_time, &now, >)) {
+				timersub(&release_time, &now, &now);
+				timeout = now.tv_sec * 1000 + (now.tv_usec + 999) / 1000;
+			}
+		}
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, timeout);
+		if (ret == -1 && errno != EINTR) {
+			hw_lock();
+			logperror(LIRC_ERROR, "decode thread: poll()");
+			hw_unlock();
+			poll(NULL, 0, 100);
+			continue;
+		}
+
+		hw_lock();
+		/* samples read ahead by the driver don't show up in poll() */
+		while ((ret > 0 && pfd.fd == curr_driver->fd) || rec_buffer_batched() > 0) {
+			ret = 0;
+			register_input();
+			message = curr_driver->rec_func(__atomic_load_n(&remotes, __ATOMIC_ACQUIRE));
+			if (message != NULL) {
+				const char *remote_name;
+				const char *button_name;
+				struct event_code ec;
+				int reps;
+
+				if (curr_driver->drvctl_func && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE))
+					curr_driver->drvctl_func(LIRC_NOTIFY_DECODE, NULL);
+				get_release_data(&remote_name, &button_name, &reps);
+				get_event_code(&ec, 0);
+				decode_release_event(0);
+				decode_ring_push(message, remote_name, button_name, reps, 0, &ec);
+			}
 		}
+		get_release_time(&release_time);
+		gettimeofday(&now, NULL);
+		if (timerisset(&release_time) && !timercmp(&now, &release_time, <))
+			decode_release_event(1);
+		hw_unlock();
 	}
+	return NULL;
+}
 
-	if (length == 0) {	/* EOF: connection closed by client */
-		return (0);
+static int start_decode_thread(void)
+{
+	if (curr_driver->rec_func == NULL) {
+		logprintf(LIRC_WARNING, "driver %s can't receive, no decode thread started", curr_driver->name);
+		return 1;
 	}
-	return (1);
+	if (!wakeup_pipe(decode_pipe, &decode_watch, WATCH_DECODER))
+		return 0;
+	hw_lock_init();
+
+	/* the hardware is kept open while the thread runs */
+	decode_thread_running = 1;
+	drv_lock();
+	hw_lock();
+	if (hw_init())
+		setup_hardware();
+	else
+		logprintf(LIRC_WARNING, "Failed to initialize hardware");
+	hw_unlock();
+	drv_unlock();
+	return spawn_thread(&decode_thread, decode_thread_main, "decode");
 }
 
-void free_old_remotes()
-{
-	struct ir_remote *scan_remotes, *found;
-	struct ir_ncode *code;
-	const char *release_event;
-	const char *release_remote_name;
-	const char *release_button_name;
+/*
+ * Additional inputs (--input). Each is a driver instance with its own
+ * receive buffer and decode state, decoding against the same remotes as
+ * the driver selected by --driver. The lirc library works on the global
+ * drv, receive buffer, release events and the state decoding keeps in
+ * the remotes, so reading an input swaps its state into them and back
+ * again under hw_lock(). Inputs are kept open all the time, and only
+ * receive; transmissions use the --driver one.
+ */
 
-	if (decoding == free_remotes)
-		return;
+/* Event source tag for a device, one word in the event line. */
+static char *make_tag(const char *device)
+{
+	char *tag, *s;
 
-	release_event = release_map_remotes(free_remotes, remotes, &release_remote_name, &release_button_name);
-	if (release_event != NULL) {
-		input_message(release_event, release_remote_name, release_button_name, 0, 1);
-	}
-	if (last_remote != NULL) {
-		if (is_in_remotes(free_remotes, last_remote)) {
-			logprintf(LIRC_INFO, "last_remote found");
-			found = get_ir_remote(remotes, last_remote->name);
-			if (found != NULL) {
-				code = get_code_by_name(found, last_remote->last_code->name);
-				if (code != NULL) {
-					found->reps = last_remote->reps;
-					found->toggle_bit_mask_state = last_remote->toggle_bit_mask_state;
-					found->min_remaining_gap = last_remote->min_remaining_gap;
-					found->max_remaining_gap = last_remote->max_remaining_gap;
-					found->last_send = last_remote->last_send;
-					last_remote = found;
-					last_remote->last_code = code;
-					logprintf(LIRC_INFO, "mapped last_remote");
-				}
-			}
-		} else {
-			last_remote = NULL;
-		}
+	tag = strdup(device);
+	if (tag == NULL) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		return NULL;
 	}
-	/* check if last config is still needed */
-	found = NULL;
-	if (repeat_remote != NULL) {
-		scan_remotes = free_remotes;
-		while (scan_remotes != NULL) {
-			if (repeat_remote == scan_remotes) {
-				found = repeat_remote;
-				break;
-			}
-			scan_remotes = scan_remotes->next;
-		}
-		if (found != NULL) {
-			found = get_ir_remote(remotes, repeat_remote->name);
-			if (found != NULL) {
-				code = get_code_by_name(found, repeat_code->name);
-				if (code != NULL) {
-					struct itimerval repeat_timer;
-
-					repeat_timer.it_value.tv_sec = 0;
-					repeat_timer.it_value.tv_usec = 0;
-					repeat_timer.it_interval.tv_sec = 0;
-					repeat_timer.it_interval.tv_usec = 0;
-
-					found->last_code = code;
-					found->last_send = repeat_remote->last_send;
-					found->toggle_bit_mask_state = repeat_remote->toggle_bit_mask_state;
-					found->min_remaining_gap = repeat_remote->min_remaining_gap;
-					found->max_remaining_gap = repeat_remote->max_remaining_gap;
-
-					setitimer(ITIMER_REAL, &repeat_timer, &repeat_timer);
-					/* "atomic" (shouldn't be necessary any more) */
-					repeat_remote = found;
-					repeat_code = code;
-					/* end "atomic" */
-					setitimer(ITIMER_REAL, &repeat_timer, NULL);
-					found = NULL;
-				}
-			} else {
-				found = repeat_remote;
-			}
-		}
+	for (s = tag; *s != '\0'; s++) {
+		if (isspace(*s))
+			*s = '_';
 	}
-	if (found == NULL && decoding != free_remotes) {
-		free_config(free_remotes);
-		free_remotes = NULL;
+	return tag;
+}
+
+static void remote_state_get(const struct ir_remote *remote, struct remote_state *state)
+{
+	state->toggle_bit_mask_state = remote->toggle_bit_mask_state;
+	state->toggle_mask_state = remote->toggle_mask_state;
+	state->last_code = remote->last_code;
+	state->toggle_code = remote->toggle_code;
+	state->reps = remote->reps;
+	state->last_send = remote->last_send;
+	state->min_remaining_gap = remote->min_remaining_gap;
+	state->max_remaining_gap = remote->max_remaining_gap;
+	state->release_detected = remote->release_detected;
+	state->dyncode = remote->dyncode;
+	state->dyncodes[0] = remote->dyncodes[0].code;
+	state->dyncodes[1] = remote->dyncodes[1].code;
+}
+
+static void remote_state_set(struct ir_remote *remote, const struct remote_state *state)
+{
+	remote->toggle_bit_mask_state = state->toggle_bit_mask_state;
+	remote->toggle_mask_state = state->toggle_mask_state;
+	remote->last_code = state->last_code;
+	remote->toggle_code = state->toggle_code;
+	remote->reps = state->reps;
+	remote->last_send = state->last_send;
+	remote->min_remaining_gap = state->min_remaining_gap;
+	remote->max_remaining_gap = state->max_remaining_gap;
+	remote->release_detected = state->release_detected;
+	remote->dyncode = state->dyncode;
+	remote->dyncodes[0].code = state->dyncodes[0];
+	remote->dyncodes[1].code = state->dyncodes[1];
+}
+
+/*
+ * Give an input the state of the current remotes, carrying over what it
+ * had for the old ones as copy_remote_state() does. Remotes new to the
+ * input start as they were read. Called with the old state swapped out.
+ */
+static int input_map_remotes(struct input *in, const struct ir_remote *old)
+{
+	struct remote_state *states;
+	struct ir_remote *remote;
+	const struct ir_remote *scan;
+	int i, j, n = 0;
+
+	for (remote = remotes; remote != NULL; remote = remote->next)
+		n++;
+	states = calloc(n > 0 ? n : 1, sizeof(struct remote_state));
+	if (states == NULL)
+		return 0;
+	for (i = 0, remote = remotes; remote != NULL; i++, remote = remote->next) {
+		remote_state_get(remote, &states[i]);
+		for (j = 0, scan = old; scan != NULL && j < in->n_states; j++, scan = scan->next)
+			if (strcmp(scan->name, remote->name) == 0)
+				break;
+		if (scan == NULL || j == in->n_states)
+			continue;
+		states[i] = in->states[j];
+		if (states[i].last_code != NULL)
+			states[i].last_code = get_code_by_name(remote, states[i].last_code->name);
+		if (states[i].toggle_code != NULL)
+			states[i].toggle_code = get_code_by_name(remote, states[i].toggle_code->name);
+	}
+	free(in->states);
+	in->states = states;
+	in->n_states = n;
+	return 1;
+}
+
+/*
+ * Exchange the state of an input with the current global one: drv, the
+ * receive buffer, the release events and what decoding keeps in the
+ * remotes. Under hw_lock(), see send_lock().
+ */
+static void input_swap(struct input *in)
+{
+	struct driver tmp;
+	struct remote_state state;
+	struct ir_remote *remote;
+	int i;
+
+	memcpy(&tmp, &drv, sizeof(struct driver));
+	memcpy(&drv, &in->drv, sizeof(struct driver));
+	memcpy(&in->drv, &tmp, sizeof(struct driver));
+	rec_buffer_swap(in->rec_buffer);
+	release_state_swap(in->release);
+	for (i = 0, remote = remotes; remote != NULL && i < in->n_states; i++, remote = remote->next) {
+		remote_state_get(remote, &state);
+		remote_state_set(remote, &in->states[i]);
+		in->states[i] = state;
+	}
+	remote = last_remote;
+	last_remote = in->last_remote;
+	in->last_remote = remote;
+	remote = last_decoded;
+	last_decoded = in->last_decoded;
+	in->last_decoded = remote;
+}
+
+static int input_is_open(const struct input *in)
+{
+	return (in->drv.fd != 0 && in->drv.fd != -1);
+}
+
+/* Keep the input's fd registered in the event loop, see update_driver_watch(). */
+static void input_update_watch(struct input *in)
+{
+	int fd = input_is_open(in) ? in->drv.fd : -1;
+
+	if (in->watch.fd != -1 && in->watch.fd != fd && loop_fd_watched(in->watch.fd, &in->watch))
+		loop_forget(&in->watch);
+	if (fd != -1 && fd == in->watch.fd && !loop_registered(&in->watch))
+		loop_forget(&in->watch);
+	if (fd == in->watch.fd)
+		return;
+	loop_del(&in->watch);
+	if (fd != -1)
+		loop_add(&in->watch, fd, WATCH_INPUT, in, LOOP_IN);
+}
+
+static void input_init(struct input *in)
+{
+	int ret;
+
+	drv_lock();
+	hw_lock();
+	loop_del(&in->watch);
+	input_swap(in);
+	ret = curr_driver->init_func == NULL || curr_driver->init_func();
+	if (ret)
+		setup_hardware();
+	input_swap(in);
+	hw_unlock();
+	drv_unlock();
+	if (ret) {
+		logprintf(LIRC_INFO, "opened input %s", in->tag);
 	} else {
-		LOGPRINTF(1, "free_remotes still in use");
+		logprintf(LIRC_WARNING, "cannot open input %s", in->tag);
+		/* retried by the event loop */
+		gettimeofday(&in->reconnect, NULL);
+		in->reconnect.tv_sec += 1;
 	}
+	input_update_watch(in);
 }
 
-void input_message(const char *message, const char *remote_name, const char *button_name, int reps, int release)
+/* Read and decode what an input has to offer. */
+static void input_read(struct input *in)
 {
+	char *message;
+	const char *remote_name;
+	const char *button_name;
 	const char *release_message;
 	const char *release_remote_name;
 	const char *release_button_name;
+	struct event_code ec, release_ec;
+	int reps;
+	int batched;
 
-	release_message = check_release_event(&release_remote_name, &release_button_name);
-	if (release_message) {
-		input_message(release_message, release_remote_name, release_button_name, 0, 1);
-	}
+	/* sends wait meanwhile, drv holds the input's driver */
+	hw_lock();
+	do {
+		input_swap(in);
+		register_input();
+		message = curr_driver->rec_func(remotes);
+		release_message = NULL;
+		if (message != NULL) {
+			if (curr_driver->drvctl_func && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE))
+				curr_driver->drvctl_func(LIRC_NOTIFY_DECODE, NULL);
+			get_release_data(&remote_name, &button_name, &reps);
+			get_event_code(&ec, 0);
+			release_message = check_release_event(&release_remote_name, &release_button_name);
+			if (release_message != NULL)
+				get_event_code(&release_ec, 1);
+		}
+		batched = rec_buffer_batched();
+		/* delivering may close the hardware, that of --driver */
+		input_swap(in);
+		if (release_message != NULL)
+			deliver_message(release_message, release_remote_name, release_button_name, 0, 1, in->tag,
+					&release_ec);
+		if (message != NULL && !is_duplicate(button_name))
+			deliver_message(message, remote_name, button_name, reps, 0, in->tag, &ec);
+	} while (batched > 0);
+	hw_unlock();
+	if (!input_is_open(in)) {
+		logprintf(LIRC_WARNING, "lost input %s", in->tag);
+		gettimeofday(&in->reconnect, NULL);
+	}
+	input_update_watch(in);
+}
 
-	if (!release || userelease) {
-		broadcast_message(message);
-	}
-#ifdef __linux__
-	if (uinputfd == -1 || reps >= 2) {
-		return;
-	}
+/* Reopen inputs which are due, and get the nearest retry time. */
+static void inputs_reconnect(struct timeval *tv)
+{
+	struct timeval now;
+	int i;
 
-	linux_input_code input_code;
+	timerclear(tv);
+	gettimeofday(&now, NULL);
+	for (i = 0; i < inputn; i++) {
+		if (input_is_open(inputs[i]))
+			continue;
+		/* some timercmp() definitions don't work with <= */
+		if (!timercmp(&now, &inputs[i]->reconnect, <)) {
+			loglevel_t oldlevel = loglevel;
 
-	if (get_input_code(button_name, &input_code) != -1) {
-		struct input_event event;
+			lirc_log_setlevel(LIRC_ERROR);
+			input_init(inputs[i]);
+			lirc_log_setlevel(oldlevel);
+			if (input_is_open(inputs[i]))
+				continue;
+		}
+		if (!timerisset(tv) || timercmp(tv, &inputs[i]->reconnect, >))
+			*tv = inputs[i]->reconnect;
+	}
+}
 
-		memset(&event, 0, sizeof(event));
-		event.type = EV_KEY;
-		event.code = input_code;
-		event.value = release ? 0 : (reps > 0 ? 2 : 1);
-		if (write(uinputfd, &event, sizeof(event)) != sizeof(event)) {
-			logprintf(LIRC_ERROR, "writing to uinput failed");
-			logperror(LIRC_ERROR, NULL);
+/* Send the release events of inputs which are due, and get the nearest one. */
+static void inputs_release(struct timeval *tv)
+{
+	const char *message;
+	const char *remote_name;
+	const char *button_name;
+	struct event_code ec;
+	struct timeval now, release_time;
+	int i;
+
+	timerclear(tv);
+	gettimeofday(&now, NULL);
+	for (i = 0; i < inputn; i++) {
+		message = NULL;
+		hw_lock();
+		release_state_swap(inputs[i]->release);
+		get_release_time(&release_time);
+		release_state_swap(inputs[i]->release);
+		/* some timercmp() definitions don't work with >= */
+		if (timerisset(&release_time) && !timercmp(&now, &release_time, <)) {
+			input_swap(inputs[i]);
+			message = trigger_release_event(&remote_name, &button_name);
+			if (message != NULL)
+				get_event_code(&ec, 1);
+			input_swap(inputs[i]);
+			timerclear(&release_time);
 		}
+		hw_unlock();
+		if (message != NULL)
+			deliver_message(message, remote_name, button_name, 0, 1, inputs[i]->tag, &ec);
+		if (timerisset(&release_time) && (!timerisset(tv) || timercmp(tv, &release_time, >)))
+			*tv = release_time;
+	}
+}
 
-		/* Need to write sync event */
-		memset(&event, 0, sizeof(event));
-		event.type = EV_SYN;
-		event.code = SYN_REPORT;
-		event.value = 0;
-		if (write(uinputfd, &event, sizeof(event)) != sizeof(event)) {
-			logprintf(LIRC_ERROR, "writing EV_SYN to uinput failed");
-			logperror(LIRC_ERROR, NULL);
+/* Create an input from a driver[@device] spec, before daemonizing. */
+static int add_input(const char *spec)
+{
+	struct input *in, **p;
+	char *name, *device;
+	int i;
+
+	name = strdup(spec);
+	p = realloc(inputs, (inputn + 1) * sizeof(struct input *));
+	in = malloc(sizeof(struct input));
+	if (name == NULL || p == NULL || in == NULL) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		return 0;
+	}
+	inputs = p;
+	memset(in, 0, sizeof(struct input));
+	in->watch.fd = -1;
+	device = strchr(name, '@');
+	if (device != NULL)
+		*device++ = '\0';
+	if (hw_load_driver(name, &in->drv) != 0) {
+		fprintf(stderr, "%s: input driver `%s' not found\n", progname, name);
+		return 0;
+	}
+	if (in->drv.rec_func == NULL) {
+		fprintf(stderr, "%s: input driver `%s' can't receive\n", progname, name);
+		return 0;
+	}
+	for (i = 0; i <= inputn; i++) {
+		if (strcmp(i < inputn ? inputs[i]->drv.name : curr_driver->name, in->drv.name) == 0) {
+			logprintf(LIRC_WARNING, "driver %s used more than once, this only works if it keeps no private state",
+				  in->drv.name);
+			break;
 		}
 	}
-	else {
-		logprintf(LIRC_DEBUG,
-			  "Dropping non-standard symbol %s in uinput mode",
-			   button_name == NULL ? "Null" : button_name);
+	in->rec_buffer = rec_buffer_alloc();
+	in->release = release_state_alloc();
+	if (in->rec_buffer == NULL || in->release == NULL) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		return 0;
 	}
-#endif
+	if (device != NULL && *device != '\0') {
+		input_swap(in);
+		curr_driver->open_func(device);
+		input_swap(in);
+	}
+	/* open_func() may keep the device in a static buffer */
+	if (in->drv.device != NULL)
+		in->drv.device = strdup(in->drv.device);
+	in->tag = make_tag(in->drv.device != NULL ? in->drv.device : in->drv.name);
+	if (in->tag == NULL)
+		return 0;
+	free(name);
+	inputs[inputn++] = in;
+	return 1;
 }
 
-
-void broadcast_message(const char *message)
+int parse_inputs(const char *opt)
 {
-	int len, i;
+	char buff[256];
+	char* spec;
+	char* device;
 
-	len = strlen(message);
+	if (opt == NULL)
+		return 1;
+	/* add_input() may call open_func(), which may reuse drv's buffer */
+	if (curr_driver->device != NULL) {
+		device = strdup(curr_driver->device);
+		if (device == NULL)
+			return 0;
+		drv.device = device;
+	}
+	strncpy(buff, opt, sizeof(buff) - 1);
+	buff[sizeof(buff) - 1] = '\0';
+	for (spec = strtok(buff, ","); spec; spec = strtok(NULL, ",")) {
+		if (!add_input(spec))
+			return 0;
+	}
+	return 1;
+}
 
-	for (i = 0; i < clin; i++) {
-		LOGPRINTF(1, "writing to client %d: %s", i, message);
-		if (write_socket(clis[i], message, len) < len) {
-			remove_client(clis[i]);
-			i--;
-		}
+static void inputs_setup(void)
+{
+	int i;
+
+	for (i = 0; i < inputn; i++) {
+		if (!input_is_open(inputs[i]))
+			continue;
+		input_swap(inputs[i]);
+		setup_hardware();
+		input_swap(inputs[i]);
 	}
 }
 
+static void inputs_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < inputn; i++) {
+		if (!input_is_open(inputs[i]))
+			continue;
+		input_swap(inputs[i]);
+		if (curr_driver->deinit_func)
+			curr_driver->deinit_func();
+		input_swap(inputs[i]);
+	}
+}
 
 static int mywaitfordata(long maxusec)
 {
-	fd_set fds;
-	int maxfd, i, ret, reconnect;
-	struct timeval tv, start, now, timeout, release_time;
+	struct loop_event events[LOOP_MAX_EVENTS];
+	int i, n, ret, reconnect, driver_ready;
+	struct timeval deadline, start, now, timeout, release_time, repeat_time, input_time;
 	loglevel_t oldlevel;
 
+	gettimeofday(&start, NULL);
 	while (1) {
 		do {
 			/* handle signals */
@@ -1996,126 +5186,92 @@ static int mywaitfordata(long maxusec)
 				dosighup(SIGHUP);
 				hup = 0;
 			}
-			if (alrm) {
-				dosigalrm(SIGALRM);
-				alrm = 0;
-			}
-			FD_ZERO(&fds);
-			FD_SET(sockfd, &fds);
-
-			maxfd = sockfd;
-			if (listen_tcpip) {
-				FD_SET(sockinet, &fds);
-				maxfd = max(maxfd, sockinet);
-			}
-
-			if (use_hw() && curr_driver->rec_mode != 0 && curr_driver->fd != 0) {
-				FD_SET(curr_driver->fd, &fds);
-				maxfd = max(maxfd, curr_driver->fd);
-			}
+			if (repeat_jobs != NULL)
+				run_repeat_jobs();
+			update_driver_watch();
 
-			for (i = 0; i < clin; i++) {
-				/* Ignore this client until codes have been
-				   sent and it will get an answer. Otherwise
-				   we could mix up answer packets and send
-				   them back in the wrong order. */
-				if (clis[i] != repeat_fd) {
-					FD_SET(clis[i], &fds);
-					maxfd = max(maxfd, clis[i]);
-				}
-			}
-			timerclear(&tv);
+			/* find the nearest deadline, absolute time */
+			timerclear(&deadline);
 			reconnect = 0;
 			for (i = 0; i < peern; i++) {
-				if (peers[i]->socket != -1) {
-					FD_SET(peers[i]->socket, &fds);
-					maxfd = max(maxfd, peers[i]->socket);
-				} else if (timerisset(&tv)) {
-					if (timercmp(&tv, &peers[i]->reconnect, >)) {
-						tv = peers[i]->reconnect;
-					}
-				} else {
-					tv = peers[i]->reconnect;
-				}
-			}
-			if (timerisset(&tv)) {
-				gettimeofday(&now, NULL);
-				if (timercmp(&now, &tv, >)) {
-					timerclear(&tv);
-				} else {
-					timersub(&tv, &now, &start);
-					tv = start;
-				}
+				if (peers[i]->socket != -1)
+					continue;
+				if (!timerisset(&deadline) || timercmp(&deadline, &peers[i]->reconnect, >))
+					deadline = peers[i]->reconnect;
 				reconnect = 1;
 			}
-			gettimeofday(&start, NULL);
 			if (maxusec > 0) {
-				tv.tv_sec = maxusec / 1000000;
-				tv.tv_usec = maxusec % 1000000;
+				timeout.tv_sec = maxusec / 1000000;
+				timeout.tv_usec = maxusec % 1000000;
+				timeradd(&start, &timeout, &timeout);
+				if (!timerisset(&deadline) || timercmp(&deadline, &timeout, >))
+					deadline = timeout;
 			}
-			if (curr_driver->fd == 0 && use_hw()) {
+			if (curr_driver->fd == 0 && use_hw() && !decode_thread_running) {
 				/* try to reconnect */
-				timerclear(&timeout);
-				timeout.tv_sec = 1;
-
-				if (timercmp(&tv, &timeout, >) || (!reconnect && !timerisset(&tv))) {
-					tv = timeout;
-				}
+				gettimeofday(&now, NULL);
+				timeout.tv_sec = now.tv_sec + 1;
+				timeout.tv_usec = now.tv_usec;
+				if (!timerisset(&deadline) || timercmp(&deadline, &timeout, >))
+					deadline = timeout;
 			}
-			get_release_time(&release_time);
+			timerclear(&release_time);
+			if (!decode_thread_running)
+				get_release_time(&release_time);
 			if (timerisset(&release_time)) {
-				gettimeofday(&now, NULL);
-				if (timercmp(&now, &release_time, >)) {
-					timerclear(&tv);
-				} else {
-					struct timeval gap;
-
-					timersub(&release_time, &now, &gap);
-					if (!(timerisset(&tv) || reconnect) || timercmp(&tv, &gap, >)) {
-						tv = gap;
-					}
-				}
+				if (!timerisset(&deadline) || timercmp(&deadline, &release_time, >))
+					deadline = release_time;
+			}
+			get_repeat_time(&repeat_time);
+			if (timerisset(&repeat_time)) {
+				if (!timerisset(&deadline) || timercmp(&deadline, &repeat_time, >))
+					deadline = repeat_time;
+			}
+			inputs_reconnect(&input_time);
+			if (timerisset(&input_time)) {
+				if (!timerisset(&deadline) || timercmp(&deadline, &input_time, >))
+					deadline = input_time;
+			}
+			inputs_release(&input_time);
+			if (timerisset(&input_time)) {
+				if (!timerisset(&deadline) || timercmp(&deadline, &input_time, >))
+					deadline = input_time;
 			}
 #ifdef SIM_REC
-			ret = select(maxfd + 1, &fds, NULL, NULL, NULL);
+			ret = loop_wait(events, LOOP_MAX_EVENTS, NULL);
 #else
-			if (timerisset(&tv) || timerisset(&release_time) || reconnect) {
-				ret = select(maxfd + 1, &fds, NULL, NULL, &tv);
-			} else {
-				ret = select(maxfd + 1, &fds, NULL, NULL, NULL);
-			}
+			ret = loop_wait(events, LOOP_MAX_EVENTS, timerisset(&deadline) ? &deadline : NULL);
 #endif
 			if (ret == -1 && errno != EINTR) {
-				logprintf(LIRC_ERROR, "select() failed");
+				logprintf(LIRC_ERROR, "event loop failed");
 				logperror(LIRC_ERROR, NULL);
 				raise(SIGTERM);
 				continue;
 			}
 			gettimeofday(&now, NULL);
-			if (timerisset(&release_time) && timercmp(&now, &release_time - 30000, >)) {
+			/* some timercmp() definitions don't work with >= */
+			if (timerisset(&release_time) && !timercmp(&now, &release_time, <)) {
 				const char *release_message;
 				const char *release_remote_name;
 				const char *release_button_name;
+				struct event_code ec;
 
 				release_message = trigger_release_event(&release_remote_name, &release_button_name);
 
 				if (release_message) {
-					input_message(release_message, release_remote_name, release_button_name, 0, 1);
+					get_event_code(&ec, 1);
+					input_message(release_message, release_remote_name, release_button_name, 0, 1,
+						      driver_tag, &ec);
 				}
 			}
-			if (free_remotes != NULL) {
-				free_old_remotes();
-			}
+			config_reclaim();
 			if (maxusec > 0) {
 				if (ret == 0) {
 					return (0);
 				}
 				if (time_elapsed(&start, &now) >= maxusec) {
 					return (0);
-				} else {
-					maxusec -= time_elapsed(&start, &now);
 				}
-
 			}
 			if (reconnect) {
 				connect_to_peers();
@@ -2123,44 +5279,75 @@ static int mywaitfordata(long maxusec)
 		}
 		while (ret == -1 && errno == EINTR);
 
-		if (curr_driver->fd == 0 && use_hw() && curr_driver->init_func) {
+		if (curr_driver->fd == 0 && use_hw() && !decode_thread_running && curr_driver->init_func) {
 			oldlevel = loglevel;
 			lirc_log_setlevel(LIRC_ERROR);
-			curr_driver->init_func();
+			drv_lock();
+			hw_lock();
+			hw_init();
 			setup_hardware();
+			hw_unlock();
+			drv_unlock();
 			lirc_log_setlevel(oldlevel);
 		}
-		for (i = 0; i < clin; i++) {
-			if (FD_ISSET(clis[i], &fds)) {
-				FD_CLR(clis[i], &fds);
-				if (get_command(clis[i]) == 0) {
-					remove_client(clis[i]);
-					i--;
+		driver_ready = 0;
+		for (n = 0; n < ret; n++) {
+			struct watch *w = events[n].watch;
+			struct peer_connection *peer;
+
+			if (w->fd == -1)
+				continue;	/* removed by a previous event */
+			switch (w->type) {
+			case WATCH_CLIENT:
+				if (events[n].events & LOOP_OUT && !client_flush(w->data)) {
+					remove_client(w->fd);
+					break;
 				}
-			}
-		}
-		for (i = 0; i < peern; i++) {
-			if (peers[i]->socket != -1 && FD_ISSET(peers[i]->socket, &fds)) {
-				if (get_peer_message(peers[i]) == 0) {
-					shutdown(peers[i]->socket, 2);
-					close(peers[i]->socket);
-					peers[i]->socket = -1;
-					peers[i]->connection_failure = 1;
-					gettimeofday(&peers[i]->reconnect, NULL);
-					peers[i]->reconnect.tv_sec += 5;
+				if (events[n].events & LOOP_IN && get_command(w->fd) == 0)
+					remove_client(w->fd);
+				break;
+			case WATCH_PEER:
+				peer = w->data;
+				if (get_peer_message(peer) == 0) {
+					loop_del(&peer->watch);
+					shutdown(peer->socket, 2);
+					close(peer->socket);
+					peer->socket = -1;
+					peer->connection_failure = 1;
+					gettimeofday(&peer->reconnect, NULL);
+					peer->reconnect.tv_sec += 5;
 				}
+				break;
+			case WATCH_LISTEN:
+				if (w == &sockfd_watch) {
+					LOGPRINTF(1, "registering local client");
+					add_client(sockfd);
+				} else {
+					LOGPRINTF(1, "registering inet client");
+					add_client(sockinet);
+				}
+				break;
+			case WATCH_DRIVER:
+				driver_ready = 1;
+				break;
+			case WATCH_DECODER:
+				decode_ring_drain();
+				break;
+			case WATCH_TRANSMIT:
+				tx_drain();
+				break;
+			case WATCH_INPUT:
+				input_read(w->data);
+				break;
+			case WATCH_CONFIG:
+				config_load_done();
+				break;
+			default:
+				break;
 			}
 		}
-
-		if (FD_ISSET(sockfd, &fds)) {
-			LOGPRINTF(1, "registering local client");
-			add_client(sockfd);
-		}
-		if (listen_tcpip && FD_ISSET(sockinet, &fds)) {
-			LOGPRINTF(1, "registering inet client");
-			add_client(sockinet);
-		}
-		if (use_hw() && curr_driver->rec_mode != 0 && curr_driver->fd != 0 && FD_ISSET(curr_driver->fd, &fds)) {
+		free_dead_clients();
+		if (driver_ready && use_hw() && curr_driver->rec_mode != 0 && curr_driver->fd != 0) {
 			register_input();
 			/* we will read later */
 			return (1);
@@ -2171,39 +5358,34 @@ static int mywaitfordata(long maxusec)
 void loop()
 {
 	char *message;
-        char prev_button_name[16];
-        struct timeval ptime, ctime, gap;
 
 	logprintf(LIRC_NOTICE, "lircd(%s) ready, using %s, dedup_delay: %d", curr_driver->name, lircdfile, dedup_delay);
 	while (1) {
 		(void)mywaitfordata(0);
-		if (!curr_driver->rec_func)
+		if (!curr_driver->rec_func || decode_thread_running)
 			continue;
-		message = curr_driver->rec_func(remotes);
-
-		if (message != NULL) {
-			const char *remote_name;
-			const char *button_name;
-			int reps;
-
-			if (curr_driver->drvctl_func && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE)) {
-				curr_driver->drvctl_func(LIRC_NOTIFY_DECODE, NULL);
-			}
-
-			get_release_data(&remote_name, &button_name, &reps);
+		hw_lock();
+		do {
+			message = curr_driver->rec_func(remotes);
 
-                        if(strcmp(button_name, prev_button_name) == 0) {
-                            gettimeofday(&ctime, NULL);
-                            timersub(&ctime, &ptime, &gap);
-                            if(gap.tv_usec <= dedup_delay)
-                                continue;
-                        }
+			if (message != NULL) {
+				const char *remote_name;
+				const char *button_name;
+				struct event_code ec;
+				int reps;
 
-                        gettimeofday(&ptime, NULL);
-                        strcpy(prev_button_name, button_name);
+				if (curr_driver->drvctl_func && (curr_driver->features & LIRC_CAN_NOTIFY_DECODE)) {
+					curr_driver->drvctl_func(LIRC_NOTIFY_DECODE, NULL);
+				}
 
-			input_message(message, remote_name, button_name, reps, 0);
-		}
+				get_release_data(&remote_name, &button_name, &reps);
+				get_event_code(&ec, 0);
+				if (!is_duplicate(button_name))
+					input_message(message, remote_name, button_name, reps, 0, driver_tag, &ec);
+			}
+			/* the driver's fd doesn't show samples it read ahead */
+		} while (rec_buffer_batched() > 0);
+		hw_unlock();
 	}
 }
 
@@ -2263,6 +5445,13 @@ static void lircd_add_defaults(void)
 		"lircd:driver-options", "",
 		"lircd:effective-user", "",
 		"lircd:dedup-delay", "0",
+		"lircd:client-buffer", "65536",
+		"lircd:overflow", "drop-oldest",
+		"lircd:decode-thread", "False",
+		"lircd:compiled-decoder", "False",
+		"lircd:adaptive-order", "False",
+		"lircd:config-cache", NULL,
+		"lircd:input", NULL,
 
 		(const char*)NULL, 	(const char*)NULL
 	};
@@ -2290,7 +5479,7 @@ int parse_peer_connections(const char *opt)
 static void lircd_parse_options(int argc, char** const argv)
 {
 	int c;
-	const char* optstring = "A:e:O:hvnp:H:d:o:U:P:l::L:c:r::aR:S:D::Y"
+	const char* optstring = "A:e:O:hvnp:H:d:o:U:P:l::L:c:r::aR:S:D::YB:Q:TMFC:I:"
 #       if defined(__linux__)
 		"u"
 #       endif
@@ -2383,6 +5572,27 @@ static void lircd_parse_options(int argc, char** const argv)
 		case 'S':
 			options_set_opt("lircd:dedup-delay", optarg);
 			break;
+		case 'B':
+			options_set_opt("lircd:client-buffer", optarg);
+			break;
+		case 'Q':
+			options_set_opt("lircd:overflow", optarg);
+			break;
+		case 'T':
+			options_set_opt("lircd:decode-thread", "True");
+			break;
+		case 'M':
+			options_set_opt("lircd:compiled-decoder", "True");
+			break;
+		case 'F':
+			options_set_opt("lircd:adaptive-order", "True");
+			break;
+		case 'C':
+			options_set_opt("lircd:config-cache", optarg);
+			break;
+		case 'I':
+			options_set_opt("lircd:input", optarg);
+			break;
 		default:
 			printf("Usage: %s [options] [config-file]\n", progname);
 			exit(EXIT_FAILURE);
@@ -2404,6 +5614,7 @@ int main(int argc, char **argv)
 	const char *device = NULL;
 	char errmsg[128];
 	const char* opt;
+	int i;
 
 	address.s_addr = htonl(INADDR_ANY);
 	hw_choose_driver(NULL);
@@ -2466,14 +5677,33 @@ int main(int argc, char **argv)
 		return(EXIT_FAILURE);
 	loglevel_opt = options_getint("lircd:debug");
 	userelease = options_getboolean("lircd:release");
-	set_release_suffix(options_getstring("lircd:release_suffix"));
+	release_suffix = options_getstring("lircd:release_suffix");
+	set_release_suffix(release_suffix);
 	allow_simulate = options_getboolean("lircd:allow-simulate");
 #       if defined(__linux__)
 	useuinput = options_getboolean("lircd:uinput");
 #       endif
 	repeat_max = options_getint("lircd:repeat-max");
 	dedup_delay = options_getint("lircd:dedup-delay");
+	client_buffer_size = options_getint("lircd:client-buffer");
+	if (client_buffer_size < MIN_CLIENT_BUFFER) {
+		fprintf(stderr, "%s: client buffer must be at least %d bytes\n", progname, MIN_CLIENT_BUFFER);
+		return (EXIT_FAILURE);
+	}
+	use_decode_thread = options_getboolean("lircd:decode-thread");
+	ir_remote_set_compiled_decoder(options_getboolean("lircd:compiled-decoder"));
+	ir_remote_set_adaptive_order(options_getboolean("lircd:adaptive-order"));
+	opt = options_getstring("lircd:overflow");
+	if (strcmp(opt, "drop-oldest") == 0) {
+		overflow_policy = OVERFLOW_DROP_OLDEST;
+	} else if (strcmp(opt, "disconnect") == 0) {
+		overflow_policy = OVERFLOW_DISCONNECT;
+	} else {
+		fprintf(stderr, "%s: bad overflow policy \"%s\"\n", progname, opt);
+		return (EXIT_FAILURE);
+	}
 	configfile = options_getstring("lircd:configfile");
+	config_cache = options_getstring("lircd:config-cache");
 	curr_driver->open_func(device);
 	if (strcmp(curr_driver->name, "null") == 0 && peern == 0) {
 		fprintf(stderr, "%s: there's no hardware I can use and no peers are specified\n", progname);
@@ -2484,6 +5714,9 @@ int main(int argc, char **argv)
 		fprintf(stderr, "%s: device and output must not be the same file: %s\n", progname, lircdfile);
 		return (EXIT_FAILURE);
 	}
+	driver_tag = make_tag(curr_driver->device != NULL ? curr_driver->device : curr_driver->name);
+	if (driver_tag == NULL || !parse_inputs(options_getstring("lircd:input")))
+		return (EXIT_FAILURE);
 
 	signal(SIGPIPE, SIG_IGN);
 
@@ -2495,11 +5728,6 @@ int main(int argc, char **argv)
 	sigaction(SIGTERM, &act, NULL);
 	sigaction(SIGINT, &act, NULL);
 
-	act.sa_handler = sigalrm;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_RESTART;	/* don't fiddle with EINTR */
-	sigaction(SIGALRM, &act, NULL);
-
 	act.sa_handler = dosigterm;
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = SA_RESTART;
@@ -2522,10 +5750,8 @@ int main(int argc, char **argv)
 		struct ir_remote *r;
 		struct ir_ncode *c;
 
-		if (curr_driver->init_func) {
-			if (!curr_driver->init_func())
-				dosigterm(SIGTERM);
-		}
+		if (!hw_init())
+			dosigterm(SIGTERM);
 
 		printf("space 1000000\n");
 		r = remotes;
@@ -2547,12 +5773,18 @@ int main(int argc, char **argv)
 			r = r->next;
 		}
 		fflush(stdout);
-		if (curr_driver->deinit_func)
-			curr_driver->deinit_func();
+		hw_deinit();
 	}
 	fprintf(stderr, "Ready.\n");
 	dosigterm(SIGUSR1);
 #endif
+	if (use_decode_thread && !start_decode_thread())
+		dosigterm(SIGTERM);
+	/* send_mode may only be known once the device is opened, see default */
+	if (curr_driver->send_func != NULL && !start_tx_thread())
+		dosigterm(SIGTERM);
+	for (i = 0; i < inputn; i++)
+		input_init(inputs[i]);
 	loop();
 
 	/* never reached */
@@ -0,0 +1,696 @@
+/****************************************************************************
+ ** config_cache.c **********************************************************
+ ****************************************************************************
+ *
+ * Binary cache of the parsed config files.
+ *
+ */
+
+/**
+ * @file config_cache.c
+ * @brief Implements config_cache.h
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "include/media/lirc.h"
+#include "lirc/lirc_log.h"
+#include "lirc/lirc_options.h"
+#include "lirc/ir_remote.h"
+#include "lirc/config_file.h"
+#include "lirc/config_cache.h"
+#include "lirc/receive.h"
+
+/* Bump when the layout below changes. */
+#define CACHE_MAGIC	"LIRCCFG"
+#define CACHE_VERSION	1
+
+#define SOURCE_FILE	1	/**< a file read_config() parsed */
+#define SOURCE_GLOB	2	/**< the files an include pattern matched */
+
+/*
+ * The cache file is a struct cache_header, n_sources struct
+ * cache_source each followed by its path, and n_remotes remotes. A
+ * remote is its struct ir_remote, its name, driver and dyncodes_name,
+ * the number of codes and their struct ir_ncode array, then per code
+ * its name, signals and the codes of its ir_code_node list. Pointers in
+ * the structs are stored as NULL. Strings are stored as a __u64 length
+ * including the terminating 0, 0 for NULL, followed by the chars. All
+ * items start at a multiple of 8 bytes and are in host byte order: the
+ * cache is only valid for the lircd which wrote it, thus the header
+ * has the lirc version and the sizes of the structs. It also has a hash
+ * of the rest to detect a damaged file.
+ */
+struct cache_header {
+	char magic[8];
+	__u32 version;
+	__u32 dynamic_codes;	/**< value of lircd:dynamic-codes */
+	__u32 sizes[4];		/**< of ir_remote, ir_ncode, ir_code, lirc_t */
+	char lirc_version[32];
+	__u32 n_sources;
+	__u32 n_remotes;
+	__u64 size;		/**< of the whole file */
+	__u64 check;		/**< hash_words() of all after the header */
+};
+
+/* A file or glob the cached remotes were read from. */
+struct cache_source {
+	__u32 kind;		/**< SOURCE_* */
+	__u32 pad;
+	__s64 mtime;		/**< file: st_mtim */
+	__s64 mtime_nsec;
+	__u64 size;		/**< file: st_size, glob: number of matches */
+	__u64 hash;		/**< file: contents, glob: matched paths */
+};
+
+/*
+ * Sources noted while read_config_cached() parses the config, by the
+ * threads parsing includes too.
+ */
+static pthread_mutex_t noted_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	int active;
+	int failed;
+	struct cache_source* items;
+	char** paths;
+	int n;
+	int size;
+} noted;
+
+/* A cache file being written or read. */
+struct cache_buf {
+	char* data;
+	size_t length;
+	size_t size;
+	int failed;
+};
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+static __u64 hash_bytes(__u64 hash, const void* data, size_t length)
+{
+	const unsigned char* p = data;
+
+	while (length-- > 0) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/* Hash the contents of a file, returns 0 on errors. */
+static int hash_file(const char* path, __u64* hash)
+{
+	char buf[8192];
+	FILE* f;
+	size_t n;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	*hash = FNV_OFFSET;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		*hash = hash_bytes(*hash, buf, n);
+	n = ferror(f);
+	fclose(f);
+	return n == 0;
+}
+
+/* A faster hash for the cache itself, length is a multiple of 8. */
+static __u64 hash_words(const char* data, size_t length)
+{
+	__u64 hash = FNV_OFFSET;
+	__u64 word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= length; i += sizeof(word)) {
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * FNV_PRIME;
+		hash ^= hash >> 32;
+	}
+	return hash;
+}
+
+static __u64 hash_glob(const glob_t* globbuf)
+{
+	__u64 hash = FNV_OFFSET;
+	size_t i;
+
+	for (i = 0; i < globbuf->gl_pathc; i++)
+		hash = hash_bytes(hash, globbuf->gl_pathv[i], strlen(globbuf->gl_pathv[i]) + 1);
+	return hash;
+}
+
+/* Fill in a SOURCE_FILE for path, returns 0 if it can't be read. */
+static int stat_file(const char* path, struct cache_source* src)
+{
+	struct stat s;
+
+	if (stat(path, &s) != 0)
+		return 0;
+	memset(src, 0, sizeof(*src));
+	src->kind = SOURCE_FILE;
+	src->mtime = s.st_mtim.tv_sec;
+	src->mtime_nsec = s.st_mtim.tv_nsec;
+	src->size = s.st_size;
+	return hash_file(path, &src->hash);
+}
+
+static void note_source(const struct cache_source* src, const char* path)
+{
+	if (noted.n == noted.size) {
+		int size = noted.size ? 2 * noted.size : 32;
+		struct cache_source* items;
+		char** paths;
+
+		items = realloc(noted.items, size * sizeof(*items));
+		if (items != NULL)
+			noted.items = items;
+		paths = realloc(noted.paths, size * sizeof(*paths));
+		if (paths != NULL)
+			noted.paths = paths;
+		if (items == NULL || paths == NULL) {
+			noted.failed = 1;
+			return;
+		}
+		noted.size = size;
+	}
+	noted.paths[noted.n] = strdup(path);
+	if (noted.paths[noted.n] == NULL) {
+		noted.failed = 1;
+		return;
+	}
+	noted.items[noted.n++] = *src;
+}
+
+void config_cache_note_file(const char* path)
+{
+	struct cache_source src;
+	int ok;
+
+	/* active is only changed while no threads are parsing */
+	if (!noted.active)
+		return;
+	ok = stat_file(path, &src);
+	pthread_mutex_lock(&noted_lock);
+	if (!ok) {
+		LOGPRINTF(1, "config cache: cannot read %s", path);
+		noted.failed = 1;
+	} else if (!noted.failed) {
+		note_source(&src, path);
+	}
+	pthread_mutex_unlock(&noted_lock);
+}
+
+void config_cache_note_glob(const char* pattern, const glob_t* globbuf)
+{
+	struct cache_source src;
+
+	if (!noted.active)
+		return;
+	memset(&src, 0, sizeof(src));
+	src.kind = SOURCE_GLOB;
+	src.size = globbuf->gl_pathc;
+	src.hash = hash_glob(globbuf);
+	pthread_mutex_lock(&noted_lock);
+	if (!noted.failed)
+		note_source(&src, pattern);
+	pthread_mutex_unlock(&noted_lock);
+}
+
+static void noted_clear(void)
+{
+	int i;
+
+	for (i = 0; i < noted.n; i++)
+		free(noted.paths[i]);
+	free(noted.items);
+	free(noted.paths);
+	memset(&noted, 0, sizeof(noted));
+}
+
+/*
+ * Check that a source is the same as when the cache was written, now is
+ * set to what it is now.
+ */
+static int source_valid(const struct cache_source* src, const char* path, struct cache_source* now)
+{
+	struct stat s;
+	glob_t globbuf;
+	int valid;
+
+	*now = *src;
+	if (src->kind == SOURCE_GLOB) {
+		memset(&globbuf, 0, sizeof(globbuf));
+		glob(path, 0, NULL, &globbuf);
+		valid = globbuf.gl_pathc == src->size && hash_glob(&globbuf) == src->hash;
+		globfree(&globbuf);
+		return valid;
+	}
+	if (src->kind != SOURCE_FILE || stat(path, &s) != 0 || s.st_size != src->size)
+		return 0;
+	if (s.st_mtim.tv_sec == src->mtime && s.st_mtim.tv_nsec == src->mtime_nsec)
+		return 1;
+	/* touched, maybe not changed */
+	return stat_file(path, now) && now->hash == src->hash;
+}
+
+static void put(struct cache_buf* buf, const void* data, size_t length)
+{
+	size_t padded = (length + 7) & ~((size_t)7);
+
+	if (buf->failed)
+		return;
+	if (buf->length + padded > buf->size) {
+		size_t size = buf->size ? buf->size : 65536;
+		char* p;
+
+		while (size < buf->length + padded)
+			size *= 2;
+		p = realloc(buf->data, size);
+		if (p == NULL) {
+			buf->failed = 1;
+			return;
+		}
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->length, data, length);
+	memset(buf->data + buf->length + length, 0, padded - length);
+	buf->length += padded;
+}
+
+static void put_u64(struct cache_buf* buf, __u64 value)
+{
+	put(buf, &value, sizeof(value));
+}
+
+static void put_string(struct cache_buf* buf, const char* s)
+{
+	__u64 length = s != NULL ? strlen(s) + 1 : 0;
+
+	put_u64(buf, length);
+	if (length > 0)
+		put(buf, s, length);
+}
+
+/* Clear all but what read_config() sets, the rest is rebuilt when loading. */
+static void clear_remote(struct ir_remote* r)
+{
+	r->name = NULL;
+	r->driver = NULL;
+	r->codes = NULL;
+	r->dyncodes_name = NULL;
+	memset(r->dyncodes, 0, sizeof(r->dyncodes));
+	r->last_code = NULL;
+	r->toggle_code = NULL;
+	r->next = NULL;
+	r->code_index = NULL;
+	r->decode_order = NULL;
+	memset(&r->signature, 0, sizeof(r->signature));
+	memset(&r->matcher, 0, sizeof(r->matcher));
+	r->raw_table = NULL;
+	memset(&r->windows, 0, sizeof(r->windows));
+	r->get_data = NULL;
+}
+
+static void clear_code(struct ir_ncode* code)
+{
+	code->name = NULL;
+	code->signals = NULL;
+	code->next = NULL;
+	code->current = NULL;
+	code->transmit_state = NULL;
+	code->waveforms = NULL;
+}
+
+static void put_remote(struct cache_buf* buf, const struct ir_remote* remote)
+{
+	struct ir_remote r = *remote;
+	struct ir_ncode code;
+	struct ir_ncode* codes;
+	struct ir_code_node* node;
+	__u64 n = 0;
+
+	clear_remote(&r);
+	put(buf, &r, sizeof(r));
+	put_string(buf, remote->name);
+	put_string(buf, remote->driver);
+	put_string(buf, remote->dyncodes_name);
+
+	for (codes = remote->codes; codes != NULL && codes->name != NULL; codes++)
+		n++;
+	put_u64(buf, n);
+	for (codes = remote->codes; codes != NULL && codes->name != NULL; codes++) {
+		code = *codes;
+		clear_code(&code);
+		put(buf, &code, sizeof(code));
+	}
+	for (codes = remote->codes; codes != NULL && codes->name != NULL; codes++) {
+		put_string(buf, codes->name);
+		put_u64(buf, codes->signals != NULL);
+		if (codes->signals != NULL)
+			put(buf, codes->signals, codes->length * sizeof(lirc_t));
+		for (n = 0, node = codes->next; node != NULL; node = node->next)
+			n++;
+		put_u64(buf, n);
+		for (node = codes->next; node != NULL; node = node->next)
+			put(buf, &node->code, sizeof(node->code));
+	}
+}
+
+static void fill_header(struct cache_header* header)
+{
+	memset(header, 0, sizeof(*header));
+	strncpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+	header->version = CACHE_VERSION;
+	header->dynamic_codes = options_getboolean("lircd:dynamic-codes") ? 1 : 0;
+	header->sizes[0] = sizeof(struct ir_remote);
+	header->sizes[1] = sizeof(struct ir_ncode);
+	header->sizes[2] = sizeof(ir_code);
+	header->sizes[3] = sizeof(lirc_t);
+	strncpy(header->lirc_version, VERSION, sizeof(header->lirc_version) - 1);
+}
+
+/* Write the cache for remotes, read from the noted sources. */
+static void cache_write(const char* path, const struct ir_remote* remotes)
+{
+	struct cache_buf buf;
+	struct cache_header header;
+	const struct ir_remote* r;
+	char* tmp;
+	size_t done;
+	ssize_t n;
+	int fd;
+	int ok;
+	int i;
+
+	memset(&buf, 0, sizeof(buf));
+	fill_header(&header);
+	header.n_sources = noted.n;
+	for (r = remotes; r != NULL; r = r->next)
+		header.n_remotes++;
+	put(&buf, &header, sizeof(header));
+	for (i = 0; i < noted.n; i++) {
+		put(&buf, &noted.items[i], sizeof(noted.items[i]));
+		put_string(&buf, noted.paths[i]);
+	}
+	for (r = remotes; r != NULL; r = r->next)
+		put_remote(&buf, r);
+	if (buf.failed) {
+		logprintf(LIRC_WARNING, "out of memory, not writing config cache %s", path);
+		free(buf.data);
+		return;
+	}
+	((struct cache_header*)buf.data)->size = buf.length;
+	((struct cache_header*)buf.data)->check = hash_words(buf.data + sizeof(header), buf.length - sizeof(header));
+
+	/* write a new file and rename it, so a reader never sees half a cache */
+	tmp = malloc(strlen(path) + 8);
+	if (tmp == NULL) {
+		free(buf.data);
+		return;
+	}
+	sprintf(tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		logprintf(LIRC_WARNING, "cannot write config cache %s", path);
+		logperror(LIRC_WARNING, NULL);
+		free(tmp);
+		free(buf.data);
+		return;
+	}
+	for (done = 0; done < buf.length; done += n) {
+		n = write(fd, buf.data + done, buf.length - done);
+		if (n <= 0)
+			break;
+	}
+	ok = done == buf.length && fchmod(fd, 0644) == 0;
+	if (close(fd) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, path) != 0) {
+		logprintf(LIRC_WARNING, "cannot write config cache %s", path);
+		logperror(LIRC_WARNING, NULL);
+		unlink(tmp);
+	} else {
+		LOGPRINTF(1, "wrote config cache %s, %lu bytes", path, (unsigned long)buf.length);
+	}
+	free(tmp);
+	free(buf.data);
+}
+
+/* Next length bytes of the mapped cache, NULL if it's too short. */
+static const void* get(struct cache_buf* buf, size_t length)
+{
+	size_t padded = (length + 7) & ~((size_t)7);
+	const void* p;
+
+	if (buf->failed || padded < length || padded > buf->size - buf->length) {
+		buf->failed = 1;
+		return NULL;
+	}
+	p = buf->data + buf->length;
+	buf->length += padded;
+	return p;
+}
+
+static __u64 get_u64(struct cache_buf* buf)
+{
+	const __u64* p = get(buf, sizeof(__u64));
+
+	return p != NULL ? *p : 0;
+}
+
+/* Next string, *s is NULL if it was stored as NULL. Returns 0 on errors. */
+static int get_string(struct cache_buf* buf, char** s, int copy)
+{
+	__u64 length = get_u64(buf);
+	const char* p;
+
+	*s = NULL;
+	if (length == 0)
+		return !buf->failed;
+	p = get(buf, length);
+	if (p == NULL || p[length - 1] != '\0') {
+		buf->failed = 1;
+		return 0;
+	}
+	*s = copy ? strdup(p) : (char*)p;
+	return *s != NULL;
+}
+
+static struct ir_remote* get_remote(struct cache_buf* buf)
+{
+	const struct ir_remote* stored;
+	const struct ir_ncode* stored_codes;
+	struct ir_remote* remote;
+	struct ir_ncode* codes;
+	struct ir_code_node** last;
+	struct ir_code_node* node;
+	const lirc_t* signals;
+	const ir_code* node_code;
+	__u64 n, i, j, nodes;
+	char* name;
+	char* driver;
+
+	stored = get(buf, sizeof(*stored));
+	if (stored == NULL)
+		return NULL;
+	remote = malloc(sizeof(*remote));
+	if (remote == NULL)
+		return NULL;
+	*remote = *stored;
+	clear_remote(remote);
+	if (!get_string(buf, &name, 1)
+	    || !get_string(buf, &driver, 1)
+	    || !get_string(buf, &remote->dyncodes_name, 1)) {
+		free_config(remote);
+		return NULL;
+	}
+	remote->name = name;
+	remote->driver = driver;
+	n = get_u64(buf);
+	stored_codes = n <= buf->size / sizeof(*codes) ? get(buf, n * sizeof(*codes)) : NULL;
+	codes = stored_codes != NULL ? calloc(n + 1, sizeof(*codes)) : NULL;
+	if (codes == NULL) {
+		free_config(remote);
+		return NULL;
+	}
+	/* free_config() stops at the first code without a name */
+	memcpy(codes, stored_codes, n * sizeof(*codes));
+	for (i = 0; i < n; i++)
+		clear_code(&codes[i]);
+	remote->codes = codes;
+	for (i = 0; i < n && !buf->failed; i++) {
+		if (!get_string(buf, &codes[i].name, 1) || codes[i].name == NULL)
+			break;
+		if (get_u64(buf)) {
+			signals = NULL;
+			if (codes[i].length >= 0 && (size_t)codes[i].length <= buf->size / sizeof(lirc_t))
+				signals = get(buf, codes[i].length * sizeof(lirc_t));
+			if (signals != NULL)
+				codes[i].signals = malloc(codes[i].length * sizeof(lirc_t));
+			if (codes[i].signals == NULL)
+				break;
+			memcpy(codes[i].signals, signals, codes[i].length * sizeof(lirc_t));
+		}
+		nodes = get_u64(buf);
+		last = &codes[i].next;
+		for (j = 0; j < nodes; j++) {
+			node_code = get(buf, sizeof(*node_code));
+			node = node_code != NULL ? malloc(sizeof(*node)) : NULL;
+			if (node == NULL)
+				break;
+			node->code = *node_code;
+			node->next = NULL;
+			*last = node;
+			last = &node->next;
+		}
+		if (j < nodes)
+			break;
+	}
+	if (i < n || buf->failed) {
+		buf->failed = 1;
+		free_config(remote);
+		return NULL;
+	}
+	if (options_getboolean("lircd:dynamic-codes")) {
+		remote->dyncodes[0].name = remote->dyncodes_name;
+		remote->dyncodes[1].name = remote->dyncodes_name;
+	}
+	/* as at the end of read_config_recursive() */
+	ir_remote_index_codes(remote);
+	receive_signature(remote);
+	receive_compile(remote);
+	receive_compile_raw(remote);
+	receive_select_decoder(remote);
+	return remote;
+}
+
+/*
+ * Read the remotes of the config file name from the cache at path,
+ * returns (void*)-1 if it's missing, out of date or broken. The sources
+ * are noted, *touched is set if some have a new mtime but are the same.
+ */
+static struct ir_remote* cache_load(const char* path, const char* name, int* touched)
+{
+	struct cache_buf buf;
+	struct cache_header expected;
+	const struct cache_header* header;
+	const struct cache_source* src;
+	struct cache_source now;
+	struct ir_remote* remotes = NULL;
+	struct ir_remote* last = NULL;
+	struct ir_remote* r;
+	struct stat s;
+	void* map;
+	char* src_path;
+	__u32 i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		LOGPRINTF(1, "no config cache %s", path);
+		return (void*)-1;
+	}
+	if (fstat(fd, &s) != 0 || s.st_size < (off_t)sizeof(*header)) {
+		close(fd);
+		return (void*)-1;
+	}
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return (void*)-1;
+	memset(&buf, 0, sizeof(buf));
+	buf.data = map;
+	buf.size = s.st_size;
+
+	fill_header(&expected);
+	header = get(&buf, sizeof(*header));
+	if (memcmp(header, &expected, offsetof(struct cache_header, n_sources)) != 0
+	    || header->size != buf.size || header->n_sources == 0) {
+		LOGPRINTF(1, "config cache %s is for another lircd", path);
+		goto invalid;
+	}
+	if (hash_words(buf.data + buf.length, buf.size - buf.length) != header->check) {
+		buf.failed = 1;
+		goto invalid;
+	}
+	for (i = 0; i < header->n_sources; i++) {
+		src = get(&buf, sizeof(*src));
+		if (src == NULL || !get_string(&buf, &src_path, 0) || src_path == NULL)
+			goto invalid;
+		/* the first one is the file the cache is for */
+		if ((i == 0 && strcmp(src_path, name) != 0) || !source_valid(src, src_path, &now)) {
+			LOGPRINTF(1, "config cache %s: %s has changed", path, src_path);
+			goto invalid;
+		}
+		if (memcmp(src, &now, sizeof(now)) != 0)
+			*touched = 1;
+		note_source(&now, src_path);
+	}
+	for (i = 0; i < header->n_remotes; i++) {
+		r = get_remote(&buf);
+		if (r == NULL)
+			goto invalid;
+		if (last == NULL)
+			remotes = r;
+		else
+			last->next = r;
+		last = r;
+	}
+	if (buf.length != buf.size)
+		goto invalid;
+	logprintf(LIRC_INFO, "Using %u remotes from config cache %s.", header->n_remotes, path);
+	munmap(map, s.st_size);
+	return remotes;
+
+invalid:
+	if (buf.failed)
+		logprintf(LIRC_WARNING, "config cache %s is broken, ignoring it", path);
+	free_config(remotes);
+	munmap(map, s.st_size);
+	return (void*)-1;
+}
+
+struct ir_remote* read_config_cached(FILE* f, const char* name, const char* cache_path)
+{
+	struct ir_remote* remotes;
+	int touched = 0;
+
+	if (cache_path == NULL)
+		return read_config(f, name);
+	noted_clear();
+	remotes = cache_load(cache_path, name, &touched);
+	if (remotes != (void*)-1) {
+		/* save checking the contents again next time */
+		if (touched && !noted.failed)
+			cache_write(cache_path, remotes);
+		noted_clear();
+		return remotes;
+	}
+
+	noted_clear();
+	noted.active = 1;
+	config_cache_note_file(name);
+	remotes = read_config(f, name);
+	if (remotes != (void*)-1 && !noted.failed)
+		cache_write(cache_path, remotes);
+	noted_clear();
+	return remotes;
+}
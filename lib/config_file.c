@@ -22,6 +22,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <glob.h>
+#include <pthread.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -40,7 +41,9 @@
 #include "lirc/lirc_options.h"
 #include "lirc/ir_remote.h"
 #include "lirc/config_file.h"
+#include "lirc/config_cache.h"
 #include "lirc/transmit.h"
+#include "lirc/receive.h"
 #include "lirc/config_flags.h"
 
 
@@ -62,11 +65,18 @@ struct void_array {
 
 #define LINE_LEN 4096
 #define MAX_INCLUDES 10
+#define MAX_INCLUDE_THREADS 8
 
 const char *whitespace = " \t";
 
-static int line;
-static int parse_error;
+/* Parser state, of each thread parsing files of an include in parallel. */
+static __thread int line;
+static __thread int parse_error;
+/* Set in these threads, which parse nested includes on their own. */
+static __thread int in_include_thread;
+
+/* Value of lircd:dynamic-codes, read once for all threads. */
+static int dynamic_codes;
 
 static struct ir_remote *read_config_recursive(FILE * f, const char *name, int depth);
 static void calculate_signal_lengths(struct ir_remote *remote);
@@ -352,7 +362,7 @@ int defineRemote(char *key, char *val, char *val2, struct ir_remote *rem)
 		logprintf(LIRC_INFO, "Using remote: %s.", val);
 		return (1);
 	}
-	if (options_getboolean("lircd:dynamic-codes")) {
+	if (dynamic_codes) {
 		if ((strcasecmp("dyncodes_name", key)) == 0) {
 			if (rem->dyncodes_name != NULL) {
 				free(rem->dyncodes_name);
@@ -747,6 +757,7 @@ struct ir_remote* read_config(FILE * f, const char *name)
 {
 	struct ir_remote* head;
 
+	dynamic_codes = options_getboolean("lircd:dynamic-codes");
 	head = read_config_recursive(f, name, 0);
 	head = sort_by_bit_count(head);
 	return head;
@@ -781,6 +792,7 @@ read_included(const char* name, int depth, char* val, struct ir_remote* top_rem)
 		logprintf(LIRC_ERROR, "invalid quoting");
 		return top_rem;
 	}
+	config_cache_note_file(childName);
 	childFile = fopen(childName, "r");
 	if (childFile == NULL) {
 		logprintf(LIRC_ERROR, "error opening child file '%s' defined at line %d:",
@@ -796,6 +808,109 @@ read_included(const char* name, int depth, char* val, struct ir_remote* top_rem)
 }
 
 
+/** The files matched by an include, parsed by several threads. */
+struct include_job {
+	char **paths;			/**< The files, in glob order. */
+	struct ir_remote **remotes;	/**< Result of each file. */
+	char *failed;			/**< Set if the file can't be opened. */
+	int n;
+	int next;			/**< Next file a thread takes. */
+	int depth;			/**< Include depth of the files. */
+	pthread_mutex_t lock;		/**< Protects next. */
+};
+
+
+static void *include_thread(void *arg)
+{
+	struct include_job *job = arg;
+	FILE *f;
+	int i;
+
+	in_include_thread = 1;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->n)
+			break;
+		config_cache_note_file(job->paths[i]);
+		f = fopen(job->paths[i], "r");
+		if (f == NULL) {
+			job->failed[i] = 1;
+			continue;
+		}
+		job->remotes[i] = read_config_recursive(f, job->paths[i], job->depth);
+		fclose(f);
+	}
+	return NULL;
+}
+
+
+/**
+ * Parse the files matched by an include in up to MAX_INCLUDE_THREADS
+ * threads, and append their remotes in glob order as read_included()
+ * does, so the result is the same as parsing them one by one.
+ *
+ * @param depth Include depth of the including file.
+ * @param globbuf Files to parse.
+ * @param top_rem root of existing ir_remotes list, updated.
+ * @return 0 if out of memory, nothing is parsed then.
+ */
+static int read_included_parallel(int depth,
+				  const glob_t* globbuf,
+				  struct ir_remote** top_rem)
+{
+	struct include_job job;
+	pthread_t threads[MAX_INCLUDE_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int include_line = line;
+	int nthreads, started, i;
+
+	memset(&job, 0, sizeof(job));
+	job.n = globbuf->gl_pathc;
+	job.paths = globbuf->gl_pathv;
+	job.depth = depth + 1;
+	job.remotes = calloc(job.n, sizeof(struct ir_remote*));
+	job.failed = calloc(job.n, 1);
+	if (job.remotes == NULL || job.failed == NULL) {
+		free(job.remotes);
+		free(job.failed);
+		return 0;
+	}
+	pthread_mutex_init(&job.lock, NULL);
+	nthreads = cpus < MAX_INCLUDE_THREADS ? cpus : MAX_INCLUDE_THREADS;
+	if (nthreads > job.n)
+		nthreads = job.n;
+	/* this thread is one of them */
+	for (started = 0; started < nthreads - 1; started++)
+		if (pthread_create(&threads[started], NULL, include_thread, &job) != 0)
+			break;
+	LOGPRINTF(2, "parsing %d files in %d threads", job.n, started + 1);
+	include_thread(&job);
+	in_include_thread = 0;
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&job.lock);
+
+	for (i = 0; i < job.n; i++) {
+		if (job.failed[i]) {
+			/* as read_included() */
+			logprintf(LIRC_ERROR, "error opening child file '%s' defined at line %d:",
+				  job.paths[i], include_line);
+			logprintf(LIRC_ERROR, "ignoring this child file for now.");
+			*top_rem = NULL;
+		} else {
+			*top_rem = ir_remotes_append(*top_rem, job.remotes[i]);
+			/* as left by the last file parsed, not by this thread */
+			parse_error = job.remotes[i] == (void *)-1;
+		}
+	}
+	free(job.remotes);
+	free(job.failed);
+	return 1;
+}
+
+
 /**
  * Parse all include files matched by glob pattern
  *
@@ -820,6 +935,12 @@ static struct ir_remote* read_all_included(const char* name,
 	val[strlen(val) - 1] = '\0';
 	lirc_parse_relative(buff, sizeof(buff), val, name);
 	glob(buff, 0, NULL, &globbuf);
+	config_cache_note_glob(buff, &globbuf);
+	if (globbuf.gl_pathc > 1 && depth <= MAX_INCLUDES && !in_include_thread
+	    && read_included_parallel(depth, &globbuf, &top_rem)) {
+		globfree(&globbuf);
+		return top_rem;
+	}
 	for (i = 0; i <  globbuf.gl_pathc; i +=1) {
 		snprintf(buff, sizeof(buff), "\"%s\"", globbuf.gl_pathv[i]);
 		top_rem = read_included(name, depth, buff, top_rem);
@@ -831,7 +952,7 @@ static struct ir_remote* read_all_included(const char* name,
 static struct ir_remote*
 read_config_recursive(FILE * f, const char *name, int depth)
 {
-	char buf[LINE_LEN + 1], *key, *val, *val2;
+	char buf[LINE_LEN + 1], *key, *val, *val2, *saveptr;
 	int len, argc;
 	struct ir_remote *top_rem = NULL, *rem = NULL;
 	struct void_array codes_list, raw_codes, signals;
@@ -867,13 +988,13 @@ read_config_recursive(FILE * f, const char *name, int depth)
 		if (buf[0] == '#') {
 			continue;
 		}
-		key = strtok(buf, whitespace);
+		key = strtok_r(buf, whitespace, &saveptr);
 		/* ignore empty lines */
 		if (key == NULL)
 			continue;
-		val = strtok(NULL, whitespace);
+		val = strtok_r(NULL, whitespace, &saveptr);
 		if (val != NULL) {
-			val2 = strtok(NULL, whitespace);
+			val2 = strtok_r(NULL, whitespace, &saveptr);
 			LOGPRINTF(3, "Tokens: \"%s\" \"%s\" \"%s\"", key, val, (val2 == NULL ? "(null)" : val));
 			if (strcasecmp("include", key) == 0) {
 				int save_line = line;
@@ -935,7 +1056,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 						if (val2[0] == '#')
 							break;	/* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &saveptr);
 					}
 					code->current = NULL;
 					add_void_array(&codes_list, code);
@@ -990,7 +1111,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 						parse_error = 1;
 						break;
 					}
-                                       	if (options_getboolean("lircd:dynamic-codes")) {
+                                       	if (dynamic_codes) {
 						if (rem->dyncodes_name == NULL) {
 							rem->dyncodes_name = s_strdup("unknown");
 						}
@@ -1008,7 +1129,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 						if (val2[0] == '#')
 							break;	/* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &saveptr);
 					}
 					code->current = NULL;
 					add_void_array(&codes_list, code);
@@ -1029,7 +1150,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 					argc = defineRemote(key, val, val2, rem);
 					if (!parse_error
 					    && ((argc == 1 && val2 != NULL)
-						|| (argc == 2 && val2 != NULL && strtok(NULL, whitespace) != NULL))) {
+						|| (argc == 2 && val2 != NULL && strtok_r(NULL, whitespace, &saveptr) != NULL))) {
 						logprintf(LIRC_WARNING,
 							  "%s: garbage after '%s'"
 							  " token in line %d ignored",
@@ -1042,7 +1163,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 						if (val2[0] == '#')
 							break;	/* comment */
 						defineNode(code, val2);
-						val2 = strtok(NULL, whitespace);
+						val2 = strtok_r(NULL, whitespace, &saveptr);
 					}
 					code->current = NULL;
 					add_void_array(&codes_list, code);
@@ -1091,7 +1212,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 								break;
 							}
 						}
-						while ((val = strtok(NULL, whitespace))) {
+						while ((val = strtok_r(NULL, whitespace, &saveptr))) {
 							if (!addSignal(&signals, val))
 								break;
 						}
@@ -1133,7 +1254,7 @@ read_config_recursive(FILE * f, const char *name, int depth)
 		}
 	}
 	if (parse_error) {
-		static int print_error = 1;
+		static __thread int print_error = 1;
 
 		if (print_error) {
 			logprintf(LIRC_ERROR, "reading of file '%s' failed", name);
@@ -1216,6 +1337,11 @@ read_config_recursive(FILE * f, const char *name, int depth)
 			}
 		}
 		calculate_signal_lengths(rem);
+		ir_remote_index_codes(rem);
+		receive_signature(rem);
+		receive_compile(rem);
+		receive_compile_raw(rem);
+		receive_select_decoder(rem);
 		rem = rem->next;
 	}
 
@@ -1236,9 +1362,14 @@ void calculate_signal_lengths(struct ir_remote *remote)
 	lirc_t max_pulse = 0, max_space = 0;
 	int first_sum = 1;
 	struct ir_ncode *c = remote->codes;
-	int i;
-
-	while (c->name) {
+	struct send_buffer *buf;
+	const lirc_t *data;
+	lirc_t sum;
+	int i, length;
+
+	/* not the buffer lircd sends from, which another thread may fill */
+	buf = send_buffer_new();
+	while (buf != NULL && c->name) {
 		struct ir_ncode code = *c;
 		struct ir_code_node *next = code.next;
 		int first = 1;
@@ -1251,9 +1382,8 @@ void calculate_signal_lengths(struct ir_remote *remote)
 				next = next->next;
 			}
 			for (repeat = 0; repeat < 2; repeat++) {
-				if (init_sim(remote, &code, repeat)) {
-					lirc_t sum = send_buffer_sum();
-
+				data = send_buffer_sim(buf, remote, &code, repeat, &length, &sum);
+				if (data != NULL) {
 					if (sum) {
 						if (first_sum || sum < min_signal_length) {
 							min_signal_length = sum;
@@ -1263,15 +1393,15 @@ void calculate_signal_lengths(struct ir_remote *remote)
 						}
 						first_sum = 0;
 					}
-					for (i = 0; i < send_buffer_length(); i++) {
+					for (i = 0; i < length; i++) {
 						if (i & 1) {	/* space */
-							if (send_buffer_data()[i] > max_space) {
-								max_space = send_buffer_data()[i];
+							if (data[i] > max_space) {
+								max_space = data[i];
 							}
 						} else {	/* pulse */
 
-							if (send_buffer_data()[i] > max_pulse) {
-								max_pulse = send_buffer_data()[i];
+							if (data[i] > max_pulse) {
+								max_pulse = data[i];
 							}
 						}
 					}
@@ -1280,6 +1410,7 @@ void calculate_signal_lengths(struct ir_remote *remote)
 		} while (next);
 		c++;
 	}
+	send_buffer_delete(buf);
 	if (first_sum) {
 		/* no timing data, so assume gap is the actual total
 		   length */
@@ -1330,6 +1461,7 @@ void free_config(struct ir_remote *remotes)
 				free(codes->name);
 				if (codes->signals != NULL)
 					free(codes->signals);
+				send_buffer_free_waveforms(codes);
 				node = codes->next;
 				while (node) {
 					next_node = node->next;
@@ -1340,6 +1472,9 @@ void free_config(struct ir_remote *remotes)
 			}
 			free(remotes->codes);
 		}
+		ir_remote_free_index(remotes);
+		ir_remote_free_order(remotes);
+		receive_free_raw(remotes);
 		free(remotes);
 		remotes = next;
 	}
@@ -264,3 +264,28 @@ int hw_choose_driver(const char* name)
 	return -1;
 
 }
+
+
+int hw_load_driver(const char* name, struct driver* dest)
+{
+	struct driver* found;
+	void* in_use = last_plugin;
+
+	if (strcasecmp(name, "dev/input") == 0) {
+		/* backwards compatibility */
+		name = "devinput";
+	}
+	/* don't let the search dlclose() the plugin drv comes from */
+	last_plugin = NULL;
+	found = for_each_driver(match_hw_name, (void*)name);
+	if (found == (struct driver*)NULL) {
+		if (last_plugin != NULL)
+			dlclose(last_plugin);
+		last_plugin = in_use;
+		return -1;
+	}
+	/* the plugin stays loaded for the rest of the process */
+	memcpy(dest, found, sizeof(struct driver));
+	last_plugin = in_use;
+	return 0;
+}
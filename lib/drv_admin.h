@@ -43,6 +43,13 @@ typedef struct driver*
 /** Search for driver with given  name and install it in the drv struct. */
 int hw_choose_driver(const char* name);
 
+/**
+ * Search for driver with given name and copy it to *dest, keeping its
+ * plugin loaded besides the one of the drv struct, which is unchanged.
+ * Returns 0 if found, else -1.
+ */
+int hw_load_driver(const char* name, struct driver* dest);
+
 /* Print name of all drivers on FILE. */
 void hw_print_drivers(FILE*);
 
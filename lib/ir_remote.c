@@ -33,6 +33,7 @@
 #include "include/media/lirc.h"
 #include "lirc/ir_remote.h"
 #include "lirc/driver.h"
+#include "lirc/receive.h"
 #include "lirc/release.h"
 #include "lirc/lirc_log.h"
 
@@ -50,17 +51,35 @@ struct ir_remote* decoding = NULL;
 
 struct ir_remote* last_remote = NULL;
 
+struct ir_remote* last_decoded = NULL;
+
 struct ir_remote* repeat_remote = NULL;
 
 struct ir_ncode *repeat_code;
 
+struct decode_stats decode_stats;
+
 static int dyncodes = 0;
 
+static int compiled_decoder = 0;
+
+static int adaptive_order = 0;
+
 void ir_remote_init(int use_dyncodes)
 {
 	dyncodes= use_dyncodes;
 }
 
+void ir_remote_set_compiled_decoder(int enable)
+{
+	compiled_decoder = enable;
+}
+
+void ir_remote_set_adaptive_order(int enable)
+{
+	adaptive_order = enable;
+}
+
 static  lirc_t time_left(struct timeval *current, struct timeval *last, lirc_t gap)
 {
 	unsigned long secs, diff;
@@ -78,6 +97,226 @@ static int match_ir_code(struct ir_remote *remote, ir_code a, ir_code b)
 		|| (remote->ignore_mask | a) == (remote->ignore_mask | (b ^ remote->toggle_bit_mask)));
 }
 
+struct code_slot {
+	ir_code key;
+	struct ir_ncode *code;	/* NULL if the slot is empty */
+};
+
+/*
+ * A code sending a sequence, with what get_code() needs to go on after
+ * a code which doesn't continue it: the longest prefix of the sequence
+ * that the codes received so far end with, as in Knuth-Morris-Pratt.
+ * Element 0 is ncode->code, element j > 0 is nodes[j].
+ */
+struct code_sequence {
+	int length;			/* number of codes */
+	int pos;			/* element ncode->current was at last */
+	struct ir_code_node **nodes;	/* nodes[0] is NULL, as ncode->current */
+	int *fail;			/* longest proper border of the first j */
+};
+
+/*
+ * Hash index of the single codes of a remote, keyed on the code as made
+ * by gen_ir_code() with the ignore_mask bits set; match_ir_code() is
+ * equality of these keys, trying the received code also with the
+ * toggle_bit_mask flipped. Codes sending a sequence keep the linear
+ * scan, their matching depends on the sequence state; a table per
+ * sequence gives the state to go on from after a code not continuing it.
+ */
+struct ir_code_index {
+	/* values of the remote the keys depend on */
+	struct ir_ncode *codes;
+	int flags;
+	int bits, pre_data_bits, post_data_bits;
+	ir_code pre_data, post_data, ignore_mask;
+
+	unsigned int mask;		/* of the slot number */
+	struct code_slot *slots;	/* linear probing, in order of the codes */
+	struct ir_ncode **sequences;	/* NULL terminated */
+	struct code_sequence *tables;	/* of sequences[i] */
+	struct ir_code_node **nodes;	/* of all tables */
+	int *fail;
+};
+
+static unsigned int code_hash(ir_code key)
+{
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+static ir_code code_key(const struct ir_remote *remote, ir_code code)
+{
+	return (gen_ir_code(remote, remote->pre_data, code, remote->post_data) | remote->ignore_mask);
+}
+
+static int index_is_current(const struct ir_remote *remote)
+{
+	const struct ir_code_index *index = remote->code_index;
+
+	return (index->codes == remote->codes && index->flags == remote->flags && index->bits == remote->bits
+		&& index->pre_data_bits == remote->pre_data_bits && index->post_data_bits == remote->post_data_bits
+		&& index->pre_data == remote->pre_data && index->post_data == remote->post_data
+		&& index->ignore_mask == remote->ignore_mask);
+}
+
+void ir_remote_free_index(struct ir_remote *remote)
+{
+	if (remote->code_index == NULL)
+		return;
+	free(remote->code_index->slots);
+	free(remote->code_index->sequences);
+	free(remote->code_index->tables);
+	free(remote->code_index->nodes);
+	free(remote->code_index->fail);
+	free(remote->code_index);
+	remote->code_index = NULL;
+}
+
+/* Fill in the table of the sequence codes sends, nodes and fail allocated. */
+static void sequence_table(struct ir_ncode *codes, struct code_sequence *t)
+{
+	struct ir_code_node *node;
+	int j, f;
+
+	t->nodes[0] = NULL;
+	for (j = 1, node = codes->next; node != NULL; node = node->next)
+		t->nodes[j++] = node;
+	t->fail[0] = 0;
+	if (t->length > 1)
+		t->fail[1] = 0;
+	for (j = 2, f = 0; j < t->length; j++) {
+		while (f > 0 && get_ir_code(codes, t->nodes[f]) != get_ir_code(codes, t->nodes[j - 1]))
+			f = t->fail[f];
+		if (get_ir_code(codes, t->nodes[f]) == get_ir_code(codes, t->nodes[j - 1]))
+			f++;
+		t->fail[j] = f;
+	}
+	t->pos = 0;
+}
+
+/* The element of the sequence codes->current is at. */
+static int sequence_pos(struct code_sequence *t, const struct ir_ncode *codes)
+{
+	int j;
+
+	if (t->nodes[t->pos] == codes->current)
+		return (t->pos);
+	/* moved on by a matching code, or done */
+	if (codes->current == NULL)
+		return (t->pos = 0);
+	if (t->pos + 1 < t->length && t->nodes[t->pos + 1] == codes->current)
+		return (++t->pos);
+	for (j = 1; j < t->length; j++) {
+		if (t->nodes[j] == codes->current)
+			return (t->pos = j);
+	}
+	return (t->pos = 0);
+}
+
+void ir_remote_index_codes(struct ir_remote *remote)
+{
+	struct ir_code_index *index;
+	struct ir_ncode *codes;
+	struct ir_code_node *node;
+	unsigned int size, h;
+	int n = 0, sequences = 0, elements = 0;
+
+	ir_remote_free_index(remote);
+	if (remote->codes == NULL)
+		return;
+	for (codes = remote->codes; codes->name != NULL; codes++) {
+		if (codes->next != NULL) {
+			sequences++;
+			for (elements++, node = codes->next; node != NULL; node = node->next)
+				elements++;
+		} else {
+			n++;
+		}
+	}
+	for (size = 8; size < 2 * n; size *= 2)
+		;
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		return;
+	index->slots = calloc(size, sizeof(struct code_slot));
+	index->sequences = calloc(sequences + 1, sizeof(struct ir_ncode *));
+	index->tables = calloc(sequences + 1, sizeof(struct code_sequence));
+	index->nodes = calloc(elements + 1, sizeof(struct ir_code_node *));
+	index->fail = calloc(elements + 1, sizeof(int));
+	if (index->slots == NULL || index->sequences == NULL || index->tables == NULL || index->nodes == NULL
+	    || index->fail == NULL) {
+		logprintf(LIRC_WARNING, "out of memory, not indexing codes of %s", remote->name);
+		remote->code_index = index;
+		ir_remote_free_index(remote);
+		return;
+	}
+	index->mask = size - 1;
+	sequences = 0;
+	elements = 0;
+	for (codes = remote->codes; codes->name != NULL; codes++) {
+		ir_code key;
+
+		if (codes->next != NULL) {
+			struct code_sequence *t = &index->tables[sequences];
+
+			for (t->length = 1, node = codes->next; node != NULL; node = node->next)
+				t->length++;
+			t->nodes = index->nodes + elements;
+			t->fail = index->fail + elements;
+			elements += t->length;
+			sequence_table(codes, t);
+			index->sequences[sequences++] = codes;
+			continue;
+		}
+		key = code_key(remote, codes->code);
+		/* duplicates are probed in order, the first one is found */
+		for (h = code_hash(key) & index->mask; index->slots[h].code != NULL; h = (h + 1) & index->mask)
+			;
+		index->slots[h].key = key;
+		index->slots[h].code = codes;
+	}
+	index->codes = remote->codes;
+	index->flags = remote->flags;
+	index->bits = remote->bits;
+	index->pre_data_bits = remote->pre_data_bits;
+	index->post_data_bits = remote->post_data_bits;
+	index->pre_data = remote->pre_data;
+	index->post_data = remote->post_data;
+	index->ignore_mask = remote->ignore_mask;
+	remote->code_index = index;
+}
+
+static struct ir_ncode *index_lookup(const struct ir_code_index *index, ir_code key)
+{
+	unsigned int h;
+
+	for (h = code_hash(key) & index->mask; index->slots[h].code != NULL; h = (h + 1) & index->mask) {
+		if (index->slots[h].key == key)
+			return (index->slots[h].code);
+	}
+	return (NULL);
+}
+
+/* The first single code which match_ir_code() would accept. */
+static struct ir_ncode *find_single_code(struct ir_remote *remote, ir_code all, int repeat_flag)
+{
+	ir_code received[4];
+	struct ir_ncode *found = NULL, *code;
+	int i, n = 0;
+
+	received[n++] = all;
+	received[n++] = all ^ remote->toggle_bit_mask;
+	if (repeat_flag && has_repeat_mask(remote)) {
+		received[n++] = all ^ remote->repeat_mask;
+		received[n++] = all ^ remote->repeat_mask ^ remote->toggle_bit_mask;
+	}
+	for (i = 0; i < n; i++) {
+		code = index_lookup(remote->code_index, received[i] | remote->ignore_mask);
+		if (code != NULL && (found == NULL || code < found))
+			found = code;
+	}
+	return (found);
+}
+
 /**
  *
  * @param remotes
@@ -350,7 +589,8 @@ static struct ir_ncode *get_code(struct ir_remote *remote, ir_code pre, ir_code
 {
 	ir_code pre_mask, code_mask, post_mask, toggle_bit_mask_state, all;
 	int found_code, have_code;
-	struct ir_ncode *codes, *found;
+	struct ir_ncode *codes, *found, *single;
+	struct ir_ncode **sequence = NULL;
 
 	pre_mask = code_mask = post_mask = 0;
 
@@ -412,8 +652,17 @@ static struct ir_ncode *get_code(struct ir_remote *remote, ir_code pre, ir_code
 	found_code = 0;
 	have_code = 0;
 	codes = remote->codes;
+	if (remote->code_index != NULL) {
+		if (!index_is_current(remote))
+			ir_remote_index_codes(remote);
+		/* with an index only sequences are scanned */
+		if (remote->code_index != NULL) {
+			sequence = remote->code_index->sequences;
+			codes = *sequence;
+		}
+	}
 	if (codes != NULL) {
-		while (codes->name != NULL) {
+		while (codes != NULL && codes->name != NULL) {
 			ir_code next_all;
 
 			next_all =
@@ -436,6 +685,27 @@ static struct ir_ncode *get_code(struct ir_remote *remote, ir_code pre, ir_code
 						have_code = 1;
 					}
 				}
+			} else if (sequence != NULL) {
+				/* find longest matching sequence, by its table */
+				struct code_sequence *t;
+				int j;
+
+				t = &remote->code_index->tables[sequence - remote->code_index->sequences];
+				j = sequence_pos(t, codes);
+				t->pos = 0;
+				while (j > 0) {
+					j = t->fail[j];
+					next_all = gen_ir_code(remote, remote->pre_data, get_ir_code(codes, t->nodes[j]),
+							       remote->post_data);
+					if (match_ir_code(remote, next_all, all)) {
+						t->pos = j + 1;
+						found_code = 1;
+						if (!have_code)
+							found = codes;
+						break;
+					}
+				}
+				codes->current = t->nodes[t->pos];
 			} else {
 				/* find longest matching sequence */
 				struct ir_code_node *search;
@@ -480,9 +750,17 @@ static struct ir_ncode *get_code(struct ir_remote *remote, ir_code pre, ir_code
 						codes->current = NULL;
 				}
 			}
-			codes++;
+			codes = sequence != NULL ? *++sequence : codes + 1;
 		}
 	}
+	if (sequence != NULL) {
+		single = find_single_code(remote, all, *repeat_flag);
+		/* the scan would have stopped at the first complete match */
+		if (single != NULL && (!have_code || single < found))
+			found = single;
+		if (single != NULL)
+			found_code = 1;
+	}
 	if (!found_code && dyncodes) {
 		if (remote->dyncodes[remote->dyncode].code != code) {
 			remote->dyncode++;
@@ -511,7 +789,6 @@ static struct ir_ncode *get_code(struct ir_remote *remote, ir_code pre, ir_code
 static __u64 set_code(struct ir_remote * remote, struct ir_ncode * found, ir_code toggle_bit_mask_state, struct decode_ctx_t* ctx)
 {
 	struct timeval current;
-	static struct ir_remote *last_decoded = NULL;
 
 	LOGPRINTF(1, "found: %s", found->name);
 
@@ -609,6 +886,94 @@ int write_message(char *buffer, size_t size, const char *remote_name, const char
 	return len;
 }
 
+/*
+ * The order decode_all() tries a list of remotes in with adaptive
+ * ordering. A remote which decodes a frame is moved ahead of the remotes
+ * before it as long as they can't decode the same frames, so of any two
+ * remotes which might, the one first in the list is always tried first.
+ * Remotes with a toggle_mask keep their place: trying them has an effect
+ * even when they fail. The list itself is left alone.
+ */
+struct decode_order {
+	int n;
+	unsigned int resolution;	/* overlap is computed for */
+	struct ir_remote **tried;	/* the remotes in the order tried */
+	int *index;			/* position of tried[i] in the list */
+	unsigned char *overlap;		/* [i * n + j] for list positions i, j */
+};
+
+void ir_remote_free_order(struct ir_remote *remote)
+{
+	struct decode_order *order = remote->decode_order;
+
+	if (order == NULL)
+		return;
+	free(order->tried);
+	free(order->index);
+	free(order->overlap);
+	free(order);
+	remote->decode_order = NULL;
+}
+
+/* The order to try remotes in, NULL to try them in list order. */
+static struct decode_order *decode_order(struct ir_remote *remotes)
+{
+	struct decode_order *order = remotes->decode_order;
+	struct ir_remote *a, *b;
+	int i, j, n = 0;
+
+	if (curr_driver->decode_func != receive_decode
+	    || (curr_driver->rec_mode != LIRC_MODE_MODE2 && curr_driver->rec_mode != LIRC_MODE_PULSE
+		&& curr_driver->rec_mode != LIRC_MODE_RAW))
+		return (NULL);
+	/* overlaps for a lower resolution hold */
+	if (order != NULL && curr_driver->resolution <= order->resolution)
+		return (order);
+	ir_remote_free_order(remotes);
+	for (a = remotes; a != NULL; a = a->next)
+		n++;
+	order = calloc(1, sizeof(*order));
+	if (order == NULL)
+		return (NULL);
+	order->tried = malloc(n * sizeof(struct ir_remote *));
+	order->index = malloc(n * sizeof(int));
+	order->overlap = malloc((size_t) n * n);
+	if (order->tried == NULL || order->index == NULL || order->overlap == NULL) {
+		logprintf(LIRC_WARNING, "out of memory, not ordering remotes");
+		remotes->decode_order = order;
+		ir_remote_free_order(remotes);
+		return (NULL);
+	}
+	for (i = 0, a = remotes; a != NULL; i++, a = a->next) {
+		order->tried[i] = a;
+		order->index[i] = i;
+		for (j = 0, b = remotes; b != NULL; j++, b = b->next)
+			order->overlap[i * n + j] = has_toggle_mask(a) || has_toggle_mask(b)
+				|| receive_may_overlap(a, b);
+	}
+	order->n = n;
+	order->resolution = curr_driver->resolution;
+	remotes->decode_order = order;
+	return (order);
+}
+
+/* The remote tried at pos decoded the frame, move it ahead. */
+static void decode_order_hit(struct decode_order *order, int pos)
+{
+	struct ir_remote *remote = order->tried[pos];
+	int i = order->index[pos];
+
+	/* the last one stays, see decode_all() */
+	if (i == order->n - 1)
+		return;
+	for (; pos > 0 && !order->overlap[i * order->n + order->index[pos - 1]]; pos--) {
+		order->tried[pos] = order->tried[pos - 1];
+		order->index[pos] = order->index[pos - 1];
+	}
+	order->tried[pos] = remote;
+	order->index[pos] = i;
+}
+
 /**
  * Tries to decode current signal trying all known remotes.
  * @param remotes
@@ -623,11 +988,37 @@ char *decode_all(struct ir_remote *remotes)
 	struct ir_remote *scan;
 	struct ir_ncode *scan_ncode;
 	struct decode_ctx_t ctx;
+	struct decode_order *order;
+	int pos;
 
 	/* use remotes carefully, it may be changed on SIGHUP */
 	decoding = remote = remotes;
-	while (remote) {
+	order = adaptive_order && remotes != NULL ? decode_order(remotes) : NULL;
+	if (order != NULL)
+		remote = order->tried[0];
+	if (compiled_decoder && curr_driver->decode_func == receive_decode)
+		receive_match_start(remotes);
+	for (pos = 0; remote != NULL;
+	     pos++, remote = order != NULL ? (pos < order->n ? order->tried[pos] : NULL) : remote->next) {
+		/*
+		 * Skip remotes whose timing doesn't fit the frame, or with
+		 * the compiled decoder can't decode it. Not the last one:
+		 * where its decode stops reading decides what's kept in the
+		 * buffer if all fail.
+		 */
+		if (curr_driver->decode_func == receive_decode && remote->next != NULL
+		    && !(compiled_decoder ? receive_match(remote) : receive_may_decode(remote))) {
+			LOGPRINTF(1, "skipped \"%s\" remote", remote->name);
+			/* read by lircd's STATS, maybe from another thread */
+			__atomic_fetch_add(&decode_stats.pruned, 1, __ATOMIC_RELAXED);
+			/* as sync_rec_buffer() of a failing decode */
+			remote->toggle_mask_state = 0;
+			if (has_toggle_mask(remote))
+				remote->toggle_code = NULL;
+			continue;
+		}
 		LOGPRINTF(1, "trying \"%s\" remote", remote->name);
+		__atomic_fetch_add(&decode_stats.decodes, 1, __ATOMIC_RELAXED);
 		if (curr_driver->decode_func(remote, &ctx)
 		    && (ncode = get_code(remote, ctx.pre, ctx.code, ctx.post, &ctx.repeat_flag, &toggle_bit_mask_state))) {
 			int len;
@@ -637,6 +1028,10 @@ char *decode_all(struct ir_remote *remotes)
 				strncpy(message, PACKET_EOF, sizeof(message));
 				return message;
 			}
+			__atomic_fetch_add(&decode_stats.decoded, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&decode_stats.attempts, pos + 1, __ATOMIC_RELAXED);
+			if (order != NULL)
+				decode_order_hit(order, pos);
 			ctx.code = set_code(remote, ncode, toggle_bit_mask_state, &ctx);
 			if ((has_toggle_mask(remote) && remote->toggle_mask_state % 2) || ncode->current != NULL) {
 				decoding = NULL;
@@ -676,7 +1071,6 @@ char *decode_all(struct ir_remote *remotes)
 			LOGPRINTF(1, "failed \"%s\" remote", remote->name);
 		}
 		remote->toggle_mask_state = 0;
-		remote = remote->next;
 	}
 	decoding = NULL;
 	last_remote = NULL;
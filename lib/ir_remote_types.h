@@ -64,6 +64,9 @@ struct ir_code_node {
 	struct ir_code_node *next;
 };
 
+/** A code's frame compiled for transmitting, private to transmit.c. */
+struct ir_waveform;
+
 /**
  * IR Command, corresponding to one (command defining) line of the
  * configuration file.
@@ -93,6 +96,9 @@ struct ir_ncode {
 
 	/** (private) */
 	struct ir_code_node *transmit_state;
+
+	/** (private) Compiled transmit frames, see send_buffer_put(). */
+	struct ir_waveform *waveforms;
 };
 
 /*
@@ -155,6 +161,102 @@ struct decode_ctx_t {
 };
 
 
+/** Index of a remote's codes, private to ir_remote.c. */
+struct ir_code_index;
+
+/** Order decode_all() tries a list of remotes in, private to ir_remote.c. */
+struct decode_order;
+
+/** Raw codes of a remote prepared for matching, private to receive.c. */
+struct ir_raw_table;
+
+/* kinds of struct ir_signature */
+#define SIGNATURE_ANY		0	/**< no prefilter, always decode */
+#define SIGNATURE_HEADER	1	/**< first pulse is the header */
+#define SIGNATURE_LEAD		2	/**< first pulse starts with plead */
+#define SIGNATURE_RAW		3	/**< first pulse of a raw code */
+#define SIGNATURE_BITS		4	/**< first pulse is a one or zero */
+
+/**
+ * Timing of the start of a frame the remote can decode, used to skip
+ * remotes which can't match, see receive_signature(). The tolerance of
+ * the remote is applied when checking.
+ */
+struct ir_signature {
+	int kind;		/**< SIGNATURE_* */
+	lirc_t pulse_min;	/**< shortest expected first pulse */
+	lirc_t pulse_max;	/**< longest expected first pulse, 0 if no limit */
+	lirc_t space_min;	/**< shortest expected first space, 0 if no limit */
+};
+
+/* steps of a compiled frame, see receive_compile() */
+#define MATCH_HEADER	1	/**< header pulse, header space pending */
+#define MATCH_LEAD	2	/**< leading pulse, merged into the next one */
+#define MATCH_BITS	3	/**< pre_data, code or post_data bits */
+#define MATCH_PRE_PS	4	/**< pre_p and pre_s after pre_data */
+#define MATCH_POST_PS	5	/**< post_p and post_s before post_data */
+#define MATCH_TRAIL	6	/**< trailing pulse */
+#define MATCH_FOOT	7	/**< foot space and pulse */
+#define MATCH_GAP	8	/**< gap after the frame */
+#define MATCH_STEPS	10
+
+/* results of struct ir_match_state */
+#define MATCH_RUNNING	0	/**< more to check, data buffered */
+#define MATCH_REJECT	1	/**< receive_decode() fails */
+#define MATCH_ACCEPT	2	/**< receive_decode() might succeed */
+#define MATCH_SUSPEND	3	/**< waiting for more buffered data */
+
+/** Where receive_match() is in a frame for one remote. */
+struct ir_match_state {
+	int result;		/**< MATCH_* result */
+	int step;		/**< index in ir_matcher.steps */
+	int bit;		/**< bits done in a MATCH_BITS step */
+	int pos;		/**< next sample in the receive buffer */
+	lirc_t pendingp;
+	lirc_t pendings;
+	lirc_t sum;		/**< as rec_buffer.sum */
+	ir_code code;		/**< bits of the current MATCH_BITS step */
+};
+
+/**
+ * The frame layout of a remote as a list of steps, run over the receive
+ * buffer for all remotes together, see receive_compile().
+ */
+struct ir_matcher {
+	int compiled;		/**< set if receive_match() can check the remote */
+	int nsteps;
+	struct {
+		int op;		/**< MATCH_* step */
+		int bits;	/**< for MATCH_BITS */
+		int done;	/**< bits before this step, for MATCH_BITS */
+	} steps[MATCH_STEPS];
+	struct ir_match_state state;
+};
+
+/** Lengths expect() accepts for one timing. */
+struct ir_window {
+	lirc_t min;
+	lirc_t max;
+};
+
+/**
+ * The windows of a remote's timings for its eps and aeps and the driver
+ * resolution, recomputed by receive_decode() when one of them changes.
+ */
+struct ir_windows {
+	int set;		/**< the windows below have been computed */
+	int eps;		/**< eps they are for */
+	int aeps;		/**< larger of aeps and resolution they are for */
+	struct ir_window phead, shead;
+	struct ir_window pone, sone, pzero, szero;
+	struct ir_window pone2, sone2, pzero2, szero2;	/**< double length RC6 bits */
+	struct ir_window plead, ptrail, pfoot, sfoot;
+	struct ir_window prepeat, srepeat;
+	struct ir_window pre_p, pre_s, post_p, post_s;
+	lirc_t min_gap;		/**< shortest space expect_at_least() takes for min_gap() */
+	lirc_t max_gap;		/**< longest space expect_at_most() takes for max_gap() */
+};
+
 /**
  * One remote as represented in the configuration file.
  */
@@ -248,6 +350,14 @@ struct ir_remote {
 	int release_detected;	/**< set by release generator */
 	int manual_sort;        /**< If set in any remote, disables automatic sorting. */
 	struct ir_remote* next;
+	struct ir_code_index* code_index;	/**< See ir_remote_index_codes(). */
+	struct decode_order* decode_order;	/**< See ir_remote_set_adaptive_order(). */
+	struct ir_signature signature;	/**< See receive_signature(). */
+	struct ir_matcher matcher;	/**< See receive_compile(). */
+	struct ir_raw_table* raw_table;	/**< See receive_compile_raw(). */
+	struct ir_windows windows;	/**< accepted lengths of the timings */
+	/** Decoder of the remote's bits, see receive_select_decoder(). */
+	ir_code (*get_data)(struct ir_remote* remote, int bits, int done);
 };
 
 #ifdef	__cplusplus
@@ -0,0 +1,62 @@
+/****************************************************************************
+ ** config_cache.h **********************************************************
+ ****************************************************************************
+ *
+ * Binary cache of the parsed config files.
+ *
+ */
+
+/**
+ * @file config_cache.h
+ * @brief  Binary snapshot of the parsed lircd.conf and its includes.
+ * @ingroup private_api
+ *
+ * read_config_cached() loads the remotes from a cache file written by
+ * an earlier call instead of parsing the config files. The cache is
+ * used when none of the files read for it has changed: a file is
+ * unchanged if its mtime and size are the same or else its contents
+ * hash to the same value, and the files an include glob matches must
+ * be the same ones. Otherwise the config is parsed and the cache is
+ * written again, so the caller gets the same result either way.
+ */
+
+/**
+ * @addtogroup private_api
+ * @{
+ */
+
+#ifndef  _CONFIG_CACHE_H
+#define  _CONFIG_CACHE_H
+
+#include <glob.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "lirc/ir_remote.h"
+
+/**
+ * Read a lircd.conf config file as read_config() does, using a cache.
+ *
+ * @param f Open FILE* connection to file.
+ * @param name Path of the open file f.
+ * @param cache_path Cache file, read_config() is used if NULL.
+ * @return Pointer to dynamically allocated ir_remote or NULL on errors,
+ *     freed using free_config().
+ */
+struct ir_remote* read_config_cached(FILE* f, const char* name, const char* cache_path);
+
+/** @cond */
+/* Called by read_config() for each file it reads and include it globs. */
+void config_cache_note_file(const char* path);
+void config_cache_note_glob(const char* pattern, const glob_t* globbuf);
+/** @endcond */
+
+/** @} */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -182,6 +182,46 @@ struct driver {
 	int (*const close_func)(void);   /**< Hard closing, returns 0 on OK.*/
 	const char* info;		 /**< Free text driver info. */
 
+// API version 3 addons:
+
+	/**
+	 * Optional: get all pulses/spaces the hardware has ready, in one
+	 * go. Used instead of readdata() if set.
+	 * @param data Where to store the samples, in readdata() format.
+	 * @param count Max number of samples to store.
+	 * @param timeout Max time to wait for the first sample (us).
+	 * @return Number of samples stored, 0 on timeout or errors.
+	 */
+	int (*const readdata_batch)(lirc_t* data, int count, lirc_t timeout);
+
+	/**
+	 * Optional: send the transmit buffer as prepared by
+	 * send_buffer_add(), holding several codes. Used for
+	 * SEND_SEQUENCE if set, else the codes are sent one by one.
+	 * @param remote The remote of the last code in the buffer. All
+	 *               codes in it share its frequency and duty cycle.
+	 * @return 0 on errors, else 1.
+	 */
+	int (*const send_buffer_func)(struct ir_remote* remote);
+
+	/**
+	 * Optional: send signals on the transmitters in mask only, for
+	 * hardware driving several emitters independently. Unlike the
+	 * other functions, lircd calls it from several threads at once,
+	 * for disjoint masks, and while receiving. Setting it tells lircd
+	 * to send jobs for different transmitters in parallel; the
+	 * transmitter mask of send_func is not changed by it. Only the
+	 * file driver has it: the transmitter mask set on a device, as
+	 * by default, applies to all writes.
+	 * @param remote The remote of the signals, for the carrier.
+	 * @param mask Transmitters to use, 0 for the default ones.
+	 * @param signals Pulses and spaces (us), starting with a pulse.
+	 * @param length Number of signals, odd.
+	 * @return 0 on errors, else 1.
+	 */
+	int (*const send_channel_func)(struct ir_remote* remote, __u32 mask,
+				       const lirc_t* signals, int length);
+
 };
 
 /** @} */
@@ -42,6 +42,12 @@ extern "C" {
  */
 extern struct ir_remote *last_remote;
 
+/**
+ * The remote decoded last, a repeat must be of it. Unlike last_remote
+ * not cleared when decoding fails. Defined in ir_remote.c.
+ */
+extern struct ir_remote* last_decoded;
+
 
 /**
  * Global pointer to the remote that contains the code currently repeating. Defined in ir_remote.c.
@@ -452,6 +458,17 @@ void map_gap(const struct ir_remote* remote,
 struct ir_ncode* get_code_by_name(const struct ir_remote* remote,
 				  const char* name);
 
+/**
+ * Build the index used to look up received codes, done by read_config().
+ * An index which doesn't match the remote any more, e. g. after irrecord
+ * changed its masks, is rebuilt on next use. Without an index (out of
+ * memory) codes are looked up by a linear scan.
+ */
+void ir_remote_index_codes(struct ir_remote* remote);
+
+/** Free the index built by ir_remote_index_codes(). */
+void ir_remote_free_index(struct ir_remote* remote);
+
 int write_message(char* buffer,
 		  size_t size,
 		  const char* remote_name,
@@ -470,6 +487,16 @@ int write_message(char* buffer,
  */
 char* decode_all(struct ir_remote* remotes);
 
+/** Counters kept by decode_all(). */
+struct decode_stats {
+	unsigned long decodes;	/**< Remotes tried with the full decoder. */
+	unsigned long pruned;	/**< Remotes skipped by receive_may_decode() or receive_match(). */
+	unsigned long decoded;	/**< Frames a remote has decoded. */
+	unsigned long attempts;	/**< Remotes tried or skipped for these, including the decoding one. */
+};
+
+extern struct decode_stats decode_stats;
+
 /**
  * Transmits the actual code in the second  argument by calling the 
  * current hardware driver.  The processing depends on global 
@@ -496,6 +523,24 @@ int send_ir_ncode(struct ir_remote* remote, struct ir_ncode* code, int delay);
  */
 void ir_remote_init(int use_dyncodes);
 
+/**
+ * Let decode_all() check frames for all remotes in one pass with
+ * receive_match() before running receive_decode() on the remotes which
+ * might match. Decoded codes are the same as without it.
+ */
+void ir_remote_set_compiled_decoder(int enable);
+
+/**
+ * Let decode_all() try the remotes which decoded the last frames first.
+ * A remote moves ahead only of remotes which can't decode the frames it
+ * does, as told by the timing of the first pulse, so decoded codes are
+ * the same as in file order. The last remote stays last.
+ */
+void ir_remote_set_adaptive_order(int enable);
+
+/** Free the order decode_all() keeps for the list starting at remote. */
+void ir_remote_free_order(struct ir_remote* remote);
+
 /** @} */
 
 #endif
@@ -122,6 +122,7 @@
 
 #include "lirc/paths.h"
 #include "lirc/lirc_config.h"
+#include "lirc/lirc_events.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -265,6 +266,85 @@ int lirc_nextcode(char** code);
  */
 int lirc_code2char(struct lirc_config* config, char* code, char** string);
 
+/** An event from lircd as returned by lirc_nextevent(). */
+struct lirc_event {
+	uint64_t code;		/**< The decoded code. */
+	uint64_t timestamp;	/**< CLOCK_MONOTONIC in microseconds, 0 if unknown. */
+	unsigned int reps;	/**< Repeat count. */
+	int release;		/**< Set for release events from binary records. */
+	const char* remote;	/**< Remote name. */
+	const char* button;	/**< Button name, for release events with suffix. */
+	const char* source;	/**< Where the event came from, NULL if untagged. */
+};
+
+/**
+ * Ask lircd to send events as fixed-size binary records, see
+ * lirc_events.h, sparing lircd and the client the text formatting and
+ * parsing. Events must then be read using lirc_nextevent().
+ *
+ * @return -1 on errors, else 0.
+ * @since 0.9.3
+ */
+int lirc_binary_events(void);
+
+/**
+ * Get next event from the lircd daemon. Handles both text and binary
+ * events, replies to commands are skipped.
+ *
+ * @param event Undefined on enter. If 1 is returned the event, with
+ *     strings valid until the next call.
+ * @return 1 if an event was read, 0 if none is available on a
+ *     non-blocking socket, -1 on errors.
+ * @since 0.9.3
+ */
+int lirc_nextevent(struct lirc_event* event);
+
+/**
+ * Translate an event from lirc_nextevent() to an application string,
+ * like lirc_code2char().
+ *
+ * @return -1 on errors, else 0.
+ * @since 0.9.3
+ */
+int lirc_event2char(struct lirc_config* config, const struct lirc_event* event, char** string);
+
+/** A mapped lircd event ring, see lirc_ring_open(). */
+struct lirc_ring;
+
+/**
+ * Map the event ring of a local lircd. Afterwards events are no longer
+ * written to the socket but only to the ring, which all local readers
+ * share; read them using lirc_ring_nextcode(). Commands can still be
+ * sent on the socket.
+ *
+ * @param fd Socket connected to lircd, e. g. from lirc_init().
+ * @return The ring, or NULL on errors.
+ * @since 0.9.3
+ */
+struct lirc_ring* lirc_ring_open(int fd);
+
+/**
+ * Get next code from the event ring, like lirc_nextcode().
+ *
+ * @param ring Ring from lirc_ring_open().
+ * @param code Undefined on enter. On exit either NULL if no code was
+ *     available in time, else a malloc()'d code string.
+ * @param timeout Max time to wait in milliseconds, -1 waits forever.
+ * @return -1 on errors, else 0.
+ * @since 0.9.3
+ */
+int lirc_ring_nextcode(struct lirc_ring* ring, char** code, int timeout);
+
+/**
+ * Number of events which were overwritten in the ring before they
+ * were read.
+ * @since 0.9.3
+ */
+unsigned long lirc_ring_lost(const struct lirc_ring* ring);
+
+/** Unmap and free a ring from lirc_ring_open(). */
+void lirc_ring_close(struct lirc_ring* ring);
+
 
 /* new interface for client daemon */
 	/**
@@ -368,6 +448,27 @@ void lirc_command_reply_to_stdout(lirc_cmd_ctx* ctx);
  * */
 int lirc_send_one(int fd, const char* remote, const char* keysym);
 
+/** A code for lirc_send_sequence(). */
+struct lirc_send_item {
+	const char* remote;	/**< Name of remote. */
+	const char* keysym;	/**< The code to send. */
+	int repeat;		/**< Number of repeats, at least 0. */
+};
+
+/**
+ * Send several codes in one request, e. g. a macro. lircd sends them
+ * with the pauses between codes it would make for separate SEND_ONCE
+ * requests, if possible in one write to the driver. This call might
+ * block until all codes are sent.
+ *
+ * @param fd File descriptor for lircd socket, as for lirc_send_one().
+ * @param items The codes, in the order they are sent.
+ * @param count Number of items.
+ * @return -1 on errors, else 0.
+ * @since 0.9.3
+ */
+int lirc_send_sequence(int fd, const struct lirc_send_item* items, int count);
+
 
 /**
  * Send a simulated lirc event.This call might block for some time
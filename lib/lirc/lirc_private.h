@@ -18,6 +18,7 @@
 #include "lirc/lirc_log.h"
 #include "lirc/lirc_options.h"
 #include "lirc/config_file.h"
+#include "lirc/config_cache.h"
 #include "lirc/dump_config.h"
 #include "lirc/input_map.h"
 #include "lirc/driver.h"
@@ -40,7 +40,13 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include "lirc_client.h"
 #include<netinet/in.h>
@@ -96,8 +102,30 @@ static int lirc_verbose = 0;
 static char *lirc_prog = NULL;
 static char *lirc_buffer = NULL;
 
+/* lirc_nextevent() input, text lines and binary frames */
+static char *lirc_event_buffer = NULL;
+static size_t lirc_event_size = 0;
+static size_t lirc_event_len = 0;
+static int lirc_event_reply = 0;	/* inside a BEGIN/END block */
+
+/* The name table of binary events, see lirc_events.h. */
+static struct {
+	char *data;
+	uint32_t generation;
+	const char **remotes;
+	unsigned int remoten;
+	unsigned int *first;		/* first button of each remote */
+	const char **buttons;
+	unsigned int buttonn;
+	const char **sources;
+	unsigned int sourcen;
+	const char *suffix;
+} lirc_names;
+
 char *prog;
 
+static void lirc_names_free(void);
+
 /** Wrapper for write(2) which logs errors. */
 static inline void
 chk_write(int fd, const void *buf, size_t count, const char* msg)
@@ -374,6 +402,12 @@ int lirc_deinit(void)
 		free(lirc_buffer);
 		lirc_buffer = NULL;
 	}
+	free(lirc_event_buffer);
+	lirc_event_buffer = NULL;
+	lirc_event_size = 0;
+	lirc_event_len = 0;
+	lirc_event_reply = 0;
+	lirc_names_free();
 	return (close(lirc_lircd));
 }
 
@@ -1655,16 +1689,59 @@ char *lirc_ir2char(struct lirc_config *config, char *code)
 }
 
 
-static int lirc_code2char_internal(struct lirc_config *config, char *code, char **string, char **prog)
+/* Find the next lircrc translation of a button press. */
+static int lirc_button2char(struct lirc_config *config, char *remote, char *button, int rep, char **string,
+			    char **prog)
 {
-	int rep;
-	char *backup;
-	char *remote, *button;
 	char *s = NULL;
 	struct lirc_config_entry *scan;
 	int exec_level;
 	int quit_happened;
 
+	scan = config->next;
+	quit_happened = 0;
+	while (scan != NULL) {
+		exec_level = lirc_iscode(scan, remote, button, rep);
+		if (exec_level > 0 &&
+		    (scan->mode == NULL ||
+		     (scan->mode != NULL &&
+		      config->current_mode != NULL &&
+		      strcasecmp(scan->mode, config->current_mode) == 0)) && quit_happened == 0) {
+			if (exec_level > 1) {
+				s = lirc_execute(config, scan);
+				if (s != NULL && prog != NULL) {
+					*prog = scan->prog;
+				}
+			} else {
+				s = NULL;
+			}
+			if (scan->flags & quit) {
+				quit_happened = 1;
+				config->next = NULL;
+				scan = scan->next;
+				continue;
+			} else if (s != NULL) {
+				config->next = scan->next;
+				break;
+			}
+		}
+		scan = scan->next;
+	}
+	if (s != NULL) {
+		*string = s;
+		return (0);
+	}
+	config->next = config->first;
+	return (0);
+}
+
+
+static int lirc_code2char_internal(struct lirc_config *config, char *code, char **string, char **prog)
+{
+	int rep, ret;
+	char *backup;
+	char *remote, *button;
+
 	*string = NULL;
 	if (sscanf(code, "%*x %x %*s %*s\n", &rep) == 1) {
 		backup = strdup(code);
@@ -1680,41 +1757,9 @@ static int lirc_code2char_internal(struct lirc_config *config, char *code, char
 			free(backup);
 			return (0);
 		}
-
-		scan = config->next;
-		quit_happened = 0;
-		while (scan != NULL) {
-			exec_level = lirc_iscode(scan, remote, button, rep);
-			if (exec_level > 0 &&
-			    (scan->mode == NULL ||
-			     (scan->mode != NULL &&
-			      config->current_mode != NULL &&
-			      strcasecmp(scan->mode, config->current_mode) == 0)) && quit_happened == 0) {
-				if (exec_level > 1) {
-					s = lirc_execute(config, scan);
-					if (s != NULL && prog != NULL) {
-						*prog = scan->prog;
-					}
-				} else {
-					s = NULL;
-				}
-				if (scan->flags & quit) {
-					quit_happened = 1;
-					config->next = NULL;
-					scan = scan->next;
-					continue;
-				} else if (s != NULL) {
-					config->next = scan->next;
-					break;
-				}
-			}
-			scan = scan->next;
-		}
+		ret = lirc_button2char(config, remote, button, rep, string, prog);
 		free(backup);
-		if (s != NULL) {
-			*string = s;
-			return (0);
-		}
+		return (ret);
 	}
 	config->next = config->first;
 	return (0);
@@ -1832,6 +1877,446 @@ int lirc_nextcode(char **code)
 }
 
 
+int lirc_binary_events(void)
+{
+	const char cmd[] = "SET_BINARY_EVENTS ON\n";
+
+	/* the reply is skipped by lirc_nextevent() */
+	if (write(lirc_lircd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd))
+		return (-1);
+	return (0);
+}
+
+
+static void lirc_names_free(void)
+{
+	free(lirc_names.data);
+	free(lirc_names.remotes);
+	free(lirc_names.first);
+	free(lirc_names.buttons);
+	free(lirc_names.sources);
+	memset(&lirc_names, 0, sizeof(lirc_names));
+}
+
+
+/* Parse a LIRC_FRAME_NAMES frame, returns -1 if it's garbled. */
+static int lirc_names_load(const char *frame, uint32_t length)
+{
+	struct lirc_names_header header;
+	const char *p, *end, *name;
+	unsigned int remoten = 0, buttonn = 0, sourcen = 0;
+	int pass;
+
+	if (length < sizeof(header))
+		return (-1);
+	memcpy(&header, frame, sizeof(header));
+	lirc_names_free();
+	lirc_names.data = (char *)malloc(length);
+	if (lirc_names.data == NULL)
+		return (-1);
+	memcpy(lirc_names.data, frame, length);
+	lirc_names.generation = header.generation;
+	end = lirc_names.data + length;
+	/* count the entries, then fill in the pointers */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			lirc_names.remotes = (const char **)malloc((remoten + 1) * sizeof(char *));
+			lirc_names.first = (unsigned int *)malloc((remoten + 1) * sizeof(unsigned int));
+			lirc_names.buttons = (const char **)malloc((buttonn + 1) * sizeof(char *));
+			lirc_names.sources = (const char **)malloc((sourcen + 1) * sizeof(char *));
+			if (lirc_names.remotes == NULL || lirc_names.first == NULL
+			    || lirc_names.buttons == NULL || lirc_names.sources == NULL)
+				goto error;
+			remoten = buttonn = sourcen = 0;
+		}
+		for (p = lirc_names.data + sizeof(header); p < end; p = name + strlen(name) + 1) {
+			name = p + 1;
+			if (name >= end || memchr(name, 0, end - name) == NULL)
+				goto error;
+			switch (*p) {
+			case LIRC_NAME_REMOTE:
+				if (pass == 1) {
+					lirc_names.remotes[remoten] = name;
+					lirc_names.first[remoten] = buttonn;
+				}
+				remoten++;
+				break;
+			case LIRC_NAME_BUTTON:
+				if (remoten == 0)
+					goto error;
+				if (pass == 1)
+					lirc_names.buttons[buttonn] = name;
+				buttonn++;
+				break;
+			case LIRC_NAME_SOURCE:
+				if (pass == 1)
+					lirc_names.sources[sourcen] = name;
+				sourcen++;
+				break;
+			case LIRC_NAME_SUFFIX:
+				if (pass == 1)
+					lirc_names.suffix = name;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	lirc_names.first[remoten] = buttonn;
+	lirc_names.remoten = remoten;
+	lirc_names.buttonn = buttonn;
+	lirc_names.sourcen = sourcen;
+	return (0);
+error:
+	lirc_names_free();
+	return (-1);
+}
+
+
+/* Translate a binary event, returns 0 if it doesn't match the name table. */
+static int lirc_event_binary(struct lirc_event *event, const char *frame, uint32_t length)
+{
+	static char button[PACKET_SIZE + 1];
+	struct lirc_event_record rec;
+	unsigned int index;
+
+	if (length < sizeof(rec))
+		return (0);
+	memcpy(&rec, frame, sizeof(rec));
+	if (rec.generation != lirc_names.generation || rec.remote >= lirc_names.remoten)
+		return (0);
+	index = lirc_names.first[rec.remote] + rec.button;
+	if (index >= lirc_names.first[rec.remote + 1])
+		return (0);
+	event->code = rec.code;
+	event->timestamp = rec.timestamp;
+	event->reps = rec.reps;
+	event->release = (rec.flags & LIRC_EVENT_RELEASE) != 0;
+	event->remote = lirc_names.remotes[rec.remote];
+	event->button = lirc_names.buttons[index];
+	if (event->release && lirc_names.suffix != NULL) {
+		snprintf(button, sizeof(button), "%s%s", event->button, lirc_names.suffix);
+		event->button = button;
+	}
+	event->source = NULL;
+	if (rec.source > 0 && rec.source <= lirc_names.sourcen)
+		event->source = lirc_names.sources[rec.source - 1];
+	return (1);
+}
+
+
+/* Parse a text line, returns 0 if it isn't an event. */
+static int lirc_event_text(struct lirc_event *event, char *line)
+{
+	char *code, *reps, *button, *remote, *source;
+
+	if (strcmp(line, "BEGIN\n") == 0) {
+		lirc_event_reply = 1;
+		return (0);
+	}
+	if (lirc_event_reply) {
+		if (strcmp(line, "END\n") == 0)
+			lirc_event_reply = 0;
+		return (0);
+	}
+	code = strtok(line, " ");
+	reps = strtok(NULL, " ");
+	button = strtok(NULL, " \n");
+	remote = strtok(NULL, " \n");
+	source = strtok(NULL, " \n");
+	if (code == NULL || reps == NULL || button == NULL || remote == NULL)
+		return (0);
+	event->code = strtoull(code, NULL, 16);
+	event->timestamp = 0;
+	event->reps = strtoul(reps, NULL, 16);
+	event->release = 0;
+	event->remote = remote;
+	event->button = button;
+	event->source = source != NULL && strcmp(source, "-") != 0 ? source : NULL;
+	return (1);
+}
+
+
+int lirc_nextevent(struct lirc_event *event)
+{
+	static char line[PACKET_SIZE + 1];
+	struct lirc_frame_header header;
+	char *end;
+	size_t len, need;
+	ssize_t n;
+	int ret;
+
+	while (1) {
+		need = lirc_event_len + PACKET_SIZE;
+		while (lirc_event_len > 0) {
+			if (lirc_event_buffer[0] == LIRC_FRAME_MARK) {
+				if (lirc_event_len < sizeof(header))
+					break;
+				memcpy(&header, lirc_event_buffer, sizeof(header));
+				if (header.length < sizeof(header))
+					return (-1);
+				if (lirc_event_len < header.length) {
+					need = header.length;
+					break;
+				}
+				if (header.type == LIRC_FRAME_NAMES)
+					ret = lirc_names_load(lirc_event_buffer, header.length);
+				else if (header.type == LIRC_FRAME_EVENT)
+					ret = lirc_event_binary(event, lirc_event_buffer, header.length);
+				else
+					ret = 0;
+				len = header.length;
+			} else {
+				end = (char *)memchr(lirc_event_buffer, '\n', lirc_event_len);
+				if (end == NULL)
+					break;
+				len = end - lirc_event_buffer + 1;
+				snprintf(line, sizeof(line), "%.*s", (int)len, lirc_event_buffer);
+				ret = lirc_event_text(event, line);
+			}
+			lirc_event_len -= len;
+			memmove(lirc_event_buffer, lirc_event_buffer + len, lirc_event_len);
+			if (ret != 0)
+				return (ret);
+		}
+		if (need > lirc_event_size) {
+			char *new_buffer;
+
+			new_buffer = (char *)realloc(lirc_event_buffer, need);
+			if (new_buffer == NULL)
+				return (-1);
+			lirc_event_buffer = new_buffer;
+			lirc_event_size = need;
+		}
+		n = read(lirc_lircd, lirc_event_buffer + lirc_event_len, lirc_event_size - lirc_event_len);
+		if (n <= 0) {
+			if (n == -1 && errno == EAGAIN)
+				return (0);
+			return (-1);
+		}
+		lirc_event_len += n;
+	}
+}
+
+
+int lirc_event2char(struct lirc_config *config, const struct lirc_event *event, char **string)
+{
+	char code[PACKET_SIZE + 1];
+	char *remote, *button;
+	int ret;
+
+	*string = NULL;
+	if (config->sockfd != -1) {
+		/* lircrcd wants the text */
+		snprintf(code, sizeof(code), "%016llx %02x %s %s\n",
+			 (unsigned long long)event->code, event->reps, event->button, event->remote);
+		return (lirc_code2char(config, code, string));
+	}
+	remote = strdup(event->remote);
+	button = strdup(event->button);
+	ret = -1;
+	if (remote != NULL && button != NULL)
+		ret = lirc_button2char(config, remote, button, event->reps, string, NULL);
+	free(remote);
+	free(button);
+	return (ret);
+}
+
+
+struct lirc_ring {
+	const struct lirc_ring_header *header;
+	size_t size;
+	uint64_t next;		/* number of the next event to read */
+	unsigned long lost;	/* events overwritten before they were read */
+};
+
+
+/* Read the GET_EVENT_RING reply, returns the descriptor passed or -1. */
+static int lirc_ring_reply(int fd)
+{
+	char buf[PACKET_SIZE + 1];
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	struct pollfd pfd;
+	char *line, *end;
+	size_t len = 0;
+	ssize_t n;
+	int ringfd = -1, state = 0, success = 0;
+
+	/* events sent before the reply are discarded */
+	while (state != 3) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, LIRC_TIMEOUT * 1000) != 1)
+			break;
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf + len;
+		iov.iov_len = PACKET_SIZE - len;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		n = recvmsg(fd, &msg, 0);
+		if (n <= 0)
+			break;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+				if (ringfd != -1)
+					close(ringfd);
+				memcpy(&ringfd, CMSG_DATA(cmsg), sizeof(int));
+			}
+		}
+		len += n;
+		buf[len] = '\0';
+		for (line = buf; state != 3 && (end = strchr(line, '\n')) != NULL; line = end + 1) {
+			*end = '\0';
+			if (state == 0 && strcmp(line, "BEGIN") == 0)
+				state = 1;
+			else if (state == 1)
+				state = strcmp(line, "GET_EVENT_RING") == 0 ? 2 : 0;
+			else if (state == 2 && strcmp(line, "SUCCESS") == 0)
+				success = 1;
+			else if (state == 2 && strcmp(line, "END") == 0)
+				state = 3;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+		if (len == PACKET_SIZE)
+			len = 0;
+	}
+	if (state != 3 || !success) {
+		if (ringfd != -1)
+			close(ringfd);
+		return (-1);
+	}
+	return (ringfd);
+}
+
+
+struct lirc_ring *lirc_ring_open(int fd)
+{
+	static const char cmd[] = "GET_EVENT_RING\n";
+	struct lirc_ring *ring;
+	struct stat st;
+	void *map;
+	int ringfd;
+
+	if (write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd))
+		return (NULL);
+	ringfd = lirc_ring_reply(fd);
+	if (ringfd == -1)
+		return (NULL);
+	ring = (struct lirc_ring *)calloc(1, sizeof(struct lirc_ring));
+	if (ring == NULL || fstat(ringfd, &st) == -1 || st.st_size < (off_t)sizeof(struct lirc_ring_header)) {
+		free(ring);
+		close(ringfd);
+		return (NULL);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, ringfd, 0);
+	close(ringfd);
+	if (map == MAP_FAILED) {
+		free(ring);
+		return (NULL);
+	}
+	ring->header = (const struct lirc_ring_header *)map;
+	ring->size = st.st_size;
+	if (ring->header->magic != LIRC_RING_MAGIC || ring->header->version != LIRC_RING_VERSION
+	    || ring->header->slots == 0 || ring->header->slot_size <= sizeof(struct lirc_ring_slot)
+	    || ring->size < sizeof(struct lirc_ring_header)
+			    + (size_t)ring->header->slots * ring->header->slot_size) {
+		lirc_ring_close(ring);
+		return (NULL);
+	}
+	ring->next = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+	return (ring);
+}
+
+
+void lirc_ring_close(struct lirc_ring *ring)
+{
+	if (ring == NULL)
+		return;
+	munmap((void *)ring->header, ring->size);
+	free(ring);
+}
+
+
+unsigned long lirc_ring_lost(const struct lirc_ring *ring)
+{
+	return (ring->lost);
+}
+
+
+/* Wait for the ring head to move on from head, returns 0 on timeout. */
+static int lirc_ring_wait(struct lirc_ring *ring, uint64_t head, int timeout)
+{
+#if defined(__linux__) && defined(SYS_futex)
+	struct timespec ts;
+
+	if (timeout == 0)
+		return (0);
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	if (syscall(SYS_futex, &ring->header->futex, FUTEX_WAIT, (uint32_t)head, timeout > 0 ? &ts : NULL,
+		    NULL, 0) == -1 && (errno == ETIMEDOUT || errno == EINTR))
+		return (0);
+	return (1);
+#else
+	/* lircd has no ring without futexes */
+	return (0);
+#endif
+}
+
+
+int lirc_ring_nextcode(struct lirc_ring *ring, char **code, int timeout)
+{
+	const struct lirc_ring_header *header = ring->header;
+	const struct lirc_ring_slot *slot;
+	uint64_t head, seq;
+	uint32_t len;
+	char *text;
+
+	*code = NULL;
+	while (1) {
+		head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+		if (ring->next == head) {
+			if (!lirc_ring_wait(ring, head, timeout))
+				return (0);
+			continue;
+		}
+		if (head - ring->next > header->slots) {
+			ring->lost += head - ring->next - header->slots;
+			ring->next = head - header->slots;
+		}
+		slot = (const struct lirc_ring_slot *)((const char *)(header + 1)
+						       + (ring->next % header->slots) * header->slot_size);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == ring->next + 1) {
+			len = slot->length;
+			if (len > header->slot_size - sizeof(*slot) - 1)
+				len = header->slot_size - sizeof(*slot) - 1;
+			text = (char *)malloc(len + 1);
+			if (text == NULL)
+				return (-1);
+			memcpy(text, slot + 1, len);
+			text[len] = '\0';
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+				ring->next++;
+				*code = text;
+				return (0);
+			}
+			free(text);
+		}
+		/* overwritten by a newer event meanwhile */
+		ring->lost++;
+		ring->next++;
+	}
+}
+
+
 size_t lirc_getsocketname(const char *id, char *buf, size_t size)
 {
 	id = id != NULL ? id : "default";
@@ -1909,6 +2394,31 @@ int lirc_send_one(int fd, const char* remote, const char* keysym)
 }
 
 
+int lirc_send_sequence(int fd, const struct lirc_send_item* items, int count)
+{
+	lirc_cmd_ctx command;
+	char packet[PACKET_SIZE];
+	int i, r, len;
+
+	if (count <= 0)
+		return EINVAL;
+	len = snprintf(packet, sizeof(packet), "SEND_SEQUENCE");
+	for (i = 0; i < count && len < (int)sizeof(packet); i++) {
+		len += snprintf(packet + len, sizeof(packet) - len, " %s %s %d",
+				items[i].remote, items[i].keysym, items[i].repeat);
+	}
+	if (len >= (int)sizeof(packet))
+		return EMSGSIZE;
+	r = lirc_command_init(&command, "%s\n", packet);
+	if (r != 0)
+		return EMSGSIZE;
+	do {
+		r = lirc_command_run(&command, fd);
+	} while (r == EAGAIN);
+	return r;
+}
+
+
 int lirc_simulate(int fd,
    		  const char* remote,
                   const char* keysym,
@@ -0,0 +1,119 @@
+/****************************************************************************
+ ** lirc_events.h ***********************************************************
+ ****************************************************************************
+ *
+ * Binary event records sent by lircd.
+ *
+ */
+
+/**
+ * @file lirc_events.h
+ * @brief Binary framing of lircd events, see SET_BINARY_EVENTS.
+ * @ingroup lirc_client
+ *
+ * A client which sends SET_BINARY_EVENTS ON gets decoded events as
+ * fixed-size struct lirc_event_record frames instead of text lines. The
+ * remote, button and source are given as indexes into a name table,
+ * which lircd sends as a LIRC_FRAME_NAMES frame right after the command
+ * and again each time the configuration is reloaded.
+ *
+ * Frames are mixed with the usual text: replies to commands and events
+ * which don't map to the name table (simulated buttons not in the
+ * config, events relayed from other lircd instances, dynamic codes) are
+ * still sent as text
+ * lines. A frame always starts with LIRC_FRAME_MARK, which never starts
+ * a text line. All fields are in host byte order, thus binary events
+ * are only available on the local socket.
+ */
+
+#ifndef _LIRC_EVENTS_H
+#define _LIRC_EVENTS_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** First byte of every binary frame. */
+#define LIRC_FRAME_MARK		0
+
+#define LIRC_FRAME_EVENT	1	/**< A struct lirc_event_record. */
+#define LIRC_FRAME_NAMES	2	/**< A struct lirc_names_header and entries. */
+
+/** Common start of all binary frames. */
+struct lirc_frame_header {
+	uint8_t mark;		/**< LIRC_FRAME_MARK */
+	uint8_t type;		/**< LIRC_FRAME_EVENT or LIRC_FRAME_NAMES */
+	uint16_t reserved;
+	uint32_t length;	/**< Size of the whole frame including this header. */
+};
+
+/** Event flag: a generated release event, see lircd --release. */
+#define LIRC_EVENT_RELEASE	0x01
+
+/** A decoded event. */
+struct lirc_event_record {
+	struct lirc_frame_header header;
+	uint64_t code;		/**< The decoded code. */
+	uint64_t timestamp;	/**< CLOCK_MONOTONIC when sent, in microseconds. */
+	uint32_t reps;		/**< Repeat count. */
+	uint32_t remote;	/**< Index of the remote in the name table. */
+	uint32_t button;	/**< Index of the button within its remote. */
+	uint32_t source;	/**< Index of the source, 0 if untagged. */
+	uint32_t flags;		/**< LIRC_EVENT_RELEASE */
+	uint32_t generation;	/**< Of the name table the indexes refer to. */
+};
+
+/*
+ * Name table entries follow the header, each a kind byte followed by a
+ * nul-terminated name. Remotes and sources are numbered in the order
+ * they appear, remotes from 0 and sources from 1. Buttons are numbered
+ * from 0 within the remote they follow.
+ */
+#define LIRC_NAME_REMOTE	1
+#define LIRC_NAME_BUTTON	2
+#define LIRC_NAME_SOURCE	3
+#define LIRC_NAME_SUFFIX	4	/**< Appended to buttons of release events. */
+
+/** Start of a LIRC_FRAME_NAMES frame. */
+struct lirc_names_header {
+	struct lirc_frame_header header;
+	uint32_t generation;	/**< Incremented for each new table. */
+	uint32_t count;		/**< Number of entries. */
+};
+
+/*
+ * The shared event ring, see GET_EVENT_RING. lircd is the only writer;
+ * readers map the memory read-only. The header is followed by slots
+ * slots of slot_size bytes, each a struct lirc_ring_slot followed by
+ * the event text. Event n is in slot n % slots, where it's overwritten
+ * by event n + slots: readers check seq before and after copying it.
+ * Readers wait for new events with FUTEX_WAIT on futex.
+ */
+#define LIRC_RING_MAGIC		0x6c697263	/**< "lirc" */
+#define LIRC_RING_VERSION	1
+
+/** Start of the shared event ring. */
+struct lirc_ring_header {
+	uint32_t magic;		/**< LIRC_RING_MAGIC */
+	uint32_t version;	/**< LIRC_RING_VERSION */
+	uint32_t slots;		/**< Number of slots, a power of two. */
+	uint32_t slot_size;	/**< Size of a slot including its header. */
+	uint32_t futex;		/**< Low 32 bits of head, changed on each event. */
+	uint32_t reserved;
+	uint64_t head;		/**< Number of events written so far. */
+};
+
+/** Start of a ring slot, the nul-terminated event text follows. */
+struct lirc_ring_slot {
+	uint64_t seq;		/**< Event number + 1, 0 while being written. */
+	uint32_t length;	/**< Of the text, without the nul. */
+	uint32_t reserved;
+};
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _LIRC_EVENTS_H */
@@ -19,26 +19,40 @@
 # include <config.h>
 #endif
 
+#define _GNU_SOURCE
+
 #include <limits.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include "include/media/lirc.h"
 #include "lirc/driver.h"
 #include "lirc/lirc_log.h"
 #include "lirc/receive.h"
 
+/* initial size of the receive buffer, a power of two */
 #define RBUF_SIZE 512
 
+/* the buffer grows up to this, so that noise can't eat up memory */
+#define RBUF_MAX 65536
+
+/* samples read at once by readdata_batch() */
+#define RBUF_BATCH 128
+
 #define REC_SYNC 8
 
 extern struct driver hw;
 extern struct ir_remote *last_remote;
 
 /**
- * Structure for the receiving buffer.
+ * Structure for the receiving buffer, a ring growing as needed. The
+ * frame being decoded starts at head, rptr and wptr count from there.
  */
 struct rbuf {
-	lirc_t data[RBUF_SIZE];
+	lirc_t* data;
+	unsigned int size;	/**< allocated samples, a power of two */
+	unsigned int head;	/**< ring index of the frame's first sample */
 	ir_code decoded;
 	int rptr;
 	int wptr;
@@ -50,6 +64,9 @@ struct rbuf {
 	struct timeval last_signal_time;
 	int at_eof;
 	FILE* input_log;
+	lirc_t batch[RBUF_BATCH];	/**< read by readdata_batch(), not used yet */
+	int batch_rptr;
+	int batch_wptr;
 };
 
 
@@ -58,12 +75,39 @@ struct rbuf {
  */
 static struct rbuf rec_buffer;
 
+/** Sample i of the frame in the receive buffer. */
+#define RBUF(i) (rec_buffer.data[(rec_buffer.head + (i)) & (rec_buffer.size - 1)])
+
+/**
+ * State of receive_match() for the frame decode_all() is working on.
+ */
+static struct {
+	struct ir_remote *remotes;	/**< the remotes tried */
+	int sync;		/**< result of frame_sync() */
+	int start;		/**< first sample after the sync space */
+	int wptr;		/**< rec_buffer.wptr at the last run */
+	int stale;		/**< buffered data was changed by a decoder */
+} match;
+
 
 static lirc_t readdata(lirc_t timeout)
 {
 	lirc_t data;
 
-	data = curr_driver->readdata(timeout);
+	if (rec_buffer.batch_rptr < rec_buffer.batch_wptr) {
+		data = rec_buffer.batch[rec_buffer.batch_rptr++];
+	} else if (curr_driver->api_version >= 3 && curr_driver->readdata_batch != NULL) {
+		rec_buffer.batch_rptr = 0;
+		rec_buffer.batch_wptr = curr_driver->readdata_batch(rec_buffer.batch, RBUF_BATCH, timeout);
+		if (rec_buffer.batch_wptr > 0) {
+			data = rec_buffer.batch[rec_buffer.batch_rptr++];
+		} else {
+			rec_buffer.batch_wptr = 0;
+			data = 0;
+		}
+	} else {
+		data = curr_driver->readdata(timeout);
+	}
 	rec_buffer.at_eof =  data & LIRC_EOF ? 1 : 0;
 	if (rec_buffer.at_eof){
 		logprintf(LIRC_DEBUG, "receive: Got EOF");
@@ -98,68 +142,120 @@ static void log_input(lirc_t data)
 }
 
 
-static lirc_t get_next_rec_buffer_internal(lirc_t maxusec)
+/*
+ * Make room for one more sample. The ring is doubled when full,
+ * which is the only time samples are copied.
+ */
+static int rbuf_reserve(void)
 {
-	if (rec_buffer.rptr < rec_buffer.wptr) {
-		LOGPRINTF(3, "<%c%lu", rec_buffer.data[rec_buffer.rptr] & PULSE_BIT ? 'p' : 's', (__u32)
-			  rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK));
-		rec_buffer.sum += rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK);
-		return (rec_buffer.data[rec_buffer.rptr++]);
-	} else {
-		if (rec_buffer.wptr < RBUF_SIZE) {
-			lirc_t data = 0;
-			unsigned long elapsed = 0;
+	lirc_t *data;
+	unsigned int size, i;
 
-			if (timerisset(&rec_buffer.last_signal_time)) {
-				struct timeval current;
+	if ((unsigned int) rec_buffer.wptr < rec_buffer.size)
+		return (1);
+	if (rec_buffer.size >= RBUF_MAX)
+		return (0);
+	size = rec_buffer.size > 0 ? 2 * rec_buffer.size : RBUF_SIZE;
+	data = malloc(size * sizeof(lirc_t));
+	if (data == NULL) {
+		logprintf(LIRC_ERROR, "out of memory for the receive buffer");
+		return (0);
+	}
+	for (i = 0; i < (unsigned int) rec_buffer.wptr; i++)
+		data[i] = RBUF(i);
+	free(rec_buffer.data);
+	rec_buffer.data = data;
+	rec_buffer.size = size;
+	rec_buffer.head = 0;
+	return (1);
+}
 
-				gettimeofday(&current, NULL);
-				elapsed = time_elapsed(&rec_buffer.last_signal_time, &current);
-			}
-			if (elapsed < maxusec) {
-				data = readdata(maxusec - elapsed);
-			}
-			if (!data) {
-				LOGPRINTF(3, "timeout: %u", maxusec);
-				return 0;
-			}
-			if (data & LIRC_EOF){
-				logprintf(LIRC_DEBUG, "Receive: returning EOF");
-				return data;
-			}
-			if (LIRC_IS_TIMEOUT(data)) {
-				LOGPRINTF(1, "timeout received: %lu", (__u32) LIRC_VALUE(data));
-				if (LIRC_VALUE(data) < maxusec) {
-					return get_next_rec_buffer_internal(maxusec - LIRC_VALUE(data));
-				}
-				return 0;
-			}
+/*
+ * Read one sample from the driver into the buffer at wptr. Returns the
+ * sample, or 0 or the EOF data if nothing was stored.
+ */
+static lirc_t rbuf_read(lirc_t maxusec)
+{
+	lirc_t data = 0;
+	unsigned long elapsed = 0;
 
-			rec_buffer.data[rec_buffer.wptr] = data;
-			if (rec_buffer.input_log != NULL){
-				log_input(data);
-			}
-			if (rec_buffer.data[rec_buffer.wptr] == 0)
-				return (0);
-			rec_buffer.sum += rec_buffer.data[rec_buffer.rptr]
-			    & (PULSE_MASK);
-			rec_buffer.wptr++;
-			rec_buffer.rptr++;
-			LOGPRINTF(3, "+%c%lu", rec_buffer.data[rec_buffer.rptr - 1] & PULSE_BIT ? 'p' : 's', (__u32)
-				  rec_buffer.data[rec_buffer.rptr - 1]
-				  & (PULSE_MASK));
-			return (rec_buffer.data[rec_buffer.rptr - 1]);
-		} else {
-			rec_buffer.too_long = 1;
-			return (0);
+	if (!rbuf_reserve()) {
+		rec_buffer.too_long = 1;
+		return (0);
+	}
+	if (timerisset(&rec_buffer.last_signal_time)) {
+		struct timeval current;
+
+		gettimeofday(&current, NULL);
+		elapsed = time_elapsed(&rec_buffer.last_signal_time, &current);
+	}
+	if (elapsed < maxusec) {
+		data = readdata(maxusec - elapsed);
+	}
+	if (!data) {
+		LOGPRINTF(3, "timeout: %u", maxusec);
+		return 0;
+	}
+	if (data & LIRC_EOF){
+		logprintf(LIRC_DEBUG, "Receive: returning EOF");
+		return data;
+	}
+	if (LIRC_IS_TIMEOUT(data)) {
+		LOGPRINTF(1, "timeout received: %lu", (__u32) LIRC_VALUE(data));
+		if (LIRC_VALUE(data) < maxusec) {
+			return rbuf_read(maxusec - LIRC_VALUE(data));
 		}
+		return 0;
 	}
-	return (0);
+
+	RBUF(rec_buffer.wptr) = data;
+	if (rec_buffer.input_log != NULL){
+		log_input(data);
+	}
+	if (RBUF(rec_buffer.wptr) == 0)
+		return (0);
+	rec_buffer.wptr++;
+	return (data);
+}
+
+/*
+ * Make sure sample pos is buffered, reading it as get_next_rec_buffer(maxusec)
+ * would. Decoders which read ahead use this. Returns 0 if the driver had
+ * nothing; it's up to the caller not to ask again for the same sample.
+ */
+static int rbuf_fill(int pos, lirc_t maxusec)
+{
+	if (pos < rec_buffer.wptr)
+		return (1);
+	rbuf_read(receive_timeout(maxusec));
+	return (pos < rec_buffer.wptr);
+}
+
+static lirc_t get_next_rec_buffer_internal(lirc_t maxusec)
+{
+	lirc_t data;
+
+	if (rec_buffer.rptr < rec_buffer.wptr) {
+		LOGPRINTF(3, "<%c%lu", RBUF(rec_buffer.rptr) & PULSE_BIT ? 'p' : 's', (__u32)
+			  RBUF(rec_buffer.rptr) & (PULSE_MASK));
+		rec_buffer.sum += RBUF(rec_buffer.rptr) & (PULSE_MASK);
+		return (RBUF(rec_buffer.rptr++));
+	}
+	data = rbuf_read(maxusec);
+	if (rec_buffer.rptr == rec_buffer.wptr)
+		return (data);
+	rec_buffer.sum += RBUF(rec_buffer.rptr)
+	    & (PULSE_MASK);
+	rec_buffer.rptr++;
+	LOGPRINTF(3, "+%c%lu", RBUF(rec_buffer.rptr - 1) & PULSE_BIT ? 'p' : 's', (__u32)
+		  RBUF(rec_buffer.rptr - 1)
+		  & (PULSE_MASK));
+	return (RBUF(rec_buffer.rptr - 1));
 }
 
 /**
  * Wait until data is available in drv.fd, timeout or a signal is raised.
- * @param maxusec timeout in micro seconds, given to select(2). If <= 0, the
+ * @param maxusec timeout in micro seconds, given to ppoll(2). If <= 0, the
  *       function will block indefinetaly, until data is available or a
  *       sugnal is processed. If positive, a timeout value in microseconds.
  * @return True (1) if there is data available in drv.fd, else 0 indicating
@@ -167,34 +263,43 @@ static lirc_t get_next_rec_buffer_internal(lirc_t maxusec)
  */
 int waitfordata(__u32 maxusec)
 {
-	fd_set fds;
+	struct pollfd pfd;
+#if defined(__linux__)
+	struct timespec timeout;
+#endif
 	int ret;
-	struct timeval tv;
 
 	while (1) {
-		FD_ZERO(&fds);
-		FD_SET(curr_driver->fd, &fds);
+		pfd.fd = curr_driver->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
 		do {
 			do {
 				if (maxusec > 0) {
-					tv.tv_sec = maxusec / 1000000;
-					tv.tv_usec = maxusec % 1000000;
-					ret = select(curr_driver->fd + 1, &fds, NULL, NULL, &tv);
+#if defined(__linux__)
+					/* short timeouts are exact, not rounded to ms */
+					timeout.tv_sec = maxusec / 1000000;
+					timeout.tv_nsec = (maxusec % 1000000) * 1000;
+					ret = ppoll(&pfd, 1, &timeout, NULL);
+#else
+					/* round up, poll(2) has ms resolution */
+					ret = poll(&pfd, 1, (maxusec + 999) / 1000);
+#endif
 					if (ret == 0)
 						return (0);
 				} else {
-					ret = select(curr_driver->fd + 1, &fds, NULL, NULL, NULL);
+					ret = poll(&pfd, 1, -1);
 				}
 			}
 			while (ret == -1 && errno == EINTR);
 			if (ret == -1) {
-				logperror(LIRC_ERROR, "select() failed");
+				logperror(LIRC_ERROR, "poll() failed");
 				continue;
 			}
 		}
 		while (ret == -1);
 
-		if (FD_ISSET(curr_driver->fd, &fds)) {
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
 			/* we will read later */
 			return (1);
 		}
@@ -218,9 +323,24 @@ static lirc_t get_next_rec_buffer(lirc_t maxusec)
 
 void rec_buffer_init(void)
 {
+	free(rec_buffer.data);
 	memset(&rec_buffer, 0, sizeof(rec_buffer));
 }
 
+struct rbuf* rec_buffer_alloc(void)
+{
+	return calloc(1, sizeof(struct rbuf));
+}
+
+void rec_buffer_swap(struct rbuf* other)
+{
+	struct rbuf tmp;
+
+	memcpy(&tmp, &rec_buffer, sizeof(struct rbuf));
+	memcpy(&rec_buffer, other, sizeof(struct rbuf));
+	memcpy(other, &tmp, sizeof(struct rbuf));
+}
+
 void rec_buffer_rewind(void)
 {
 	rec_buffer.rptr = 0;
@@ -261,16 +381,18 @@ int rec_buffer_clear(void)
 
 		move = rec_buffer.wptr - rec_buffer.rptr;
 		if (move > 0 && rec_buffer.rptr > 0) {
-			memmove(&rec_buffer.data[0], &rec_buffer.data[rec_buffer.rptr],
-				sizeof(rec_buffer.data[0]) * move);
+			/* the unread samples start the next frame */
+			rec_buffer.head += rec_buffer.rptr;
 			rec_buffer.wptr -= rec_buffer.rptr;
 		} else {
 			rec_buffer.wptr = 0;
+			if (!rbuf_reserve())
+				return (0);
 			data = readdata(0);
 
 			LOGPRINTF(3, "c%lu", (__u32) data & (PULSE_MASK));
 
-			rec_buffer.data[rec_buffer.wptr] = data;
+			RBUF(rec_buffer.wptr) = data;
 			rec_buffer.wptr++;
 		}
 	}
@@ -281,14 +403,19 @@ int rec_buffer_clear(void)
 	return (1);
 }
 
+int rec_buffer_batched(void)
+{
+	return (rec_buffer.batch_wptr - rec_buffer.batch_rptr);
+}
+
 static  void unget_rec_buffer(int count)
 {
 	LOGPRINTF(5, "unget: %d", count);
 	if (count == 1 || count == 2) {
 		rec_buffer.rptr -= count;
-		rec_buffer.sum -= rec_buffer.data[rec_buffer.rptr] & (PULSE_MASK);
+		rec_buffer.sum -= RBUF(rec_buffer.rptr) & (PULSE_MASK);
 		if (count == 2) {
-			rec_buffer.sum -= rec_buffer.data[rec_buffer.rptr + 1]
+			rec_buffer.sum -= RBUF(rec_buffer.rptr + 1)
 			    & (PULSE_MASK);
 		}
 	}
@@ -296,9 +423,10 @@ static  void unget_rec_buffer(int count)
 
 static  void unget_rec_buffer_delta(lirc_t delta)
 {
+	match.stale = 1;
 	rec_buffer.rptr--;
 	rec_buffer.sum -= delta & (PULSE_MASK);
-	rec_buffer.data[rec_buffer.rptr] = delta;
+	RBUF(rec_buffer.rptr) = delta;
 }
 
 static  lirc_t get_next_pulse(lirc_t maxusec)
@@ -501,515 +629,1613 @@ static  int expectzero(struct ir_remote *remote, int bit)
 	return (1);
 }
 
-static  lirc_t sync_rec_buffer(struct ir_remote * remote)
+/*
+ * Finds the start of the buffered frame as sync_rec_buffer() does.
+ * Returns 1 and sets *start to the first sample after the sync space
+ * and *gap to that space, 0 if sync_rec_buffer() fails and -1 if too
+ * little is buffered to tell. A buffer starting with a pulse gives -1
+ * too, the decoder may read it differently, so it's left to that.
+ */
+static int frame_sync(int *start, lirc_t *gap)
 {
-	int count;
-	lirc_t deltas, deltap;
+	int i = 0, count = 0;
 
-	count = 0;
-	deltas = get_next_space(1000000);
-	if (deltas == 0)
+	if (rec_buffer.wptr < 1 || is_pulse(RBUF(0)))
+		return (-1);
+	if (RBUF(0) == 0)
 		return (0);
-
-	if (last_remote != NULL && !is_rcmm(remote)) {
-		while (!expect_at_least(last_remote, deltas, last_remote->min_remaining_gap)) {
-			deltap = get_next_pulse(1000000);
-			if (deltap == 0)
+	if (last_remote != NULL) {
+		while (!expect_at_least(last_remote, RBUF(i), last_remote->min_remaining_gap)) {
+			if (i + 1 >= rec_buffer.wptr)
+				return (-1);
+			if (!is_pulse(RBUF(i + 1)) || (RBUF(i + 1) & (PULSE_MASK)) == 0)
 				return (0);
-			deltas = get_next_space(1000000);
-			if (deltas == 0)
+			if (i + 2 >= rec_buffer.wptr)
+				return (-1);
+			if (!is_space(RBUF(i + 2)) || RBUF(i + 2) == 0)
 				return (0);
+			i += 2;
 			count++;
-			if (count > REC_SYNC) {	/* no sync found,
-						   let's try a diffrent remote */
+			if (count > REC_SYNC)
 				return (0);
-			}
-		}
-		if (has_toggle_mask(remote)) {
-			if (!expect_at_most(last_remote, deltas, last_remote->max_remaining_gap)) {
-				remote->toggle_mask_state = 0;
-				remote->toggle_code = NULL;
-			}
-
 		}
 	}
-	rec_buffer.sum = 0;
-	return (deltas);
+	*start = i + 1;
+	*gap = RBUF(i);
+	return (1);
 }
 
-static  int get_header(struct ir_remote *remote)
+/*
+ * The first pulse and space of the buffered frame. Returns how many of
+ * them are buffered.
+ */
+static int peek_frame_start(lirc_t *pulse, lirc_t *space)
 {
-	if (is_rcmm(remote)) {
-		lirc_t deltap, deltas, sum;
+	lirc_t gap;
+	int i;
 
-		deltap = get_next_pulse(remote->phead);
-		if (deltap == 0) {
-			unget_rec_buffer(1);
-			return (0);
-		}
-		deltas = get_next_space(remote->shead);
-		if (deltas == 0) {
-			unget_rec_buffer(2);
-			return (0);
-		}
-		sum = deltap + deltas;
-		if (expect(remote, sum, remote->phead + remote->shead)) {
-			return (1);
-		}
-		unget_rec_buffer(2);
+	if (frame_sync(&i, &gap) != 1)
 		return (0);
-	} else if (is_bo(remote)) {
-		if (expectpulse(remote, remote->pone) && expectspace(remote, remote->sone)
-		    && expectpulse(remote, remote->pone) && expectspace(remote, remote->sone)
-		    && expectpulse(remote, remote->phead) && expectspace(remote, remote->shead)) {
-			return 1;
-		}
-		return 0;
-	}
-	if (remote->shead == 0) {
-		if (!sync_pending_space(remote))
-			return 0;
-		set_pending_pulse(remote->phead);
-		return 1;
-	}
-	if (!expectpulse(remote, remote->phead)) {
-		unget_rec_buffer(1);
+	if (i >= rec_buffer.wptr || !is_pulse(RBUF(i)))
 		return (0);
-	}
-	/* if this flag is set I need a decision now if this is really
-	   a header */
-	if (remote->flags & NO_HEAD_REP) {
-		lirc_t deltas;
+	*pulse = RBUF(i) & (PULSE_MASK);
+	if (i + 1 >= rec_buffer.wptr || !is_space(RBUF(i + 1)) || RBUF(i + 1) == 0)
+		return (1);
+	*space = RBUF(i + 1);
+	return (2);
+}
 
-		deltas = get_next_space(remote->shead);
-		if (deltas != 0) {
-			if (expect(remote, remote->shead, deltas)) {
-				return (1);
+/* Largest difference expect() accepts. */
+static lirc_t tolerance(const struct ir_remote *remote, lirc_t exdelta)
+{
+	lirc_t aeps = curr_driver->resolution > remote->aeps ? curr_driver->resolution : remote->aeps;
+	lirc_t eps = exdelta * remote->eps / 100;
+
+	return (eps > aeps ? eps : aeps);
+}
+
+static void set_window(const struct ir_remote *remote, struct ir_window *w, lirc_t exdelta)
+{
+	lirc_t t = tolerance(remote, exdelta);
+
+	w->min = exdelta - t;
+	w->max = exdelta + t;
+}
+
+/* Same as expect() for the timing of the window. */
+static inline int in_window(const struct ir_window *w, lirc_t delta)
+{
+	return (delta >= w->min && delta <= w->max);
+}
+
+/* Recompute remote->windows if eps, aeps or the resolution have changed. */
+static void update_windows(struct ir_remote *remote)
+{
+	struct ir_windows *w = &remote->windows;
+	int aeps = curr_driver->resolution > remote->aeps ? curr_driver->resolution : remote->aeps;
+
+	if (w->set && w->eps == remote->eps && w->aeps == aeps)
+		return;
+	set_window(remote, &w->phead, remote->phead);
+	set_window(remote, &w->shead, remote->shead);
+	set_window(remote, &w->pone, remote->pone);
+	set_window(remote, &w->sone, remote->sone);
+	set_window(remote, &w->pzero, remote->pzero);
+	set_window(remote, &w->szero, remote->szero);
+	set_window(remote, &w->pone2, 2 * remote->pone);
+	set_window(remote, &w->sone2, 2 * remote->sone);
+	set_window(remote, &w->pzero2, 2 * remote->pzero);
+	set_window(remote, &w->szero2, 2 * remote->szero);
+	set_window(remote, &w->plead, remote->plead);
+	set_window(remote, &w->ptrail, remote->ptrail);
+	set_window(remote, &w->pfoot, remote->pfoot);
+	set_window(remote, &w->sfoot, remote->sfoot);
+	set_window(remote, &w->prepeat, remote->prepeat);
+	set_window(remote, &w->srepeat, remote->srepeat);
+	set_window(remote, &w->pre_p, remote->pre_p);
+	set_window(remote, &w->pre_s, remote->pre_s);
+	set_window(remote, &w->post_p, remote->post_p);
+	set_window(remote, &w->post_s, remote->post_s);
+	w->min_gap = min_gap(remote) - tolerance(remote, min_gap(remote));
+	w->max_gap = max_gap(remote) + tolerance(remote, max_gap(remote));
+	w->eps = remote->eps;
+	w->aeps = aeps;
+	w->set = 1;
+}
+
+/*
+ * A remote is skipped only if receive_decode() would fail: each kind
+ * covers remotes for which the first pulse (and space) after the sync
+ * is known to be checked against the given timing.
+ */
+void receive_signature(struct ir_remote *remote)
+{
+	struct ir_signature *sig = &remote->signature;
+	struct ir_ncode *codes;
+
+	memset(sig, 0, sizeof(*sig));
+	if (is_rcmm(remote) || is_bo(remote))
+		return;
+	if (has_header(remote)) {
+		/* the header may be missing */
+		if (remote->flags & NO_HEAD_REP)
+			return;
+		sig->kind = SIGNATURE_HEADER;
+		sig->pulse_min = sig->pulse_max = remote->phead;
+		/* the pending header space is checked by the next pulse */
+		if (is_space_enc(remote) && bit_count(remote) > 0
+		    && (remote->plead > 0 || (remote->pone > 0 && remote->pzero > 0)))
+			sig->space_min = remote->shead;
+	} else if (is_raw(remote)) {
+		if (remote->codes == NULL || remote->codes->name == NULL)
+			return;
+		for (codes = remote->codes; codes->name != NULL; codes++) {
+			if (codes->length == 0 || codes->signals == NULL) {
+				memset(sig, 0, sizeof(*sig));
+				return;
 			}
-			unget_rec_buffer(2);
-			return (0);
+			if (sig->pulse_min == 0 || codes->signals[0] < sig->pulse_min)
+				sig->pulse_min = codes->signals[0];
+			if (codes->signals[0] > sig->pulse_max)
+				sig->pulse_max = codes->signals[0];
+		}
+		sig->kind = SIGNATURE_RAW;
+	} else if (is_space_enc(remote) && bit_count(remote) > 0 && remote->pone > 0 && remote->pzero > 0) {
+		if (remote->plead > 0) {
+			/* the lead is merged into the first pulse */
+			sig->kind = SIGNATURE_LEAD;
+			sig->pulse_min = remote->plead;
+		} else {
+			sig->kind = SIGNATURE_BITS;
+			sig->pulse_min = remote->pone < remote->pzero ? remote->pone : remote->pzero;
+			sig->pulse_max = remote->pone > remote->pzero ? remote->pone : remote->pzero;
 		}
 	}
-
-	set_pending_space(remote->shead);
-	return (1);
 }
 
-static  int get_foot(struct ir_remote *remote)
+int receive_may_decode(const struct ir_remote *remote)
 {
-	if (!expectspace(remote, remote->sfoot))
+	const struct ir_signature *sig = &remote->signature;
+	lirc_t pulse, space;
+	int n;
+
+	if (sig->kind == SIGNATURE_ANY || rec_buffer.at_eof)
+		return (1);
+	if (curr_driver->rec_mode != LIRC_MODE_MODE2 && curr_driver->rec_mode != LIRC_MODE_PULSE
+	    && curr_driver->rec_mode != LIRC_MODE_RAW)
+		return (1);
+	/* might be a repeat code */
+	if (has_repeat(remote) && last_remote == remote)
+		return (1);
+	n = peek_frame_start(&pulse, &space);
+	if (n == 0)
+		return (1);
+	if (pulse + tolerance(remote, sig->pulse_min) < sig->pulse_min)
 		return (0);
-	if (!expectpulse(remote, remote->pfoot))
+	if (sig->pulse_max > 0 && pulse > sig->pulse_max + tolerance(remote, sig->pulse_max))
+		return (0);
+	if (n == 2 && sig->space_min > 0 && space + tolerance(remote, sig->space_min) < sig->space_min)
 		return (0);
 	return (1);
 }
 
-static  int get_lead(struct ir_remote *remote)
+/*
+ * The lengths of the first pulse after the sync receive_decode() may
+ * accept for the remote, for a full frame and for a repeat code. Returns
+ * the number of windows, or -1 if it isn't known.
+ */
+static int first_pulse(const struct ir_remote *remote, struct ir_window *w)
 {
-	if (remote->plead == 0)
-		return 1;
-	if (!sync_pending_space(remote))
-		return 0;
-	set_pending_pulse(remote->plead);
-	return 1;
+	const struct ir_signature *sig = &remote->signature;
+	lirc_t repeat;
+
+	if (sig->kind == SIGNATURE_ANY)
+		return (-1);
+	w[0].min = sig->pulse_min - tolerance(remote, sig->pulse_min);
+	w[0].max = sig->pulse_max > 0 ? sig->pulse_max + tolerance(remote, sig->pulse_max) : PULSE_MASK;
+	if (!has_repeat(remote) || (remote->flags & REPEAT_HEADER && has_header(remote)))
+		return (1);
+	/* see get_repeat(), the lead is merged into the repeat pulse */
+	if (is_biphase(remote))
+		return (-1);
+	repeat = remote->plead + remote->prepeat;
+	w[1].min = repeat - tolerance(remote, remote->prepeat);
+	w[1].max = repeat + tolerance(remote, remote->prepeat);
+	return (2);
 }
 
-static  int get_trail(struct ir_remote *remote)
+int receive_may_overlap(const struct ir_remote *a, const struct ir_remote *b)
 {
-	if (remote->ptrail != 0) {
-		if (!expectpulse(remote, remote->ptrail))
-			return (0);
-	}
-	if (rec_buffer.pendingp > 0) {
-		if (!sync_pending_pulse(remote))
-			return (0);
+	struct ir_window wa[2], wb[2];
+	int na, nb, i, j;
+
+	na = first_pulse(a, wa);
+	nb = first_pulse(b, wb);
+	if (na < 0 || nb < 0)
+		return (1);
+	for (i = 0; i < na; i++) {
+		for (j = 0; j < nb; j++) {
+			if (wa[i].min <= wb[j].max && wb[j].min <= wa[i].max)
+				return (1);
+		}
 	}
+	return (0);
+}
+
+/*
+ * The compiled decoder: receive_decode() split into steps, which are
+ * run for all remotes over the buffered data. Each function below does
+ * what its counterpart above does to the receive buffer on the
+ * remote's own read position, and returns -1 where it would have to
+ * read from the driver.
+ */
+
+static int match_next(struct ir_match_state *s, lirc_t *data)
+{
+	if (s->pos >= rec_buffer.wptr)
+		return (-1);
+	*data = RBUF(s->pos++);
+	s->sum += *data & (PULSE_MASK);
 	return (1);
 }
 
-static  int get_gap(struct ir_remote *remote, lirc_t gap)
+static int match_pulse(struct ir_match_state *s, lirc_t *deltap)
 {
 	lirc_t data;
 
-	LOGPRINTF(2, "sum: %d", rec_buffer.sum);
-	data = get_next_rec_buffer(gap - gap * remote->eps / 100);
-	if (data == 0)
-		return (1);
-	if (!is_space(data)) {
-		LOGPRINTF(2, "space expected");
-		return (0);
-	}
-	unget_rec_buffer(1);
-	if (!expect_at_least(remote, data, gap)) {
-		LOGPRINTF(1, "end of signal not found");
-		return (0);
-	}
+	if (match_next(s, &data) < 0)
+		return (-1);
+	*deltap = data != 0 && is_pulse(data) ? data & (PULSE_MASK) : 0;
 	return (1);
 }
 
-static  int get_repeat(struct ir_remote *remote)
+static int match_space(struct ir_match_state *s, lirc_t *deltas)
 {
-	if (!get_lead(remote))
-		return (0);
-	if (is_biphase(remote)) {
-		if (!expectspace(remote, remote->srepeat))
-			return (0);
-		if (!expectpulse(remote, remote->prepeat))
-			return (0);
-	} else {
-		if (!expectpulse(remote, remote->prepeat))
-			return (0);
-		set_pending_space(remote->srepeat);
-	}
-	if (!get_trail(remote))
-		return (0);
-	if (!get_gap
-	    (remote,
-	     is_const(remote) ? (min_gap(remote) >
-				 rec_buffer.sum ? min_gap(remote) -
-				 rec_buffer.sum : 0) : (has_repeat_gap(remote) ? remote->repeat_gap : min_gap(remote))
-	    ))
-		return (0);
+	lirc_t data;
+
+	if (match_next(s, &data) < 0)
+		return (-1);
+	*deltas = is_space(data) ? data : 0;
 	return (1);
 }
 
-static ir_code get_data(struct ir_remote * remote, int bits, int done)
+static void match_unget(struct ir_match_state *s, int count)
 {
-	ir_code code;
-	int i;
-
-	code = 0;
+	if (count == 1 || count == 2) {
+		s->pos -= count;
+		s->sum -= RBUF(s->pos) & (PULSE_MASK);
+		if (count == 2)
+			s->sum -= RBUF(s->pos + 1) & (PULSE_MASK);
+	}
+}
 
-	if (is_rcmm(remote)) {
-		lirc_t deltap, deltas, sum;
+/* unget count samples if a bit failed, as expectone() does */
+static int match_fail(struct ir_match_state *s, int r, int count)
+{
+	if (r == 0)
+		match_unget(s, count);
+	return (r);
+}
 
-		if (bits % 2 || done % 2) {
-			logprintf(LIRC_ERROR, "invalid bit number.");
+static int match_sync_pending_pulse(const struct ir_remote *remote, struct ir_match_state *s)
+{
+	lirc_t deltap;
+
+	if (s->pendingp > 0) {
+		if (match_pulse(s, &deltap) < 0)
+			return (-1);
+		if (deltap == 0 || !expect(remote, deltap, s->pendingp))
+			return (0);
+		s->pendingp = 0;
+	}
+	return (1);
+}
+
+static int match_sync_pending_space(const struct ir_remote *remote, struct ir_match_state *s)
+{
+	lirc_t deltas;
+
+	if (s->pendings > 0) {
+		if (match_space(s, &deltas) < 0)
+			return (-1);
+		if (deltas == 0 || !expect(remote, deltas, s->pendings))
+			return (0);
+		s->pendings = 0;
+	}
+	return (1);
+}
+
+static int match_expectpulse(const struct ir_remote *remote, struct ir_match_state *s, const struct ir_window *w)
+{
+	lirc_t deltap;
+	int r;
+
+	r = match_sync_pending_space(remote, s);
+	if (r != 1)
+		return (r);
+	if (match_pulse(s, &deltap) < 0)
+		return (-1);
+	if (deltap == 0)
+		return (0);
+	if (s->pendingp > 0) {
+		if (s->pendingp > deltap || !in_window(w, deltap - s->pendingp))
+			return (0);
+		s->pendingp = 0;
+		return (1);
+	}
+	return (in_window(w, deltap));
+}
+
+static int match_expectspace(const struct ir_remote *remote, struct ir_match_state *s, const struct ir_window *w)
+{
+	lirc_t deltas;
+	int r;
+
+	r = match_sync_pending_pulse(remote, s);
+	if (r != 1)
+		return (r);
+	if (match_space(s, &deltas) < 0)
+		return (-1);
+	if (deltas == 0)
+		return (0);
+	if (s->pendings > 0) {
+		if (s->pendings > deltas || !in_window(w, deltas - s->pendings))
+			return (0);
+		s->pendings = 0;
+		return (1);
+	}
+	return (in_window(w, deltas));
+}
+
+static int match_one(const struct ir_remote *remote, struct ir_match_state *s, int bit)
+{
+	const struct ir_windows *w = &remote->windows;
+	int r;
+
+	if (is_biphase(remote)) {
+		ir_code mask = ((ir_code) 1) << (bit_count(remote) - 1 - bit);
+		lirc_t n = mask & remote->rc6_mask ? 2 : 1;
+
+		if (remote->sone > 0
+		    && (r = match_expectspace(remote, s, n == 2 ? &w->sone2 : &w->sone)) != 1)
+			return (match_fail(s, r, 1));
+		s->pendingp = n * remote->pone;
+	} else if (is_space_first(remote)) {
+		if (remote->sone > 0 && (r = match_expectspace(remote, s, &w->sone)) != 1)
+			return (match_fail(s, r, 1));
+		if (remote->pone > 0 && (r = match_expectpulse(remote, s, &w->pone)) != 1)
+			return (match_fail(s, r, 2));
+	} else {
+		if (remote->pone > 0 && (r = match_expectpulse(remote, s, &w->pone)) != 1)
+			return (match_fail(s, r, 1));
+		if (remote->ptrail > 0) {
+			if (remote->sone > 0 && (r = match_expectspace(remote, s, &w->sone)) != 1)
+				return (match_fail(s, r, 2));
+		} else {
+			s->pendings = remote->sone;
+		}
+	}
+	return (1);
+}
+
+static int match_zero(const struct ir_remote *remote, struct ir_match_state *s, int bit)
+{
+	const struct ir_windows *w = &remote->windows;
+	int r;
+
+	if (is_biphase(remote)) {
+		ir_code mask = ((ir_code) 1) << (bit_count(remote) - 1 - bit);
+		lirc_t n = mask & remote->rc6_mask ? 2 : 1;
+
+		if ((r = match_expectpulse(remote, s, n == 2 ? &w->pzero2 : &w->pzero)) != 1)
+			return (match_fail(s, r, 1));
+		s->pendings = n * remote->szero;
+	} else if (is_space_first(remote)) {
+		if (remote->szero > 0 && (r = match_expectspace(remote, s, &w->szero)) != 1)
+			return (match_fail(s, r, 1));
+		if (remote->pzero > 0 && (r = match_expectpulse(remote, s, &w->pzero)) != 1)
+			return (match_fail(s, r, 2));
+	} else {
+		if ((r = match_expectpulse(remote, s, &w->pzero)) != 1)
+			return (match_fail(s, r, 1));
+		if (remote->ptrail > 0) {
+			if ((r = match_expectspace(remote, s, &w->szero)) != 1)
+				return (match_fail(s, r, 2));
+		} else {
+			s->pendings = remote->szero;
+		}
+	}
+	return (1);
+}
+
+/* min is the shortest space expect_at_least() takes for the gap */
+static int match_gap(struct ir_match_state *s, lirc_t min)
+{
+	lirc_t data;
+
+	if (match_next(s, &data) < 0)
+		return (-1);
+	if (data == 0)
+		return (1);
+	if (!is_space(data))
+		return (0);
+	match_unget(s, 1);
+	return (data >= min);
+}
+
+/* Runs one step, or one bit of a MATCH_BITS step. */
+static int match_step(const struct ir_remote *remote, struct ir_match_state *s)
+{
+	const struct ir_matcher *m = &remote->matcher;
+	lirc_t gap;
+	int r = 1;
+
+	switch (m->steps[s->step].op) {
+	case MATCH_HEADER:
+		r = match_expectpulse(remote, s, &remote->windows.phead);
+		s->pendings = remote->shead;
+		break;
+	case MATCH_LEAD:
+		r = match_sync_pending_space(remote, s);
+		s->pendingp = remote->plead;
+		break;
+	case MATCH_BITS:
+		s->code <<= 1;
+		r = match_one(remote, s, m->steps[s->step].done + s->bit);
+		if (r == 1)
+			s->code |= 1;
+		else if (r == 0)
+			r = match_zero(remote, s, m->steps[s->step].done + s->bit);
+		if (r != 1)
+			return (r);
+		if (++s->bit < m->steps[s->step].bits)
+			return (1);
+		/* get_data() can't tell this code from a failure */
+		if (s->code == (ir_code) -1)
+			return (0);
+		s->bit = 0;
+		s->code = 0;
+		break;
+	case MATCH_PRE_PS:
+		r = match_expectpulse(remote, s, &remote->windows.pre_p);
+		s->pendings = remote->pre_s;
+		break;
+	case MATCH_POST_PS:
+		r = match_expectpulse(remote, s, &remote->windows.post_p);
+		s->pendings = remote->post_s;
+		break;
+	case MATCH_TRAIL:
+		if (remote->ptrail != 0)
+			r = match_expectpulse(remote, s, &remote->windows.ptrail);
+		if (r == 1)
+			r = match_sync_pending_pulse(remote, s);
+		break;
+	case MATCH_FOOT:
+		r = match_expectspace(remote, s, &remote->windows.sfoot);
+		if (r == 1)
+			r = match_expectpulse(remote, s, &remote->windows.pfoot);
+		break;
+	case MATCH_GAP:
+		if (is_const(remote)) {
+			gap = min_gap(remote) > s->sum ? min_gap(remote) - s->sum : 0;
+			r = match_gap(s, gap - tolerance(remote, gap));
+		} else {
+			r = match_gap(s, remote->windows.min_gap);
+		}
+		if (r == 1)
+			s->result = MATCH_ACCEPT;
+		return (r);
+	}
+	if (r == 1)
+		s->step++;
+	return (r);
+}
+
+static void match_advance(struct ir_remote *remote)
+{
+	struct ir_match_state *s = &remote->matcher.state;
+	struct ir_match_state saved = *s;
+	int r;
+
+	r = match_step(remote, s);
+	if (r < 0) {
+		/* start the step over once more is buffered */
+		*s = saved;
+		s->result = MATCH_SUSPEND;
+	} else if (r == 0) {
+		s->result = MATCH_REJECT;
+	}
+}
+
+/*
+ * Advance all remotes by one step per round, until the given one is
+ * decided or needs more data than is buffered.
+ */
+static void match_run(struct ir_remote *target)
+{
+	struct ir_remote *remote;
+
+	if (match.wptr != rec_buffer.wptr) {
+		match.wptr = rec_buffer.wptr;
+		for (remote = match.remotes; remote != NULL; remote = remote->next) {
+			if (remote->matcher.state.result == MATCH_SUSPEND)
+				remote->matcher.state.result = MATCH_RUNNING;
+		}
+	}
+	while (target->matcher.state.result == MATCH_RUNNING) {
+		for (remote = match.remotes; remote != NULL; remote = remote->next) {
+			if (remote->matcher.state.result == MATCH_RUNNING)
+				match_advance(remote);
+		}
+	}
+}
+
+void receive_compile(struct ir_remote *remote)
+{
+	struct ir_matcher *m = &remote->matcher;
+	int protocol = remote->flags & IR_PROTOCOL_MASK;
+
+	memset(m, 0, sizeof(*m));
+	/* only protocols decoded by expectone() and expectzero() */
+	if (protocol != SPACE_ENC && protocol != SPACE_FIRST && protocol != RC5 && protocol != RC6)
+		return;
+	if (remote->flags & NO_HEAD_REP)
+		return;
+	if (has_header(remote))
+		m->steps[m->nsteps++].op = MATCH_HEADER;
+	if (remote->plead != 0)
+		m->steps[m->nsteps++].op = MATCH_LEAD;
+	if (has_pre(remote)) {
+		m->steps[m->nsteps].op = MATCH_BITS;
+		m->steps[m->nsteps].bits = remote->pre_data_bits;
+		m->steps[m->nsteps++].done = 0;
+		if (remote->pre_p > 0 && remote->pre_s > 0)
+			m->steps[m->nsteps++].op = MATCH_PRE_PS;
+	}
+	if (remote->bits > 0) {
+		m->steps[m->nsteps].op = MATCH_BITS;
+		m->steps[m->nsteps].bits = remote->bits;
+		m->steps[m->nsteps++].done = remote->pre_data_bits;
+	}
+	if (has_post(remote)) {
+		if (remote->post_p > 0 && remote->post_s > 0)
+			m->steps[m->nsteps++].op = MATCH_POST_PS;
+		m->steps[m->nsteps].op = MATCH_BITS;
+		m->steps[m->nsteps].bits = remote->post_data_bits;
+		m->steps[m->nsteps++].done = remote->pre_data_bits + remote->bits;
+	}
+	m->steps[m->nsteps++].op = MATCH_TRAIL;
+	if (has_foot(remote))
+		m->steps[m->nsteps++].op = MATCH_FOOT;
+	m->steps[m->nsteps++].op = MATCH_GAP;
+	m->compiled = 1;
+}
+
+/*
+ * The raw codes of a remote as windows of the accepted lengths, with the
+ * windows of all codes for one signal next to each other. Candidates
+ * are dropped signal by signal, in loops the compiler can vectorize.
+ */
+struct ir_raw_table {
+	struct ir_ncode *codes;	/* the codes the table is for */
+	int ncodes;
+	int signals;		/* of the longest code */
+	int eps;		/* of the windows, aeps < 0 if not set */
+	int aeps;
+	int *length;		/* of each code */
+	lirc_t *min;		/* [signal * ncodes + code] */
+	lirc_t *max;
+	unsigned char *alive;	/* candidates in raw_match() */
+};
+
+void receive_free_raw(struct ir_remote *remote)
+{
+	struct ir_raw_table *t = remote->raw_table;
+
+	if (t == NULL)
+		return;
+	free(t->length);
+	free(t->min);
+	free(t->max);
+	free(t->alive);
+	free(t);
+	remote->raw_table = NULL;
+}
+
+void receive_compile_raw(struct ir_remote *remote)
+{
+	struct ir_raw_table *t;
+	struct ir_ncode *codes;
+	int n = 0, length = 0;
+
+	receive_free_raw(remote);
+	/* raw_match() starts at the first signal, a header isn't handled */
+	if (!is_raw(remote) || remote->codes == NULL || has_header(remote))
+		return;
+	for (codes = remote->codes; codes->name != NULL; codes++) {
+		n++;
+		if (codes->length > length)
+			length = codes->length;
+	}
+	if (n == 0)
+		return;
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return;
+	t->length = malloc(n * sizeof(int));
+	t->min = malloc((size_t) n * length * sizeof(lirc_t));
+	t->max = malloc((size_t) n * length * sizeof(lirc_t));
+	t->alive = malloc(n);
+	if (t->length == NULL || t->min == NULL || t->max == NULL || t->alive == NULL) {
+		logprintf(LIRC_WARNING, "out of memory, not compiling raw codes of %s", remote->name);
+		remote->raw_table = t;
+		receive_free_raw(remote);
+		return;
+	}
+	for (n = 0, codes = remote->codes; codes->name != NULL; codes++)
+		t->length[n++] = codes->length;
+	t->codes = remote->codes;
+	t->ncodes = n;
+	t->signals = length;
+	t->aeps = -1;
+	remote->raw_table = t;
+}
+
+/* Set the windows of the table to what expect() accepts. */
+static void raw_windows(const struct ir_remote *remote, struct ir_raw_table *t, int aeps)
+{
+	int c, i, n = t->ncodes;
+	lirc_t exdelta, tolerance;
+
+	for (c = 0; c < n; c++) {
+		for (i = 0; i < t->length[c]; i++) {
+			exdelta = t->codes[c].signals[i];
+			tolerance = exdelta * remote->eps / 100;
+			if (tolerance < aeps)
+				tolerance = aeps;
+			t->min[i * n + c] = exdelta - tolerance;
+			t->max[i * n + c] = exdelta + tolerance;
+		}
+		/* a code which has matched stays a candidate */
+		for (; i < t->signals; i++) {
+			t->min[i * n + c] = 0;
+			t->max[i * n + c] = PULSE_MASK;
+		}
+	}
+	t->eps = remote->eps;
+	t->aeps = aeps;
+}
+
+/*
+ * rbuf_fill() for raw_match(). Once the driver had nothing, *dry is set
+ * and it isn't asked again: trying the codes in turn would only time out
+ * on the same sample again.
+ */
+static int raw_fill(int pos, lirc_t maxusec, int *dry)
+{
+	if (pos < rec_buffer.wptr)
+		return (1);
+	if (*dry || !rbuf_fill(pos, maxusec)) {
+		*dry = 1;
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * What get_gap() says about the sample after a raw code of the given
+ * length: 1 if it ends the code or that can't be told here, 0 if not.
+ */
+static int raw_gap(const struct ir_remote *remote, int length, int *dry)
+{
+	lirc_t gap = min_gap(remote);
+	lirc_t data;
+
+	/* the gap of a const remote depends on the sum, left to get_gap() */
+	if (is_const(remote))
+		return (1);
+	if (!raw_fill(rec_buffer.rptr + length, gap - gap * remote->eps / 100, dry))
+		return (1);
+	data = RBUF(rec_buffer.rptr + length);
+	if (data == 0)
+		return (1);
+	return (is_space(data) && data >= remote->windows.min_gap);
+}
+
+/*
+ * Find the code receive_decode() has to start with for a raw remote: the
+ * first one whose signals all match and which might be followed by the
+ * gap, or the end of the codes if none matches. Samples are read in the
+ * order and with the timeouts of trying the codes in turn, but a sample
+ * the driver had nothing for isn't asked for again; codes which need it
+ * fail. *ended is set if the code found is followed by that sample, so
+ * get_gap() would find nothing after it either.
+ */
+static struct ir_ncode *raw_match(struct ir_remote *remote, int *ended)
+{
+	struct ir_raw_table *t = remote->raw_table;
+	int aeps = curr_driver->resolution > remote->aeps ? curr_driver->resolution : remote->aeps;
+	int c, i, n, first;
+	int dry = 0;
+	const lirc_t *min, *max;
+	unsigned char *alive;
+	lirc_t data;
+
+	*ended = 0;
+	if (t->codes != remote->codes)
+		return (remote->codes);
+	if (t->eps != remote->eps || t->aeps != aeps)
+		raw_windows(remote, t, aeps);
+	n = t->ncodes;
+	alive = t->alive;
+	memset(alive, 1, n);
+	for (first = 0, i = 0;;) {
+		while (first < n && !alive[first])
+			first++;
+		if (first == n)
+			break;
+		if (t->length[first] <= i) {
+			if (raw_gap(remote, t->length[first], &dry)) {
+				*ended = dry && rec_buffer.rptr + t->length[first] >= rec_buffer.wptr;
+				break;
+			}
+			alive[first] = 0;
+			continue;
+		}
+		if (!raw_fill(rec_buffer.rptr + i, t->codes[first].signals[i], &dry)) {
+			alive[first] = 0;
+			continue;
+		}
+		data = RBUF(rec_buffer.rptr + i);
+		if (is_pulse(data) != !(i % 2)) {
+			for (c = first; c < n; c++)
+				alive[c] &= t->length[c] <= i;
+		} else {
+			data &= PULSE_MASK;
+			min = t->min + i * n;
+			max = t->max + i * n;
+			for (c = first; c < n; c++)
+				alive[c] &= (data >= min[c]) & (data <= max[c]);
+		}
+		i++;
+	}
+	return (t->codes + first);
+}
+
+void receive_match_start(struct ir_remote *remotes)
+{
+	struct ir_remote *remote;
+	lirc_t gap;
+
+	match.remotes = remotes;
+	match.wptr = rec_buffer.wptr;
+	match.stale = 0;
+	match.sync = frame_sync(&match.start, &gap);
+	for (remote = remotes; remote != NULL; remote = remote->next) {
+		struct ir_match_state *s = &remote->matcher.state;
+
+		update_windows(remote);
+		memset(s, 0, sizeof(*s));
+		s->pos = match.start;
+		if (!remote->matcher.compiled || (has_repeat(remote) && last_remote == remote))
+			/* not checked, might be a repeat code */
+			s->result = MATCH_ACCEPT;
+		else if (match.sync != 1)
+			s->result = MATCH_SUSPEND;
+	}
+}
+
+int receive_match(struct ir_remote *remote)
+{
+	if (!remote->matcher.compiled || rec_buffer.at_eof
+	    || (curr_driver->rec_mode != LIRC_MODE_MODE2 && curr_driver->rec_mode != LIRC_MODE_PULSE
+		&& curr_driver->rec_mode != LIRC_MODE_RAW))
+		return (receive_may_decode(remote));
+	if (match.stale)
+		receive_match_start(match.remotes);
+	if (match.sync == -1 && match.wptr != rec_buffer.wptr)
+		receive_match_start(match.remotes);
+	if (match.sync == 0)
+		return (0);
+	if (match.sync == -1)
+		return (1);
+	match_run(remote);
+	return (remote->matcher.state.result != MATCH_REJECT);
+}
+
+static  lirc_t sync_rec_buffer(struct ir_remote * remote)
+{
+	int count;
+	lirc_t deltas, deltap;
+
+	count = 0;
+	deltas = get_next_space(1000000);
+	if (deltas == 0)
+		return (0);
+
+	if (last_remote != NULL && !is_rcmm(remote)) {
+		while (!expect_at_least(last_remote, deltas, last_remote->min_remaining_gap)) {
+			deltap = get_next_pulse(1000000);
+			if (deltap == 0)
+				return (0);
+			deltas = get_next_space(1000000);
+			if (deltas == 0)
+				return (0);
+			count++;
+			if (count > REC_SYNC) {	/* no sync found,
+						   let's try a diffrent remote */
+				return (0);
+			}
+		}
+		if (has_toggle_mask(remote)) {
+			if (!expect_at_most(last_remote, deltas, last_remote->max_remaining_gap)) {
+				remote->toggle_mask_state = 0;
+				remote->toggle_code = NULL;
+			}
+
+		}
+	}
+	rec_buffer.sum = 0;
+	return (deltas);
+}
+
+static  int get_header(struct ir_remote *remote)
+{
+	if (is_rcmm(remote)) {
+		lirc_t deltap, deltas, sum;
+
+		deltap = get_next_pulse(remote->phead);
+		if (deltap == 0) {
+			unget_rec_buffer(1);
+			return (0);
+		}
+		deltas = get_next_space(remote->shead);
+		if (deltas == 0) {
+			unget_rec_buffer(2);
+			return (0);
+		}
+		sum = deltap + deltas;
+		if (expect(remote, sum, remote->phead + remote->shead)) {
+			return (1);
+		}
+		unget_rec_buffer(2);
+		return (0);
+	} else if (is_bo(remote)) {
+		if (expectpulse(remote, remote->pone) && expectspace(remote, remote->sone)
+		    && expectpulse(remote, remote->pone) && expectspace(remote, remote->sone)
+		    && expectpulse(remote, remote->phead) && expectspace(remote, remote->shead)) {
+			return 1;
+		}
+		return 0;
+	}
+	if (remote->shead == 0) {
+		if (!sync_pending_space(remote))
+			return 0;
+		set_pending_pulse(remote->phead);
+		return 1;
+	}
+	if (!expectpulse(remote, remote->phead)) {
+		unget_rec_buffer(1);
+		return (0);
+	}
+	/* if this flag is set I need a decision now if this is really
+	   a header */
+	if (remote->flags & NO_HEAD_REP) {
+		lirc_t deltas;
+
+		deltas = get_next_space(remote->shead);
+		if (deltas != 0) {
+			if (expect(remote, remote->shead, deltas)) {
+				return (1);
+			}
+			unget_rec_buffer(2);
+			return (0);
+		}
+	}
+
+	set_pending_space(remote->shead);
+	return (1);
+}
+
+static  int get_foot(struct ir_remote *remote)
+{
+	if (!expectspace(remote, remote->sfoot))
+		return (0);
+	if (!expectpulse(remote, remote->pfoot))
+		return (0);
+	return (1);
+}
+
+static  int get_lead(struct ir_remote *remote)
+{
+	if (remote->plead == 0)
+		return 1;
+	if (!sync_pending_space(remote))
+		return 0;
+	set_pending_pulse(remote->plead);
+	return 1;
+}
+
+static  int get_trail(struct ir_remote *remote)
+{
+	if (remote->ptrail != 0) {
+		if (!expectpulse(remote, remote->ptrail))
+			return (0);
+	}
+	if (rec_buffer.pendingp > 0) {
+		if (!sync_pending_pulse(remote))
+			return (0);
+	}
+	return (1);
+}
+
+static  int get_gap(struct ir_remote *remote, lirc_t gap)
+{
+	lirc_t data;
+
+	LOGPRINTF(2, "sum: %d", rec_buffer.sum);
+	data = get_next_rec_buffer(gap - gap * remote->eps / 100);
+	if (data == 0)
+		return (1);
+	if (!is_space(data)) {
+		LOGPRINTF(2, "space expected");
+		return (0);
+	}
+	unget_rec_buffer(1);
+	if (!expect_at_least(remote, data, gap)) {
+		LOGPRINTF(1, "end of signal not found");
+		return (0);
+	}
+	return (1);
+}
+
+static  int get_repeat(struct ir_remote *remote)
+{
+	if (!get_lead(remote))
+		return (0);
+	if (is_biphase(remote)) {
+		if (!expectspace(remote, remote->srepeat))
+			return (0);
+		if (!expectpulse(remote, remote->prepeat))
+			return (0);
+	} else {
+		if (!expectpulse(remote, remote->prepeat))
+			return (0);
+		set_pending_space(remote->srepeat);
+	}
+	if (!get_trail(remote))
+		return (0);
+	if (!get_gap
+	    (remote,
+	     is_const(remote) ? (min_gap(remote) >
+				 rec_buffer.sum ? min_gap(remote) -
+				 rec_buffer.sum : 0) : (has_repeat_gap(remote) ? remote->repeat_gap : min_gap(remote))
+	    ))
+		return (0);
+	return (1);
+}
+
+static ir_code get_data_rcmm(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
+
+	if (bits % 2 || done % 2) {
+		logprintf(LIRC_ERROR, "invalid bit number.");
+		return ((ir_code) - 1);
+	}
+	if (!sync_pending_space(remote))
+		return 0;
+	for (i = 0; i < bits; i += 2) {
+		code <<= 2;
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		if (deltap == 0 || deltas == 0) {
+			logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
 			return ((ir_code) - 1);
 		}
-		if (!sync_pending_space(remote))
-			return 0;
-		for (i = 0; i < bits; i += 2) {
-			code <<= 2;
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			if (deltap == 0 || deltas == 0) {
-				logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
-				return ((ir_code) - 1);
-			}
-			sum = deltap + deltas;
-			LOGPRINTF(3, "rcmm: sum %ld", (__u32) sum);
-			if (expect(remote, sum, remote->pzero + remote->szero)) {
-				code |= 0;
-				LOGPRINTF(2, "00");
-			} else if (expect(remote, sum, remote->pone + remote->sone)) {
-				code |= 1;
-				LOGPRINTF(2, "01");
-			} else if (expect(remote, sum, remote->ptwo + remote->stwo)) {
-				code |= 2;
-				LOGPRINTF(2, "10");
-			} else if (expect(remote, sum, remote->pthree + remote->sthree)) {
-				code |= 3;
-				LOGPRINTF(2, "11");
-			} else {
-				LOGPRINTF(2, "no match for %d+%d=%d", deltap, deltas, sum);
-				return ((ir_code) - 1);
-			}
+		sum = deltap + deltas;
+		LOGPRINTF(3, "rcmm: sum %ld", (__u32) sum);
+		if (expect(remote, sum, remote->pzero + remote->szero)) {
+			code |= 0;
+			LOGPRINTF(2, "00");
+		} else if (expect(remote, sum, remote->pone + remote->sone)) {
+			code |= 1;
+			LOGPRINTF(2, "01");
+		} else if (expect(remote, sum, remote->ptwo + remote->stwo)) {
+			code |= 2;
+			LOGPRINTF(2, "10");
+		} else if (expect(remote, sum, remote->pthree + remote->sthree)) {
+			code |= 3;
+			LOGPRINTF(2, "11");
+		} else {
+			LOGPRINTF(2, "no match for %d+%d=%d", deltap, deltas, sum);
+			return ((ir_code) - 1);
 		}
-		return (code);
-	} else if (is_grundig(remote)) {
-		lirc_t deltap, deltas, sum;
-		int state, laststate;
+	}
+	return (code);
+}
+
+static ir_code get_data_grundig(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
+	int state, laststate;
 
-		if (bits % 2 || done % 2) {
-			logprintf(LIRC_ERROR, "invalid bit number.");
+	if (bits % 2 || done % 2) {
+		logprintf(LIRC_ERROR, "invalid bit number.");
+		return ((ir_code) - 1);
+	}
+	if (!sync_pending_pulse(remote))
+		return ((ir_code) - 1);
+	for (laststate = state = -1, i = 0; i < bits;) {
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		if (deltas == 0 || deltap == 0) {
+			logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
 			return ((ir_code) - 1);
 		}
-		if (!sync_pending_pulse(remote))
+		sum = deltas + deltap;
+		LOGPRINTF(3, "grundig: sum %ld", (__u32) sum);
+		if (expect(remote, sum, remote->szero + remote->pzero)) {
+			state = 0;
+			LOGPRINTF(2, "2T");
+		} else if (expect(remote, sum, remote->sone + remote->pone)) {
+			state = 1;
+			LOGPRINTF(2, "3T");
+		} else if (expect(remote, sum, remote->stwo + remote->ptwo)) {
+			state = 2;
+			LOGPRINTF(2, "4T");
+		} else if (expect(remote, sum, remote->sthree + remote->pthree)) {
+			state = 3;
+			LOGPRINTF(2, "6T");
+		} else {
+			LOGPRINTF(2, "no match for %d+%d=%d", deltas, deltap, sum);
 			return ((ir_code) - 1);
-		for (laststate = state = -1, i = 0; i < bits;) {
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			if (deltas == 0 || deltap == 0) {
-				logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
-				return ((ir_code) - 1);
-			}
-			sum = deltas + deltap;
-			LOGPRINTF(3, "grundig: sum %ld", (__u32) sum);
-			if (expect(remote, sum, remote->szero + remote->pzero)) {
-				state = 0;
-				LOGPRINTF(2, "2T");
-			} else if (expect(remote, sum, remote->sone + remote->pone)) {
-				state = 1;
-				LOGPRINTF(2, "3T");
-			} else if (expect(remote, sum, remote->stwo + remote->ptwo)) {
-				state = 2;
-				LOGPRINTF(2, "4T");
-			} else if (expect(remote, sum, remote->sthree + remote->pthree)) {
-				state = 3;
-				LOGPRINTF(2, "6T");
-			} else {
-				LOGPRINTF(2, "no match for %d+%d=%d", deltas, deltap, sum);
-				return ((ir_code) - 1);
-			}
-			if (state == 3) {	/* 6T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 0;
-			} else if (laststate == 2 && state == 0) {	/* 4T2T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 1;
-			} else if (laststate == 1 && state == 1) {	/* 3T3T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 2;
-			} else if (laststate == 0 && state == 2) {	/* 2T4T */
-				i += 2;
-				code <<= 2;
-				state = -1;
-				code |= 3;
-			} else if (laststate == -1) {
-				/* 1st bit */
-			} else {
-				logprintf(LIRC_ERROR, "invalid state %d:%d", laststate, state);
-				return ((ir_code) - 1);
-			}
-			laststate = state;
-		}
-		return (code);
-	} else if (is_serial(remote)) {
-		int received;
-		int space, stop_bit, parity_bit;
-		int parity;
-		lirc_t delta, origdelta, pending, expecting, gap_delta;
-		lirc_t base, stop;
-		lirc_t max_space, max_pulse;
-
-		base = 1000000 / remote->baud;
-
-		/* start bit */
-		set_pending_pulse(base);
-
-		received = 0;
-		space = (rec_buffer.pendingp == 0);	/* expecting space ? */
-		stop_bit = 0;
-		parity_bit = 0;
-		delta = origdelta = 0;
-		stop = base * remote->stop_bits / 2;
-		parity = 0;
-		gap_delta = 0;
-
-		max_space = remote->sone * remote->bits_in_byte + stop;
-		max_pulse = remote->pzero * (1 + remote->bits_in_byte);
-		if (remote->parity != IR_PARITY_NONE) {
-			parity_bit = 1;
-			max_space += remote->sone;
-			max_pulse += remote->pzero;
-			bits += bits / remote->bits_in_byte;
-		}
-
-		while (received < bits || stop_bit) {
-			if (delta == 0) {
-				delta = space ? get_next_space(max_space) : get_next_pulse(max_pulse);
-				if (delta == 0 && space && received + remote->bits_in_byte + parity_bit >= bits) {
-					/* open end */
-					delta = max_space;
-				}
-				origdelta = delta;
-			}
-			if (delta == 0) {
-				LOGPRINTF(1, "failed before bit %d", received + 1);
-				return ((ir_code) - 1);
+		}
+		if (state == 3) {	/* 6T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 0;
+		} else if (laststate == 2 && state == 0) {	/* 4T2T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 1;
+		} else if (laststate == 1 && state == 1) {	/* 3T3T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 2;
+		} else if (laststate == 0 && state == 2) {	/* 2T4T */
+			i += 2;
+			code <<= 2;
+			state = -1;
+			code |= 3;
+		} else if (laststate == -1) {
+			/* 1st bit */
+		} else {
+			logprintf(LIRC_ERROR, "invalid state %d:%d", laststate, state);
+			return ((ir_code) - 1);
+		}
+		laststate = state;
+	}
+	return (code);
+}
+
+static ir_code get_data_serial(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int received;
+	int space, stop_bit, parity_bit;
+	int parity;
+	lirc_t delta, origdelta, pending, expecting, gap_delta;
+	lirc_t base, stop;
+	lirc_t max_space, max_pulse;
+
+	base = 1000000 / remote->baud;
+
+	/* start bit */
+	set_pending_pulse(base);
+
+	received = 0;
+	space = (rec_buffer.pendingp == 0);	/* expecting space ? */
+	stop_bit = 0;
+	parity_bit = 0;
+	delta = origdelta = 0;
+	stop = base * remote->stop_bits / 2;
+	parity = 0;
+	gap_delta = 0;
+
+	max_space = remote->sone * remote->bits_in_byte + stop;
+	max_pulse = remote->pzero * (1 + remote->bits_in_byte);
+	if (remote->parity != IR_PARITY_NONE) {
+		parity_bit = 1;
+		max_space += remote->sone;
+		max_pulse += remote->pzero;
+		bits += bits / remote->bits_in_byte;
+	}
+
+	while (received < bits || stop_bit) {
+		if (delta == 0) {
+			delta = space ? get_next_space(max_space) : get_next_pulse(max_pulse);
+			if (delta == 0 && space && received + remote->bits_in_byte + parity_bit >= bits) {
+				/* open end */
+				delta = max_space;
 			}
-			pending = (space ? rec_buffer.pendings : rec_buffer.pendingp);
-			if (expect(remote, delta, pending)) {
+			origdelta = delta;
+		}
+		if (delta == 0) {
+			LOGPRINTF(1, "failed before bit %d", received + 1);
+			return ((ir_code) - 1);
+		}
+		pending = (space ? rec_buffer.pendings : rec_buffer.pendingp);
+		if (expect(remote, delta, pending)) {
+			delta = 0;
+		} else if (delta > pending) {
+			delta -= pending;
+		} else {
+			LOGPRINTF(1, "failed before bit %d", received + 1);
+			return ((ir_code) - 1);
+		}
+		if (pending > 0) {
+			if (stop_bit) {
+				LOGPRINTF(5, "delta: %lu", delta);
+				gap_delta = delta;
 				delta = 0;
-			} else if (delta > pending) {
-				delta -= pending;
+				set_pending_pulse(base);
+				set_pending_space(0);
+				stop_bit = 0;
+				space = 0;
+				LOGPRINTF(3, "stop bit found");
 			} else {
-				LOGPRINTF(1, "failed before bit %d", received + 1);
-				return ((ir_code) - 1);
-			}
-			if (pending > 0) {
-				if (stop_bit) {
-					LOGPRINTF(5, "delta: %lu", delta);
-					gap_delta = delta;
-					delta = 0;
-					set_pending_pulse(base);
-					set_pending_space(0);
-					stop_bit = 0;
-					space = 0;
-					LOGPRINTF(3, "stop bit found");
-				} else {
-					LOGPRINTF(3, "pending bit found");
-					set_pending_pulse(0);
-					set_pending_space(0);
-					if (delta == 0) {
-						space = (space ? 0 : 1);
-					}
+				LOGPRINTF(3, "pending bit found");
+				set_pending_pulse(0);
+				set_pending_space(0);
+				if (delta == 0) {
+					space = (space ? 0 : 1);
 				}
-				continue;
 			}
-			expecting = (space ? remote->sone : remote->pzero);
-			if (delta > expecting || expect(remote, delta, expecting)) {
-				delta -= (expecting > delta ? delta : expecting);
-				received++;
-				code <<= 1;
-				code |= space;
-				parity ^= space;
-				LOGPRINTF(2, "adding %d", space);
-				if (received % (remote->bits_in_byte + parity_bit) == 0) {
-					ir_code temp;
-
-					if ((remote->parity == IR_PARITY_EVEN && parity)
-					    || (remote->parity == IR_PARITY_ODD && !parity)) {
-						LOGPRINTF(1, "parity error after %d bits", received + 1);
-						return ((ir_code) - 1);
-					}
-					parity = 0;
-
-					/* parity bit is filtered out */
-					temp = code >> (remote->bits_in_byte + parity_bit);
-					code =
-					    temp << remote->bits_in_byte | reverse(code >> parity_bit,
-										   remote->bits_in_byte);
-
-					if (space && delta == 0) {
-						LOGPRINTF(1, "failed at stop bit after %d bits", received + 1);
-						return ((ir_code) - 1);
-					}
-					LOGPRINTF(3, "awaiting stop bit");
-					set_pending_space(stop);
-					stop_bit = 1;
+			continue;
+		}
+		expecting = (space ? remote->sone : remote->pzero);
+		if (delta > expecting || expect(remote, delta, expecting)) {
+			delta -= (expecting > delta ? delta : expecting);
+			received++;
+			code <<= 1;
+			code |= space;
+			parity ^= space;
+			LOGPRINTF(2, "adding %d", space);
+			if (received % (remote->bits_in_byte + parity_bit) == 0) {
+				ir_code temp;
+
+				if ((remote->parity == IR_PARITY_EVEN && parity)
+				    || (remote->parity == IR_PARITY_ODD && !parity)) {
+					LOGPRINTF(1, "parity error after %d bits", received + 1);
+					return ((ir_code) - 1);
 				}
-			} else {
-				if (delta == origdelta) {
-					LOGPRINTF(1, "framing error after %d bits", received + 1);
+				parity = 0;
+
+				/* parity bit is filtered out */
+				temp = code >> (remote->bits_in_byte + parity_bit);
+				code =
+				    temp << remote->bits_in_byte | reverse(code >> parity_bit,
+									   remote->bits_in_byte);
+
+				if (space && delta == 0) {
+					LOGPRINTF(1, "failed at stop bit after %d bits", received + 1);
 					return ((ir_code) - 1);
 				}
-				delta = 0;
+				LOGPRINTF(3, "awaiting stop bit");
+				set_pending_space(stop);
+				stop_bit = 1;
 			}
-			if (delta == 0) {
-				space = (space ? 0 : 1);
+		} else {
+			if (delta == origdelta) {
+				LOGPRINTF(1, "framing error after %d bits", received + 1);
+				return ((ir_code) - 1);
 			}
+			delta = 0;
 		}
-		if (gap_delta)
-			unget_rec_buffer_delta(gap_delta);
-		set_pending_pulse(0);
-		set_pending_space(0);
-		return code;
-	} else if (is_bo(remote)) {
-		int lastbit = 1;
-		lirc_t deltap, deltas;
-		lirc_t pzero, szero;
-		lirc_t pone, sone;
+		if (delta == 0) {
+			space = (space ? 0 : 1);
+		}
+	}
+	if (gap_delta)
+		unget_rec_buffer_delta(gap_delta);
+	set_pending_pulse(0);
+	set_pending_space(0);
+	return code;
+}
 
-		for (i = 0; i < bits; i++) {
-			code <<= 1;
-			deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
-			deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
-			if (deltap == 0 || deltas == 0) {
-				logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
-				return ((ir_code) - 1);
-			}
-			if (lastbit == 1) {
-				pzero = remote->pone;
-				szero = remote->sone;
-				pone = remote->ptwo;
-				sone = remote->stwo;
-			} else {
-				pzero = remote->ptwo;
-				szero = remote->stwo;
-				pone = remote->pthree;
-				sone = remote->sthree;
-			}
-			LOGPRINTF(5, "%lu %lu %lu %lu", pzero, szero, pone, sone);
-			if (expect(remote, deltap, pzero)) {
-				if (expect(remote, deltas, szero)) {
-					code |= 0;
-					lastbit = 0;
-					LOGPRINTF(2, "0");
-					continue;
-				}
+static ir_code get_data_bo(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	int lastbit = 1;
+	lirc_t deltap, deltas;
+	lirc_t pzero, szero;
+	lirc_t pone, sone;
+
+	for (i = 0; i < bits; i++) {
+		code <<= 1;
+		deltap = get_next_pulse(remote->pzero + remote->pone + remote->ptwo + remote->pthree);
+		deltas = get_next_space(remote->szero + remote->sone + remote->stwo + remote->sthree);
+		if (deltap == 0 || deltas == 0) {
+			logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
+			return ((ir_code) - 1);
+		}
+		if (lastbit == 1) {
+			pzero = remote->pone;
+			szero = remote->sone;
+			pone = remote->ptwo;
+			sone = remote->stwo;
+		} else {
+			pzero = remote->ptwo;
+			szero = remote->stwo;
+			pone = remote->pthree;
+			sone = remote->sthree;
+		}
+		LOGPRINTF(5, "%lu %lu %lu %lu", pzero, szero, pone, sone);
+		if (expect(remote, deltap, pzero)) {
+			if (expect(remote, deltas, szero)) {
+				code |= 0;
+				lastbit = 0;
+				LOGPRINTF(2, "0");
+				continue;
 			}
+		}
 
-			if (expect(remote, deltap, pone)) {
-				if (expect(remote, deltas, sone)) {
-					code |= 1;
-					lastbit = 1;
-					LOGPRINTF(2, "1");
-					continue;
-				}
+		if (expect(remote, deltap, pone)) {
+			if (expect(remote, deltas, sone)) {
+				code |= 1;
+				lastbit = 1;
+				LOGPRINTF(2, "1");
+				continue;
 			}
+		}
+		logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
+		return ((ir_code) - 1);
+	}
+	return code;
+}
+
+static ir_code get_data_xmp(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i;
+	lirc_t deltap, deltas, sum;
+	ir_code n;
+
+	if (bits % 4 || done % 4) {
+		logprintf(LIRC_ERROR, "invalid bit number.");
+		return ((ir_code) - 1);
+	}
+	if (!sync_pending_space(remote))
+		return 0;
+	for (i = 0; i < bits; i += 4) {
+		code <<= 4;
+		deltap = get_next_pulse(remote->pzero);
+		deltas = get_next_space(remote->szero + 16 * remote->sone);
+		if (deltap == 0 || deltas == 0) {
 			logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
 			return ((ir_code) - 1);
 		}
-		return code;
-	} else if (is_xmp(remote)) {
-		lirc_t deltap, deltas, sum;
-		ir_code n;
+		sum = deltap + deltas;
 
-		if (bits % 4 || done % 4) {
-			logprintf(LIRC_ERROR, "invalid bit number.");
+		sum -= remote->pzero + remote->szero;
+		n = (sum + remote->sone / 2) / remote->sone;
+		if (n >= 16) {
+			logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
 			return ((ir_code) - 1);
 		}
-		if (!sync_pending_space(remote))
-			return 0;
-		for (i = 0; i < bits; i += 4) {
-			code <<= 4;
-			deltap = get_next_pulse(remote->pzero);
-			deltas = get_next_space(remote->szero + 16 * remote->sone);
-			if (deltap == 0 || deltas == 0) {
-				logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
-				return ((ir_code) - 1);
-			}
-			sum = deltap + deltas;
+		LOGPRINTF(1, "%d: %lx", i, n);
+		code |= n;
 
-			sum -= remote->pzero + remote->szero;
-			n = (sum + remote->sone / 2) / remote->sone;
-			if (n >= 16) {
-				logprintf(LIRC_ERROR, "failed on bit %d", done + i + 1);
-				return ((ir_code) - 1);
-			}
-			LOGPRINTF(1, "%d: %lx", i, n);
-			code |= n;
+	}
+	return code;
+}
 
+/* Decodes one bit the generic way, returns the bit or -1 on failure. */
+static int get_bit(struct ir_remote *remote, int bit)
+{
+	if (is_goldstar(remote)) {
+		if (bit % 2) {
+			LOGPRINTF(2, "$1");
+			remote->pone = remote->ptwo;
+			remote->sone = remote->stwo;
+		} else {
+			LOGPRINTF(2, "$2");
+			remote->pone = remote->pthree;
+			remote->sone = remote->sthree;
 		}
-		return code;
 	}
 
+	if (expectone(remote, bit)) {
+		LOGPRINTF(2, "1");
+		return (1);
+	} else if (expectzero(remote, bit)) {
+		LOGPRINTF(2, "0");
+		return (0);
+	}
+	LOGPRINTF(1, "failed on bit %d", bit + 1);
+	return (-1);
+}
+
+static ir_code get_data_generic(struct ir_remote * remote, int bits, int done)
+{
+	ir_code code = 0;
+	int i, bit;
+
 	for (i = 0; i < bits; i++) {
-		code = code << 1;
-		if (is_goldstar(remote)) {
-			if ((done + i) % 2) {
-				LOGPRINTF(2, "$1");
-				remote->pone = remote->ptwo;
-				remote->sone = remote->stwo;
-			} else {
-				LOGPRINTF(2, "$2");
-				remote->pone = remote->pthree;
-				remote->sone = remote->sthree;
-			}
+		bit = get_bit(remote, done + i);
+		if (bit < 0)
+			return ((ir_code) - 1);
+		code = code << 1 | bit;
+	}
+	return (code);
+}
+
+/*
+ * Bit decoders of the protocol families picked by receive_select_decoder().
+ * Each one does what expectone() and, if that fails, expectzero() do for
+ * the remote, on a copy of the receive buffer state in *s, reading from
+ * the driver in the same order and with the same timeouts. They return
+ * the bit, -1 if the bit fails or isn't a plain one, which get_bit() then
+ * sorts out from the buffer state before the bit, or BIT_NODATA.
+ */
+
+/*
+ * The driver had nothing for a sample the bit needs. get_bit() would
+ * only wait for it again and fail, so the bit fails right away.
+ */
+#define BIT_NODATA (-2)
+
+static int match_fill(struct ir_match_state *s, lirc_t maxusec)
+{
+	return (rbuf_fill(s->pos, maxusec) ? 1 : BIT_NODATA);
+}
+
+/*
+ * The length of a pulse or space less a pending one merged into it, or
+ * 0 if it's shorter than that.
+ */
+static inline lirc_t match_merged(lirc_t delta, lirc_t pending)
+{
+	return (pending > delta ? 0 : delta - pending);
+}
+
+/* space encoded with a trailing pulse, e. g. NEC */
+static int space_enc_bit(const struct ir_remote *remote, struct ir_match_state *s, int bit)
+{
+	const struct ir_windows *w = &remote->windows;
+	lirc_t deltap, deltas;
+	int one;
+
+	if (s->pendings > 0) {
+		if (match_fill(s, s->pendings) < 0)
+			return (BIT_NODATA);
+		if (match_sync_pending_space(remote, s) != 1)
+			return (-1);
+	}
+	if (match_fill(s, s->pendingp + remote->pone) < 0)
+		return (BIT_NODATA);
+	match_pulse(s, &deltap);
+	deltap = match_merged(deltap, s->pendingp);
+	if (deltap == 0)
+		return (-1);
+	one = in_window(&w->pone, deltap);
+	if (!one && !in_window(&w->pzero, deltap))
+		return (-1);
+	if (match_fill(s, one ? remote->sone : remote->szero) < 0)
+		return (BIT_NODATA);
+	match_space(s, &deltas);
+	if (deltas == 0)
+		return (-1);
+	if (one && in_window(&w->sone, deltas)) {
+		s->pendingp = 0;
+		return (1);
+	}
+	/* expectone() has dropped the pending pulse then */
+	if (one && s->pendingp > 0)
+		return (-1);
+	if (in_window(&w->pzero, deltap) && in_window(&w->szero, deltas)) {
+		s->pendingp = 0;
+		return (0);
+	}
+	return (-1);
+}
+
+static int space_first_bit(const struct ir_remote *remote, struct ir_match_state *s, int bit)
+{
+	const struct ir_windows *w = &remote->windows;
+	lirc_t deltas, deltap;
+	int one;
+
+	if (s->pendingp > 0) {
+		if (match_fill(s, s->pendingp) < 0)
+			return (BIT_NODATA);
+		if (match_sync_pending_pulse(remote, s) != 1)
+			return (-1);
+	}
+	if (match_fill(s, s->pendings + remote->sone) < 0)
+		return (BIT_NODATA);
+	match_space(s, &deltas);
+	deltas = match_merged(deltas, s->pendings);
+	if (deltas == 0)
+		return (-1);
+	one = in_window(&w->sone, deltas);
+	if (!one && !in_window(&w->szero, deltas))
+		return (-1);
+	if (match_fill(s, one ? remote->pone : remote->pzero) < 0)
+		return (BIT_NODATA);
+	match_pulse(s, &deltap);
+	if (deltap == 0)
+		return (-1);
+	if (one && in_window(&w->pone, deltap)) {
+		s->pendings = 0;
+		return (1);
+	}
+	/* expectone() has dropped the pending space then */
+	if (one && s->pendings > 0)
+		return (-1);
+	if (in_window(&w->szero, deltas) && in_window(&w->pzero, deltap)) {
+		s->pendings = 0;
+		return (0);
+	}
+	return (-1);
+}
+
+/* biphase, e. g. RC5; the double length bits of RC6 are left to get_bit() */
+static int rc5_bit(const struct ir_remote *remote, struct ir_match_state *s, int bit)
+{
+	const struct ir_windows *w = &remote->windows;
+	int r = 1;
+	int fail;
+
+	if (s->pendingp > 0) {
+		r = match_fill(s, s->pendingp);
+		if (r == 1)
+			r = match_sync_pending_pulse(remote, s);
+	}
+	if (r == 1) {
+		r = match_fill(s, s->pendings + remote->sone);
+		if (r == 1 && match_expectspace(remote, s, &w->sone) == 1) {
+			s->pendingp = remote->pone;
+			return (1);
 		}
+	}
+	/*
+	 * If the driver had nothing for a one, expectzero() may still find
+	 * its pulse buffered; that happens when a frame ends before the
+	 * remote's bits do. If not, get_bit() would only wait again.
+	 */
+	fail = r == BIT_NODATA ? BIT_NODATA : -1;
+	match_unget(s, 1);
+	if (s->pendings > 0) {
+		if (match_fill(s, s->pendings) < 0)
+			return (BIT_NODATA);
+		if (match_sync_pending_space(remote, s) != 1)
+			return (fail);
+	}
+	if (match_fill(s, s->pendingp + remote->pzero) < 0)
+		return (BIT_NODATA);
+	if (match_expectpulse(remote, s, &w->pzero) != 1)
+		return (fail);
+	s->pendings = remote->szero;
+	return (0);
+}
 
-		if (expectone(remote, done + i)) {
-			LOGPRINTF(2, "1");
-			code |= 1;
-		} else if (expectzero(remote, done + i)) {
-			LOGPRINTF(2, "0");
-			code |= 0;
+/*
+ * The loop of the family decoders: bits are decoded on a copy of the
+ * receive buffer state, which is written back before get_bit() has to
+ * take over or the bit fails.
+ */
+static inline ir_code get_data_bits(struct ir_remote *remote, int bits, int done,
+				    int (*get)(const struct ir_remote *, struct ir_match_state *, int))
+{
+	struct ir_match_state s, t;
+	ir_code code = 0;
+	int i, bit;
+
+	memset(&s, 0, sizeof(s));
+	s.pos = rec_buffer.rptr;
+	s.sum = rec_buffer.sum;
+	s.pendingp = rec_buffer.pendingp;
+	s.pendings = rec_buffer.pendings;
+	for (i = 0; i < bits; i++) {
+		t = s;
+		bit = get(remote, &t, done + i);
+		if (bit >= 0) {
+			LOGPRINTF(2, "%d", bit);
+			s = t;
 		} else {
-			LOGPRINTF(1, "failed on bit %d", done + i + 1);
-			return ((ir_code) - 1);
+			rec_buffer.rptr = s.pos;
+			rec_buffer.sum = s.sum;
+			rec_buffer.pendingp = s.pendingp;
+			rec_buffer.pendings = s.pendings;
+			if (bit == BIT_NODATA) {
+				LOGPRINTF(1, "failed on bit %d", done + i + 1);
+				return ((ir_code) - 1);
+			}
+			bit = get_bit(remote, done + i);
+			if (bit < 0)
+				return ((ir_code) - 1);
+			s.pos = rec_buffer.rptr;
+			s.sum = rec_buffer.sum;
+			s.pendingp = rec_buffer.pendingp;
+			s.pendings = rec_buffer.pendings;
 		}
+		code = code << 1 | bit;
 	}
+	rec_buffer.rptr = s.pos;
+	rec_buffer.sum = s.sum;
+	rec_buffer.pendingp = s.pendingp;
+	rec_buffer.pendings = s.pendings;
 	return (code);
 }
 
+static ir_code get_data_space_enc(struct ir_remote * remote, int bits, int done)
+{
+	return (get_data_bits(remote, bits, done, space_enc_bit));
+}
+
+static ir_code get_data_space_first(struct ir_remote * remote, int bits, int done)
+{
+	return (get_data_bits(remote, bits, done, space_first_bit));
+}
+
+static ir_code get_data_rc5(struct ir_remote * remote, int bits, int done)
+{
+	return (get_data_bits(remote, bits, done, rc5_bit));
+}
+
+/*
+ * The bit decoder for the remote's current flags and timing. The family
+ * decoders need the timings expectone() and expectzero() check for zero.
+ */
+static ir_code (*data_decoder(const struct ir_remote *remote))(struct ir_remote *, int, int)
+{
+	if (is_rcmm(remote))
+		return (get_data_rcmm);
+	if (is_grundig(remote))
+		return (get_data_grundig);
+	if (is_serial(remote))
+		return (get_data_serial);
+	if (is_bo(remote))
+		return (get_data_bo);
+	if (is_xmp(remote))
+		return (get_data_xmp);
+	if (is_biphase(remote)) {
+		if (remote->sone == 0 || remote->rc6_mask)
+			return (get_data_generic);
+		return (get_data_rc5);
+	}
+	if (is_space_first(remote)) {
+		if (remote->pone == 0 || remote->sone == 0 || remote->pzero == 0 || remote->szero == 0)
+			return (get_data_generic);
+		return (get_data_space_first);
+	}
+	if (is_space_enc(remote) && remote->pone > 0 && remote->ptrail > 0 && remote->sone > 0)
+		return (get_data_space_enc);
+	return (get_data_generic);
+}
+
+void receive_select_decoder(struct ir_remote *remote)
+{
+	remote->get_data = data_decoder(remote);
+}
+
+static ir_code get_data(struct ir_remote * remote, int bits, int done)
+{
+	if (remote->get_data != NULL)
+		return (remote->get_data(remote, bits, done));
+	return (data_decoder(remote)(remote, bits, done));
+}
+
 static ir_code get_pre(struct ir_remote * remote)
 {
 	ir_code pre;
@@ -1055,6 +2281,7 @@ int receive_decode(struct ir_remote *remote, struct decode_ctx_t* ctx)
 
 	sync = 0;		/* make compiler happy */
 	memset(ctx, 0, sizeof(struct decode_ctx_t));
+	update_windows(remote);
 	ctx->code = ctx->pre = ctx->post = 0;
 	header = 0;
 
@@ -1121,7 +2348,7 @@ int receive_decode(struct ir_remote *remote, struct decode_ctx_t* ctx)
 			header = 1;
 			if (!get_header(remote)) {
 				header = 0;
-				if (!(remote->flags & NO_HEAD_REP && expect_at_most(remote, sync, max_gap(remote)))) {
+				if (!(remote->flags & NO_HEAD_REP && sync <= remote->windows.max_gap)) {
 					LOGPRINTF(1, "failed on header");
 					return (0);
 				}
@@ -1132,12 +2359,21 @@ int receive_decode(struct ir_remote *remote, struct decode_ctx_t* ctx)
 
 	if (is_raw(remote)) {
 		struct ir_ncode *codes, *found;
-		int i;
+		int i, ended;
 
 		if (curr_driver->rec_mode == LIRC_MODE_LIRCCODE)
 			return (0);
 
 		codes = remote->codes;
+		ended = 0;
+		if (remote->raw_table != NULL && rec_buffer.pendingp == 0 && rec_buffer.pendings == 0) {
+			/* skip the codes which fail, as if they had been tried */
+			codes = raw_match(remote, &ended);
+			if (codes != remote->codes) {
+				rec_buffer_rewind();
+				sync_rec_buffer(remote);
+			}
+		}
 		found = NULL;
 		while (codes->name != NULL && found == NULL) {
 			found = codes;
@@ -1156,11 +2392,13 @@ int receive_decode(struct ir_remote *remote, struct decode_ctx_t* ctx)
 				}
 			}
 			codes++;
-			if (found != NULL) {
+			/* raw_match() knows the driver has nothing after an ended code */
+			if (found != NULL && !ended) {
 				if (!get_gap
 				    (remote, is_const(remote) ? min_gap(remote) - rec_buffer.sum : min_gap(remote)))
 					found = NULL;
 			}
+			ended = 0;
 		}
 		if (found == NULL)
 			return (0);
@@ -58,12 +58,35 @@ int waitfordata(__u32 maxusec);
 /** Clear internal buffer to pristine state. */
 void rec_buffer_init();
 
+/** Receive buffer state, opaque outside receive.c. */
+struct rbuf;
+
+/**
+ * Allocate a cleared receive buffer for another driver instance,
+ * see rec_buffer_swap(). Returns NULL if out of memory.
+ */
+struct rbuf* rec_buffer_alloc(void);
+
+/**
+ * Exchange the internal buffer with the one given. Used to run several
+ * driver instances in one process: swap in the instance's buffer before
+ * reading from it, and back again afterwards.
+ */
+void rec_buffer_swap(struct rbuf* other);
+
 /**
  * Flush the internal fifo and store a single code read
  * from the driver in it.
  */
 int rec_buffer_clear(void);
 
+/**
+ * Return the number of samples the driver's readdata_batch() returned
+ * which aren't in the internal fifo yet. The driver's fd doesn't show
+ * these, so callers should decode again while this is non-zero.
+ */
+int rec_buffer_batched(void);
+
 /**
  * Decode data from remote
  *
@@ -81,6 +104,75 @@ void rec_buffer_rewind(void);
 /** Reset internal fifo's write pointer.  */
 void rec_buffer_reset_wptr(void);
 
+/**
+ * Set remote->signature from the remote's timing, done by read_config().
+ * Remotes whose frames can start in ways not covered get SIGNATURE_ANY.
+ */
+void receive_signature(struct ir_remote* remote);
+
+/**
+ * Check the start of the frame in the internal buffer against the
+ * remote's signature, without reading from the driver.
+ *
+ * @return 0 if receive_decode() can't decode the frame for the remote,
+ *     1 if it might, also if too little is buffered to tell.
+ */
+int receive_may_decode(const struct ir_remote* remote);
+
+/**
+ * Tell from the first pulse receive_may_decode() checks if any frame
+ * can be decoded by both remotes.
+ *
+ * @return 0 if not, for the current driver resolution and any lower
+ *     one, else 1.
+ */
+int receive_may_overlap(const struct ir_remote* a, const struct ir_remote* b);
+
+/**
+ * Set remote->matcher from the remote's timing, done by read_config().
+ * Only remotes whose bits are all decoded by the same pulse and space
+ * checks are compiled, i. e. space encoded, space first, RC5 and RC6
+ * remotes without NO_HEAD_REP.
+ */
+void receive_compile(struct ir_remote* remote);
+
+/**
+ * Set remote->raw_table for a raw remote without header, done by
+ * read_config(). receive_decode() uses it to find the first code which
+ * can match the frame without trying all codes before it one by one.
+ */
+void receive_compile_raw(struct ir_remote* remote);
+
+/** Free the table built by receive_compile_raw(). */
+void receive_free_raw(struct ir_remote* remote);
+
+/**
+ * Set remote->get_data to the bit decoder of the remote's protocol family,
+ * done by read_config(). Space encoded (NEC and pulse width like), space
+ * first, RC5 and RC6 remotes get decoders which read the pulse and space
+ * of a bit once and check them for both values, leaving anything else to
+ * expectone() and expectzero(). Other remotes get the decoder of their
+ * protocol, or the generic one.
+ */
+void receive_select_decoder(struct ir_remote* remote);
+
+/**
+ * Start checking a new frame with receive_match(), done by decode_all()
+ * before trying the remotes.
+ */
+void receive_match_start(struct ir_remote* remotes);
+
+/**
+ * Check the buffered frame with the compiled steps of all remotes,
+ * advancing them together until the given remote is decided. Like
+ * receive_may_decode() this never reads from the driver, which is used
+ * for remotes which aren't compiled.
+ *
+ * @return 0 if receive_decode() can't decode the frame for the remote,
+ *     1 if it might, also if too little is buffered to tell.
+ */
+int receive_match(struct ir_remote* remote);
+
 
 /** @} */
 #ifdef	__cplusplus
@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 
 #include "include/media/lirc.h"
@@ -28,64 +29,100 @@
 #include "lirc/receive.h"
 #include "lirc/lirc_log.h"
 
-static struct timeval release_time;
-static struct ir_remote *release_remote;
-static struct ir_ncode *release_ncode;
-static ir_code release_code;
-static int release_reps;
-static lirc_t release_gap;
-
-static struct ir_remote *release_remote2;
-static struct ir_ncode *release_ncode2;
-static ir_code release_code2;
+struct release_state {
+	struct timeval release_time;
+	struct ir_remote *release_remote;
+	struct ir_ncode *release_ncode;
+	ir_code release_code;
+	int release_reps;
+	lirc_t release_gap;
+
+	struct ir_remote *release_remote2;
+	struct ir_ncode *release_ncode2;
+	ir_code release_code2;
+
+	/* Of the last release event, see get_release_code(). */
+	struct ir_remote *released_remote;
+	struct ir_ncode *released_ncode;
+	ir_code released_code;
+};
+
+static struct release_state state;
 static const char *release_suffix = LIRC_RELEASE_SUFFIX;
 static char message[PACKET_SIZE + 1];
 
+struct release_state* release_state_alloc(void)
+{
+	return calloc(1, sizeof(struct release_state));
+}
+
+void release_state_swap(struct release_state* other)
+{
+	struct release_state tmp;
+
+	memcpy(&tmp, &state, sizeof(struct release_state));
+	memcpy(&state, other, sizeof(struct release_state));
+	memcpy(other, &tmp, sizeof(struct release_state));
+}
+
 void register_input(void)
 {
 	struct timeval gap;
 
-	if (release_remote == NULL)
+	if (state.release_remote == NULL)
 		return;
 
 	timerclear(&gap);
-	gap.tv_usec = release_gap;
+	gap.tv_usec = state.release_gap;
 
-	gettimeofday(&release_time, NULL);
-	timeradd(&release_time, &gap, &release_time);
+	gettimeofday(&state.release_time, NULL);
+	timeradd(&state.release_time, &gap, &state.release_time);
 }
 
 void register_button_press(struct ir_remote *remote, struct ir_ncode *ncode, ir_code code, int reps)
 {
-	if (reps == 0 && release_remote != NULL) {
-		release_remote2 = release_remote;
-		release_ncode2 = release_ncode;
-		release_code2 = release_code;
+	if (reps == 0 && state.release_remote != NULL) {
+		state.release_remote2 = state.release_remote;
+		state.release_ncode2 = state.release_ncode;
+		state.release_code2 = state.release_code;
 	}
 
-	release_remote = remote;
-	release_ncode = ncode;
-	release_code = code;
-	release_reps = reps;
-	release_gap = upper_limit(remote, remote->max_total_signal_length - remote->min_gap_length) + receive_timeout(upper_limit(remote, remote->min_gap_length)) + 10000;	/* some additional safety margin */
+	state.release_remote = remote;
+	state.release_ncode = ncode;
+	state.release_code = code;
+	state.release_reps = reps;
+	state.release_gap = upper_limit(remote, remote->max_total_signal_length - remote->min_gap_length) + receive_timeout(upper_limit(remote, remote->min_gap_length)) + 10000;	/* some additional safety margin */
 
-	LOGPRINTF(1, "release_gap: %lu", release_gap);
+	LOGPRINTF(1, "release_gap: %lu", state.release_gap);
 
 	register_input();
 }
 
 void get_release_data(const char **remote_name, const char **button_name, int *reps)
 {
-	if (release_remote != NULL) {
-		*remote_name = release_remote->name;
-		*button_name = release_ncode->name;
-		*reps = release_reps;
+	if (state.release_remote != NULL) {
+		*remote_name = state.release_remote->name;
+		*button_name = state.release_ncode->name;
+		*reps = state.release_reps;
 	} else {
 		*remote_name = *button_name = "(NULL)";
 		*reps = 0;
 	}
 }
 
+void get_release_code(int release, struct ir_remote **remote, struct ir_ncode **ncode, ir_code *code)
+{
+	if (release) {
+		*remote = state.released_remote;
+		*ncode = state.released_ncode;
+		*code = state.released_code;
+	} else {
+		*remote = state.release_remote;
+		*ncode = state.release_ncode;
+		*code = state.release_code;
+	}
+}
+
 void set_release_suffix(const char *s)
 {
 	release_suffix = s;
@@ -93,22 +130,25 @@ void set_release_suffix(const char *s)
 
 void get_release_time(struct timeval *tv)
 {
-	*tv = release_time;
+	*tv = state.release_time;
 }
 
 const char *check_release_event(const char **remote_name, const char **button_name)
 {
 	int len = 0;
 
-	if (release_remote2 != NULL) {
-		*remote_name = release_remote2->name;
-		*button_name = release_ncode2->name;
+	if (state.release_remote2 != NULL) {
+		*remote_name = state.release_remote2->name;
+		*button_name = state.release_ncode2->name;
 		len =
-		    write_message(message, PACKET_SIZE + 1, release_remote2->name, release_ncode2->name, release_suffix,
-				  release_code2, 0);
-		release_remote2 = NULL;
-		release_ncode2 = NULL;
-		release_code2 = 0;
+		    write_message(message, PACKET_SIZE + 1, state.release_remote2->name, state.release_ncode2->name, release_suffix,
+				  state.release_code2, 0);
+		state.released_remote = state.release_remote2;
+		state.released_ncode = state.release_ncode2;
+		state.released_code = state.release_code2;
+		state.release_remote2 = NULL;
+		state.release_ncode2 = NULL;
+		state.release_code2 = 0;
 
 		if (len >= PACKET_SIZE + 1) {
 			logprintf(LIRC_ERROR, "message buffer overflow");
@@ -125,17 +165,20 @@ const char *trigger_release_event(const char **remote_name, const char **button_
 {
 	int len = 0;
 
-	if (release_remote != NULL) {
-		release_remote->release_detected = 1;
-		*remote_name = release_remote->name;
-		*button_name = release_ncode->name;
+	if (state.release_remote != NULL) {
+		state.release_remote->release_detected = 1;
+		*remote_name = state.release_remote->name;
+		*button_name = state.release_ncode->name;
 		len =
-		    write_message(message, PACKET_SIZE + 1, release_remote->name, release_ncode->name, release_suffix,
-				  release_code, 0);
-		timerclear(&release_time);
-		release_remote = NULL;
-		release_ncode = NULL;
-		release_code = 0;
+		    write_message(message, PACKET_SIZE + 1, state.release_remote->name, state.release_ncode->name, release_suffix,
+				  state.release_code, 0);
+		state.released_remote = state.release_remote;
+		state.released_ncode = state.release_ncode;
+		state.released_code = state.release_code;
+		timerclear(&state.release_time);
+		state.release_remote = NULL;
+		state.release_ncode = NULL;
+		state.release_code = 0;
 
 		if (len >= PACKET_SIZE + 1) {
 			logprintf(LIRC_ERROR, "message buffer overflow");
@@ -153,16 +196,16 @@ const char *release_map_remotes(struct ir_remote *old, struct ir_remote *new, co
 	struct ir_remote *remote;
 	struct ir_ncode *ncode;
 
-	if (release_remote2 != NULL) {
+	if (state.release_remote2 != NULL) {
 		/* should not happen */
 		logprintf(LIRC_ERROR, "release_remote2 still in use");
-		release_remote2 = NULL;
+		state.release_remote2 = NULL;
 	}
-	if (release_remote && is_in_remotes(old, release_remote)) {
-		if ((remote = get_ir_remote(new, release_remote->name))
-		    && (ncode = get_code_by_name(remote, release_ncode->name))) {
-			release_remote = remote;
-			release_ncode = ncode;
+	if (state.release_remote && is_in_remotes(old, state.release_remote)) {
+		if ((remote = get_ir_remote(new, state.release_remote->name))
+		    && (ncode = get_code_by_name(remote, state.release_ncode->name))) {
+			state.release_remote = remote;
+			state.release_ncode = ncode;
 		} else {
 			return trigger_release_event(remote_name, button_name);
 		}
@@ -21,6 +21,21 @@ extern "C" {
 
 #include "ir_remote_types.h"
 
+/** Release event state, opaque outside release.c. */
+struct release_state;
+
+/**
+ * Allocate a cleared release state for another driver instance, see
+ * release_state_swap(). Returns NULL if out of memory.
+ */
+struct release_state* release_state_alloc(void);
+
+/**
+ * Exchange the internal release state with the one given, as
+ * rec_buffer_swap() does for the receive buffer.
+ */
+void release_state_swap(struct release_state* other);
+
 void register_input(void);
 
 void register_button_press(struct ir_remote* remote,
@@ -31,6 +46,16 @@ void get_release_data(const char** remote_name,
 		      const char** button_name,
 		      int* reps);
 
+/*
+ * The remote, code and code value of the last button press, or with
+ * release set of the event check_release_event() or
+ * trigger_release_event() returned last. remote is NULL if none.
+ */
+void get_release_code(int release,
+		      struct ir_remote** remote,
+		      struct ir_ncode** ncode,
+		      ir_code* code);
+
 void set_release_suffix(const char* s);
 
 void get_release_time(struct timeval* tv);
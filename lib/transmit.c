@@ -23,114 +23,234 @@
    signals and send the signal chain at a single blow */
 #define LIRCD_EXACT_GAP_THRESHOLD 10000
 
+/* most compiled frames kept per code, see send_code() */
+#define MAX_WAVEFORMS 8
+
+#include <stdlib.h>
+#include <string.h>
+
 #include "include/media/lirc.h"
 #include "lirc/lirc_log.h"
 #include "lirc/transmit.h"
 
 /**
- * Struct for the global sending buffer.
+ * A sending buffer, the global one or one from send_buffer_new().
  */
-static struct sbuf {
+struct send_buffer {
 	lirc_t *data;
 
-	lirc_t _data[WBUF_SIZE]; /**< Actual sending data. */
+	lirc_t *_data;		/**< Actual sending data, grown as needed. */
+	int size;		/**< Allocated items in _data. */
 	int wptr;
 	int too_long;
 	int is_biphase;
 	lirc_t pendingp;
 	lirc_t pendings;
 	lirc_t sum;
-} send_buffer;
+	lirc_t pause;		/**< Before the next send_buffer_add() code. */
 
+	int recording;		/**< send_frame() output is compiled too. */
+	int rec_first_pulse;	/**< rec_data[0] is a pulse. */
+	int rec_length;
+	lirc_t rec_data[WBUF_SIZE];	/**< send_frame() output, merged. */
+};
 
-static void send_signals(lirc_t * signals, int n);
-static int init_send_or_sim(struct ir_remote *remote, struct ir_ncode *code, int sim, int repeat_preset);
+static struct send_buffer global_send_buffer;
+
+/**
+ * The buffer everything works on in this thread, see send_buffer_select().
+ * Read once per call, the internal functions are passed the buffer.
+ */
+static __thread struct send_buffer *sbuf = &global_send_buffer;
+
+/**
+ * A frame send_frame() sent for a code, kept with the code so it is
+ * sent again without going through the bits. The signals alternate
+ * between pulses and spaces as send_pulse() and send_space() merge
+ * them; the first and last one may still merge with what's around.
+ */
+struct ir_waveform {
+	struct ir_waveform *next;	/**< Other frames of the code. */
+	ir_code code;		/**< As passed to send_frame(). */
+	int repeat;		/**< As passed to send_frame(). */
+	ir_code toggle_bits;	/**< toggle_bit_mask_state bits in toggle_bit_mask. */
+	int toggled;		/**< toggle_mask applied. */
+	int first_pulse;	/**< signals[0] is a pulse. */
+	int length;
+	lirc_t mid_sum;		/**< Sum of all signals but the first and the last. */
+	lirc_t *signals;
+};
+
+
+static void send_signals(struct send_buffer *sb, lirc_t * signals, int n);
+static int init_send_or_sim(struct send_buffer *sb, struct ir_remote *remote, struct ir_ncode *code, int sim, int repeat_preset, int reps);
 
 /*
   sending stuff
 */
 
 /**
- * Initializes the global sending buffer. (Just fills it with zeros.)
+ * Initializes the selected sending buffer. (Just fills it with zeros.)
  */
 void send_buffer_init(void)
 {
-	memset(&send_buffer, 0, sizeof(send_buffer));
+	struct send_buffer *sb = sbuf;
+
+	free(sb->_data);
+	memset(sb, 0, sizeof(*sb));
+}
+
+struct send_buffer *send_buffer_new(void)
+{
+	struct send_buffer *buf;
+
+	buf = calloc(1, sizeof(struct send_buffer));
+	if (buf == NULL)
+		logprintf(LIRC_ERROR, "out of memory");
+	return (buf);
 }
 
-static  void clear_send_buffer(void)
+void send_buffer_delete(struct send_buffer *buf)
+{
+	if (buf == NULL)
+		return;
+	if (sbuf == buf)
+		sbuf = &global_send_buffer;
+	free(buf->_data);
+	free(buf);
+}
+
+struct send_buffer *send_buffer_select(struct send_buffer *buf)
+{
+	struct send_buffer *prev = sbuf;
+
+	sbuf = buf != NULL ? buf : &global_send_buffer;
+	return (prev == &global_send_buffer ? NULL : prev);
+}
+
+static  void clear_send_buffer(struct send_buffer *sb)
 {
 	LOGPRINTF(3, "clearing transmit buffer");
-	send_buffer.wptr = 0;
-	send_buffer.too_long = 0;
-	send_buffer.is_biphase = 0;
-	send_buffer.pendingp = 0;
-	send_buffer.pendings = 0;
-	send_buffer.sum = 0;
+	sb->wptr = 0;
+	sb->too_long = 0;
+	sb->is_biphase = 0;
+	sb->pendingp = 0;
+	sb->pendings = 0;
+	sb->sum = 0;
+}
+
+/* Make room for n more signals, returns 0 if out of memory. */
+static int reserve_send_buffer(struct send_buffer *sb, int n)
+{
+	lirc_t *data;
+	int size, own;
+
+	if (sb->wptr + n <= sb->size)
+		return (1);
+	size = sb->size > 0 ? sb->size : WBUF_SIZE;
+	while (size < sb->wptr + n)
+		size *= 2;
+	own = sb->data == sb->_data;
+	data = realloc(sb->_data, size * sizeof(lirc_t));
+	if (data == NULL) {
+		logprintf(LIRC_ERROR, "out of memory");
+		return (0);
+	}
+	sb->_data = data;
+	sb->size = size;
+	if (own)
+		sb->data = data;
+	return (1);
 }
 
-static  void add_send_buffer(lirc_t data)
+static  void add_send_buffer(struct send_buffer *sb, lirc_t data)
 {
-	if (send_buffer.wptr < WBUF_SIZE) {
+	if (reserve_send_buffer(sb, 1)) {
 		LOGPRINTF(3, "adding to transmit buffer: %u", data);
-		send_buffer.sum += data;
-		send_buffer._data[send_buffer.wptr] = data;
-		send_buffer.wptr++;
+		sb->sum += data;
+		sb->_data[sb->wptr] = data;
+		sb->wptr++;
 	} else {
-		send_buffer.too_long = 1;
+		sb->too_long = 1;
 	}
 }
 
-static  void send_pulse(lirc_t data)
+/*
+ * Add a signal to the frame being compiled. A zero signal doesn't merge
+ * like the others, frames with one aren't compiled.
+ */
+static void record_signal(struct send_buffer *sb, int pulse, lirc_t data)
 {
-	if (send_buffer.pendingp > 0) {
-		send_buffer.pendingp += data;
+	int last = sb->rec_length - 1;
+
+	if (data == 0) {
+		sb->recording = 0;
+		return;
+	}
+	if (last < 0) {
+		sb->rec_first_pulse = pulse;
+	} else if ((last % 2 == 0) == (pulse == sb->rec_first_pulse)) {
+		sb->rec_data[last] += data;
+		return;
+	}
+	if (sb->rec_length == WBUF_SIZE) {
+		sb->recording = 0;
+		return;
+	}
+	sb->rec_data[sb->rec_length++] = data;
+}
+
+static  void send_pulse(struct send_buffer *sb, lirc_t data)
+{
+	if (sb->recording)
+		record_signal(sb, 1, data);
+	if (sb->pendingp > 0) {
+		sb->pendingp += data;
 	} else {
-		if (send_buffer.pendings > 0) {
-			add_send_buffer(send_buffer.pendings);
-			send_buffer.pendings = 0;
+		if (sb->pendings > 0) {
+			add_send_buffer(sb, sb->pendings);
+			sb->pendings = 0;
 		}
-		send_buffer.pendingp = data;
+		sb->pendingp = data;
 	}
 }
 
-static  void send_space(lirc_t data)
+static  void send_space(struct send_buffer *sb, lirc_t data)
 {
-	if (send_buffer.wptr == 0 && send_buffer.pendingp == 0) {
+	if (sb->recording)
+		record_signal(sb, 0, data);
+	if (sb->wptr == 0 && sb->pendingp == 0) {
 		LOGPRINTF(1, "first signal is a space!");
 		return;
 	}
-	if (send_buffer.pendings > 0) {
-		send_buffer.pendings += data;
+	if (sb->pendings > 0) {
+		sb->pendings += data;
 	} else {
-		if (send_buffer.pendingp > 0) {
-			add_send_buffer(send_buffer.pendingp);
-			send_buffer.pendingp = 0;
+		if (sb->pendingp > 0) {
+			add_send_buffer(sb, sb->pendingp);
+			sb->pendingp = 0;
 		}
-		send_buffer.pendings = data;
+		sb->pendings = data;
 	}
 }
 
-static  int bad_send_buffer(void)
+static  int bad_send_buffer(struct send_buffer *sb)
 {
-	if (send_buffer.too_long != 0)
+	if (sb->too_long != 0)
 		return (1);
-	if (send_buffer.wptr == WBUF_SIZE && send_buffer.pendingp > 0) {
-		return (1);
-	}
 	return (0);
 }
 
-static int check_send_buffer(void)
+static int check_send_buffer(struct send_buffer *sb)
 {
 	int i;
 
-	if (send_buffer.wptr == 0) {
+	if (sb->wptr == 0) {
 		LOGPRINTF(1, "nothing to send");
 		return (0);
 	}
-	for (i = 0; i < send_buffer.wptr; i++) {
-		if (send_buffer.data[i] == 0) {
+	for (i = 0; i < sb->wptr; i++) {
+		if (sb->data[i] == 0) {
 			if (i % 2) {
 				LOGPRINTF(1, "invalid space: %d", i);
 			} else {
@@ -143,59 +263,59 @@ static int check_send_buffer(void)
 	return 1;
 }
 
-static  void flush_send_buffer(void)
+static  void flush_send_buffer(struct send_buffer *sb)
 {
-	if (send_buffer.pendingp > 0) {
-		add_send_buffer(send_buffer.pendingp);
-		send_buffer.pendingp = 0;
+	if (sb->pendingp > 0) {
+		add_send_buffer(sb, sb->pendingp);
+		sb->pendingp = 0;
 	}
-	if (send_buffer.pendings > 0) {
-		add_send_buffer(send_buffer.pendings);
-		send_buffer.pendings = 0;
+	if (sb->pendings > 0) {
+		add_send_buffer(sb, sb->pendings);
+		sb->pendings = 0;
 	}
 }
 
-static  void sync_send_buffer(void)
+static  void sync_send_buffer(struct send_buffer *sb)
 {
-	if (send_buffer.pendingp > 0) {
-		add_send_buffer(send_buffer.pendingp);
-		send_buffer.pendingp = 0;
+	if (sb->pendingp > 0) {
+		add_send_buffer(sb, sb->pendingp);
+		sb->pendingp = 0;
 	}
-	if (send_buffer.wptr > 0 && send_buffer.wptr % 2 == 0)
-		send_buffer.wptr--;
+	if (sb->wptr > 0 && sb->wptr % 2 == 0)
+		sb->wptr--;
 }
 
-static  void send_header(struct ir_remote *remote)
+static  void send_header(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (has_header(remote)) {
-		send_pulse(remote->phead);
-		send_space(remote->shead);
+		send_pulse(sb, remote->phead);
+		send_space(sb, remote->shead);
 	}
 }
 
-static  void send_foot(struct ir_remote *remote)
+static  void send_foot(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (has_foot(remote)) {
-		send_space(remote->sfoot);
-		send_pulse(remote->pfoot);
+		send_space(sb, remote->sfoot);
+		send_pulse(sb, remote->pfoot);
 	}
 }
 
-static  void send_lead(struct ir_remote *remote)
+static  void send_lead(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (remote->plead != 0) {
-		send_pulse(remote->plead);
+		send_pulse(sb, remote->plead);
 	}
 }
 
-static  void send_trail(struct ir_remote *remote)
+static  void send_trail(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (remote->ptrail != 0) {
-		send_pulse(remote->ptrail);
+		send_pulse(sb, remote->ptrail);
 	}
 }
 
-static  void send_data(struct ir_remote *remote, ir_code data, int bits, int done)
+static  void send_data(struct send_buffer *sb, struct ir_remote *remote, ir_code data, int bits, int done)
 {
 	int i;
 	int all_bits = bit_count(remote);
@@ -207,26 +327,27 @@ static  void send_data(struct ir_remote *remote, ir_code data, int bits, int don
 		mask = 1 << (all_bits - 1 - done);
 		if (bits % 2 || done % 2) {
 			logprintf(LIRC_ERROR, "invalid bit number.");
+			sb->recording = 0;
 			return;
 		}
 		for (i = 0; i < bits; i += 2, mask >>= 2) {
 			switch (data & 3) {
 			case 0:
-				send_pulse(remote->pzero);
-				send_space(remote->szero);
+				send_pulse(sb, remote->pzero);
+				send_space(sb, remote->szero);
 				break;
 				/* 2 and 1 swapped due to reverse() */
 			case 2:
-				send_pulse(remote->pone);
-				send_space(remote->sone);
+				send_pulse(sb, remote->pone);
+				send_space(sb, remote->sone);
 				break;
 			case 1:
-				send_pulse(remote->ptwo);
-				send_space(remote->stwo);
+				send_pulse(sb, remote->ptwo);
+				send_space(sb, remote->stwo);
 				break;
 			case 3:
-				send_pulse(remote->pthree);
-				send_space(remote->sthree);
+				send_pulse(sb, remote->pthree);
+				send_space(sb, remote->sthree);
 				break;
 			}
 			data = data >> 2;
@@ -235,14 +356,15 @@ static  void send_data(struct ir_remote *remote, ir_code data, int bits, int don
 	} else if (is_xmp(remote)) {
 		if (bits % 4 || done % 4) {
 			logprintf(LIRC_ERROR, "invalid bit number.");
+			sb->recording = 0;
 			return;
 		}
 		for (i = 0; i < bits; i += 4) {
 			ir_code nibble;
 
 			nibble = reverse(data & 0xf, 4);
-			send_pulse(remote->pzero);
-			send_space(remote->szero + nibble * remote->sone);
+			send_pulse(sb, remote->pzero);
+			send_space(sb, remote->szero + nibble * remote->sone);
 			data >>= 4;
 		}
 		return;
@@ -270,88 +392,170 @@ static  void send_data(struct ir_remote *remote, ir_code data, int bits, int don
 			if (is_biphase(remote)) {
 
 				if (mask & remote->rc6_mask) {
-					send_space(2 * remote->sone);
-					send_pulse(2 * remote->pone);
+					send_space(sb, 2 * remote->sone);
+					send_pulse(sb, 2 * remote->pone);
 				} else {
-					send_space(remote->sone);
-					send_pulse(remote->pone);
+					send_space(sb, remote->sone);
+					send_pulse(sb, remote->pone);
 				}
 			} else if (is_space_first(remote)) {
-				send_space(remote->sone);
-				send_pulse(remote->pone);
+				send_space(sb, remote->sone);
+				send_pulse(sb, remote->pone);
 			} else {
-				send_pulse(remote->pone);
-				send_space(remote->sone);
+				send_pulse(sb, remote->pone);
+				send_space(sb, remote->sone);
 			}
 		} else {
 			if (mask & remote->rc6_mask) {
-				send_pulse(2 * remote->pzero);
-				send_space(2 * remote->szero);
+				send_pulse(sb, 2 * remote->pzero);
+				send_space(sb, 2 * remote->szero);
 			} else if (is_space_first(remote)) {
-				send_space(remote->szero);
-				send_pulse(remote->pzero);
+				send_space(sb, remote->szero);
+				send_pulse(sb, remote->pzero);
 			} else {
-				send_pulse(remote->pzero);
-				send_space(remote->szero);
+				send_pulse(sb, remote->pzero);
+				send_space(sb, remote->szero);
 			}
 		}
 		data = data >> 1;
 	}
 }
 
-static  void send_pre(struct ir_remote *remote)
+static  void send_pre(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (has_pre(remote)) {
-		send_data(remote, remote->pre_data, remote->pre_data_bits, 0);
+		send_data(sb, remote, remote->pre_data, remote->pre_data_bits, 0);
 		if (remote->pre_p > 0 && remote->pre_s > 0) {
-			send_pulse(remote->pre_p);
-			send_space(remote->pre_s);
+			send_pulse(sb, remote->pre_p);
+			send_space(sb, remote->pre_s);
 		}
 	}
 }
 
-static  void send_post(struct ir_remote *remote)
+static  void send_post(struct send_buffer *sb, struct ir_remote *remote)
 {
 	if (has_post(remote)) {
 		if (remote->post_p > 0 && remote->post_s > 0) {
-			send_pulse(remote->post_p);
-			send_space(remote->post_s);
+			send_pulse(sb, remote->post_p);
+			send_space(sb, remote->post_s);
 		}
-		send_data(remote, remote->post_data, remote->post_data_bits, remote->pre_data_bits + remote->bits);
+		send_data(sb, remote, remote->post_data, remote->post_data_bits, remote->pre_data_bits + remote->bits);
 	}
 }
 
-static  void send_repeat(struct ir_remote *remote)
+static  void send_repeat(struct send_buffer *sb, struct ir_remote *remote)
 {
-	send_lead(remote);
-	send_pulse(remote->prepeat);
-	send_space(remote->srepeat);
-	send_trail(remote);
+	send_lead(sb, remote);
+	send_pulse(sb, remote->prepeat);
+	send_space(sb, remote->srepeat);
+	send_trail(sb, remote);
 }
 
-static  void send_code(struct ir_remote *remote, ir_code code, int repeat)
+static  void send_frame(struct send_buffer *sb, struct ir_remote *remote, ir_code code, int repeat)
 {
 	if (!repeat || !(remote->flags & NO_HEAD_REP))
-		send_header(remote);
-	send_lead(remote);
-	send_pre(remote);
-	send_data(remote, code, remote->bits, remote->pre_data_bits);
-	send_post(remote);
-	send_trail(remote);
+		send_header(sb, remote);
+	send_lead(sb, remote);
+	send_pre(sb, remote);
+	send_data(sb, remote, code, remote->bits, remote->pre_data_bits);
+	send_post(sb, remote);
+	send_trail(sb, remote);
 	if (!repeat || !(remote->flags & NO_FOOT_REP))
-		send_foot(remote);
+		send_foot(sb, remote);
+}
+
+/* Send a compiled frame as send_frame() would. */
+static void send_waveform(struct send_buffer *sb, const struct ir_waveform *w)
+{
+	int last = w->length - 1;
+
+	if (w->first_pulse)
+		send_pulse(sb, w->signals[0]);
+	else
+		send_space(sb, w->signals[0]);
+	if (last == 0)
+		return;
+	/* each signal from here on completes the one before */
+	flush_send_buffer(sb);
+	if (reserve_send_buffer(sb, last - 1)) {
+		memcpy(sb->_data + sb->wptr, w->signals + 1, (last - 1) * sizeof(lirc_t));
+		sb->wptr += last - 1;
+		sb->sum += w->mid_sum;
+	} else {
+		sb->too_long = 1;
+	}
+	if ((last % 2 == 0) == (w->first_pulse != 0))
+		sb->pendingp = w->signals[last];
+	else
+		sb->pendings = w->signals[last];
+}
+
+/* Keep the frame send_frame() just sent with the code. */
+static void add_waveform(struct send_buffer *sb, struct ir_ncode *ncode, ir_code code, int repeat, ir_code toggle_bits, int toggled)
+{
+	struct ir_waveform *w;
+	int i, n = sb->rec_length;
+
+	if (n == 0)
+		return;
+	w = malloc(sizeof(*w) + n * sizeof(lirc_t));
+	if (w == NULL)
+		return;
+	w->code = code;
+	w->repeat = repeat;
+	w->toggle_bits = toggle_bits;
+	w->toggled = toggled;
+	w->first_pulse = sb->rec_first_pulse;
+	w->length = n;
+	w->signals = (lirc_t *)(w + 1);
+	memcpy(w->signals, sb->rec_data, n * sizeof(lirc_t));
+	w->mid_sum = 0;
+	for (i = 1; i < n - 1; i++)
+		w->mid_sum += w->signals[i];
+	w->next = ncode->waveforms;
+	ncode->waveforms = w;
+}
+
+/*
+ * Send code as a frame of ncode, if not NULL from the frames compiled
+ * for it: these depend on the code, repeat and toggle state only.
+ */
+static  void send_code(struct send_buffer *sb, struct ir_remote *remote, struct ir_ncode *ncode, ir_code code, int repeat)
+{
+	struct ir_waveform *w = NULL;
+	ir_code toggle_bits = remote->toggle_bit_mask_state & remote->toggle_bit_mask;
+	int toggled = has_toggle_mask(remote) && remote->toggle_mask_state % 2;
+	int n = 0;
+
+	if (ncode != NULL) {
+		for (w = ncode->waveforms; w != NULL; w = w->next, n++) {
+			if (w->code == code && w->repeat == repeat
+			    && w->toggle_bits == toggle_bits && w->toggled == toggled)
+				break;
+		}
+	}
+	if (w != NULL) {
+		send_waveform(sb, w);
+	} else {
+		sb->recording = ncode != NULL && n < MAX_WAVEFORMS;
+		sb->rec_length = 0;
+		send_frame(sb, remote, code, repeat);
+		if (sb->recording)
+			add_waveform(sb, ncode, code, repeat, toggle_bits, toggled);
+		sb->recording = 0;
+	}
 
 	if (!repeat && remote->flags & NO_HEAD_REP && remote->flags & CONST_LENGTH) {
-		send_buffer.sum -= remote->phead + remote->shead;
+		sb->sum -= remote->phead + remote->shead;
 	}
 }
 
-static void send_signals(lirc_t * signals, int n)
+static void send_signals(struct send_buffer *sb, lirc_t * signals, int n)
 {
 	int i;
 
 	for (i = 0; i < n; i++) {
-		add_send_buffer(signals[i]);
+		add_send_buffer(sb, signals[i]);
 	}
 }
 
@@ -363,7 +567,42 @@ static void send_signals(lirc_t * signals, int n)
  */
 int send_buffer_put(struct ir_remote *remote, struct ir_ncode *code)
 {
-	return init_send_or_sim(remote, code, 0, 0);
+	return init_send_or_sim(sbuf, remote, code, 0, 0, -1);
+}
+
+void send_buffer_start(void)
+{
+	send_buffer_start_into(sbuf);
+}
+
+int send_buffer_add(struct ir_remote *remote, struct ir_ncode *code, int reps)
+{
+	return init_send_or_sim(sbuf, remote, code, 0, 0, reps < 0 ? 0 : reps);
+}
+
+const lirc_t *send_buffer_put_into(struct send_buffer *buf, struct ir_remote *remote, struct ir_ncode *code,
+				   int *length)
+{
+	if (!init_send_or_sim(buf, remote, code, 0, 0, -1))
+		return (NULL);
+	*length = buf->wptr;
+	return (buf->data);
+}
+
+void send_buffer_start_into(struct send_buffer *buf)
+{
+	clear_send_buffer(buf);
+	buf->data = buf->_data;
+	buf->pause = 0;
+}
+
+const lirc_t *send_buffer_add_into(struct send_buffer *buf, struct ir_remote *remote, struct ir_ncode *code,
+				   int reps, int *length)
+{
+	if (!init_send_or_sim(buf, remote, code, 0, 0, reps < 0 ? 0 : reps))
+		return (NULL);
+	*length = buf->wptr;
+	return (buf->data);
 }
 
 /** Do not document this function
@@ -371,30 +610,56 @@ int send_buffer_put(struct ir_remote *remote, struct ir_ncode *code)
  */
 int init_sim(struct ir_remote *remote, struct ir_ncode *code, int repeat_preset)
 {
-	return init_send_or_sim(remote, code, 1, repeat_preset);
+	return init_send_or_sim(sbuf, remote, code, 1, repeat_preset, -1);
+}
+
+const lirc_t *send_buffer_sim(struct send_buffer *buf, struct ir_remote *remote, struct ir_ncode *code,
+			      int repeat_preset, int *length, lirc_t *sum)
+{
+	if (!init_send_or_sim(buf, remote, code, 1, repeat_preset, -1))
+		return (NULL);
+	*length = buf->wptr;
+	*sum = buf->sum;
+	return (buf->data);
 }
 /** @endcond */
 
 
 int send_buffer_length()
 {
-	return send_buffer.wptr;
+	return sbuf->wptr;
 }
 
 
 const lirc_t* send_buffer_data()
 {
-	return send_buffer.data;
+	return sbuf->data;
 }
 
 lirc_t send_buffer_sum()
 {
-	return send_buffer.sum;
+	return sbuf->sum;
+}
+
+void send_buffer_free_waveforms(struct ir_ncode *code)
+{
+	struct ir_waveform *w, *next;
+
+	for (w = code->waveforms; w != NULL; w = next) {
+		next = w->next;
+		free(w);
+	}
+	code->waveforms = NULL;
 }
 
-static int init_send_or_sim(struct ir_remote *remote, struct ir_ncode *code, int sim, int repeat_preset)
+/*
+ * Prepare the buffer for code. With reps >= 0 the code is added to the
+ * buffer for send_buffer_add(), with the frames lircd would send for a
+ * SEND_ONCE with reps repeats.
+ */
+static int init_send_or_sim(struct send_buffer *sb, struct ir_remote *remote, struct ir_ncode *code, int sim, int repeat_preset, int reps)
 {
-	int i, repeat = repeat_preset;
+	int i, more, repeat = repeat_preset;
 
 	if (is_grundig(remote) || is_goldstar(remote) || is_serial(remote) || is_bo(remote)) {
 		if (!sim) {
@@ -402,18 +667,29 @@ static int init_send_or_sim(struct ir_remote *remote, struct ir_ncode *code, int
 		}
 		return (0);
 	}
-	clear_send_buffer();
+	if (reps < 0) {
+		clear_send_buffer(sb);
+	} else if (sb->wptr > 0) {
+		send_space(sb, sb->pause);
+		flush_send_buffer(sb);
+		sb->sum = 0;
+	}
 	if (strcmp(remote->name, "lirc") == 0) {
-		send_buffer.data[send_buffer.wptr] = LIRC_EOF | 1;
-	        send_buffer.wptr += 1;
+		if (!reserve_send_buffer(sb, 1))
+			return (0);
+		sb->data = sb->_data;
+		sb->data[sb->wptr] = LIRC_EOF | 1;
+	        sb->wptr += 1;
 		goto final_check;
 	}
 
 	if (is_biphase(remote)) {
-		send_buffer.is_biphase = 1;
+		sb->is_biphase = 1;
 	}
 	if (!sim) {
-		if (repeat_remote == NULL) {
+		if (reps >= 0) {
+			remote->repeat_countdown = reps > remote->min_repeat ? reps : remote->min_repeat;
+		} else if (repeat_remote == NULL) {
 			remote->repeat_countdown = remote->min_repeat;
 		} else {
 			repeat = 1;
@@ -423,9 +699,9 @@ static int init_send_or_sim(struct ir_remote *remote, struct ir_ncode *code, int
 init_send_loop:
 	if (repeat && has_repeat(remote)) {
 		if (remote->flags & REPEAT_HEADER && has_header(remote)) {
-			send_header(remote);
+			send_header(sb, remote);
 		}
-		send_repeat(remote);
+		send_repeat(sb, remote);
 	} else {
 		if (!is_raw(remote)) {
 			ir_code next_code;
@@ -440,14 +716,14 @@ init_send_loop:
 			        next_code ^= remote->repeat_mask;
 			}
 
-			send_code(remote, next_code, repeat);
+			send_code(sb, remote, sim ? NULL : code, next_code, repeat);
 			if (!sim && has_toggle_mask(remote)) {
 				remote->toggle_mask_state++;
 				if (remote->toggle_mask_state == 4) {
 					remote->toggle_mask_state = 2;
 				}
 			}
-			send_buffer.data = send_buffer._data;
+			sb->data = sb->_data;
 		} else {
 			if (code->signals == NULL) {
 				if (!sim) {
@@ -455,19 +731,19 @@ init_send_loop:
 				}
 				return 0;
 			}
-			if (send_buffer.wptr > 0) {
-				send_signals(code->signals, code->length);
+			if (sb->wptr > 0 || reps >= 0) {
+				send_signals(sb, code->signals, code->length);
 			} else {
-				send_buffer.data = code->signals;
-				send_buffer.wptr = code->length;
+				sb->data = code->signals;
+				sb->wptr = code->length;
 				for (i = 0; i < code->length; i++) {
-					send_buffer.sum += code->signals[i];
+					sb->sum += code->signals[i];
 				}
 			}
 		}
 	}
-	sync_send_buffer();
-	if (bad_send_buffer()) {
+	sync_send_buffer(sb);
+	if (bad_send_buffer(sb)) {
 		if (!sim)
 			logprintf(LIRC_ERROR, "buffer too small");
 		return (0);
@@ -479,9 +755,9 @@ init_send_loop:
 		remote->min_remaining_gap = remote->repeat_gap;
 		remote->max_remaining_gap = remote->repeat_gap;
 	} else if (is_const(remote)) {
-		if (min_gap(remote) > send_buffer.sum) {
-			remote->min_remaining_gap = min_gap(remote) - send_buffer.sum;
-			remote->max_remaining_gap = max_gap(remote) - send_buffer.sum;
+		if (min_gap(remote) > sb->sum) {
+			remote->min_remaining_gap = min_gap(remote) - sb->sum;
+			remote->max_remaining_gap = max_gap(remote) - sb->sum;
 		} else {
 			logprintf(LIRC_ERROR, "too short gap: %u", remote->gap);
 			remote->min_remaining_gap = min_gap(remote);
@@ -503,35 +779,45 @@ init_send_loop:
 			}
 		}
 	}
-	if ((remote->repeat_countdown > 0 || code->transmit_state != NULL)
-	    && remote->min_remaining_gap < LIRCD_EXACT_GAP_THRESHOLD) {
-		if (send_buffer.data != send_buffer._data) {
+	if (reps >= 0) {
+		/* as lircd's tx_repeat_frame() does */
+		more = remote->repeat_countdown > 0 || (!repeat && code->next != NULL);
+		if (more && (code->next == NULL
+			     || (code->transmit_state != NULL && code->transmit_state->next == NULL)))
+			remote->repeat_countdown--;
+	} else {
+		more = (remote->repeat_countdown > 0 || code->transmit_state != NULL)
+		       && remote->min_remaining_gap < LIRCD_EXACT_GAP_THRESHOLD;
+		if (more && (code->next == NULL || code->transmit_state == NULL))
+			remote->repeat_countdown--;
+	}
+	if (more) {
+		if (sb->data != sb->_data) {
 			lirc_t *signals;
 			int n;
 
 			LOGPRINTF(1, "unrolling raw signal optimisation");
-			signals = send_buffer.data;
-			n = send_buffer.wptr;
-			send_buffer.data = send_buffer._data;
-			send_buffer.wptr = 0;
+			signals = sb->data;
+			n = sb->wptr;
+			sb->data = sb->_data;
+			sb->wptr = 0;
 
-			send_signals(signals, n);
+			send_signals(sb, signals, n);
 		}
 		LOGPRINTF(1, "concatenating low gap signals");
-		if (code->next == NULL || code->transmit_state == NULL) {
-			remote->repeat_countdown--;
-		}
-		send_space(remote->min_remaining_gap);
-		flush_send_buffer();
-		send_buffer.sum = 0;
+		send_space(sb, remote->min_remaining_gap);
+		flush_send_buffer(sb);
+		sb->sum = 0;
 
 		repeat = 1;
 		goto init_send_loop;
 	}
+	/* as send_ir_ncode() waits before the next code */
+	sb->pause = 2 * remote->min_remaining_gap;
 	LOGPRINTF(3, "transmit buffer ready");
 
 final_check:
-	if (!check_send_buffer()) {
+	if (!check_send_buffer(sb)) {
 		if (!sim) {
 			logprintf(LIRC_ERROR, "invalid send buffer");
 			logprintf(LIRC_ERROR, "this remote configuration cannot be used to transmit");
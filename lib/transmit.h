@@ -10,7 +10,17 @@
  *
  * Operations in this module applies to the transmit buffer. The buffer
  * is initiated using send_buffer_init(), filled with data using send_buffer_put()
- * and accessed using  send_buffer_data() and send_buffer_length().
+ * and accessed using  send_buffer_data() and send_buffer_length(). Several
+ * codes sent in one go are added using send_buffer_start() and
+ * send_buffer_add() instead.
+ *
+ * There is a global buffer, and buffers of their own made by
+ * send_buffer_new() for transmissions which go on in parallel. The
+ * *_into() functions work on the buffer passed, the others on the one
+ * send_buffer_select() selected in the calling thread. Filling a buffer
+ * updates the state of the remote, so it is not thread-safe: the caller
+ * serializes it, but the data of a buffer stays valid while other
+ * buffers are filled and sent.
  *
  * A prepared buffer contains an even number of unsigned ints, each of
  * which representing a pulse width in microseconds. The first item represents
@@ -33,11 +43,28 @@
 extern "C" {
 #endif
 
+/** Initial size of the buffer, which grows as needed. */
 #define WBUF_SIZE 256
 
+/** A buffer of its own, see send_buffer_select(). */
+struct send_buffer;
+
 /** Clear and re-initiate the buffer. */
 void send_buffer_init(void);
 
+/** @return A new, empty buffer, NULL if out of memory. */
+struct send_buffer* send_buffer_new(void);
+
+/** Free a buffer from send_buffer_new(), NULL is ignored. */
+void send_buffer_delete(struct send_buffer* buf);
+
+/**
+ * Select the buffer the other functions work on in the calling thread.
+ * @param buf Buffer from send_buffer_new(), NULL for the global one.
+ * @return The buffer selected before, NULL for the global one.
+ */
+struct send_buffer* send_buffer_select(struct send_buffer* buf);
+
 /**
  * Prepare the buffer.
  * @param remote Parsed lircd.conf data.
@@ -46,10 +73,61 @@ void send_buffer_init(void);
  */
 int send_buffer_put(struct ir_remote* remote, struct ir_ncode* code);
 
+/** Empty the buffer for send_buffer_add(). */
+void send_buffer_start(void);
+
+/**
+ * Add a code to the buffer, with the frames lircd sends for SEND_ONCE:
+ * at least min_repeat and reps repeats, and all codes of a sequence.
+ * A code after another one is preceded by the pause send_ir_ncode()
+ * would make between them.
+ * @param remote Parsed lircd.conf data.
+ * @param code Data item to be added.
+ * @param reps Number of repeats.
+ * @return 0 on errors, else 1
+ */
+int send_buffer_add(struct ir_remote* remote, struct ir_ncode* code, int reps);
+
+/**
+ * As send_buffer_put(), in buf instead of the selected buffer. Threads
+ * sending in parallel fill buffers of their own this way.
+ * @param length Set to the number of signals.
+ * @return The signals, NULL on errors.
+ */
+const lirc_t* send_buffer_put_into(struct send_buffer* buf,
+                                   struct ir_remote* remote,
+                                   struct ir_ncode* code,
+                                   int* length);
+
+/** As send_buffer_start(), for buf. */
+void send_buffer_start_into(struct send_buffer* buf);
+
+/**
+ * As send_buffer_add(), in buf instead of the selected buffer.
+ * @param length Set to the number of signals in buf.
+ * @return All signals in buf, NULL on errors.
+ */
+const lirc_t* send_buffer_add_into(struct send_buffer* buf,
+                                   struct ir_remote* remote,
+                                   struct ir_ncode* code,
+                                   int reps,
+                                   int* length);
+
 /** @cond */
 int init_sim(struct ir_remote* remote,
              struct ir_ncode* code,
              int repeat_preset);
+
+/*
+ * As init_sim(), in buf instead of the selected buffer.
+ * @return The data, NULL on errors.
+ */
+const lirc_t* send_buffer_sim(struct send_buffer* buf,
+                              struct ir_remote* remote,
+                              struct ir_ncode* code,
+                              int repeat_preset,
+                              int* length,
+                              lirc_t* sum);
 /** @endcond */
 
 /** @return Number of items accessible in array send_buffer_data(). */
@@ -61,6 +139,13 @@ const lirc_t* send_buffer_data();
 /** @return Total length of buffer in microseconds. */
 lirc_t send_buffer_sum();
 
+/**
+ * Free the frames send_buffer_put() compiled for a code. The config
+ * they were compiled from must not change while they are kept.
+ * @param code Code in a config about to be freed or changed.
+ */
+void send_buffer_free_waveforms(struct ir_ncode* code);
+
 /** @} */
 
 #ifdef	__cplusplus
@@ -27,6 +27,8 @@
 
 #include "lirc_driver.h"
 
+/* Samples the kernel takes in one write, LIRCBUF_SIZE of older kernels. */
+#define MAX_WRITE_SAMPLES 256
 
 static __u32 supported_send_modes[] = {
 	/* LIRC_CAN_SEND_LIRCCODE, */
@@ -52,6 +54,8 @@ int default_send(struct ir_remote *remote, struct ir_ncode *code);
 char *default_rec(struct ir_remote *remotes);
 int default_ioctl(unsigned int cmd, void *arg);
 lirc_t default_readdata(lirc_t timeout);
+int default_readdata_batch(lirc_t *data, int count, lirc_t timeout);
+int default_send_buffer(struct ir_remote *remote);
 
 
 
@@ -71,7 +75,9 @@ static const const struct driver hw_default = {
 	.decode_func	=	receive_decode,
 	.drvctl_func	=	default_ioctl,
 	.readdata	=	default_readdata,
-	.api_version	=	2,
+	.readdata_batch	=	default_readdata_batch,
+	.send_buffer_func =	default_send_buffer,
+	.api_version	=	3,
 	.driver_version = 	"0.9.2",
 	.info		=	"No info available"
 };
@@ -122,6 +128,45 @@ int default_readdata(lirc_t timeout)
 	return data ;
 }
 
+int default_readdata_batch(lirc_t *data, int count, lirc_t timeout)
+{
+	static int data_warning = 1;
+	char *buffer = (char *)data;
+	int ret, i;
+
+	if (!waitfordata((long)timeout))
+		return 0;
+
+	ret = read(drv.fd, buffer, count * sizeof(*data));
+	/* sockets and fifos may return part of a sample */
+	while (ret > 0 && ret % sizeof(*data) != 0) {
+		i = read(drv.fd, buffer + ret, sizeof(*data) - ret % sizeof(*data));
+		if (i <= 0) {
+			ret = i;
+			break;
+		}
+		ret += i;
+	}
+	if (ret <= 0) {
+		logperror(LIRC_ERROR, "error reading from %s (ret %d)", drv.device, ret);
+		default_deinit();
+
+		return 0;
+	}
+
+	count = ret / sizeof(*data);
+	for (i = 0; i < count; i++) {
+		if (data[i] == 0) {
+			if (data_warning) {
+				logprintf(LIRC_WARNING, "read invalid data from device %s", drv.device);
+				data_warning = 0;
+			}
+			data[i] = 1;
+		}
+	}
+	return count;
+}
+
 /*
   interface functions
 */
@@ -275,19 +320,36 @@ int default_deinit(void)
 
 static int write_send_buffer(int lirc)
 {
+	const lirc_t *signals;
+	int length, split, i;
+
 	if (send_buffer_length() == 0) {
 		LOGPRINTF(1, "nothing to send");
 		return (0);
 	}
-	return (write(lirc, send_buffer_data(), send_buffer_length() * sizeof(lirc_t)));
+	signals = send_buffer_data();
+	length = send_buffer_length();
+	/*
+	 * Longer writes fail with EINVAL. Split at the longest space, a gap
+	 * between frames unless one frame is too long anyway, and wait for
+	 * it here as lircd waits between frames sent one by one.
+	 */
+	while (length > MAX_WRITE_SAMPLES) {
+		split = 1;
+		for (i = 3; i < MAX_WRITE_SAMPLES; i += 2)
+			if (signals[i] >= signals[split])
+				split = i;
+		if (write(lirc, signals, split * sizeof(lirc_t)) == -1)
+			return (-1);
+		usleep(signals[split]);
+		signals += split + 1;
+		length -= split + 1;
+	}
+	return (write(lirc, signals, length * sizeof(lirc_t)));
 }
 
-int default_send(struct ir_remote *remote, struct ir_ncode *code)
+static int set_send_carrier(struct ir_remote *remote)
 {
-	/* things are easy, because we only support one mode */
-	if (drv.send_mode != LIRC_MODE_PULSE)
-		return (0);
-
 	if (drv.features & LIRC_CAN_SET_SEND_CARRIER) {
 		unsigned int freq;
 
@@ -308,6 +370,17 @@ int default_send(struct ir_remote *remote, struct ir_ncode *code)
 			return (0);
 		}
 	}
+	return (1);
+}
+
+int default_send(struct ir_remote *remote, struct ir_ncode *code)
+{
+	/* things are easy, because we only support one mode */
+	if (drv.send_mode != LIRC_MODE_PULSE)
+		return (0);
+
+	if (!set_send_carrier(remote))
+		return (0);
 	if (!send_buffer_put(remote, code))
 		return (0);
 	if (write_send_buffer(drv.fd) == -1) {
@@ -318,6 +391,22 @@ int default_send(struct ir_remote *remote, struct ir_ncode *code)
 	return (1);
 }
 
+/* Send the codes send_buffer_add() prepared, in as few writes as the kernel takes. */
+int default_send_buffer(struct ir_remote *remote)
+{
+	if (drv.send_mode != LIRC_MODE_PULSE)
+		return (0);
+
+	if (!set_send_carrier(remote))
+		return (0);
+	if (write_send_buffer(drv.fd) == -1) {
+		logprintf(LIRC_ERROR, "write failed");
+		logperror(LIRC_ERROR, NULL);
+		return (0);
+	}
+	return (1);
+}
+
 char *default_rec(struct ir_remote *remotes)
 {
 	if (!rec_buffer_clear()) {
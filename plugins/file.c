@@ -16,6 +16,9 @@
  *  Upon a request to send a LIRC_EOF pulse the driver will terminate the
  *  running process using SIGUSR1.
  *
+ *  It takes sends for any transmitter mask in parallel, each logged
+ *  after a '# transmitters <mask>' line.
+ *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
  *  the Free Software Foundation; either version 2 of the License, or
@@ -54,6 +57,9 @@
 static int init_func(void);
 static int deinit_func(void);
 static int send_func(struct ir_remote *remote, struct ir_ncode *code);
+static int send_buffer_func(struct ir_remote *remote);
+static int send_channel_func(struct ir_remote *remote, __u32 mask,
+			     const lirc_t* signals, int length);
 static char* receive_func(struct ir_remote* remotes);
 static int open_func(const char* path);
 static int close_func(void);
@@ -65,7 +71,8 @@ static int drvctl_func(unsigned int cmd, void* arg);
 const struct driver  drv_test = {
 	.name           =       "file",
 	.device         =       "testdata.sym",
-	.features       =       LIRC_CAN_REC_MODE2 | LIRC_CAN_SEND_PULSE,
+	.features       =       LIRC_CAN_REC_MODE2 | LIRC_CAN_SEND_PULSE
+				| LIRC_CAN_SET_TRANSMITTER_MASK,
 	.send_mode      =       LIRC_MODE_PULSE,
 	.rec_mode       =       LIRC_MODE_MODE2,
 	.code_length    =       0,
@@ -78,10 +85,12 @@ const struct driver  drv_test = {
 	.decode_func    =       decode_func,
 	.drvctl_func    =       drvctl_func,
 	.readdata       =       readdata,
-	.api_version	=	2,
+	.api_version	=	3,
 	.driver_version = 	"0.9.2",
 	.info		=	"test driver which logs received data to file, and"
-				" optionally sends data from an input file."
+				" optionally sends data from an input file.",
+	.send_buffer_func =	send_buffer_func,
+	.send_channel_func =	send_channel_func
 };
 
 
@@ -210,14 +219,20 @@ static void write_line(const char* type, int duration)
 
 static int send_func(struct ir_remote *remote, struct ir_ncode *code)
 {
-	int i;
-
 	logprintf(LIRC_TRACE, "file.c: sending, code: %s", code->name);
 
 	if (!send_buffer_put(remote, code)) {
 		logprintf(LIRC_DEBUG, "file.c: Cannot make send_buffer_put");
 		return 0;
 	}
+	return send_buffer_func(remote);
+}
+
+
+static int send_buffer_func(struct ir_remote *remote)
+{
+	int i;
+
         for (i = 0;;) {	
 		write_line("pulse", send_buffer_data()[i++]);
                 if (i >= send_buffer_length())
@@ -229,6 +244,43 @@ static int send_func(struct ir_remote *remote, struct ir_ncode *code)
 }
 
 
+/*
+ * Log signals sent on some transmitters. They are written in one go,
+ * so those sent at the same time on other transmitters don't get
+ * mixed up with them.
+ */
+static int send_channel_func(struct ir_remote *remote, __u32 mask,
+			     const lirc_t* signals, int length)
+{
+	char* buffer;
+	int i, len, size;
+	int eof = 0;
+
+	size = (length + 2) * 32;
+	buffer = malloc(size);
+	if (buffer == NULL) {
+		logprintf(LIRC_ERROR, "file.c: out of memory");
+		return 0;
+	}
+	len = snprintf(buffer, size, "# transmitters 0x%x\n", mask);
+	for (i = 0; i < length; i++) {
+		len += snprintf(buffer + len, size - len, "%s %d\n",
+				i % 2 == 0 ? "pulse" : "space", signals[i]);
+		if (signals[i] & LIRC_EOF)
+			eof = 1;
+	}
+	len += snprintf(buffer + len, size - len, "space %d\n",
+			remote->min_remaining_gap);
+	chk_write(outfile_fd, buffer, len);
+	free(buffer);
+	if (eof) {
+		logprintf(LIRC_NOTICE, "Exiting on input EOF");
+		raise(SIGUSR1);
+	}
+	return 1;
+}
+
+
 static int drvctl_func(unsigned int cmd, void* arg)
 {
 	struct option_t* opt;
@@ -263,6 +315,9 @@ static int drvctl_func(unsigned int cmd, void* arg)
 		else {
 			return DRV_ERR_BAD_OPTION;
 		}
+	case LIRC_SET_TRANSMITTER_MASK:
+		/* any mask, see send_channel_func() */
+		return 0;
 	default:
 		return DRV_ERR_NOT_IMPLEMENTED;
 	}
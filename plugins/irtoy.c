@@ -618,6 +618,10 @@ static int send(struct ir_remote *remote, struct ir_ncode *code)
 
 	length = send_buffer_length();
 	signals = send_buffer_data();
+	if (length > WBUF_SIZE) {
+		logprintf(LIRC_ERROR, "irtoy: too many signals to send: %d", length);
+		return 0;
+	}
 
 	for (i = 0; i < length; i++) {
 		val = (lirc_t)(((double) signals[i]) / IRTOY_UNIT);
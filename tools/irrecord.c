@@ -494,6 +494,13 @@ int main(int argc, char **argv)
 		remote = *remotes;
 		remote.name = NULL;
 		remote.codes = NULL;
+		remote.code_index = NULL;
+		remote.decode_order = NULL;
+		memset(&remote.signature, 0, sizeof(remote.signature));
+		memset(&remote.matcher, 0, sizeof(remote.matcher));
+		remote.raw_table = NULL;
+		memset(&remote.windows, 0, sizeof(remote.windows));
+		remote.get_data = NULL;
 		remote.last_code = NULL;
 		remote.next = NULL;
 		if (remote.pre_p == 0 && remote.pre_s == 0 && remote.post_p == 0 && remote.post_s == 0) {
@@ -37,6 +37,7 @@ static const char* const help =
 "    irsend [options] SEND_ONCE remote code [code...]\n"
 "    irsend [options] SEND_START remote code \n"
 "    irsend [options] SEND_STOP remote code \n"
+"    irsend [options] SEND_SEQUENCE remote code [code...]\n"
 "    irsend [options] LIST remote\n"
 "    irsend [options] SET_TRANSMITTERS remote num [num...]\n"
 "    irsend [options] SIMULATE \"scancode repeat keysym remote\"\n"
@@ -224,6 +225,30 @@ int main(int argc, char **argv)
 		if (send_packet(&ctx, fd) == -1) {
 			exit(EXIT_FAILURE);
 		}
+	} else if (strcasecmp(directive, "SEND_SEQUENCE") == 0) {
+		struct lirc_send_item items[PACKET_SIZE / 6];
+		int n = 0;
+
+		remote = argv[optind++];
+		if (optind == argc) {
+			fprintf(stderr, "%s: not enough arguments\n", prog);
+			exit(EXIT_FAILURE);
+		}
+		while (optind < argc) {
+			if (n == sizeof(items) / sizeof(items[0])) {
+				fprintf(stderr, "%s: input too long\n", prog);
+				exit(EXIT_FAILURE);
+			}
+			items[n].remote = remote;
+			items[n].keysym = argv[optind++];
+			items[n].repeat = count > 1 ? count : 0;
+			n++;
+		}
+		r = lirc_send_sequence(fd, items, n);
+		if (r != 0) {
+			fprintf(stderr, "%s: %s\n", prog, strerror(r));
+			exit(EXIT_FAILURE);
+		}
 	} else {
 		remote = argv[optind++];
 